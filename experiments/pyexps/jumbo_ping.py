@@ -0,0 +1,79 @@
+# Copyright 2022 Max Planck Institute for Software Systems, and
+# National University of Singapore
+#
+# Permission is hereby granted, free of charge, to any person obtaining
+# a copy of this software and associated documentation files (the
+# "Software"), to deal in the Software without restriction, including
+# without limitation the rights to use, copy, modify, merge, publish,
+# distribute, sublicense, and/or sell copies of the Software, and to
+# permit persons to whom the Software is furnished to do so, subject to
+# the following conditions:
+#
+# The above copyright notice and this permission notice shall be
+# included in all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+# MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+# CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+# TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+# SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+"""
+Jumbo frame experiment: a client and a server host with 9000 B MTU connected
+through a switch.
+
+The client pings the server with payloads that only fit into a single frame
+with jumbo frames enabled on the hosts, NICs, and the switch.
+"""
+
+from simbricks.orchestration.experiments import Experiment
+from simbricks.orchestration.nodeconfig import (
+    CorundumLinuxNode, I40eLinuxNode, IdleHost, PingClient
+)
+from simbricks.orchestration.simulators import (
+    CorundumBMNIC, I40eNIC, QemuHost, SwitchNet
+)
+
+mtu = 9000
+max_frame = 9024  # MTU plus Ethernet and VLAN headers
+
+experiments = []
+for nic_type in ['i40e', 'cd_bm']:
+    if nic_type == 'i40e':
+        NicClass = I40eNIC
+        NcClass = I40eLinuxNode
+    else:
+        NicClass = CorundumBMNIC
+        NcClass = CorundumLinuxNode
+
+    e = Experiment(name=f'jumbo_ping-{nic_type}')
+
+    network = SwitchNet()
+    network.max_frame = max_frame
+    e.add_network(network)
+
+    for (name, ip) in [('server', '10.0.0.1'), ('client', '10.0.0.2')]:
+        node_config = NcClass()
+        node_config.ip = ip
+        node_config.mtu = mtu
+        if name == 'client':
+            node_config.app = PingClient(server_ip='10.0.0.1')
+            # largest ICMP payload fitting into one frame
+            node_config.app.payload_size = mtu - 28
+        else:
+            node_config.app = IdleHost()
+
+        host = QemuHost(node_config)
+        host.name = name
+        host.sync = True
+        host.wait = name == 'client'
+        e.add_host(host)
+
+        nic = NicClass()
+        nic.max_frame = max_frame
+        e.add_nic(nic)
+        host.add_nic(nic)
+        nic.set_network(network)
+
+    experiments.append(e)
@@ -425,8 +425,14 @@ class PingClient(AppConfig):
     def __init__(self, server_ip: str = '192.168.64.1'):
         super().__init__()
         self.server_ip = server_ip
+        self.payload_size: tp.Optional[int] = None
+        """ICMP payload size in bytes, sent without fragmentation if set."""
 
     def run_cmds(self, node):
+        if self.payload_size is not None:
+            return [
+                f'ping {self.server_ip} -c 10 -s {self.payload_size} -M do'
+            ]
         return [f'ping {self.server_ip} -c 10']
 
 
@@ -118,6 +118,11 @@ class NICSim(PCIDevSim):
         self.eth_latency = 500
         """Ethernet latency in nanoseconds from this NIC to the network
         component."""
+        self.max_frame = 0
+        """Maximal Ethernet frame length in bytes the network connection is
+        sized for, 0 for the default (1536). Needs to be raised for MTUs
+        above 1500, e.g. to 9024 for 9000. Only supported by the behavioral
+        NIC models."""
 
     def set_network(self, net: NetSim):
         """Connect this NIC to a network simulator."""
@@ -125,7 +130,10 @@ class NICSim(PCIDevSim):
         net.nics.append(self)
 
     def basic_args(self, env, extra=None):
-        cmd = (
+        cmd = ''
+        if self.max_frame:
+            cmd += f'-J {self.max_frame} '
+        cmd += (
             f'{env.dev_pci_path(self)} {env.nic_eth_path(self)}'
             f' {env.dev_shm_path(self)} {self.sync_mode} {self.start_tick}'
             f' {self.sync_period} {self.pci_latency} {self.eth_latency}'
@@ -660,6 +668,10 @@ class CorundumVerilatorNIC(NICSim):
     def __init__(self):
         super().__init__()
         self.clock_freq = 250  # MHz
+        self.idle_cycles = 0
+        """Cycles the design has to be quiescent before the simulator skips
+        ahead to the next input, e.g. 256. The default 0 simulates every
+        cycle."""
 
     def resreq_mem(self):
         # this is a guess
@@ -667,20 +679,56 @@ class CorundumVerilatorNIC(NICSim):
 
     def run_cmd(self, env):
         return self.basic_run_cmd(
-            env, '/corundum/corundum_verilator', str(self.clock_freq)
+            env,
+            '/corundum/corundum_verilator',
+            f'{self.clock_freq} {self.idle_cycles}'
         )
 
 
 class CorundumBMNIC(NICSim):
 
+    def __init__(self):
+        super().__init__()
+        self.tx_sched = ''
+        """Transmit scheduler as RATE-MBPS[:W0,W1,...] with per tx queue
+        weights, empty to send frames without pacing."""
+
     def run_cmd(self, env):
-        return self.basic_run_cmd(env, '/corundum_bm/corundum_bm')
+        cmd = f'{env.repodir}/sims/nic/corundum_bm/corundum_bm '
+        if self.tx_sched:
+            cmd += f'--tx-sched={self.tx_sched} '
+        return cmd + self.basic_args(env)
 
 
 class I40eNIC(NICSim):
 
+    def __init__(self):
+        super().__init__()
+        self.debug = ''
+        """Comma-separated debug message classes to enable: dev, adminq, hmc,
+        lan, queues, or all."""
+        self.desc_thresh = ''
+        """LAN queue descriptor thresholds as
+        PTHRESH:HTHRESH:WTHRESH[:TIMEOUT-NS], empty for the defaults."""
+        self.flow_director = False
+        """Advertise the flow director capability to the driver. Without it,
+        flow director filters are only programmed by drivers that send
+        filter programming descriptors regardless, e.g. custom ones."""
+        self.vfs = 0
+        """Number of virtual functions, as register windows in BAR 5."""
+
     def run_cmd(self, env):
-        return self.basic_run_cmd(env, '/i40e_bm/i40e_bm')
+        cmd = f'{env.repodir}/sims/nic/i40e_bm/i40e_bm '
+        if self.desc_thresh:
+            cmd += f'--desc-thresh={self.desc_thresh} '
+        if self.flow_director:
+            cmd += '--flow-director '
+        if self.vfs:
+            cmd += f'--vfs={self.vfs} '
+        cmd += self.basic_args(env)
+        if self.debug:
+            cmd = f'env I40E_DEBUG={self.debug} ' + cmd
+        return cmd
 
 
 class E1000NIC(NICSim):
@@ -717,6 +765,12 @@ class I40eMultiNIC(Simulator):
     def __init__(self):
         super().__init__()
         self.subnics = []
+        self.threads = 1
+        """Number of worker threads the NIC instances are distributed across."""
+        self.veb_latency = 0
+        """Latency in nanoseconds of the in-process bridge switching unicast
+        frames between the NIC instances, e.g. VFs assigned to different VMs.
+        0 sends all frames through the network."""
 
     def create_subnic(self):
         sn = MultiSubNIC(self)
@@ -726,8 +780,15 @@ class I40eMultiNIC(Simulator):
     def full_name(self):
         return 'multinic.' + self.name
 
+    def resreq_cores(self):
+        return self.threads
+
     def run_cmd(self, env):
         args = ''
+        if self.threads > 1:
+            args += f'--threads={self.threads} '
+        if self.veb_latency > 0:
+            args += f'--veb={self.veb_latency} '
         first = True
         for sn in self.subnics:
             if not first:
@@ -769,10 +830,16 @@ class SwitchNet(NetSim):
     def __init__(self):
         super().__init__()
         self.sync = True
+        self.max_frame = 0
+        """Maximal Ethernet frame length in bytes for the ports the switch
+        listens on, 0 for the default (1536). Ports connecting to NICs use the
+        NIC's `max_frame`."""
 
     def run_cmd(self, env):
         cmd = env.repodir + '/sims/net/switch/net_switch'
         cmd += f' -S {self.sync_period} -E {self.eth_latency}'
+        if self.max_frame:
+            cmd += f' -J {self.max_frame}'
 
         if not self.sync:
             cmd += ' -u'
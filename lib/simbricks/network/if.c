@@ -30,10 +30,16 @@
 
 void SimbricksNetIfDefaultParams(struct SimbricksBaseIfParams *params) {
   SimbricksBaseIfDefaultParams(params);
-  params->in_entries_size = params->out_entries_size = 1536 + 64;
+  SimbricksNetIfParamsMaxFrame(params, SIMBRICKS_NET_MAX_FRAME_DEFAULT);
   params->upper_layer_proto = SIMBRICKS_PROTO_ID_NET;
 }
 
+void SimbricksNetIfParamsMaxFrame(struct SimbricksBaseIfParams *params,
+                                  size_t max_frame) {
+  params->in_entries_size = params->out_entries_size =
+      max_frame + sizeof(struct SimbricksProtoNetMsgPacket);
+}
+
 int SimbricksNetIfInit(struct SimbricksNetIf *nsif,
                        struct SimbricksBaseIfParams *params,
                        const char *eth_socket_path, int *sync_eth) {
@@ -31,11 +31,23 @@
 #include <simbricks/base/generic.h>
 #include <simbricks/network/proto.h>
 
+/** Default maximal frame length, standard Ethernet frames with headroom. */
+#define SIMBRICKS_NET_MAX_FRAME_DEFAULT 1536
+/** Maximal jumbo frame length, 9000 B MTU plus Ethernet and VLAN headers. */
+#define SIMBRICKS_NET_MAX_FRAME_JUMBO 9024
+
 struct SimbricksNetIf {
   struct SimbricksBaseIf base;
 };
 
 void SimbricksNetIfDefaultParams(struct SimbricksBaseIfParams *params);
+/**
+ * Size the message queues for frames of up to `max_frame` bytes. This only
+ * takes effect for the listening side of a connection, the connecting side
+ * adopts the message sizes of the listener during the handshake.
+ */
+void SimbricksNetIfParamsMaxFrame(struct SimbricksBaseIfParams *params,
+                                  size_t max_frame);
 int SimbricksNetIfInit(struct SimbricksNetIf *nsif,
                        struct SimbricksBaseIfParams *params,
                        const char *eth_socket_path, int *sync_eth);
@@ -43,4 +55,13 @@ int SimbricksNetIfInit(struct SimbricksNetIf *nsif,
 /** Generate queue access functions */
 SIMBRICKS_BASEIF_GENERIC(SimbricksNetIf, SimbricksProtoNetMsg, SimbricksNetIf);
 
+/**
+ * Maximal length of frames that can be sent on a connected interface, as
+ * negotiated during the handshake.
+ */
+static inline size_t SimbricksNetIfOutMaxFrame(struct SimbricksNetIf *nsif) {
+  return SimbricksBaseIfOutMsgLen(&nsif->base) -
+         sizeof(struct SimbricksProtoNetMsgPacket);
+}
+
 #endif  // SIMBRICKS_NETWORK_IF_H_
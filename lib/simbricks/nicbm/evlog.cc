@@ -0,0 +1,337 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "lib/simbricks/nicbm/evlog.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace nicbm {
+
+/** Background thread draining all open event logs. */
+class EvLogFlusher {
+ protected:
+  static constexpr unsigned kIntervalMs = 1;
+
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  /* signalled when the flusher is done with `busy_` */
+  std::condition_variable busy_cv_;
+  std::set<EvLog *> logs_;
+  /* log currently flushed without holding `mtx_` */
+  EvLog *busy_;
+  std::vector<EvLog *> pass_;
+  std::thread thread_;
+  bool stop_;
+
+  void Run() {
+    std::unique_lock<std::mutex> lk(mtx_);
+    while (!stop_) {
+      // flush without holding the lock, so Add and Remove wait for at most
+      // one Flush call instead of for as long as the logs have data
+      bool any = false;
+      pass_.assign(logs_.begin(), logs_.end());
+      for (EvLog *log : pass_) {
+        if (!logs_.count(log))
+          continue;
+        busy_ = log;
+        lk.unlock();
+        any |= log->Flush();
+        lk.lock();
+        busy_ = nullptr;
+        busy_cv_.notify_all();
+      }
+      // keep going while there is data, otherwise wait for more to accumulate
+      if (!any)
+        cv_.wait_for(lk, std::chrono::milliseconds(kIntervalMs));
+    }
+  }
+
+ public:
+  EvLogFlusher() : busy_(nullptr), stop_(false) {
+  }
+
+  ~EvLogFlusher() {
+    {
+      std::lock_guard<std::mutex> lk(mtx_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable())
+      thread_.join();
+  }
+
+  static EvLogFlusher &Get() {
+    static EvLogFlusher flusher;
+    return flusher;
+  }
+
+  void Add(EvLog *log) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    logs_.insert(log);
+    if (!thread_.joinable())
+      thread_ = std::thread(&EvLogFlusher::Run, this);
+  }
+
+  /** After this returns the flusher no longer touches `log`. */
+  void Remove(EvLog *log) {
+    std::unique_lock<std::mutex> lk(mtx_);
+    logs_.erase(log);
+    busy_cv_.wait(lk, [this, log]() { return busy_ != log; });
+  }
+};
+
+/** Process-wide table of message strings, ids are shared by all logs. */
+class EvLogStrings {
+ protected:
+  std::mutex mtx_;
+  std::unordered_map<std::string, uint32_t> ids_;
+  /* deque so pointers to existing strings stay valid when adding more */
+  std::deque<std::string> strs_;
+
+ public:
+  static EvLogStrings &Get() {
+    static EvLogStrings strings;
+    return strings;
+  }
+
+  uint32_t Id(const char *str) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    auto it = ids_.find(str);
+    if (it != ids_.end())
+      return it->second;
+
+    uint32_t id = strs_.size();
+    strs_.emplace_back(str);
+    ids_.emplace(strs_.back(), id);
+    return id;
+  }
+
+  const char *Str(uint32_t id) {
+    std::lock_guard<std::mutex> lk(mtx_);
+    return strs_.at(id).c_str();
+  }
+};
+
+EvLog::EvLog()
+    : ring_(nullptr),
+      file_(nullptr),
+      head_(0),
+      tail_(0),
+      dropped_(0),
+      dropped_pending_(0) {
+}
+
+EvLog::~EvLog() {
+  Close();
+}
+
+bool EvLog::Open(const char *path) {
+  if (!(file_ = fopen(path, "w"))) {
+    perror("EvLog::Open: fopen failed");
+    return false;
+  }
+
+  EvLogHeader hdr;
+  memcpy(hdr.magic, NICBM_EVLOG_MAGIC, sizeof(hdr.magic));
+  hdr.version = NICBM_EVLOG_VERSION;
+  hdr.record_size = sizeof(EvLogRecord);
+  if (fwrite(&hdr, sizeof(hdr), 1, file_) != 1) {
+    perror("EvLog::Open: writing header failed");
+    fclose(file_);
+    file_ = nullptr;
+    return false;
+  }
+
+  ring_ = new EvLogRecord[kRingRecords];
+  str_written_.clear();
+  EvLogFlusher::Get().Add(this);
+  return true;
+}
+
+void EvLog::Close() {
+  if (!ring_)
+    return;
+
+  EvLogFlusher::Get().Remove(this);
+  Flush();
+  if (dropped_)
+    fprintf(stderr, "EvLog: dropped %lu records\n", dropped_);
+  fclose(file_);
+  file_ = nullptr;
+  delete[] ring_;
+  ring_ = nullptr;
+}
+
+bool EvLog::Flush() {
+  uint64_t tail = tail_.load(std::memory_order_relaxed);
+  uint64_t head = head_.load(std::memory_order_acquire);
+  if (head == tail)
+    return false;
+
+  // at most two contiguous chunks if the range wraps around
+  while (tail != head) {
+    uint64_t idx = tail & (kRingRecords - 1);
+    uint64_t n = head - tail;
+    if (n > kRingRecords - idx)
+      n = kRingRecords - idx;
+    if (fwrite(ring_ + idx, sizeof(EvLogRecord), n, file_) != n)
+      perror("EvLog::Flush: fwrite failed");
+    tail += n;
+  }
+  tail_.store(tail, std::memory_order_release);
+  return true;
+}
+
+void EvLog::Msg(uint64_t ts, uint32_t src, uint32_t fmt, const uint64_t *args,
+                unsigned n) {
+  if (n > kMsgMaxArgs)
+    n = kMsgMaxArgs;
+
+  // strings not yet in this log are written out first, all records for the
+  // message are dropped together so the decoder never misses a definition
+  uint32_t ids[2] = {src, fmt};
+  const char *strs[2] = {nullptr, nullptr};
+  uint64_t need = 1 + n / 2;
+  for (int i = 0; i < 2; i++) {
+    if ((ids[i] < str_written_.size() && str_written_[ids[i]]) ||
+        (i == 1 && fmt == src))
+      continue;
+    strs[i] = Str(ids[i]);
+    need += strlen(strs[i]) / 16 + 1;
+  }
+
+  uint64_t head = head_.load(std::memory_order_relaxed);
+  uint64_t used = head - tail_.load(std::memory_order_acquire);
+  if (used + need + (dropped_pending_ ? 1 : 0) > kRingRecords) {
+    dropped_ += need;
+    dropped_pending_ += need;
+    return;
+  }
+
+  if (dropped_pending_) {
+    Put(head++, kEvDropped, ts, dropped_pending_, 0, 0, 0);
+    dropped_pending_ = 0;
+  }
+  for (int i = 0; i < 2; i++) {
+    if (!strs[i])
+      continue;
+    size_t len = strlen(strs[i]) + 1;
+    for (size_t off = 0; off < len; off += 16) {
+      uint64_t part[2] = {0, 0};
+      memcpy(part, strs[i] + off, std::min<size_t>(16, len - off));
+      Put(head++, kEvMsgStr, ts, part[0], part[1], ids[i], off + 16 >= len);
+    }
+    if (ids[i] >= str_written_.size())
+      str_written_.resize(ids[i] + 1);
+    str_written_[ids[i]] = true;
+  }
+  Put(head++, kEvMsg, ts, src, n > 0 ? args[0] : 0, fmt, n);
+  for (unsigned i = 1; i < n; i += 2)
+    Put(head++, kEvMsgArgs, ts, args[i], i + 1 < n ? args[i + 1] : 0, 0, 0);
+  head_.store(head, std::memory_order_release);
+}
+
+uint32_t EvLog::StrId(const char *str) {
+  return EvLogStrings::Get().Id(str);
+}
+
+const char *EvLog::Str(uint32_t id) {
+  return EvLogStrings::Get().Str(id);
+}
+
+std::string EvLog::Format(const char *fmt, const uint64_t *args,
+                          unsigned n) {
+  std::string out;
+  unsigned ai = 0;
+  for (const char *p = fmt; *p; p++) {
+    if (*p != '%') {
+      out += *p;
+      continue;
+    } else if (p[1] == '%') {
+      out += '%';
+      p++;
+      continue;
+    }
+
+    // keep flags, width, and precision, the length is always long long
+    std::string spec = "%";
+    const char *q = p + 1;
+    while (*q && strchr("-+ #0123456789.", *q))
+      spec += *q++;
+    while (*q && strchr("hljztq", *q))
+      q++;
+
+    char buf[64];
+    uint64_t v = ai < n ? args[ai] : 0;
+    switch (*q) {
+      case 'd':
+      case 'i':
+        spec += "lld";
+        snprintf(buf, sizeof(buf), spec.c_str(), static_cast<long long>(v));
+        break;
+      case 'u':
+      case 'x':
+      case 'X':
+      case 'o':
+        spec += "ll";
+        spec += *q;
+        snprintf(buf, sizeof(buf), spec.c_str(),
+                 static_cast<unsigned long long>(v));
+        break;
+      case 'p':
+        spec += "llx";
+        out += "0x";
+        snprintf(buf, sizeof(buf), spec.c_str(),
+                 static_cast<unsigned long long>(v));
+        break;
+      case 'c':
+        spec += 'c';
+        snprintf(buf, sizeof(buf), spec.c_str(), static_cast<int>(v));
+        break;
+      default:
+        // unsupported conversion, copy it literally
+        out.append(p, *q ? q + 1 - p : q - p);
+        if (!*q)
+          return out;
+        p = q;
+        continue;
+    }
+    out += buf;
+    ai++;
+    p = q;
+  }
+  return out;
+}
+
+}  // namespace nicbm
@@ -0,0 +1,186 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SIMBRICKS_NICBM_EVLOG_H_
+#define SIMBRICKS_NICBM_EVLOG_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace nicbm {
+
+/*
+ * On-disk format: an `EvLogHeader` followed by fixed size `EvLogRecord`s, all
+ * in native byte order.
+ */
+#define NICBM_EVLOG_MAGIC "NICBMEV1"
+#define NICBM_EVLOG_VERSION 1
+
+struct EvLogHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+};
+
+enum EvLogType : uint8_t {
+  /* a: offset, b: value (first 8 bytes), len: access size, flags: bar */
+  kEvMmioRead = 1,
+  kEvMmioWrite = 2,
+  /* a: op id, b: address, len: length, flags: 1 for writes */
+  kEvDmaIssue = 3,
+  /* a: op id */
+  kEvDmaComplete = 4,
+  /* len: packet length, flags: port */
+  kEvEthTx = 5,
+  kEvEthRx = 6,
+  /* a: vector, flags: SIMBRICKS_PROTO_PCIE_INT_* */
+  kEvInterrupt = 7,
+  /* a: number of records lost before this one because the ring was full */
+  kEvDropped = 8,
+  /* device log message, len: format string id, flags: number of arguments,
+   * a: source string id, b: first argument; followed by `kEvMsgArgs` records
+   * with the remaining arguments, two each in a and b */
+  kEvMsg = 9,
+  kEvMsgArgs = 10,
+  /* string table entry, written before the first message using it. len:
+   * string id, a and b: next 16 bytes of the string, flags: 1 on the last */
+  kEvMsgStr = 11,
+};
+
+struct EvLogRecord {
+  uint64_t ts;
+  uint64_t a;
+  uint64_t b;
+  uint32_t len;
+  uint8_t type;
+  uint8_t flags;
+  uint16_t rsvd;
+};
+
+/* both are naturally aligned without padding */
+static_assert(sizeof(EvLogHeader) == 16, "unexpected event header size");
+static_assert(sizeof(EvLogRecord) == 32, "unexpected event record size");
+
+/**
+ * Binary event log for one `Runner`. Records go into a single-producer ring
+ * that is drained to the file by a background thread shared by all logs in
+ * the process, so logging never blocks on I/O. If the flusher falls behind,
+ * records are dropped and a `kEvDropped` record marks the gap.
+ */
+class EvLog {
+ public:
+  static const uint64_t kRingRecords = 1 << 16;
+
+  EvLog();
+  ~EvLog();
+
+  /** Create the log file and start flushing, returns false on error. */
+  bool Open(const char *path);
+  /** Write out remaining records and close the file. */
+  void Close();
+
+  bool Enabled() const {
+    return ring_ != nullptr;
+  }
+
+  void Log(uint8_t type, uint64_t ts, uint64_t a, uint64_t b, uint32_t len,
+           uint8_t flags) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    uint64_t used = head - tail_.load(std::memory_order_acquire);
+    if (used + (dropped_pending_ ? 2 : 1) > kRingRecords) {
+      dropped_++;
+      dropped_pending_++;
+      return;
+    }
+
+    if (dropped_pending_) {
+      Put(head++, kEvDropped, ts, dropped_pending_, 0, 0, 0);
+      dropped_pending_ = 0;
+    }
+    Put(head++, type, ts, a, b, len, flags);
+    head_.store(head, std::memory_order_release);
+  }
+
+  /**
+   * Log message with format string `fmt` from `src`, both ids from `StrId`,
+   * and `n` integer arguments. Strings are added to the log on first use.
+   */
+  void Msg(uint64_t ts, uint32_t src, uint32_t fmt, const uint64_t *args,
+           unsigned n);
+
+  uint64_t Dropped() const {
+    return dropped_;
+  }
+
+  static const unsigned kMsgMaxArgs = 16;
+
+  /** Id of `str` in the process-wide message string table. */
+  static uint32_t StrId(const char *str);
+  /** String for an id returned by `StrId`. */
+  static const char *Str(uint32_t id);
+  /**
+   * printf-style formatting of `fmt` with integer arguments: supports flags,
+   * width, and precision with the conversions d, i, u, x, X, o, c, and p, any
+   * length modifiers are ignored.
+   */
+  static std::string Format(const char *fmt, const uint64_t *args,
+                            unsigned n);
+
+ protected:
+  friend class EvLogFlusher;
+
+  EvLogRecord *ring_;
+  FILE *file_;
+  /* producer position, only written by the runner */
+  std::atomic<uint64_t> head_;
+  /* consumer position, only written by the flusher */
+  std::atomic<uint64_t> tail_;
+  uint64_t dropped_;
+  uint64_t dropped_pending_;
+  /* string ids already written to this log */
+  std::vector<bool> str_written_;
+
+  void Put(uint64_t pos, uint8_t type, uint64_t ts, uint64_t a, uint64_t b,
+           uint32_t len, uint8_t flags) {
+    EvLogRecord &r = ring_[pos & (kRingRecords - 1)];
+    r.ts = ts;
+    r.a = a;
+    r.b = b;
+    r.len = len;
+    r.type = type;
+    r.flags = flags;
+    r.rsvd = 0;
+  }
+
+  /** Write out all available records, returns false if there were none. */
+  bool Flush();
+};
+
+}  // namespace nicbm
+
+#endif  // SIMBRICKS_NICBM_EVLOG_H_
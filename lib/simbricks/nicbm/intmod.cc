@@ -0,0 +1,236 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "lib/simbricks/nicbm/intmod.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace nicbm {
+
+/* (delay, events) levels for adaptive mode, same as the Linux DIM CQE
+ * profiles for RX */
+const IntModerator::Profile IntModerator::kProfiles[kNumProfiles] = {
+    {2000000ULL, 256},  {8000000ULL, 128},  {16000000ULL, 64},
+    {32000000ULL, 64},  {64000000ULL, 64},
+};
+
+/* relative rate change below which two DIM samples count as equal */
+static const double kDimTolerance = 0.1;
+
+bool IntModConfig::Parse(const char *str) {
+  if (!strcmp(str, "none")) {
+    mode = kModeNone;
+    return true;
+  }
+  if (!strcmp(str, "adaptive")) {
+    mode = kModeAdaptive;
+    return true;
+  }
+  if (strncmp(str, "static:", 7))
+    return false;
+
+  char *end;
+  uint64_t delay_ns = strtoull(str + 7, &end, 10);
+  if (*end != ':')
+    return false;
+  unsigned long events = strtoul(end + 1, &end, 10);
+  if (*end || events == 0)
+    return false;
+
+  mode = kModeStatic;
+  delay = delay_ns * 1000ULL;
+  max_events = events;
+  return true;
+}
+
+IntModerator::Vector::Vector()
+    : idx(0),
+      armed(false),
+      pending(0),
+      events(0),
+      interrupts(0),
+      timer_fired(0),
+      profile_changes(0),
+      profile(0),
+      dir(1),
+      sample_time(0),
+      sample_events(0),
+      sample_ints(0),
+      prev_event_rate(0),
+      prev_int_rate(0) {
+}
+
+IntModerator::IntModerator(Runner::Device &dev, unsigned num_vecs,
+                           FireFn fire)
+    : dev_(dev), fire_(fire), vecs_(num_vecs) {
+  for (unsigned i = 0; i < num_vecs; i++)
+    vecs_[i].idx = i;
+}
+
+void IntModerator::SetDefaults(const IntModConfig &cfg) {
+  defaults_ = cfg;
+  for (unsigned i = 0; i < vecs_.size(); i++)
+    Configure(i, cfg);
+}
+
+void IntModerator::Configure(unsigned vec, const IntModConfig &cfg) {
+  Vector &v = vecs_[vec];
+  v.cfg = cfg;
+  if (cfg.mode == IntModConfig::kModeAdaptive)
+    ApplyProfile(v);
+
+  // the new thresholds might already be exceeded
+  if (v.pending > 0 && (v.cfg.mode == IntModConfig::kModeNone ||
+                        v.pending >= v.cfg.max_events))
+    Fire(v);
+}
+
+void IntModerator::ApplyProfile(Vector &v) {
+  v.cfg.delay = kProfiles[v.profile].delay;
+  v.cfg.max_events = kProfiles[v.profile].max_events;
+}
+
+void IntModerator::Event(unsigned vec, uint32_t n) {
+  Vector &v = vecs_[vec];
+  v.pending += n;
+  v.events += n;
+
+  if (v.cfg.mode == IntModConfig::kModeNone ||
+      v.pending >= v.cfg.max_events) {
+    Fire(v);
+  } else if (!v.armed) {
+    v.armed = true;
+    v.time_ = dev_.runner_->TimePs() + v.cfg.delay;
+    dev_.runner_->EventSchedule(v);
+  }
+}
+
+void IntModerator::Flush(unsigned vec) {
+  Vector &v = vecs_[vec];
+  if (v.pending > 0)
+    Fire(v);
+}
+
+void IntModerator::Fire(Vector &v) {
+  if (v.armed) {
+    dev_.runner_->EventCancel(v);
+    v.armed = false;
+  }
+  v.pending = 0;
+  v.interrupts++;
+  fire_(v.idx);
+
+  if (v.cfg.mode == IntModConfig::kModeAdaptive &&
+      v.interrupts - v.sample_ints >= kDimSampleInts)
+    DimSample(v);
+}
+
+/* -1 if `cur` is worse than `prev`, 0 if equal, 1 if better */
+static int DimCompare(double cur, double prev) {
+  if (prev == 0)
+    return cur > 0 ? 1 : 0;
+  double delta = (cur - prev) / prev;
+  if (delta > kDimTolerance)
+    return 1;
+  if (delta < -kDimTolerance)
+    return -1;
+  return 0;
+}
+
+void IntModerator::DimSample(Vector &v) {
+  uint64_t now = dev_.runner_->TimePs();
+  uint64_t dt = now - v.sample_time;
+  if (dt == 0)
+    return;
+
+  double event_rate = (double)(v.events - v.sample_events) / dt;
+  double int_rate = (double)(v.interrupts - v.sample_ints) / dt;
+
+  // more events per time is better, at the same event rate fewer
+  // interrupts are better
+  int cmp = DimCompare(event_rate, v.prev_event_rate);
+  if (cmp == 0)
+    cmp = -DimCompare(int_rate, v.prev_int_rate);
+
+  if (cmp < 0)
+    v.dir = -v.dir;
+  if (cmp != 0) {
+    int next = (int)v.profile + v.dir;
+    if (next < 0 || next >= (int)kNumProfiles) {
+      // bounce off the ends of the table
+      v.dir = -v.dir;
+    } else {
+      v.profile = next;
+      v.profile_changes++;
+      ApplyProfile(v);
+    }
+  }
+
+  v.sample_time = now;
+  v.sample_events = v.events;
+  v.sample_ints = v.interrupts;
+  v.prev_event_rate = event_rate;
+  v.prev_int_rate = int_rate;
+}
+
+bool IntModerator::Timed(TimedEvent &te) {
+  Vector *v = dynamic_cast<Vector *>(&te);
+  if (!v || v < vecs_.data() || v >= vecs_.data() + vecs_.size())
+    return false;
+
+  v->armed = false;
+  v->timer_fired++;
+  if (v->pending > 0)
+    Fire(*v);
+  return true;
+}
+
+void IntModerator::Reset() {
+  for (Vector &v : vecs_) {
+    if (v.armed) {
+      dev_.runner_->EventCancel(v);
+      v.armed = false;
+    }
+    v.pending = 0;
+  }
+}
+
+void IntModerator::PrintStats(FILE *f) const {
+  for (const Vector &v : vecs_) {
+    if (v.events == 0)
+      continue;
+    fprintf(f,
+            "intmod vec %u: events=%lu interrupts=%lu timer_fired=%lu "
+            "coalescing_ratio=%.2f",
+            v.idx, v.events, v.interrupts, v.timer_fired,
+            v.interrupts ? (double)v.events / v.interrupts : 0.0);
+    if (v.cfg.mode == IntModConfig::kModeAdaptive)
+      fprintf(f, " profile=%u profile_changes=%lu", v.profile,
+              v.profile_changes);
+    fprintf(f, "\n");
+  }
+}
+
+}  // namespace nicbm
@@ -0,0 +1,148 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SIMBRICKS_NICBM_INTMOD_H_
+#define SIMBRICKS_NICBM_INTMOD_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <functional>
+#include <vector>
+
+#include <simbricks/nicbm/nicbm.h>
+
+namespace nicbm {
+
+/** Interrupt moderation settings for one vector. */
+struct IntModConfig {
+  enum Mode {
+    /** every event raises an interrupt right away */
+    kModeNone,
+    /** fixed thresholds */
+    kModeStatic,
+    /** thresholds picked from `kProfiles` based on the observed load */
+    kModeAdaptive,
+  };
+
+  Mode mode;
+  /** time threshold: max delay after the first pending event [ps] */
+  uint64_t delay;
+  /** event threshold: fire as soon as this many events are pending */
+  uint32_t max_events;
+
+  IntModConfig() : mode(kModeNone), delay(0), max_events(1) {
+  }
+
+  /**
+   * Parse "none", "adaptive", or "static:DELAY-NS:EVENTS".
+   * Returns false if the string is invalid.
+   */
+  bool Parse(const char *str);
+};
+
+/**
+ * Interrupt moderation shared by device models. The device reports events
+ * (e.g. completions) per vector through `Event()`, and the moderator calls
+ * the fire callback once the event or time threshold of the vector is reached.
+ *
+ * The adaptive mode follows the Linux DIM approach: every `kDimSampleInts`
+ * interrupts the event and interrupt rates are compared against the previous
+ * sample, and the vector steps through `kProfiles` in the direction that
+ * increases the event rate or, at equal event rates, reduces the interrupt
+ * rate.
+ */
+class IntModerator {
+ public:
+  typedef std::function<void(unsigned vec)> FireFn;
+
+  struct Profile {
+    uint64_t delay;
+    uint32_t max_events;
+  };
+  static const unsigned kNumProfiles = 5;
+  static const Profile kProfiles[kNumProfiles];
+  static const unsigned kDimSampleInts = 64;
+
+ protected:
+  class Vector : public TimedEvent {
+   public:
+    unsigned idx;
+    bool armed;
+    IntModConfig cfg;
+    uint32_t pending;
+
+    /* statistics */
+    uint64_t events;
+    uint64_t interrupts;
+    uint64_t timer_fired;
+    uint64_t profile_changes;
+
+    /* adaptive mode state */
+    unsigned profile;
+    int dir;
+    uint64_t sample_time;
+    uint64_t sample_events;
+    uint64_t sample_ints;
+    double prev_event_rate;
+    double prev_int_rate;
+
+    Vector();
+  };
+
+  Runner::Device &dev_;
+  FireFn fire_;
+  IntModConfig defaults_;
+  std::vector<Vector> vecs_;
+
+  void Fire(Vector &v);
+  void DimSample(Vector &v);
+  void ApplyProfile(Vector &v);
+
+ public:
+  IntModerator(Runner::Device &dev, unsigned num_vecs, FireFn fire);
+
+  /** Set config for all vectors, overrides per vector settings. */
+  void SetDefaults(const IntModConfig &cfg);
+  /** Set config for one vector. */
+  void Configure(unsigned vec, const IntModConfig &cfg);
+
+  /** Report `n` new events on `vec`. */
+  void Event(unsigned vec, uint32_t n = 1);
+  /** Immediately fire `vec` if it has pending events. */
+  void Flush(unsigned vec);
+
+  /** Handle timed event, returns false if `te` does not belong to us. */
+  bool Timed(TimedEvent &te);
+
+  /** Drop pending events and timers, keeps configuration and statistics. */
+  void Reset();
+
+  /** Print per-vector event and interrupt counts and coalescing ratios. */
+  void PrintStats(FILE *f) const;
+};
+
+}  // namespace nicbm
+
+#endif  // SIMBRICKS_NICBM_INTMOD_H_
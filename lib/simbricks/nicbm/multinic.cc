@@ -24,9 +24,13 @@
 
 #include "lib/simbricks/nicbm/multinic.h"
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include <atomic>
 #include <boost/bind.hpp>
+#include <boost/fiber/algo/work_stealing.hpp>
 #include <boost/fiber/all.hpp>
 #include <thread>
 #include <vector>
@@ -38,8 +42,8 @@ void MultiNicRunner::CompRunner::YieldPoll() {
 }
 
 int MultiNicRunner::CompRunner::NicIfInit() {
-  volatile bool ready = false;
-  volatile int result = 0;
+  std::atomic<bool> ready(false);
+  int result = 0;
 
   // NicIfInit will block, so run it in a separate thread and then wait for it
   std::thread t([this, &ready, &result]() {
@@ -53,37 +57,127 @@ int MultiNicRunner::CompRunner::NicIfInit() {
   return result;
 }
 
-MultiNicRunner::CompRunner::CompRunner(Device &dev) : Runner(dev) {
+void MultiNicRunner::CompRunner::AddOptions(Options &opts) {
+  mr_.AddOptions(opts);
+  Runner::AddOptions(opts);
 }
 
-MultiNicRunner::MultiNicRunner(DeviceFactory &factory) : factory_(factory) {
+MultiNicRunner::CompRunner::CompRunner(Device &dev, MultiNicRunner &mr)
+    : Runner(dev), mr_(mr) {
+}
+
+MultiNicRunner::MultiNicRunner(DeviceFactory &factory)
+    : factory_(factory), num_threads_(1), veb_latency_(0), veb_(nullptr) {
+}
+
+// positive number without trailing characters
+static bool ParsePositive(const char *arg, unsigned long &n) {
+  char *end;
+  n = strtoul(arg, &end, 10);
+  return !*end && n > 0;
+}
+
+void MultiNicRunner::AddOptions(Options &opts) {
+  opts.Add("threads", "N", "worker threads for the NICs (default 1)",
+           [this](const char *arg) {
+             unsigned long n;
+             if (!ParsePositive(arg, n))
+               return false;
+             num_threads_ = n;
+             return true;
+           });
+  opts.Add("veb", "LAT-NS", "bridge frames between the NICs in memory",
+           [this](const char *arg) {
+             unsigned long n;
+             if (!ParsePositive(arg, n))
+               return false;
+             veb_latency_ = n * 1000ULL;
+             return true;
+           });
 }
 
 int MultiNicRunner::RunMain(int argc, char *argv[]) {
   int start = 0;
-  std::vector<Runner *> runners;
-  std::vector<boost::fibers::fiber *> fibers;
+  std::vector<CompRunner *> runners;
   do {
     int end;
     for (end = start + 1; end < argc && strcmp(argv[end], "--"); end++) {
     }
     argv[start] = argv[0];
 
-    CompRunner *r = new CompRunner(factory_.create());
+    CompRunner *r = new CompRunner(factory_.create(), *this);
     if (r->ParseArgs(end - start, argv + start))
       return -1;
 
-    auto *f = new boost::fibers::fiber(
-        boost::bind(&CompRunner::RunMain, boost::ref(*r)));
     runners.push_back(r);
-    fibers.push_back(f);
     start = end;
   } while (start < argc);
 
+  // runners exporting statistics to the same file would overwrite each other
+  std::vector<bool> shared(runners.size(), false);
+  for (size_t i = 0; i < runners.size(); i++) {
+    const char *p = runners[i]->StatsExport().Path();
+    for (size_t j = i + 1; p && j < runners.size(); j++) {
+      const char *q = runners[j]->StatsExport().Path();
+      if (q && !strcmp(p, q))
+        shared[i] = shared[j] = true;
+    }
+  }
+  for (size_t i = 0; i < runners.size(); i++) {
+    if (shared[i])
+      runners[i]->StatsExport().Uniquify(i);
+  }
+
+  if (veb_latency_ && runners.size() > 1) {
+    veb_ = new Veb(veb_latency_);
+    for (CompRunner *r : runners)
+      r->AttachVeb(veb_->Attach());
+  }
+
+  // all participating threads need to register with the work stealing
+  // scheduler before the first fiber is created, as the scheduler will
+  // otherwise try to steal from threads that do not exist yet.
+  std::vector<std::thread> workers;
+  boost::fibers::mutex mtx;
+  boost::fibers::condition_variable cv;
+  bool done = false;
+  boost::fibers::barrier start_barrier(num_threads_);
+  if (num_threads_ > 1) {
+    boost::fibers::use_scheduling_algorithm<
+        boost::fibers::algo::work_stealing>(num_threads_);
+    for (unsigned i = 1; i < num_threads_; i++) {
+      workers.emplace_back([this, &mtx, &cv, &done, &start_barrier]() {
+        boost::fibers::use_scheduling_algorithm<
+            boost::fibers::algo::work_stealing>(num_threads_);
+        start_barrier.wait();
+
+        // keep the thread (and its scheduler) alive to run stolen fibers,
+        // this needs to be a fiber wait to not block the scheduler
+        std::unique_lock<boost::fibers::mutex> lk(mtx);
+        cv.wait(lk, [&done]() { return done; });
+      });
+    }
+    start_barrier.wait();
+  }
+
+  std::vector<boost::fibers::fiber *> fibers;
+  for (CompRunner *r : runners) {
+    fibers.push_back(new boost::fibers::fiber(
+        boost::bind(&CompRunner::RunMain, boost::ref(*r))));
+  }
+
   for (auto f : fibers) {
     f->join();
     delete (f);
   }
+
+  {
+    std::lock_guard<boost::fibers::mutex> lk(mtx);
+    done = true;
+  }
+  cv.notify_all();
+  for (auto &t : workers)
+    t.join();
   return 0;
 }
 
@@ -39,19 +39,43 @@ class MultiNicRunner {
  protected:
   class CompRunner : public Runner {
    protected:
+    MultiNicRunner &mr_;
+
     void YieldPoll() override;
     int NicIfInit() override;
+    void AddOptions(Options &opts) override;
 
    public:
-    explicit CompRunner(Device &dev_);
+    CompRunner(Device &dev_, MultiNicRunner &mr);
+
+    StatsExporter &StatsExport() {
+      return stats_export_;
+    }
   };
 
   DeviceFactory &factory_;
+  unsigned num_threads_;
+  /* latency of the bridge between the NICs [ps], 0 if disabled */
+  uint64_t veb_latency_;
+  Veb *veb_;
+
+  /* options for all NICs, accepted among the options of any of them */
+  void AddOptions(Options &opts);
 
  public:
   explicit MultiNicRunner(DeviceFactory &factory);
 
-  /** Run the simulation */
+  /**
+   * Run the simulation. Arguments for the individual NICs are separated by
+   * `--`, device options apply to the NIC they are given for. `--threads=N`
+   * distributes the NIC fibers across N worker threads with work stealing
+   * (default: 1, all on the main thread). `--veb=LAT` bridges unicast frames
+   * between the NICs in memory with a latency of LAT nanoseconds instead of
+   * going through the network. These two apply to all NICs and may be given
+   * among the options of any of them.
+   * NICs given the same statistics file (`-s`) export to FILE.IDX.EXT with
+   * their index among the NICs instead.
+   */
   int RunMain(int argc, char *argv[]);
 };
 
@@ -32,10 +32,12 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <getopt.h>
+
+#include <algorithm>
 #include <cassert>
 #include <ctime>
 #include <iostream>
-#include <vector>
 
 extern "C" {
 #include <simbricks/base/proto.h>
@@ -49,25 +51,14 @@ namespace nicbm {
 
 static volatile int exiting = 0;
 
-static std::vector<Runner *> runners;
+/* Signals are process-wide, but runners may execute on different threads.
+ * Handlers therefore only bump flags that each runner checks from its own
+ * main loop. */
+static volatile sig_atomic_t sigusr1_cnt = 0;
+static volatile sig_atomic_t sigusr2_cnt = 0;
 
 #ifdef STAT_NICBM
-static uint64_t h2d_poll_total = 0;
-static uint64_t h2d_poll_suc = 0;
-static uint64_t h2d_poll_sync = 0;
-// count from signal USR2
-static uint64_t s_h2d_poll_total = 0;
-static uint64_t s_h2d_poll_suc = 0;
-static uint64_t s_h2d_poll_sync = 0;
-
-static uint64_t n2d_poll_total = 0;
-static uint64_t n2d_poll_suc = 0;
-static uint64_t n2d_poll_sync = 0;
-// count from signal USR2
-static uint64_t s_n2d_poll_total = 0;
-static uint64_t s_n2d_poll_suc = 0;
-static uint64_t s_n2d_poll_sync = 0;
-static int stat_flag = 0;
+static volatile sig_atomic_t stat_flag = 0;
 #endif
 
 static void sigint_handler(int dummy) {
@@ -75,15 +66,15 @@ static void sigint_handler(int dummy) {
 }
 
 static void sigusr1_handler(int dummy) {
-  for (Runner *r : runners)
-    fprintf(stderr, "[%p] main_time = %lu\n", r, r->TimePs());
+  sigusr1_cnt = sigusr1_cnt + 1;
 }
 
-#ifdef STAT_NICBM
 static void sigusr2_handler(int dummy) {
+#ifdef STAT_NICBM
   stat_flag = 1;
-}
 #endif
+  sigusr2_cnt = sigusr2_cnt + 1;
+}
 
 volatile union SimbricksProtoPcieD2H *Runner::D2HAlloc() {
   if (SimbricksBaseIfInTerminated(&nicif_.pcie.base)) {
@@ -105,16 +96,20 @@ volatile union SimbricksProtoPcieD2H *Runner::D2HAlloc() {
   if (!first)
     fprintf(stderr, "D2HAlloc: entry successfully allocated\n");
 
+#ifdef STAT_NICBM
+  stats_.d2h_msgs++;
+#endif
   return msg;
 }
 
-volatile union SimbricksProtoNetMsg *Runner::D2NAlloc() {
+volatile union SimbricksProtoNetMsg *Runner::D2NAlloc(uint8_t port) {
   volatile union SimbricksProtoNetMsg *msg;
+  struct SimbricksNetIf *netif = NetIf(port);
   bool first = true;
-  while ((msg = SimbricksNetIfOutAlloc(&nicif_.net, main_time_)) == NULL) {
+  while ((msg = SimbricksNetIfOutAlloc(netif, main_time_)) == NULL) {
     if (first) {
       fprintf(stderr, "D2NAlloc: warning waiting for entry (%zu)\n",
-              nicif_.pcie.base.out_pos);
+              netif->base.out_pos);
       first = false;
     }
     YieldPoll();
@@ -123,10 +118,22 @@ volatile union SimbricksProtoNetMsg *Runner::D2NAlloc() {
   if (!first)
     fprintf(stderr, "D2NAlloc: entry successfully allocated\n");
 
+#ifdef STAT_NICBM
+  stats_.d2n_msgs++;
+#endif
   return msg;
 }
 
 void Runner::IssueDma(DMAOp &op) {
+#ifdef STAT_NICBM
+  stats_.dma_issued++;
+  op.issue_ts_ = main_time_;
+  op.issue_wall_ = stats_.timing ? StatsWallNs() : 0;
+#endif
+  if (evlog_.Enabled())
+    evlog_.Log(kEvDmaIssue, main_time_, (uintptr_t)&op, op.dma_addr_, op.len_,
+               op.write_);
+
   if (dma_pending_ < DMA_MAX_PENDING) {
     // can directly issue
 #ifdef DEBUG_NICBM
@@ -227,6 +234,9 @@ void Runner::MsiIssue(uint8_t vec) {
   volatile struct SimbricksProtoPcieD2HInterrupt *intr = &msg->interrupt;
   intr->vector = vec;
   intr->inttype = SIMBRICKS_PROTO_PCIE_INT_MSI;
+  if (evlog_.Enabled())
+    evlog_.Log(kEvInterrupt, main_time_, vec, 0, 0,
+               SIMBRICKS_PROTO_PCIE_INT_MSI);
 
   SimbricksPcieIfD2HOutSend(&nicif_.pcie, msg,
                             SIMBRICKS_PROTO_PCIE_D2H_MSG_INTERRUPT);
@@ -244,6 +254,9 @@ void Runner::MsiXIssue(uint8_t vec) {
   volatile struct SimbricksProtoPcieD2HInterrupt *intr = &msg->interrupt;
   intr->vector = vec;
   intr->inttype = SIMBRICKS_PROTO_PCIE_INT_MSIX;
+  if (evlog_.Enabled())
+    evlog_.Log(kEvInterrupt, main_time_, vec, 0, 0,
+               SIMBRICKS_PROTO_PCIE_INT_MSIX);
 
   SimbricksPcieIfD2HOutSend(&nicif_.pcie, msg,
                             SIMBRICKS_PROTO_PCIE_D2H_MSG_INTERRUPT);
@@ -261,6 +274,8 @@ void Runner::IntXIssue(bool level) {
   intr->vector = 0;
   intr->inttype = (level ? SIMBRICKS_PROTO_PCIE_INT_LEGACY_HI
                          : SIMBRICKS_PROTO_PCIE_INT_LEGACY_LO);
+  if (evlog_.Enabled())
+    evlog_.Log(kEvInterrupt, main_time_, 0, 0, 0, intr->inttype);
 
   SimbricksPcieIfD2HOutSend(&nicif_.pcie, msg,
                             SIMBRICKS_PROTO_PCIE_D2H_MSG_INTERRUPT);
@@ -281,7 +296,22 @@ void Runner::H2DRead(volatile struct SimbricksProtoPcieH2DRead *read) {
   msg = D2HAlloc();
   rc = &msg->readcomp;
 
-  dev_.RegRead(read->bar, read->offset, (void *)rc->data, read->len);
+  {
+    uint8_t bar = read->bar;
+    uint64_t offset = read->offset;
+    uint64_t prof = profiler_.Start();
+    CallbackTimer t(stats_, RunnerStats::kCbRegRead);
+    dev_.RegRead(bar, offset, (void *)rc->data, read->len);
+    profiler_.RecordKeyed(RunnerStats::kCbRegRead,
+                          Profiler::RegKey(bar, offset), prof);
+
+    if (evlog_.Enabled()) {
+      uint32_t len = read->len;
+      uint64_t val = 0;
+      memcpy(&val, (const void *)rc->data, len <= 8 ? len : 8);
+      evlog_.Log(kEvMmioRead, main_time_, offset, val, len, bar);
+    }
+  }
   rc->req_id = read->req_id;
 
 #ifdef DEBUG_NICBM
@@ -308,7 +338,22 @@ void Runner::H2DWrite(volatile struct SimbricksProtoPcieH2DWrite *write,
       "posted=%u)\n",
       main_time_, write->offset, write->len, dbg_val, posted);
 #endif
-  dev_.RegWrite(write->bar, write->offset, (void *)write->data, write->len);
+  {
+    uint8_t bar = write->bar;
+    uint64_t offset = write->offset;
+    uint64_t prof = profiler_.Start();
+    CallbackTimer t(stats_, RunnerStats::kCbRegWrite);
+    dev_.RegWrite(bar, offset, (void *)write->data, write->len);
+    profiler_.RecordKeyed(RunnerStats::kCbRegWrite,
+                          Profiler::RegKey(bar, offset), prof);
+
+    if (evlog_.Enabled()) {
+      uint32_t len = write->len;
+      uint64_t val = 0;
+      memcpy(&val, (const void *)write->data, len <= 8 ? len : 8);
+      evlog_.Log(kEvMmioWrite, main_time_, offset, val, len, bar);
+    }
+  }
 
   if (!posted) {
     msg = D2HAlloc();
@@ -329,7 +374,7 @@ void Runner::H2DReadcomp(volatile struct SimbricksProtoPcieH2DReadcomp *rc) {
 #endif
 
   memcpy(op->data_, (void *)rc->data, op->len_);
-  dev_.DmaComplete(*op);
+  DmaCompleted(*op);
 
   dma_pending_--;
   DmaTrigger();
@@ -343,57 +388,123 @@ void Runner::H2DWritecomp(volatile struct SimbricksProtoPcieH2DWritecomp *wc) {
          main_time_, op, op->dma_addr_, op->len_);
 #endif
 
-  dev_.DmaComplete(*op);
+  DmaCompleted(*op);
 
   dma_pending_--;
   DmaTrigger();
 }
 
+void Runner::DmaCompleted(DMAOp &op) {
+#ifdef STAT_NICBM
+  stats_.dma_completed++;
+  stats_.dma_lat_sim.Add(main_time_ - op.issue_ts_);
+  if (stats_.timing)
+    stats_.dma_lat_wall.Add(StatsWallNs() - op.issue_wall_);
+#endif
+
+  // the device may free the op in the callback
+  if (evlog_.Enabled())
+    evlog_.Log(kEvDmaComplete, main_time_, (uintptr_t)&op, 0, 0, 0);
+  Profiler::TypeTag tag = Profiler::Tag(op);
+  uint64_t prof = profiler_.Start();
+  CallbackTimer t(stats_, RunnerStats::kCbDmaComplete);
+  dev_.DmaComplete(op);
+  profiler_.RecordTyped(RunnerStats::kCbDmaComplete, tag, prof);
+}
+
 void Runner::H2DDevctrl(volatile struct SimbricksProtoPcieH2DDevctrl *dc) {
+  uint64_t prof = profiler_.Start();
+  CallbackTimer t(stats_, RunnerStats::kCbDevctrl);
   dev_.DevctrlUpdate(*(struct SimbricksProtoPcieH2DDevctrl *)dc);
+  profiler_.Record(RunnerStats::kCbDevctrl, prof);
 }
 
-void Runner::EthRecv(volatile struct SimbricksProtoNetMsgPacket *packet) {
+void Runner::EthRecv(uint8_t port, const void *data, size_t len) {
 #ifdef DEBUG_NICBM
-  printf("main_time = %lu: nicbm: eth rx: port %u len %u\n", main_time_,
-         packet->port, packet->len);
+  printf("main_time = %lu: nicbm: eth rx: port %u len %zu\n", main_time_,
+         port, len);
 #endif
 
-  dev_.EthRx(packet->port, (void *)packet->data, packet->len);
+  if (evlog_.Enabled())
+    evlog_.Log(kEvEthRx, main_time_, 0, 0, len, port);
+
+  uint64_t prof = profiler_.Start();
+  CallbackTimer t(stats_, RunnerStats::kCbEthRx);
+  dev_.EthRx(port, data, len);
+  profiler_.RecordKeyed(RunnerStats::kCbEthRx, port, prof);
 }
 
 void Runner::EthSend(const void *data, size_t len) {
+  EthSend(0, data, len);
+}
+
+void Runner::EthSend(uint8_t port, const void *data, size_t len) {
+  void *buf = EthSendAlloc(port);
+  assert(len <= EthSendMaxLen(port));
+  memcpy(buf, data, len);
+  EthSendCommit(port, len);
+}
+
+void *Runner::EthSendAlloc(uint8_t port) {
+  assert(port < num_eth_ports_);
+  assert(eth_tx_pending_[port] == nullptr);
+  volatile union SimbricksProtoNetMsg *msg = D2NAlloc(port);
+  eth_tx_pending_[port] = msg;
+  return (void *)msg->packet.data;
+}
+
+void Runner::EthSendCommit(uint8_t port, size_t len) {
 #ifdef DEBUG_NICBM
-  printf("main_time = %lu: nicbm: eth tx: len %zu\n", main_time_, len);
+  printf("main_time = %lu: nicbm: eth tx: port %u len %zu\n", main_time_, port,
+         len);
 #endif
+  if (evlog_.Enabled())
+    evlog_.Log(kEvEthTx, main_time_, 0, 0, len, port);
+
+  volatile union SimbricksProtoNetMsg *msg = eth_tx_pending_[port];
+  assert(msg != nullptr);
+  eth_tx_pending_[port] = nullptr;
 
-  volatile union SimbricksProtoNetMsg *msg = D2NAlloc();
   volatile struct SimbricksProtoNetMsgPacket *packet = &msg->packet;
-  packet->port = 0;  // single port
+  if (port == 0 && veb_port_ &&
+      veb_port_->Send(main_time_, (const void *)packet->data, len)) {
+    // switched locally, the allocated slot still has to go out, as a sync
+    SimbricksNetIfOutSend(NetIf(port), msg, SIMBRICKS_PROTO_MSG_TYPE_SYNC);
+    return;
+  }
+
+  packet->port = 0;  // each port has its own interface
   packet->len = len;
-  memcpy((void *)packet->data, data, len);
-  SimbricksNetIfOutSend(&nicif_.net, msg, SIMBRICKS_PROTO_NET_MSG_PACKET);
+  SimbricksNetIfOutSend(NetIf(port), msg, SIMBRICKS_PROTO_NET_MSG_PACKET);
+}
+
+size_t Runner::EthSendMaxLen(uint8_t port) {
+  return SimbricksNetIfOutMaxFrame(NetIf(port));
+}
+
+unsigned Runner::NumEthPorts() const {
+  return num_eth_ports_;
 }
 
-void Runner::PollH2D() {
+bool Runner::PollH2D() {
   volatile union SimbricksProtoPcieH2D *msg =
       SimbricksPcieIfH2DInPoll(&nicif_.pcie, main_time_);
   uint8_t type;
 
 #ifdef STAT_NICBM
-  h2d_poll_total += 1;
+  stats_.h2d_poll_total += 1;
   if (stat_flag) {
-    s_h2d_poll_total += 1;
+    stats_.s_h2d_poll_total += 1;
   }
 #endif
 
   if (msg == NULL)
-    return;
+    return false;
 
 #ifdef STAT_NICBM
-  h2d_poll_suc += 1;
+  stats_.h2d_poll_suc += 1;
   if (stat_flag) {
-    s_h2d_poll_suc += 1;
+    stats_.s_h2d_poll_suc += 1;
   }
 #endif
 
@@ -425,9 +536,9 @@ void Runner::PollH2D() {
 
     case SIMBRICKS_PROTO_MSG_TYPE_SYNC:
 #ifdef STAT_NICBM
-      h2d_poll_sync += 1;
+      stats_.h2d_poll_sync += 1;
       if (stat_flag) {
-        s_h2d_poll_sync += 1;
+        stats_.s_h2d_poll_sync += 1;
       }
 #endif
       break;
@@ -441,41 +552,59 @@ void Runner::PollH2D() {
   }
 
   SimbricksPcieIfH2DInDone(&nicif_.pcie, msg);
+  return type != SIMBRICKS_PROTO_MSG_TYPE_SYNC;
 }
 
-void Runner::PollN2D() {
-  volatile union SimbricksProtoNetMsg *msg =
-      SimbricksNetIfInPoll(&nicif_.net, main_time_);
+bool Runner::PollN2D() {
+  uint8_t port = 0;
   uint8_t t;
 
+  // with multiple ports, process the ready message with the earliest timestamp
+  // first, so packets arriving on different ports are handled in order
+  if (num_eth_ports_ > 1) {
+    uint64_t min_ts = UINT64_MAX;
+    for (unsigned i = 0; i < num_eth_ports_; i++) {
+      volatile union SimbricksProtoBaseMsg *m =
+          SimbricksBaseIfInPeek(&NetIf(i)->base, main_time_);
+      if (m && m->header.timestamp < min_ts) {
+        min_ts = m->header.timestamp;
+        port = i;
+      }
+    }
+  }
+
+  struct SimbricksNetIf *netif = NetIf(port);
+  volatile union SimbricksProtoNetMsg *msg =
+      SimbricksNetIfInPoll(netif, main_time_);
+
 #ifdef STAT_NICBM
-  n2d_poll_total += 1;
+  stats_.n2d_poll_total += 1;
   if (stat_flag) {
-    s_n2d_poll_total += 1;
+    stats_.s_n2d_poll_total += 1;
   }
 #endif
 
   if (msg == NULL)
-    return;
+    return false;
 
 #ifdef STAT_NICBM
-  n2d_poll_suc += 1;
+  stats_.n2d_poll_suc += 1;
   if (stat_flag) {
-    s_n2d_poll_suc += 1;
+    stats_.s_n2d_poll_suc += 1;
   }
 #endif
 
-  t = SimbricksNetIfInType(&nicif_.net, msg);
+  t = SimbricksNetIfInType(netif, msg);
   switch (t) {
     case SIMBRICKS_PROTO_NET_MSG_PACKET:
-      EthRecv(&msg->packet);
+      EthRecv(port, (const void *)msg->packet.data, msg->packet.len);
       break;
 
     case SIMBRICKS_PROTO_MSG_TYPE_SYNC:
 #ifdef STAT_NICBM
-      n2d_poll_sync += 1;
+      stats_.n2d_poll_sync += 1;
       if (stat_flag) {
-        s_n2d_poll_sync += 1;
+        stats_.s_n2d_poll_sync += 1;
       }
 #endif
       break;
@@ -484,7 +613,16 @@ void Runner::PollN2D() {
       fprintf(stderr, "poll_n2d: unsupported type=%u", t);
   }
 
-  SimbricksNetIfInDone(&nicif_.net, msg);
+  SimbricksNetIfInDone(netif, msg);
+  return t != SIMBRICKS_PROTO_MSG_TYPE_SYNC;
+}
+
+bool Runner::PollVeb() {
+  if (!veb_port_ || !veb_port_->Recv(main_time_, veb_frame_))
+    return false;
+
+  EthRecv(0, veb_frame_.data(), veb_frame_.size());
+  return true;
 }
 
 uint64_t Runner::TimePs() const {
@@ -495,6 +633,14 @@ uint64_t Runner::GetMacAddr() const {
   return mac_addr_;
 }
 
+const RunnerStats &Runner::Stats() const {
+  return stats_;
+}
+
+EvLog &Runner::EventLog() {
+  return evlog_;
+}
+
 bool Runner::EventNext(uint64_t &retval) {
   if (events_.empty())
     return false;
@@ -503,32 +649,129 @@ bool Runner::EventNext(uint64_t &retval) {
   return true;
 }
 
-void Runner::EventTrigger() {
+bool Runner::EventTrigger() {
   auto it = events_.begin();
   if (it == events_.end())
-    return;
+    return false;
 
   TimedEvent *ev = *it;
 
   // event is in the future
   if (ev->time_ > main_time_)
-    return;
+    return false;
 
   events_.erase(it);
+#ifdef STAT_NICBM
+  stats_.events_fired++;
+#endif
+
+  Profiler::TypeTag tag = Profiler::Tag(*ev);
+  uint64_t prof = profiler_.Start();
+  CallbackTimer t(stats_, RunnerStats::kCbTimed);
   dev_.Timed(*ev);
+  profiler_.RecordTyped(RunnerStats::kCbTimed, tag, prof);
+  return true;
+}
+
+uint64_t Runner::NextTimestamp(bool sync_pcie, bool sync_net, bool active) {
+  // while idle grow the step exponentially, fall back to the floor as soon as
+  // anything happens
+  if (active)
+    idle_step_ = step_min_;
+  else if (idle_step_ < step_max_)
+    idle_step_ = std::min(idle_step_ * 2, step_max_);
+
+  bool is_sync = sync_pcie || sync_net;
+  uint64_t step = (is_sync ? step_max_ : idle_step_);
+  uint64_t next_ts =
+      (main_time_ > UINT64_MAX - step ? UINT64_MAX : main_time_ + step);
+  RunnerStats::StepBound bound =
+      (is_sync ? RunnerStats::kStepCeiling : RunnerStats::kStepIdle);
+
+  // with synchronization we can jump straight to the next point where a peer
+  // message becomes ready or where we need to send a sync message
+  uint64_t ts;
+  if (sync_pcie) {
+    ts = SimbricksPcieIfH2DInTimestamp(&nicif_.pcie);
+    if (ts < next_ts) {
+      next_ts = ts;
+      bound = RunnerStats::kStepPeer;
+    }
+    ts = SimbricksPcieIfD2HOutNextSync(&nicif_.pcie);
+    if (ts < next_ts) {
+      next_ts = ts;
+      bound = RunnerStats::kStepSync;
+    }
+  }
+  for (unsigned i = 0; sync_net && i < num_eth_ports_; i++) {
+    struct SimbricksNetIf *netif = NetIf(i);
+    if (!SimbricksBaseIfSyncEnabled(&netif->base))
+      continue;
+
+    ts = SimbricksNetIfInTimestamp(netif);
+    if (ts < next_ts) {
+      next_ts = ts;
+      bound = RunnerStats::kStepPeer;
+    }
+    ts = SimbricksNetIfOutNextSync(netif);
+    if (ts < next_ts) {
+      next_ts = ts;
+      bound = RunnerStats::kStepSync;
+    }
+  }
+
+  if (EventNext(ts) && ts < next_ts) {
+    next_ts = ts;
+    bound = RunnerStats::kStepEvent;
+  }
+
+  // frames from bridged devices are like peer messages, but the other
+  // devices also bound how far we may go
+  if (veb_port_) {
+    ts = std::min(veb_port_->InTimestamp(), veb_port_->Horizon());
+    if (ts < next_ts) {
+      next_ts = ts;
+      bound = RunnerStats::kStepPeer;
+    }
+  }
+
+#ifdef STAT_NICBM
+  if (next_ts > main_time_)
+    stats_.step_bound[bound]++;
+#endif
+  return next_ts;
 }
 
 void Runner::YieldPoll() {
 }
 
 int Runner::NicIfInit() {
-  return SimbricksNicIfInit(&nicif_, shmPath_, &netParams_, &pcieParams_,
-                            &dintro_);
+  return SimbricksNicIfInitMultiNet(&nicif_, shmPath_, &netParams_,
+                                    extraNets_, extraNetParams_,
+                                    num_eth_ports_ - 1, &pcieParams_, &dintro_);
 }
 
-Runner::Runner(Device &dev) : main_time_(0), dev_(dev), events_(EventCmp()) {
+int Runner::IfSync() {
+  int ret = SimbricksNicIfSync(&nicif_, main_time_);
+  for (unsigned i = 1; i < num_eth_ports_; i++) {
+    if (SimbricksNetIfOutSync(NetIf(i), main_time_))
+      ret = -1;
+  }
+  return ret;
+}
+
+Runner::Runner(Device &dev)
+    : main_time_(0),
+      dev_(dev),
+      events_(EventCmp()),
+      num_eth_ports_(1),
+      sigusr1_seen_(0),
+      sigusr2_seen_(0),
+      evlog_path_(nullptr),
+      veb_port_(nullptr) {
+  for (unsigned i = 0; i < kMaxEthPorts; i++)
+    eth_tx_pending_[i] = nullptr;
   // mac_addr = lrand48() & ~(3ULL << 46);
-  runners.push_back(this);
   dma_pending_ = 0;
   dev_.runner_ = this;
 
@@ -543,16 +786,126 @@ Runner::Runner(Device &dev) : main_time_(0), dev_(dev), events_(EventCmp()) {
   close(rfd);
   mac_addr_ &= ~3ULL;
 
+  step_min_ = kDefaultStepMin;
+  step_max_ = 0;
+  idle_step_ = step_min_;
+
   SimbricksNetIfDefaultParams(&netParams_);
   SimbricksPcieIfDefaultParams(&pcieParams_);
 }
 
+void Runner::AttachVeb(Veb::Port &port) {
+  veb_port_ = &port;
+}
+
+void Runner::AddOptions(Options &opts) {
+  dev_.AddOptions(opts);
+}
+
 int Runner::ParseArgs(int argc, char *argv[]) {
-  if (argc < 4 || argc > 10) {
+  const char *stats_path = nullptr;
+  RunnerStats::Format stats_format = RunnerStats::kFormatJson;
+  uint64_t stats_interval = 1000;
+  bool bad_option = false;
+  const char *prog = strrchr(argv[0], '/');
+  prog = prog ? prog + 1 : argv[0];
+  int c;
+
+  Options opts;
+  AddOptions(opts);
+  std::vector<struct option> long_opts = opts.Table();
+
+  // reset getopt, as this may be called repeatedly by MultiNicRunner
+  optind = 0;
+  while ((c = getopt_long(argc, argv, "s:f:i:tm:M:e:l:J:", long_opts.data(),
+                          nullptr)) != -1 &&
+         !bad_option) {
+    switch (c) {
+      case 'e':
+        if (num_eth_ports_ >= kMaxEthPorts) {
+          fprintf(stderr, "at most %u ethernet ports supported\n",
+                  kMaxEthPorts);
+          bad_option = true;
+          break;
+        }
+        extraNetParams_[num_eth_ports_++ - 1].sock_path = optarg;
+        break;
+
+      case 'm':
+        step_min_ = strtoull(optarg, NULL, 0);
+        break;
+
+      case 'M':
+        step_max_ = strtoull(optarg, NULL, 0);
+        break;
+
+      case 's':
+        stats_path = optarg;
+        break;
+
+      case 'f':
+        if (!strcmp(optarg, "json")) {
+          stats_format = RunnerStats::kFormatJson;
+        } else if (!strcmp(optarg, "prom")) {
+          stats_format = RunnerStats::kFormatPrometheus;
+        } else {
+          fprintf(stderr, "unknown stats format: %s\n", optarg);
+          bad_option = true;
+        }
+        break;
+
+      case 'i':
+        stats_interval = strtoull(optarg, NULL, 0);
+        break;
+
+      case 't':
+        stats_.timing = true;
+        break;
+
+      case 'l':
+        evlog_path_ = optarg;
+        break;
+
+      case 'J': {
+        unsigned long long max_frame = strtoull(optarg, NULL, 0);
+        if (max_frame < 64 || max_frame > UINT16_MAX) {
+          fprintf(stderr, "invalid maximal frame length: %s\n", optarg);
+          bad_option = true;
+          break;
+        }
+        SimbricksNetIfParamsMaxFrame(&netParams_, max_frame);
+        break;
+      }
+
+      default:
+        bad_option = !opts.Apply(c, optarg);
+        break;
+    }
+  }
+
+  // positional arguments, argv[0] is skipped below
+  argc -= optind - 1;
+  argv += optind - 1;
+
+  if (step_max_ == 0)
+    step_max_ = step_min_;
+  if (step_min_ == 0 || step_max_ < step_min_) {
+    fprintf(stderr, "invalid time step bounds: min=%lu max=%lu\n", step_min_,
+            step_max_);
+    bad_option = true;
+  }
+  idle_step_ = step_min_;
+
+  if (bad_option || argc < 4 || argc > 10) {
     fprintf(stderr,
-            "Usage: corundum_bm PCI-SOCKET ETH-SOCKET "
-            "SHM [SYNC-MODE] [START-TICK] [SYNC-PERIOD] [PCI-LATENCY] "
-            "[ETH-LATENCY] [MAC-ADDR]\n");
+            "Usage: %s [OPTION]... PCI-SOCKET ETH-SOCKET SHM [SYNC-MODE] "
+            "[START-TICK] [SYNC-PERIOD] [PCI-LATENCY] [ETH-LATENCY] "
+            "[MAC-ADDR]\n"
+            "  -s STATS-FILE, -f json|prom, -i STATS-INTERVAL-MS, -t\n"
+            "  -m MIN-STEP-PS, -M MAX-STEP-PS, -e ETH-SOCKET..., "
+            "-l EVENT-LOG, -J MAX-FRAME\n",
+            prog);
+    opts.Usage(stderr);
     return -1;
   }
   if (argc >= 6)
@@ -570,18 +923,28 @@ int Runner::ParseArgs(int argc, char *argv[]) {
   pcieParams_.sock_path = argv[1];
   netParams_.sock_path = argv[2];
   shmPath_ = argv[3];
+
+  // additional ports use the same parameters as port 0
+  for (unsigned i = 0; i < num_eth_ports_ - 1; i++) {
+    const char *path = extraNetParams_[i].sock_path;
+    extraNetParams_[i] = netParams_;
+    extraNetParams_[i].sock_path = path;
+  }
+
+  if (stats_path) {
+    // wall time measurements are only useful if they get exported
+    stats_.timing = true;
+    stats_export_.Configure(stats_path, stats_format, stats_interval);
+  }
   return 0;
 }
 
 int Runner::RunMain() {
   uint64_t next_ts;
-  uint64_t max_step = 10000;
 
   signal(SIGINT, sigint_handler);
   signal(SIGUSR1, sigusr1_handler);
-#ifdef STAT_NICBM
   signal(SIGUSR2, sigusr2_handler);
-#endif
 
   memset(&dintro_, 0, sizeof(dintro_));
   dev_.SetupIntro(dintro_);
@@ -589,16 +952,22 @@ int Runner::RunMain() {
   if (NicIfInit()) {
     return EXIT_FAILURE;
   }
+  if (evlog_path_ && !evlog_.Open(evlog_path_))
+    return EXIT_FAILURE;
   bool sync_pcie = SimbricksBaseIfSyncEnabled(&nicif_.pcie.base);
-  bool sync_net = SimbricksBaseIfSyncEnabled(&nicif_.net.base);
+  bool sync_net = false;
+  for (unsigned i = 0; i < num_eth_ports_; i++)
+    sync_net |= SimbricksBaseIfSyncEnabled(&NetIf(i)->base);
 
   fprintf(stderr, "mac_addr=%lx\n", mac_addr_);
   fprintf(stderr, "sync_pci=%d sync_eth=%d\n", sync_pcie, sync_net);
 
-  bool is_sync = sync_pcie || sync_net;
+  uint64_t loop_iters = 0;
+  if (veb_port_)
+    veb_port_->Advance(main_time_);
 
   while (!exiting) {
-    while (SimbricksNicIfSync(&nicif_, main_time_)) {
+    while (IfSync()) {
       fprintf(stderr, "warn: SimbricksNicIfSync failed (t=%lu)\n", main_time_);
       YieldPoll();
     }
@@ -609,76 +978,59 @@ int Runner::RunMain() {
         YieldPoll();
       first = false;
 
-      PollH2D();
-      PollN2D();
-      EventTrigger();
-
-      if (is_sync) {
-        next_ts = SimbricksNicIfNextTimestamp(&nicif_);
-        if (next_ts > main_time_ + max_step)
-          next_ts = main_time_ + max_step;
-      } else {
-        next_ts = main_time_ + max_step;
-      }
+      bool active = PollH2D();
+      active |= PollN2D();
+      active |= PollVeb();
+      active |= EventTrigger();
 
-      uint64_t ev_ts;
-      if (EventNext(ev_ts) && ev_ts < next_ts)
-        next_ts = ev_ts;
+      next_ts = NextTimestamp(sync_pcie, sync_net, active);
     } while (next_ts <= main_time_ && !exiting);
     main_time_ = next_ts;
+    if (veb_port_)
+      veb_port_->Advance(main_time_);
+
+    if (sigusr1_seen_ != (uint64_t)sigusr1_cnt) {
+      sigusr1_seen_ = sigusr1_cnt;
+      fprintf(stderr, "[%p] main_time = %lu\n", this, main_time_);
+    }
+    if (Profiler::kEnabled && sigusr2_seen_ != (uint64_t)sigusr2_cnt) {
+      sigusr2_seen_ = sigusr2_cnt;
+      profiler_.Report(stderr, pcieParams_.sock_path);
+    }
+
+    // checking the wall clock on every iteration is too expensive
+    if (stats_export_.Enabled() && (++loop_iters & 0x3ff) == 0)
+      stats_export_.Poll(stats_, pcieParams_.sock_path, main_time_);
 
     YieldPoll();
   }
 
   fprintf(stderr, "exit main_time: %lu\n", main_time_);
+  if (veb_port_) {
+    // do not hold back the other bridged devices
+    veb_port_->Advance(UINT64_MAX);
+    fprintf(stderr, "veb: frames_tx=%lu frames_rx=%lu\n",
+            veb_port_->frames_tx, veb_port_->frames_rx);
+  }
 #ifdef STAT_NICBM
-  fprintf(stderr, "%20s: %22lu %20s: %22lu  poll_suc_rate: %f\n",
-          "h2d_poll_total", h2d_poll_total, "h2d_poll_suc", h2d_poll_suc,
-          (double)h2d_poll_suc / h2d_poll_total);
-
-  fprintf(stderr, "%65s: %22lu  sync_rate: %f\n", "h2d_poll_sync",
-          h2d_poll_sync, (double)h2d_poll_sync / h2d_poll_suc);
-
-  fprintf(stderr, "%20s: %22lu %20s: %22lu  poll_suc_rate: %f\n",
-          "n2d_poll_total", n2d_poll_total, "n2d_poll_suc", n2d_poll_suc,
-          (double)n2d_poll_suc / n2d_poll_total);
-
-  fprintf(stderr, "%65s: %22lu  sync_rate: %f\n", "n2d_poll_sync",
-          n2d_poll_sync, (double)n2d_poll_sync / n2d_poll_suc);
-
-  fprintf(
-      stderr, "%20s: %22lu %20s: %22lu  sync_rate: %f\n", "recv_total",
-      h2d_poll_suc + n2d_poll_suc, "recv_sync", h2d_poll_sync + n2d_poll_sync,
-      (double)(h2d_poll_sync + n2d_poll_sync) / (h2d_poll_suc + n2d_poll_suc));
-
-  fprintf(stderr, "%20s: %22lu %20s: %22lu  poll_suc_rate: %f\n",
-          "s_h2d_poll_total", s_h2d_poll_total, "s_h2d_poll_suc",
-          s_h2d_poll_suc, (double)s_h2d_poll_suc / s_h2d_poll_total);
-
-  fprintf(stderr, "%65s: %22lu  sync_rate: %f\n", "s_h2d_poll_sync",
-          s_h2d_poll_sync, (double)s_h2d_poll_sync / s_h2d_poll_suc);
-
-  fprintf(stderr, "%20s: %22lu %20s: %22lu  poll_suc_rate: %f\n",
-          "s_n2d_poll_total", s_n2d_poll_total, "s_n2d_poll_suc",
-          s_n2d_poll_suc, (double)s_n2d_poll_suc / s_n2d_poll_total);
-
-  fprintf(stderr, "%65s: %22lu  sync_rate: %f\n", "s_n2d_poll_sync",
-          s_n2d_poll_sync, (double)s_n2d_poll_sync / s_n2d_poll_suc);
-
-  fprintf(stderr, "%20s: %22lu %20s: %22lu  sync_rate: %f\n", "s_recv_total",
-          s_h2d_poll_suc + s_n2d_poll_suc, "s_recv_sync",
-          s_h2d_poll_sync + s_n2d_poll_sync,
-          (double)(s_h2d_poll_sync + s_n2d_poll_sync) /
-              (s_h2d_poll_suc + s_n2d_poll_suc));
+  stats_.Print(stderr);
 #endif
+  profiler_.Report(stderr, pcieParams_.sock_path);
+  stats_export_.Poll(stats_, pcieParams_.sock_path, main_time_, true);
+  evlog_.Close();
 
   SimbricksNicIfCleanup(&nicif_);
+  for (unsigned i = 1; i < num_eth_ports_; i++)
+    SimbricksBaseIfClose(&NetIf(i)->base);
   return 0;
 }
 
 void Runner::Device::Timed(TimedEvent &te) {
 }
 
+void Runner::Device::AddOptions(Options &opts) {
+}
+
 void Runner::Device::DevctrlUpdate(
     struct SimbricksProtoPcieH2DDevctrl &devctrl) {
   int_intx_en_ = devctrl.flags & SIMBRICKS_PROTO_PCIE_CTRL_INTX_EN;
@@ -29,8 +29,14 @@
 #include <cstring>
 #include <deque>
 #include <set>
+#include <vector>
 
 #include <simbricks/base/cxxatomicfix.h>
+#include <simbricks/nicbm/evlog.h>
+#include <simbricks/nicbm/options.h>
+#include <simbricks/nicbm/profiler.h>
+#include <simbricks/nicbm/stats.h>
+#include <simbricks/nicbm/veb.h>
 extern "C" {
 #include <simbricks/nicif/nicif.h>
 }
@@ -46,6 +52,10 @@ class DMAOp {
   uint64_t dma_addr_;
   size_t len_;
   void *data_;
+
+  /* set by the runner for latency statistics */
+  uint64_t issue_ts_;
+  uint64_t issue_wall_;
 };
 
 class TimedEvent {
@@ -115,6 +125,12 @@ class Runner {
      * Device control update
      */
     virtual void DevctrlUpdate(struct SimbricksProtoPcieH2DDevctrl &devctrl);
+
+    /**
+     * Register the device's long command line options, called by
+     * `ParseArgs` before parsing.
+     */
+    virtual void AddOptions(Options &opts);
   };
 
  protected:
@@ -137,34 +153,91 @@ class Runner {
   struct SimbricksNicIf nicif_;
   struct SimbricksProtoPcieDevIntro dintro_;
 
+  /* Ethernet port 0 is `nicif_.net`, the others are kept here */
+  static const unsigned kMaxEthPorts = 8;
+  unsigned num_eth_ports_;
+  struct SimbricksBaseIfParams extraNetParams_[kMaxEthPorts - 1];
+  struct SimbricksNetIf extraNets_[kMaxEthPorts - 1];
+  /* slots handed out by EthSendAlloc, not yet committed */
+  volatile union SimbricksProtoNetMsg *eth_tx_pending_[kMaxEthPorts];
+
+  uint64_t sigusr1_seen_;
+  uint64_t sigusr2_seen_;
+
+  /* time advance step bounds [ps], the ceiling defaults to the floor (a fixed
+   * step) unless set with `-M` */
+  static const uint64_t kDefaultStepMin = 10000;
+  uint64_t step_min_;
+  uint64_t step_max_;
+  uint64_t idle_step_;
+
+  RunnerStats stats_;
+  StatsExporter stats_export_;
+  Profiler profiler_;
+  const char *evlog_path_;
+  EvLog evlog_;
+
+  /* bridge to other devices in this process for port 0, if attached */
+  Veb::Port *veb_port_;
+  std::vector<uint8_t> veb_frame_;
+
   volatile union SimbricksProtoPcieD2H *D2HAlloc();
-  volatile union SimbricksProtoNetMsg *D2NAlloc();
+  volatile union SimbricksProtoNetMsg *D2NAlloc(uint8_t port);
+
+  struct SimbricksNetIf *NetIf(uint8_t port) {
+    return port == 0 ? &nicif_.net : &extraNets_[port - 1];
+  }
+  int IfSync();
 
   void H2DRead(volatile struct SimbricksProtoPcieH2DRead *read);
   void H2DWrite(volatile struct SimbricksProtoPcieH2DWrite *write, bool posted);
   void H2DReadcomp(volatile struct SimbricksProtoPcieH2DReadcomp *rc);
   void H2DWritecomp(volatile struct SimbricksProtoPcieH2DWritecomp *wc);
   void H2DDevctrl(volatile struct SimbricksProtoPcieH2DDevctrl *dc);
-  void PollH2D();
+  bool PollH2D();
 
-  void EthRecv(volatile struct SimbricksProtoNetMsgPacket *packetl);
-  void PollN2D();
+  void EthRecv(uint8_t port, const void *data, size_t len);
+  bool PollN2D();
+  bool PollVeb();
 
   bool EventNext(uint64_t &retval);
-  void EventTrigger();
+  bool EventTrigger();
+
+  /**
+   * Determine the timestamp to advance to: the earliest of the next event,
+   * the next peer message, and the next required sync message, capped by the
+   * step ceiling. Without synchronization the step starts at the floor and
+   * doubles on every idle iteration up to the ceiling.
+   */
+  uint64_t NextTimestamp(bool sync_pcie, bool sync_net, bool active);
 
   void DmaDo(DMAOp &op);
   void DmaTrigger();
+  void DmaCompleted(DMAOp &op);
 
   virtual void YieldPoll();
   virtual int NicIfInit();
+  /** Register long options, by default the device's */
+  virtual void AddOptions(Options &opts);
 
  public:
   explicit Runner(Device &dev_);
 
-  /** Parse command line arguments. */
+  /**
+   * Parse command line arguments: short and long options in any order,
+   * followed by the positional arguments.
+   */
   int ParseArgs(int argc, char *argv[]);
 
+  /** Switch frames on port 0 through `port`, must be called before RunMain */
+  void AttachVeb(Veb::Port &port);
+
+  /** Statistics for this runner */
+  const RunnerStats &Stats() const;
+
+  /** Binary event log, enabled with `-l`, devices can add messages to it */
+  EvLog &EventLog();
+
   /** Run the simulation */
   int RunMain();
 
@@ -174,6 +247,16 @@ class Runner {
   void MsiXIssue(uint8_t vec);
   void IntXIssue(bool level);
   void EthSend(const void *data, size_t len);
+  void EthSend(uint8_t port, const void *data, size_t len);
+  /**
+   * Zero-copy variant of `EthSend`: returns a buffer of `EthSendMaxLen(port)`
+   * bytes in the next outgoing message slot of `port`, the packet is sent
+   * with `EthSendCommit`. No other packet may be sent on `port` in between.
+   */
+  void *EthSendAlloc(uint8_t port);
+  void EthSendCommit(uint8_t port, size_t len);
+  size_t EthSendMaxLen(uint8_t port);
+  unsigned NumEthPorts() const;
 
   void EventSchedule(TimedEvent &evt);
   void EventCancel(TimedEvent &evt);
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "lib/simbricks/nicbm/options.h"
+
+#include <string>
+
+namespace nicbm {
+
+void Options::Add(const char *name, const char *arg_name, const char *help,
+                  Handler handler) {
+  opts_.push_back({name, arg_name, help, handler});
+}
+
+std::vector<struct option> Options::Table() const {
+  std::vector<struct option> table;
+  for (size_t i = 0; i < opts_.size(); i++) {
+    table.push_back({opts_[i].name,
+                     opts_[i].arg_name ? required_argument : no_argument,
+                     nullptr, kFirstVal + static_cast<int>(i)});
+  }
+  table.push_back({nullptr, 0, nullptr, 0});
+  return table;
+}
+
+bool Options::Apply(int val, const char *arg) const {
+  if (val < kFirstVal || val - kFirstVal >= static_cast<int>(opts_.size()))
+    return false;
+
+  const Opt &o = opts_[val - kFirstVal];
+  if (!o.handler(arg)) {
+    fprintf(stderr, "invalid argument for --%s: %s\n", o.name,
+            arg ? arg : "");
+    return false;
+  }
+  return true;
+}
+
+void Options::Usage(FILE *f) const {
+  for (const Opt &o : opts_) {
+    std::string opt = std::string("--") + o.name;
+    if (o.arg_name)
+      opt += std::string("=") + o.arg_name;
+    // help for long options continues on the next line
+    if (opt.size() > 30)
+      fprintf(f, "  %s\n  %-30s %s\n", opt.c_str(), "", o.help);
+    else
+      fprintf(f, "  %-30s %s\n", opt.c_str(), o.help);
+  }
+}
+
+}  // namespace nicbm
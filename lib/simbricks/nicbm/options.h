@@ -0,0 +1,84 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef SIMBRICKS_NICBM_OPTIONS_H_
+#define SIMBRICKS_NICBM_OPTIONS_H_
+
+#include <getopt.h>
+#include <stdio.h>
+
+#include <functional>
+#include <vector>
+
+namespace nicbm {
+
+/**
+ * Long command line options (`--NAME` or `--NAME=ARG`) registered by a
+ * runner and its device. `Runner::ParseArgs` parses them with getopt_long
+ * together with the runner's short options, so all options may be given in
+ * any order before the positional arguments.
+ */
+class Options {
+ public:
+  /** Apply the argument of an option (nullptr for flags), false if invalid */
+  typedef std::function<bool(const char *arg)> Handler;
+
+  /** getopt_long value of the first registered option */
+  static const int kFirstVal = 0x100;
+
+ protected:
+  struct Opt {
+    const char *name;
+    const char *arg_name;
+    const char *help;
+    Handler handler;
+  };
+  std::vector<Opt> opts_;
+
+ public:
+  /**
+   * Register `--NAME=ARG-NAME`, or the flag `--NAME` if `arg_name` is
+   * nullptr. `help` describes the option in the usage message.
+   */
+  void Add(const char *name, const char *arg_name, const char *help,
+           Handler handler);
+
+  /** Option table for getopt_long, terminated by a zero entry */
+  std::vector<struct option> Table() const;
+
+  /**
+   * Apply option `val` as returned by getopt_long. Prints an error and
+   * returns false if `val` is not a registered option or its argument is
+   * invalid.
+   */
+  bool Apply(int val, const char *arg) const;
+
+  /** Print one line per option */
+  void Usage(FILE *f) const;
+};
+
+}  // namespace nicbm
+
+#endif  // SIMBRICKS_NICBM_OPTIONS_H_
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "lib/simbricks/nicbm/profiler.h"
+
+#include <cxxabi.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace nicbm {
+
+/* upper bound of the bucket containing the given quantile, capped by max */
+static uint64_t Quantile(const Log2Histogram &h, double q) {
+  uint64_t target = h.count * q;
+  uint64_t seen = 0;
+  for (unsigned i = 0; i < Log2Histogram::kBuckets; i++) {
+    seen += h.buckets[i];
+    if (seen > target)
+      return std::min(Log2Histogram::BucketLimit(i), h.max);
+  }
+  return h.max;
+}
+
+static std::string TypeName(const std::type_index &ti) {
+  int status;
+  char *dem = abi::__cxa_demangle(ti.name(), nullptr, nullptr, &status);
+  if (status != 0)
+    return ti.name();
+  std::string s(dem);
+  free(dem);
+  return s;
+}
+
+void CallbackProfiler<true>::PrintLine(FILE *f, const char *cb,
+                                       const char *site,
+                                       const Log2Histogram &h,
+                                       uint64_t all_cycles) {
+  fprintf(f, "%-13s %-40s %12lu %16lu %6.2f%% %10lu %10lu %10lu\n", cb, site,
+          h.count, h.sum, all_cycles ? 100.0 * h.sum / all_cycles : 0.0,
+          h.count ? h.sum / h.count : 0, Quantile(h, 0.99), h.max);
+}
+
+void CallbackProfiler<true>::Report(FILE *f, const char *instance) const {
+  uint64_t all_cycles = 0;
+  for (unsigned i = 0; i < RunnerStats::kNumCallbacks; i++)
+    all_cycles += total_[i].sum;
+
+  fprintf(f, "callback profile [%s] (cycles):\n", instance);
+  fprintf(f, "%-13s %-40s %12s %16s %7s %10s %10s %10s\n", "callback", "site",
+          "calls", "total", "share", "mean", "p99", "max");
+
+  for (unsigned i = 0; i < RunnerStats::kNumCallbacks; i++) {
+    RunnerStats::Callback cb = static_cast<RunnerStats::Callback>(i);
+    const char *cb_name = RunnerStats::CallbackName(cb);
+    if (total_[i].count == 0)
+      continue;
+    PrintLine(f, cb_name, "*", total_[i], all_cycles);
+
+    std::vector<std::pair<std::string, const Log2Histogram *>> sites;
+    char buf[64];
+    for (auto &kv : keyed_[i]) {
+      if (cb == RunnerStats::kCbRegRead || cb == RunnerStats::kCbRegWrite) {
+        snprintf(buf, sizeof(buf), "bar%u+0x%lx", (unsigned)(kv.first >> 56),
+                 (kv.first & ((1UL << 56) - 1)) << kRegBucketShift);
+      } else {
+        snprintf(buf, sizeof(buf), "port%lu", kv.first);
+      }
+      sites.emplace_back(buf, &kv.second);
+    }
+    for (auto &kv : typed_[i])
+      sites.emplace_back(TypeName(kv.first), &kv.second);
+
+    std::sort(sites.begin(), sites.end(), [](const auto &a, const auto &b) {
+      return a.second->sum > b.second->sum;
+    });
+    for (auto &s : sites)
+      PrintLine(f, cb_name, s.first.c_str(), *s.second, all_cycles);
+  }
+}
+
+}  // namespace nicbm
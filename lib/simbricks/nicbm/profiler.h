@@ -0,0 +1,153 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SIMBRICKS_NICBM_PROFILER_H_
+#define SIMBRICKS_NICBM_PROFILER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+
+#include <simbricks/nicbm/stats.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* Set through `make ENABLE_NICBM_PROFILE=y`. This changes the layout of
+ * `nicbm::Runner`, so the library and all device models have to be built
+ * with the same setting. */
+#ifndef NICBM_PROFILE
+#define NICBM_PROFILE 0
+#endif
+
+namespace nicbm {
+
+/** Cheap timestamp for profiling: TSC cycles where available. */
+static inline uint64_t ProfileCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return StatsWallNs();
+#endif
+}
+
+/**
+ * Per-callback profiler for device models. Every profiled callback is
+ * bracketed by `Start()` and one of the `Record*()` calls, which attribute the
+ * elapsed cycles to the callback and to a breakdown site within it: the
+ * BAR/register-offset bucket for register accesses, the port for received
+ * packets, and the dynamic type of the `DMAOp` or `TimedEvent` otherwise.
+ *
+ * The disabled specialization is empty so all calls compile away.
+ */
+template <bool kEnable>
+class CallbackProfiler;
+
+template <>
+class CallbackProfiler<false> {
+ public:
+  static const bool kEnabled = false;
+  struct TypeTag {};
+
+  template <class T>
+  static TypeTag Tag(const T &obj) {
+    return TypeTag();
+  }
+  uint64_t Start() const {
+    return 0;
+  }
+  void RecordKeyed(RunnerStats::Callback cb, uint64_t key, uint64_t start) {
+  }
+  void RecordTyped(RunnerStats::Callback cb, TypeTag tag, uint64_t start) {
+  }
+  void Record(RunnerStats::Callback cb, uint64_t start) {
+  }
+  static uint64_t RegKey(uint8_t bar, uint64_t addr) {
+    return 0;
+  }
+  void Report(FILE *f, const char *instance) const {
+  }
+};
+
+template <>
+class CallbackProfiler<true> {
+ public:
+  static const bool kEnabled = true;
+  /** register accesses are aggregated per 2^kRegBucketShift bytes */
+  static const unsigned kRegBucketShift = 6;
+  typedef std::type_index TypeTag;
+
+  /** Tag for the dynamic type of `obj`, take it before `obj` may be freed. */
+  template <class T>
+  static TypeTag Tag(const T &obj) {
+    return std::type_index(typeid(obj));
+  }
+
+ protected:
+  Log2Histogram total_[RunnerStats::kNumCallbacks];
+  std::unordered_map<uint64_t, Log2Histogram>
+      keyed_[RunnerStats::kNumCallbacks];
+  std::unordered_map<std::type_index, Log2Histogram>
+      typed_[RunnerStats::kNumCallbacks];
+
+  static void PrintLine(FILE *f, const char *cb, const char *site,
+                        const Log2Histogram &h, uint64_t all_cycles);
+
+ public:
+  uint64_t Start() const {
+    return ProfileCycles();
+  }
+
+  void RecordKeyed(RunnerStats::Callback cb, uint64_t key, uint64_t start) {
+    uint64_t cycles = ProfileCycles() - start;
+    total_[cb].Add(cycles);
+    keyed_[cb][key].Add(cycles);
+  }
+
+  void RecordTyped(RunnerStats::Callback cb, TypeTag tag, uint64_t start) {
+    uint64_t cycles = ProfileCycles() - start;
+    total_[cb].Add(cycles);
+    typed_[cb][tag].Add(cycles);
+  }
+
+  void Record(RunnerStats::Callback cb, uint64_t start) {
+    total_[cb].Add(ProfileCycles() - start);
+  }
+
+  static uint64_t RegKey(uint8_t bar, uint64_t addr) {
+    return ((uint64_t)bar << 56) | (addr >> kRegBucketShift);
+  }
+
+  /** Print a flat profile, sites sorted by total cycles. */
+  void Report(FILE *f, const char *instance) const;
+};
+
+typedef CallbackProfiler<NICBM_PROFILE> Profiler;
+
+}  // namespace nicbm
+
+#endif  // SIMBRICKS_NICBM_PROFILER_H_
@@ -24,7 +24,8 @@ include mk/subdir_pre.mk
 
 lib_nicbm := $(d)libnicbm.a
 
-OBJS := $(addprefix $(d),nicbm.o multinic.o)
+OBJS := $(addprefix $(d),nicbm.o multinic.o stats.o profiler.o intmod.o \
+	evlog.o veb.o options.o)
 
 $(lib_nicbm): $(OBJS)
 
@@ -0,0 +1,348 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "lib/simbricks/nicbm/stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+namespace nicbm {
+
+Log2Histogram::Log2Histogram() {
+  Reset();
+}
+
+void Log2Histogram::Reset() {
+  count = 0;
+  sum = 0;
+  min = UINT64_MAX;
+  max = 0;
+  memset(buckets, 0, sizeof(buckets));
+}
+
+uint64_t Log2Histogram::BucketLimit(unsigned i) {
+  if (i == 0)
+    return 0;
+  if (i >= 64)
+    return UINT64_MAX;
+  return (1ULL << i) - 1;
+}
+
+RunnerStats::RunnerStats() : timing(false) {
+  Reset();
+}
+
+void RunnerStats::Reset() {
+  h2d_poll_total = h2d_poll_suc = h2d_poll_sync = 0;
+  s_h2d_poll_total = s_h2d_poll_suc = s_h2d_poll_sync = 0;
+  n2d_poll_total = n2d_poll_suc = n2d_poll_sync = 0;
+  s_n2d_poll_total = s_n2d_poll_suc = s_n2d_poll_sync = 0;
+  d2h_msgs = d2n_msgs = 0;
+  dma_issued = dma_completed = 0;
+  events_fired = 0;
+  memset(step_bound, 0, sizeof(step_bound));
+
+  dma_lat_sim.Reset();
+  dma_lat_wall.Reset();
+  for (unsigned i = 0; i < kNumCallbacks; i++)
+    cb_wall[i].Reset();
+}
+
+const char *RunnerStats::CallbackName(Callback cb) {
+  switch (cb) {
+    case kCbRegRead:
+      return "reg_read";
+    case kCbRegWrite:
+      return "reg_write";
+    case kCbDmaComplete:
+      return "dma_complete";
+    case kCbEthRx:
+      return "eth_rx";
+    case kCbTimed:
+      return "timed";
+    case kCbDevctrl:
+      return "devctrl";
+    default:
+      return "unknown";
+  }
+}
+
+const char *RunnerStats::StepBoundName(StepBound b) {
+  switch (b) {
+    case kStepEvent:
+      return "event";
+    case kStepPeer:
+      return "peer";
+    case kStepSync:
+      return "sync";
+    case kStepIdle:
+      return "idle";
+    case kStepCeiling:
+      return "ceiling";
+    default:
+      return "unknown";
+  }
+}
+
+void RunnerStats::Print(FILE *f) const {
+  fprintf(f, "%20s: %22lu %20s: %22lu  poll_suc_rate: %f\n", "h2d_poll_total",
+          h2d_poll_total, "h2d_poll_suc", h2d_poll_suc,
+          (double)h2d_poll_suc / h2d_poll_total);
+
+  fprintf(f, "%65s: %22lu  sync_rate: %f\n", "h2d_poll_sync", h2d_poll_sync,
+          (double)h2d_poll_sync / h2d_poll_suc);
+
+  fprintf(f, "%20s: %22lu %20s: %22lu  poll_suc_rate: %f\n", "n2d_poll_total",
+          n2d_poll_total, "n2d_poll_suc", n2d_poll_suc,
+          (double)n2d_poll_suc / n2d_poll_total);
+
+  fprintf(f, "%65s: %22lu  sync_rate: %f\n", "n2d_poll_sync", n2d_poll_sync,
+          (double)n2d_poll_sync / n2d_poll_suc);
+
+  fprintf(f, "%20s: %22lu %20s: %22lu  sync_rate: %f\n", "recv_total",
+          h2d_poll_suc + n2d_poll_suc, "recv_sync",
+          h2d_poll_sync + n2d_poll_sync,
+          (double)(h2d_poll_sync + n2d_poll_sync) /
+              (h2d_poll_suc + n2d_poll_suc));
+
+  fprintf(f, "%20s: %22lu %20s: %22lu  poll_suc_rate: %f\n",
+          "s_h2d_poll_total", s_h2d_poll_total, "s_h2d_poll_suc",
+          s_h2d_poll_suc, (double)s_h2d_poll_suc / s_h2d_poll_total);
+
+  fprintf(f, "%65s: %22lu  sync_rate: %f\n", "s_h2d_poll_sync",
+          s_h2d_poll_sync, (double)s_h2d_poll_sync / s_h2d_poll_suc);
+
+  fprintf(f, "%20s: %22lu %20s: %22lu  poll_suc_rate: %f\n",
+          "s_n2d_poll_total", s_n2d_poll_total, "s_n2d_poll_suc",
+          s_n2d_poll_suc, (double)s_n2d_poll_suc / s_n2d_poll_total);
+
+  fprintf(f, "%65s: %22lu  sync_rate: %f\n", "s_n2d_poll_sync",
+          s_n2d_poll_sync, (double)s_n2d_poll_sync / s_n2d_poll_suc);
+
+  fprintf(f, "%20s: %22lu %20s: %22lu  sync_rate: %f\n", "s_recv_total",
+          s_h2d_poll_suc + s_n2d_poll_suc, "s_recv_sync",
+          s_h2d_poll_sync + s_n2d_poll_sync,
+          (double)(s_h2d_poll_sync + s_n2d_poll_sync) /
+              (s_h2d_poll_suc + s_n2d_poll_suc));
+
+  fprintf(f, "%20s: %22lu %20s: %22lu %20s: %22lu\n", "dma_completed",
+          dma_completed, "events_fired", events_fired, "d2h_msgs", d2h_msgs);
+  fprintf(f, "%20s:", "step_bound");
+  for (unsigned i = 0; i < kNumStepBounds; i++)
+    fprintf(f, " %s=%lu", StepBoundName(static_cast<StepBound>(i)),
+            step_bound[i]);
+  fprintf(f, "\n");
+  // wall clock latencies are only sampled when enabled
+  if (dma_lat_sim.count > 0) {
+    fprintf(f, "%20s: avg %lu ps, avg %lu ns wall\n", "dma_latency",
+            dma_lat_sim.sum / dma_lat_sim.count,
+            dma_lat_wall.count ? dma_lat_wall.sum / dma_lat_wall.count : 0);
+  }
+}
+
+static void JsonHistogram(FILE *f, const char *name, const Log2Histogram &h) {
+  fprintf(f, "\"%s\":{\"count\":%lu,\"sum\":%lu,\"min\":%lu,\"max\":%lu,", name,
+          h.count, h.sum, h.count ? h.min : 0, h.max);
+  fprintf(f, "\"buckets\":[");
+  // skip trailing empty buckets to keep lines short
+  unsigned n = Log2Histogram::kBuckets;
+  while (n > 0 && h.buckets[n - 1] == 0)
+    n--;
+  for (unsigned i = 0; i < n; i++)
+    fprintf(f, "%s%lu", i ? "," : "", h.buckets[i]);
+  fprintf(f, "]}");
+}
+
+void RunnerStats::WriteJson(FILE *f, const char *instance,
+                            uint64_t main_time) const {
+  fprintf(f, "{\"instance\":\"%s\",\"wall_ns\":%lu,\"main_time\":%lu,",
+          instance, StatsWallNs(), main_time);
+  fprintf(f,
+          "\"h2d_poll_total\":%lu,\"h2d_poll_suc\":%lu,\"h2d_poll_sync\":%lu,",
+          h2d_poll_total, h2d_poll_suc, h2d_poll_sync);
+  fprintf(f,
+          "\"n2d_poll_total\":%lu,\"n2d_poll_suc\":%lu,\"n2d_poll_sync\":%lu,",
+          n2d_poll_total, n2d_poll_suc, n2d_poll_sync);
+  fprintf(f, "\"d2h_msgs\":%lu,\"d2n_msgs\":%lu,", d2h_msgs, d2n_msgs);
+  fprintf(f, "\"dma_issued\":%lu,\"dma_completed\":%lu,\"events_fired\":%lu,",
+          dma_issued, dma_completed, events_fired);
+  fprintf(f, "\"step_bound\":{");
+  for (unsigned i = 0; i < kNumStepBounds; i++)
+    fprintf(f, "%s\"%s\":%lu", i ? "," : "",
+            StepBoundName(static_cast<StepBound>(i)), step_bound[i]);
+  fprintf(f, "},");
+  JsonHistogram(f, "dma_lat_sim_ps", dma_lat_sim);
+  fprintf(f, ",");
+  JsonHistogram(f, "dma_lat_wall_ns", dma_lat_wall);
+  fprintf(f, ",\"callbacks\":{");
+  for (unsigned i = 0; i < kNumCallbacks; i++) {
+    if (i)
+      fprintf(f, ",");
+    JsonHistogram(f, CallbackName(static_cast<Callback>(i)), cb_wall[i]);
+  }
+  fprintf(f, "}}\n");
+}
+
+static void PromCounter(FILE *f, const char *name, const char *help,
+                        const char *instance, uint64_t val) {
+  fprintf(f, "# HELP nicbm_%s %s\n", name, help);
+  fprintf(f, "# TYPE nicbm_%s counter\n", name);
+  fprintf(f, "nicbm_%s{instance=\"%s\"} %lu\n", name, instance, val);
+}
+
+static void PromHistogram(FILE *f, const char *name, const char *labels,
+                          const Log2Histogram &h) {
+  uint64_t cum = 0;
+  for (unsigned i = 0; i < Log2Histogram::kBuckets - 1; i++) {
+    cum += h.buckets[i];
+    fprintf(f, "nicbm_%s_bucket{%s,le=\"%lu\"} %lu\n", name, labels,
+            Log2Histogram::BucketLimit(i), cum);
+    // only emit buckets up to the one containing the largest observed value
+    if (Log2Histogram::BucketLimit(i) >= h.max)
+      break;
+  }
+  fprintf(f, "nicbm_%s_bucket{%s,le=\"+Inf\"} %lu\n", name, labels, h.count);
+  fprintf(f, "nicbm_%s_sum{%s} %lu\n", name, labels, h.sum);
+  fprintf(f, "nicbm_%s_count{%s} %lu\n", name, labels, h.count);
+}
+
+void RunnerStats::WritePrometheus(FILE *f, const char *instance,
+                                  uint64_t main_time) const {
+  fprintf(f, "# HELP nicbm_main_time_ps Current simulation time.\n");
+  fprintf(f, "# TYPE nicbm_main_time_ps gauge\n");
+  fprintf(f, "nicbm_main_time_ps{instance=\"%s\"} %lu\n", instance, main_time);
+
+  PromCounter(f, "h2d_poll_total", "PCIe queue polls.", instance,
+              h2d_poll_total);
+  PromCounter(f, "h2d_poll_suc", "Successful PCIe queue polls.", instance,
+              h2d_poll_suc);
+  PromCounter(f, "h2d_poll_sync", "PCIe sync messages received.", instance,
+              h2d_poll_sync);
+  PromCounter(f, "n2d_poll_total", "Network queue polls.", instance,
+              n2d_poll_total);
+  PromCounter(f, "n2d_poll_suc", "Successful network queue polls.", instance,
+              n2d_poll_suc);
+  PromCounter(f, "n2d_poll_sync", "Network sync messages received.", instance,
+              n2d_poll_sync);
+  PromCounter(f, "d2h_msgs", "PCIe messages sent.", instance, d2h_msgs);
+  PromCounter(f, "d2n_msgs", "Network messages sent.", instance, d2n_msgs);
+  PromCounter(f, "dma_issued", "DMA operations issued by the device.",
+              instance, dma_issued);
+  PromCounter(f, "dma_completed", "DMA operations completed.", instance,
+              dma_completed);
+  PromCounter(f, "events_fired", "Timed events fired.", instance,
+              events_fired);
+
+  fprintf(f, "# HELP nicbm_step_bound Time advance steps by limiting bound.\n");
+  fprintf(f, "# TYPE nicbm_step_bound counter\n");
+  for (unsigned i = 0; i < kNumStepBounds; i++) {
+    fprintf(f, "nicbm_step_bound{instance=\"%s\",bound=\"%s\"} %lu\n",
+            instance, StepBoundName(static_cast<StepBound>(i)), step_bound[i]);
+  }
+
+  std::string labels = std::string("instance=\"") + instance + "\"";
+  fprintf(f, "# HELP nicbm_dma_latency_ps DMA latency in simulation time.\n");
+  fprintf(f, "# TYPE nicbm_dma_latency_ps histogram\n");
+  PromHistogram(f, "dma_latency_ps", labels.c_str(), dma_lat_sim);
+  fprintf(f, "# HELP nicbm_dma_latency_wall_ns DMA latency in wall time.\n");
+  fprintf(f, "# TYPE nicbm_dma_latency_wall_ns histogram\n");
+  PromHistogram(f, "dma_latency_wall_ns", labels.c_str(), dma_lat_wall);
+
+  fprintf(f, "# HELP nicbm_callback_wall_ns Wall time in device callbacks.\n");
+  fprintf(f, "# TYPE nicbm_callback_wall_ns histogram\n");
+  for (unsigned i = 0; i < kNumCallbacks; i++) {
+    std::string cl = labels + ",callback=\"" +
+                     CallbackName(static_cast<Callback>(i)) + "\"";
+    PromHistogram(f, "callback_wall_ns", cl.c_str(), cb_wall[i]);
+  }
+}
+
+StatsExporter::StatsExporter()
+    : path_(nullptr),
+      format_(RunnerStats::kFormatJson),
+      interval_ns_(0),
+      next_export_(0),
+      json_f_(nullptr) {
+}
+
+StatsExporter::~StatsExporter() {
+  if (json_f_)
+    fclose(json_f_);
+}
+
+void StatsExporter::Configure(const char *path, RunnerStats::Format format,
+                              uint64_t interval_ms) {
+  path_ = path;
+  format_ = format;
+  interval_ns_ = interval_ms * 1000000ULL;
+  next_export_ = StatsWallNs() + interval_ns_;
+}
+
+void StatsExporter::Uniquify(unsigned idx) {
+  std::string p(path_);
+  size_t base = p.rfind('/');
+  size_t ext = p.rfind('.');
+  if (ext == std::string::npos || (base != std::string::npos && ext < base))
+    ext = p.size();
+  unique_path_ = p.substr(0, ext) + "." + std::to_string(idx) + p.substr(ext);
+  path_ = unique_path_.c_str();
+}
+
+void StatsExporter::Poll(const RunnerStats &stats, const char *instance,
+                         uint64_t main_time, bool force) {
+  if (!path_)
+    return;
+
+  uint64_t now = StatsWallNs();
+  if (!force && now < next_export_)
+    return;
+  next_export_ = now + interval_ns_;
+
+  if (format_ == RunnerStats::kFormatJson) {
+    if (!json_f_ && !(json_f_ = fopen(path_, "a"))) {
+      perror("StatsExporter::Poll: opening stats file failed");
+      path_ = nullptr;
+      return;
+    }
+    stats.WriteJson(json_f_, instance, main_time);
+    fflush(json_f_);
+  } else {
+    // write to temporary file and rename, so readers never see partial files
+    std::string tmp = std::string(path_) + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "w");
+    if (!f) {
+      perror("StatsExporter::Poll: opening stats file failed");
+      path_ = nullptr;
+      return;
+    }
+    stats.WritePrometheus(f, instance, main_time);
+    fclose(f);
+    if (rename(tmp.c_str(), path_))
+      perror("StatsExporter::Poll: rename failed");
+  }
+}
+
+}  // namespace nicbm
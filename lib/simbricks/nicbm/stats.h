@@ -0,0 +1,210 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SIMBRICKS_NICBM_STATS_H_
+#define SIMBRICKS_NICBM_STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <string>
+
+namespace nicbm {
+
+/** Monotonic wall clock time in nanoseconds. */
+static inline uint64_t StatsWallNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Histogram with power-of-two buckets. Bucket 0 counts zero values, bucket i
+ * counts values in [2^(i-1), 2^i).
+ */
+class Log2Histogram {
+ public:
+  static const unsigned kBuckets = 65;
+
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t buckets[kBuckets];
+
+  Log2Histogram();
+  void Reset();
+
+  void Add(uint64_t v) {
+    buckets[v ? 64 - __builtin_clzll(v) : 0]++;
+    count++;
+    sum += v;
+    if (v < min)
+      min = v;
+    if (v > max)
+      max = v;
+  }
+
+  /** Upper bound (inclusive) of values counted in bucket `i`. */
+  static uint64_t BucketLimit(unsigned i);
+};
+
+/**
+ * Statistics for one `Runner`. Every runner owns its instance, so no
+ * synchronization is needed even if runners execute on different threads.
+ */
+class RunnerStats {
+ public:
+  enum Callback {
+    kCbRegRead,
+    kCbRegWrite,
+    kCbDmaComplete,
+    kCbEthRx,
+    kCbTimed,
+    kCbDevctrl,
+    kNumCallbacks,
+  };
+
+  /** What limited a time advance step of the main loop. */
+  enum StepBound {
+    kStepEvent,
+    kStepPeer,
+    kStepSync,
+    kStepIdle,
+    kStepCeiling,
+    kNumStepBounds,
+  };
+
+  enum Format {
+    kFormatJson,
+    kFormatPrometheus,
+  };
+
+  /* poll statistics, the s_* variants only count after SIGUSR2 */
+  uint64_t h2d_poll_total;
+  uint64_t h2d_poll_suc;
+  uint64_t h2d_poll_sync;
+  uint64_t s_h2d_poll_total;
+  uint64_t s_h2d_poll_suc;
+  uint64_t s_h2d_poll_sync;
+
+  uint64_t n2d_poll_total;
+  uint64_t n2d_poll_suc;
+  uint64_t n2d_poll_sync;
+  uint64_t s_n2d_poll_total;
+  uint64_t s_n2d_poll_suc;
+  uint64_t s_n2d_poll_sync;
+
+  /* outgoing messages */
+  uint64_t d2h_msgs;
+  uint64_t d2n_msgs;
+
+  uint64_t dma_issued;
+  uint64_t dma_completed;
+  uint64_t events_fired;
+  uint64_t step_bound[kNumStepBounds];
+
+  /* DMA latency from `IssueDma` to completion in simulation time [ps] and
+   * wall clock time [ns] */
+  Log2Histogram dma_lat_sim;
+  Log2Histogram dma_lat_wall;
+  /* wall clock time spent in device callbacks [ns], only recorded if
+   * `timing` is enabled */
+  Log2Histogram cb_wall[kNumCallbacks];
+  bool timing;
+
+  RunnerStats();
+  void Reset();
+
+  static const char *CallbackName(Callback cb);
+  static const char *StepBoundName(StepBound b);
+
+  /** Print human readable summary (the classic exit statistics). */
+  void Print(FILE *f) const;
+  /** Append one JSON object on a single line. */
+  void WriteJson(FILE *f, const char *instance, uint64_t main_time) const;
+  /** Write statistics in the Prometheus text exposition format. */
+  void WritePrometheus(FILE *f, const char *instance,
+                       uint64_t main_time) const;
+};
+
+/** Records wall time of a device callback for the lifetime of the object. */
+class CallbackTimer {
+ protected:
+  Log2Histogram *hist_;
+  uint64_t start_;
+
+ public:
+  CallbackTimer(RunnerStats &stats, RunnerStats::Callback cb)
+      : hist_(stats.timing ? &stats.cb_wall[cb] : nullptr),
+        start_(hist_ ? StatsWallNs() : 0) {
+  }
+
+  ~CallbackTimer() {
+    if (hist_)
+      hist_->Add(StatsWallNs() - start_);
+  }
+};
+
+/**
+ * Periodically exports `RunnerStats` to a file. JSON is appended as one line
+ * per export, Prometheus files are rewritten atomically (for use with the
+ * node exporter textfile collector).
+ */
+class StatsExporter {
+ protected:
+  const char *path_;
+  std::string unique_path_;
+  RunnerStats::Format format_;
+  uint64_t interval_ns_;
+  uint64_t next_export_;
+  FILE *json_f_;
+
+ public:
+  StatsExporter();
+  ~StatsExporter();
+
+  void Configure(const char *path, RunnerStats::Format format,
+                 uint64_t interval_ms);
+  bool Enabled() const {
+    return path_ != nullptr;
+  }
+  const char *Path() const {
+    return path_;
+  }
+  /**
+   * Insert `idx` into the file name (`FILE.EXT` becomes `FILE.IDX.EXT`), for
+   * exporters of several runners that were configured with the same path.
+   */
+  void Uniquify(unsigned idx);
+
+  /** Export if the interval has passed (or unconditionally if `force`). */
+  void Poll(const RunnerStats &stats, const char *instance, uint64_t main_time,
+            bool force = false);
+};
+
+}  // namespace nicbm
+
+#endif  // SIMBRICKS_NICBM_STATS_H_
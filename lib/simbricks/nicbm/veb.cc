@@ -0,0 +1,137 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "lib/simbricks/nicbm/veb.h"
+
+#include <assert.h>
+#include <string.h>
+
+namespace nicbm {
+
+Veb::Port::Port(Veb &veb, unsigned id)
+    : veb_(veb),
+      id_(id),
+      time_(0),
+      in_ts_(UINT64_MAX),
+      frames_tx(0),
+      frames_rx(0) {
+}
+
+void Veb::Port::Advance(uint64_t time) {
+  time_.store(time, std::memory_order_release);
+}
+
+uint64_t Veb::Port::Horizon() const {
+  uint64_t h = UINT64_MAX;
+  for (Port *p : veb_.ports_) {
+    if (p == this)
+      continue;
+    uint64_t t = p->time_.load(std::memory_order_acquire);
+    if (t < UINT64_MAX - veb_.latency_ && t + veb_.latency_ < h)
+      h = t + veb_.latency_;
+  }
+  return h;
+}
+
+bool Veb::Port::Send(uint64_t time, const void *data, size_t len) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  uint64_t dst = 0;
+  uint64_t src = 0;
+  if (len < 12)
+    return false;
+  memcpy(&dst, p, 6);
+  memcpy(&src, p + 6, 6);
+
+  // the group bit is the lowest bit of the first byte, multicast and
+  // broadcast frames are left to the network
+  Port *to;
+  {
+    std::lock_guard<std::mutex> lk(veb_.mac_mtx_);
+    if (!(src & 1))
+      veb_.macs_[src] = id_;
+    if (dst & 1)
+      return false;
+    auto it = veb_.macs_.find(dst);
+    if (it == veb_.macs_.end() || it->second == id_)
+      return false;
+    to = veb_.ports_[it->second];
+  }
+
+  uint64_t ts = time + veb_.latency_;
+  {
+    std::lock_guard<std::mutex> lk(to->in_mtx_);
+    Frame f;
+    f.ts = ts;
+    if (!to->free_.empty()) {
+      f.data.swap(to->free_.back());
+      to->free_.pop_back();
+    }
+    f.data.assign(p, p + len);
+
+    // frames from one sender are in order, only frames from different
+    // senders need to be merged
+    auto pos = to->in_.end();
+    while (pos != to->in_.begin() && (pos - 1)->ts > ts)
+      --pos;
+    to->in_.insert(pos, std::move(f));
+    to->in_ts_.store(to->in_.front().ts, std::memory_order_release);
+  }
+  frames_tx++;
+  return true;
+}
+
+bool Veb::Port::Recv(uint64_t time, std::vector<uint8_t> &frame) {
+  if (InTimestamp() > time)
+    return false;
+
+  std::lock_guard<std::mutex> lk(in_mtx_);
+  if (in_.empty() || in_.front().ts > time)
+    return false;
+
+  frame.swap(in_.front().data);
+  free_.push_back(std::move(in_.front().data));
+  in_.pop_front();
+  in_ts_.store(in_.empty() ? UINT64_MAX : in_.front().ts,
+               std::memory_order_release);
+  frames_rx++;
+  return true;
+}
+
+Veb::Veb(uint64_t latency) : latency_(latency) {
+  assert(latency > 0);
+}
+
+Veb::~Veb() {
+  for (Port *p : ports_)
+    delete p;
+}
+
+Veb::Port &Veb::Attach() {
+  Port *p = new Port(*this, ports_.size());
+  ports_.push_back(p);
+  return *p;
+}
+
+}  // namespace nicbm
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef SIMBRICKS_NICBM_VEB_H_
+#define SIMBRICKS_NICBM_VEB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace nicbm {
+
+/**
+ * Virtual Ethernet bridge between the devices of one process. Unicast frames
+ * to a MAC address learned from another attached device are handed over in
+ * memory instead of going through the network, everything else is left to
+ * the network. Frames are delivered after a fixed latency, which is also the
+ * lookahead for synchronizing the attached runners with each other: a runner
+ * never advances further than the latency beyond the slowest other one.
+ */
+class Veb {
+ public:
+  class Port {
+   protected:
+    friend class Veb;
+
+    struct Frame {
+      uint64_t ts;
+      std::vector<uint8_t> data;
+    };
+
+    Veb &veb_;
+    unsigned id_;
+    /* current time of the attached runner */
+    std::atomic<uint64_t> time_;
+    /* timestamp of the first incoming frame, UINT64_MAX if none */
+    std::atomic<uint64_t> in_ts_;
+    std::mutex in_mtx_;
+    /* incoming frames ordered by timestamp */
+    std::deque<Frame> in_;
+    /* buffers of delivered frames for reuse */
+    std::vector<std::vector<uint8_t>> free_;
+
+    Port(Veb &veb, unsigned id);
+
+   public:
+    uint64_t frames_tx;
+    uint64_t frames_rx;
+
+    /** The attached runner advanced to `time`. */
+    void Advance(uint64_t time);
+    /** Latest time the attached runner can advance to. */
+    uint64_t Horizon() const;
+    /** Timestamp of the next incoming frame, UINT64_MAX if none. */
+    uint64_t InTimestamp() const {
+      return in_ts_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Switch a frame sent at `time`, returns false if the frame is not for
+     * another attached device and should go to the network.
+     */
+    bool Send(uint64_t time, const void *data, size_t len);
+    /**
+     * Retrieve the next incoming frame due at or before `time` into
+     * `frame`, returns false if there is none.
+     */
+    bool Recv(uint64_t time, std::vector<uint8_t> &frame);
+  };
+
+  /** `latency` in picoseconds, must be larger than 0. */
+  explicit Veb(uint64_t latency);
+  ~Veb();
+
+  /** Add a port, all ports must be attached before any runner starts. */
+  Port &Attach();
+
+ protected:
+  uint64_t latency_;
+  std::vector<Port *> ports_;
+  std::mutex mac_mtx_;
+  /* learned source MAC address to port */
+  std::unordered_map<uint64_t, unsigned> macs_;
+};
+
+}  // namespace nicbm
+
+#endif  // SIMBRICKS_NICBM_VEB_H_
@@ -28,12 +28,47 @@
 #include <stdio.h>
 #include <string.h>
 
+static int NetIfSetup(struct SimbricksNicIf *nicif,
+                      struct SimbricksNetIf *netif,
+                      struct SimbricksBaseIfParams *params,
+                      struct SimbricksProtoNetIntro *intro,
+                      struct SimBricksBaseIfEstablishData *est) {
+  if (SimbricksBaseIfInit(&netif->base, params)) {
+    perror("SimbricksNicIfInit: SimbricksBaseIfInit net failed");
+    return -1;
+  }
+
+  if (SimbricksBaseIfListen(&netif->base, &nicif->pool)) {
+    perror("SimbricksNicIfInit: SimbricksBaseIfListen net failed");
+    return -1;
+  }
+
+  est->base_if = &netif->base;
+  est->tx_intro = intro;
+  est->tx_intro_len = sizeof(*intro);
+  est->rx_intro = intro;
+  est->rx_intro_len = sizeof(*intro);
+  return 0;
+}
+
 int SimbricksNicIfInit(struct SimbricksNicIf *nicif, const char *shm_path,
                        struct SimbricksBaseIfParams *netParams,
                        struct SimbricksBaseIfParams *pcieParams,
                        struct SimbricksProtoPcieDevIntro *di) {
-  struct SimbricksBaseIf *netif = &nicif->net.base;
+  return SimbricksNicIfInitMultiNet(nicif, shm_path, netParams, NULL, NULL, 0,
+                                    pcieParams, di);
+}
+
+int SimbricksNicIfInitMultiNet(struct SimbricksNicIf *nicif,
+                               const char *shm_path,
+                               struct SimbricksBaseIfParams *netParams,
+                               struct SimbricksNetIf *extraNets,
+                               struct SimbricksBaseIfParams *extraNetParams,
+                               unsigned numExtraNets,
+                               struct SimbricksBaseIfParams *pcieParams,
+                               struct SimbricksProtoPcieDevIntro *di) {
   struct SimbricksBaseIf *pcieif = &nicif->pcie.base;
+  unsigned i;
 
   // first allocate pool
   size_t shm_size = 0;
@@ -41,6 +76,12 @@ int SimbricksNicIfInit(struct SimbricksNicIf *nicif, const char *shm_path,
     shm_size += netParams->in_num_entries * netParams->in_entries_size;
     shm_size += netParams->out_num_entries * netParams->out_entries_size;
   }
+  for (i = 0; i < numExtraNets; i++) {
+    shm_size += extraNetParams[i].in_num_entries *
+                extraNetParams[i].in_entries_size;
+    shm_size += extraNetParams[i].out_num_entries *
+                extraNetParams[i].out_entries_size;
+  }
   if (pcieParams) {
     shm_size += pcieParams->in_num_entries * pcieParams->in_entries_size;
     shm_size += pcieParams->out_num_entries * pcieParams->out_entries_size;
@@ -50,27 +91,21 @@ int SimbricksNicIfInit(struct SimbricksNicIf *nicif, const char *shm_path,
     return -1;
   }
 
-  struct SimBricksBaseIfEstablishData ests[2];
+  struct SimBricksBaseIfEstablishData ests[2 + numExtraNets];
   struct SimbricksProtoNetIntro net_intro;
   struct SimbricksProtoPcieHostIntro pcie_h_intro;
   unsigned n_bifs = 0;
+  memset(&net_intro, 0, sizeof(net_intro));
   if (netParams) {
-    if (SimbricksBaseIfInit(netif, netParams)) {
-      perror("SimbricksNicIfInit: SimbricksBaseIfInit net failed");
+    if (NetIfSetup(nicif, &nicif->net, netParams, &net_intro, &ests[n_bifs]))
       return -1;
-    }
+    n_bifs++;
+  }
 
-    if (SimbricksBaseIfListen(netif, &nicif->pool)) {
-      perror("SimbricksNicIfInit: SimbricksBaseIfListen net failed");
+  for (i = 0; i < numExtraNets; i++) {
+    if (NetIfSetup(nicif, &extraNets[i], &extraNetParams[i], &net_intro,
+                   &ests[n_bifs]))
       return -1;
-    }
-
-    memset(&net_intro, 0, sizeof(net_intro));
-    ests[n_bifs].base_if = netif;
-    ests[n_bifs].tx_intro = &net_intro;
-    ests[n_bifs].tx_intro_len = sizeof(net_intro);
-    ests[n_bifs].rx_intro = &net_intro;
-    ests[n_bifs].rx_intro_len = sizeof(net_intro);
     n_bifs++;
   }
 
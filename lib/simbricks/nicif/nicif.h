@@ -42,6 +42,21 @@ int SimbricksNicIfInit(struct SimbricksNicIf *nicif, const char *shmPath,
                        struct SimbricksBaseIfParams *pcieParams,
                        struct SimbricksProtoPcieDevIntro *di);
 
+/**
+ * Like `SimbricksNicIfInit`, but additionally sets up `numExtraNets` network
+ * interfaces `extraNets` (with parameters `extraNetParams`) for NICs with
+ * multiple Ethernet ports. All interfaces share the same SHM pool. The caller
+ * is responsible for syncing and closing the extra interfaces.
+ */
+int SimbricksNicIfInitMultiNet(struct SimbricksNicIf *nicif,
+                               const char *shmPath,
+                               struct SimbricksBaseIfParams *netParams,
+                               struct SimbricksNetIf *extraNets,
+                               struct SimbricksBaseIfParams *extraNetParams,
+                               unsigned numExtraNets,
+                               struct SimbricksBaseIfParams *pcieParams,
+                               struct SimbricksProtoPcieDevIntro *di);
+
 int SimbricksNicIfCleanup(struct SimbricksNicIf *nicif);
 
 static inline int SimbricksNicIfSync(struct SimbricksNicIf *nicif,
@@ -22,10 +22,12 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <pthread.h>
 #include <signal.h>
 #include <verilated.h>
 #include <verilated_fst_c.h>
 
+#include <chrono>
 #include <iostream>
 #include <vector>
 
@@ -35,21 +37,35 @@
 #define MAX_PKT_SIZE 2048
 
 // #define ETH_DEBUG
-// #define TRACE_ENABLED
 
 class EthernetTx;
 class EthernetRx;
 
-std::vector<Port *> ports;
-int synchronized = 0;
+static std::vector<Port *> ports;
+static int synchronized = 0;
 uint64_t sync_period = (500 * 1000ULL);  // 500ns
 uint64_t eth_latency = (500 * 1000ULL);  // 500ns
 int sync_mode = SIMBRICKS_PROTO_SYNC_SIMBRICKS;
 static uint64_t clock_period = 4 * 1000ULL;  // 4ns -> 250MHz
-uint64_t main_time = 0;
-int exiting = 0;
-EthernetTx *txMAC;
-EthernetRx *rxMAC;
+static uint64_t main_time = 0;
+static volatile int exiting = 0;
+static EthernetTx *txMAC;
+static EthernetRx *rxMAC;
+
+/* Waveform tracing is configured with MENSHEN_TRACE (see trace_config) and
+ * toggled with SIGUSR1. The main loop only compares main_time to trace_next
+ * after each eval, trace_step does everything else. */
+static VerilatedFstC *trace = nullptr;
+static const char *trace_file;
+static bool tracing = false;
+static volatile uint64_t trace_next = UINT64_MAX;
+static volatile sig_atomic_t trace_toggle = 0;
+static uint64_t trace_start = 0;
+static uint64_t trace_end = UINT64_MAX;
+static uint64_t trace_len = UINT64_MAX;
+static uint64_t trace_stop_at;
+static uint64_t trace_pkts = 0;
+static uint64_t packets = 0;
 
 static void sigint_handler(int dummy) {
   exiting = 1;
@@ -57,12 +73,105 @@ static void sigint_handler(int dummy) {
 
 static void sigusr1_handler(int dummy) {
   fprintf(stderr, "main_time = %lu\n", main_time);
+  if (trace) {
+    trace_toggle = 1;
+    trace_next = 0;
+  }
 }
 
 double sc_time_stamp() {
   return main_time;
 }
 
+/* parse FILE[,start=NS][,end=NS][,len=NS][,pkts=N][,signal]: trace to FILE
+ * once start is reached and pkts frames have been sent or received, for len
+ * but at most until end. signal disables this automatic start, SIGUSR1 turns
+ * tracing on and off in any case. */
+static int trace_config(const char *spec) {
+  char *s = strdup(spec);
+  char *save;
+  for (char *opt = strtok_r(s, ",", &save); opt;
+       opt = strtok_r(NULL, ",", &save)) {
+    if (!strncmp(opt, "start=", 6)) {
+      trace_start = strtoull(opt + 6, NULL, 0) * 1000ULL;
+    } else if (!strncmp(opt, "end=", 4)) {
+      trace_end = strtoull(opt + 4, NULL, 0) * 1000ULL;
+    } else if (!strncmp(opt, "len=", 4)) {
+      trace_len = strtoull(opt + 4, NULL, 0) * 1000ULL;
+    } else if (!strncmp(opt, "pkts=", 5)) {
+      trace_pkts = strtoull(opt + 5, NULL, 0);
+    } else if (!strcmp(opt, "signal")) {
+      trace_start = UINT64_MAX;
+    } else if (opt == s && !strchr(opt, '=')) {
+      trace_file = opt;
+    } else {
+      fprintf(stderr, "trace_config: invalid option '%s'\n", opt);
+      return -1;
+    }
+  }
+  if (!trace_file) {
+    fprintf(stderr, "trace_config: no trace file in '%s'\n", spec);
+    return -1;
+  }
+  return 0;
+}
+
+static void trace_open(Vrmt_wrapper *top) {
+  trace = new VerilatedFstC;
+  top->trace(trace, 99);
+  trace->open(trace_file);
+  trace_next = 0;
+}
+
+static void trace_begin(uint64_t stop_at) {
+  fprintf(stderr, "trace: start main_time = %lu\n", main_time);
+  tracing = true;
+  trace_stop_at = stop_at;
+}
+
+static void trace_stop() {
+  fprintf(stderr, "trace: stop main_time = %lu\n", main_time);
+  tracing = false;
+  trace->flush();
+}
+
+/* called once main_time reaches trace_next: starts or stops tracing and dumps
+ * the model state while it is on */
+static void trace_step() {
+  if (trace_toggle) {
+    trace_toggle = 0;
+    if (tracing)
+      trace_stop();
+    else
+      trace_begin(UINT64_MAX);
+  } else if (!tracing && main_time >= trace_start && packets >= trace_pkts) {
+    /* the automatic start only happens once */
+    trace_start = UINT64_MAX;
+    trace_begin(main_time < trace_end && trace_len < trace_end - main_time
+                    ? main_time + trace_len
+                    : trace_end);
+  } else if (tracing && main_time >= trace_stop_at) {
+    trace_stop();
+  }
+
+  if (tracing) {
+    trace->dump(main_time);
+    trace_next = 0;
+  } else if (packets < trace_pkts)
+    trace_next = UINT64_MAX;  // re-armed by trace_packet
+  else
+    trace_next = trace_start;
+  /* SIGUSR1 raised in the meantime */
+  if (trace_toggle)
+    trace_next = 0;
+}
+
+/* count a frame sent or received for the pkts trigger */
+static void trace_packet() {
+  if (++packets == trace_pkts)
+    trace_next = 0;
+}
+
 static void reset_inputs(Vrmt_wrapper *top) {
   top->clk = 0;
   top->aresetn = 0;
@@ -141,6 +250,7 @@ class EthernetTx {
     }
 
     ports[port_id]->TxPacket(packet_buf, packet_len, main_time);
+    trace_packet();
 
 #ifdef ETH_DEBUG
     std::cerr << main_time << " EthernetTx: packet len=" << std::hex
@@ -204,6 +314,7 @@ class EthernetRx {
     memcpy(fifo_bufs[fifo_pos_wr], data, len);
     fifo_lens[fifo_pos_wr] = len;
     fifo_ports[fifo_pos_wr] = port;
+    trace_packet();
 
 #ifdef ETH_DEBUG
     std::cout << main_time << " rx into " << fifo_pos_wr << std::endl;
@@ -271,7 +382,6 @@ class EthernetRx {
         top.s_axis_tvalid = 1;
         top.s_axis_tlast = (packet_off == fifo_lens[fifo_pos_rd]);
       }
-      //  trace->dump(main_time);
     } else {
       // no data
       top.s_axis_tuser[0] = 0;
@@ -304,16 +414,18 @@ static void poll_ports() {
   }
 }
 
-int main(int argc, char *argv[]) {
-  signal(SIGINT, sigint_handler);
-  signal(SIGUSR1, sigusr1_handler);
-
-  char *vargs[2] = {argv[0], NULL};
-  Verilated::commandArgs(1, vargs);
-#ifdef TRACE_ENABLED
-  Verilated::traceEverOn(true);
-#endif
+/* The worker threads of a multithreaded model start with the model and
+ * inherit our signal mask, block the signals meanwhile so only the main
+ * thread handles them. The workers only run inside eval(), all other state is
+ * accessed by the main thread alone. */
+static Vrmt_wrapper *create_model() {
+  sigset_t set, old;
+  sigemptyset(&set);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &set, &old);
   Vrmt_wrapper *top = new Vrmt_wrapper;
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
 
   /* execute reset */
   reset_inputs(top);
@@ -323,6 +435,61 @@ int main(int argc, char *argv[]) {
     top->clk = !top->clk;
   }
   top->aresetn = 1;
+  return top;
+}
+
+/* clock the pipeline on its own with a stream of frames and report the
+ * simulation speed */
+static int bench_main(uint64_t cycles) {
+  Vrmt_wrapper *top = create_model();
+  rxMAC = new EthernetRx(*top);
+  uint8_t frame[1514];
+  memset(frame, 0, sizeof(frame));
+  memset(frame, 0xff, 6);
+  frame[12] = 0x08;
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < cycles; i++) {
+    /* dropped while the fifo is full */
+    rxMAC->packet_received(frame, sizeof(frame), 0);
+
+    top->clk = !top->clk;
+    main_time += clock_period / 2;
+    top->eval();
+
+    /* output frames are discarded */
+    top->m_axis_tready = 1;
+    rxMAC->step();
+
+    top->clk = !top->clk;
+    main_time += clock_period / 2;
+    top->eval();
+  }
+  std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+
+  printf("menshen_hw: cycles=%lu secs=%.2f cycles_per_s=%.0f\n", cycles,
+         secs.count(), cycles / secs.count());
+  top->final();
+  delete rxMAC;
+  delete top;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  signal(SIGINT, sigint_handler);
+  signal(SIGUSR1, sigusr1_handler);
+
+  char *vargs[2] = {argv[0], NULL};
+  Verilated::commandArgs(1, vargs);
+  if (argc == 3 && !strcmp(argv[1], "--bench"))
+    return bench_main(strtoull(argv[2], NULL, 0));
+  const char *trace_spec = getenv("MENSHEN_TRACE");
+  if (trace_spec) {
+    if (trace_config(trace_spec))
+      return EXIT_FAILURE;
+    Verilated::traceEverOn(true);
+  }
+  Vrmt_wrapper *top = create_model();
 
   dump_if(top);
 
@@ -346,12 +513,8 @@ int main(int argc, char *argv[]) {
   txMAC = new EthernetTx(*top);
   rxMAC = new EthernetRx(*top);
 
-#ifdef TRACE_ENABLED
-  VerilatedFstC *trace = nullptr;
-  trace = new VerilatedFstC;
-  top->trace(trace, 99);
-  trace->open("debug.fst");
-#endif
+  if (trace_spec)
+    trace_open(top);
   while (!exiting) {
     // Sync all interfaces
     for (auto port : ports)
@@ -363,9 +526,8 @@ int main(int argc, char *argv[]) {
     top->clk = !top->clk;
     main_time += clock_period / 2;
     top->eval();
-#ifdef TRACE_ENABLED
-    trace->dump(main_time);
-#endif
+    if (main_time >= trace_next)
+      trace_step();
 
     txMAC->step();
     rxMAC->step();
@@ -374,14 +536,15 @@ int main(int argc, char *argv[]) {
     top->clk = !top->clk;
     main_time += clock_period / 2;
     top->eval();
-#ifdef TRACE_ENABLED
-    trace->dump(main_time);
-#endif
+    if (main_time >= trace_next)
+      trace_step();
   }
 
-#ifdef TRACE_ENABLED
-  trace->close();
-#endif
+  if (trace) {
+    if (tracing)
+      trace->dump(main_time + 1);
+    trace->close();
+  }
   dump_if(top);
 
   return 0;
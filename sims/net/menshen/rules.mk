@@ -28,6 +28,7 @@ bin_menshen := $(d)menshen_hw
 verilator_dir_menshen := $(d)obj_dir
 verilator_src_menshen := $(verilator_dir_menshen)/Vrmt_wrapper.cpp
 verilator_bin_menshen := $(verilator_dir_menshen)/Vrmt_wrapper
+verilator_cfg_menshen := $(verilator_dir_menshen)/.model_config
 
 vsrcs_menshen := $(wildcard $(d)rtl/*.v $(d)lib/*/rtl/*.v \
     $(d)lib/*/lib/*/rtl/*.v)
@@ -36,9 +37,14 @@ OBJS := $(srcs_menshen:.cc=.o)
 
 #$(OBJS): CPPFLAGS := $(CPPFLAGS) -I$(d)include/
 
-$(verilator_src_menshen): $(vsrcs_menshen)
-	$(VERILATOR) $(VFLAGS) --cc -O3 \
-	    -CFLAGS "-I$(abspath $(lib_dir)) -iquote $(abspath $(base_dir)) -O3 -g -Wall -Wno-maybe-uninitialized -fno-var-tracking-assignments" \
+# rewritten only when the model build settings change
+$(verilator_cfg_menshen): FORCE
+	@mkdir -p $(@D)
+	@echo '$(VMODEL_CONFIG)' | cmp -s - $@ || echo '$(VMODEL_CONFIG)' > $@
+
+$(verilator_src_menshen): $(vsrcs_menshen) $(verilator_cfg_menshen)
+	$(VERILATOR) $(VFLAGS) $(VFLAGS_MODEL) --cc -O3 \
+	    -CFLAGS "-I$(abspath $(lib_dir)) -iquote $(abspath $(base_dir)) -O3 -g -Wall -Wno-maybe-uninitialized -fno-var-tracking-assignments $(VCFLAGS_MODEL)" \
 	    --Mdir $(verilator_dir_menshen) \
 	    -y $(dir_menshen)rtl -y $(dir_menshen)rtl/extract \
 	    -y $(dir_menshen)rtl/action  -y $(dir_menshen)rtl/lookup -y $(dir_menshen)lib \
@@ -54,5 +60,6 @@ $(bin_menshen): $(verilator_bin_menshen)
 CLEAN := $(bin_menshen) $(verilator_dir_menshen) $(OBJS)
 ifeq ($(ENABLE_VERILATOR),y)
 ALL := $(bin_menshen)
+VBENCH_ALL += $(bin_menshen)
 endif
 include mk/subdir_post.mk
@@ -49,7 +49,7 @@ extern "C" {
 
 struct SimbricksBaseIfParams netParams;
 static pcap_dumper_t *dumpfile = nullptr;
-#define PKT_LEN 1500                                           // byte
+static size_t pkt_len = 1500;                                  // byte
 static uint64_t bit_rate = 100 * 1000ULL * 1000ULL * 1000ULL;  // 100 Gbps
 static uint64_t target_tick = 1 * 1000ULL * 1000ULL * 1000ULL * 1000ULL;  // 1s
 static uint64_t last_pkt_sent = 0;
@@ -57,8 +57,8 @@ static uint64_t pkt_recv_num = 0;
 static uint64_t pkt_recv_byte = 0;
 static uint64_t pkt_tx_num = 0;
 static uint64_t pkt_tx_byte = 0;
-static uint64_t period = (1E12 * 8 * PKT_LEN) / bit_rate;  // per packet
-static uint8_t packet[PKT_LEN];
+static uint64_t period;  // per packet
+static uint8_t packet[SIMBRICKS_NET_MAX_FRAME_JUMBO];
 
 #ifdef NETSWITCH_STAT
 #endif
@@ -202,6 +202,9 @@ class NetPort : public Port {
   }
 
   bool TxPacket(const void *data, size_t len, uint64_t cur_ts) override {
+    if (len > SimbricksNetIfOutMaxFrame(netif_))
+      return false;
+
     volatile union SimbricksProtoNetMsg *msg_to =
         SimbricksNetIfOutAlloc(netif_, cur_ts);
     if (!msg_to && !sync_) {
@@ -385,13 +388,13 @@ static void sendq(Port &port, size_t iport) {
   // then send
   if (port.IsSync()) {
     while ((last_pkt_sent + period) <= cur_ts) {
-      port.TxPacket(packet, PKT_LEN, last_pkt_sent + period);
+      port.TxPacket(packet, pkt_len, last_pkt_sent + period);
       last_pkt_sent += period;
       pkt_tx_num++;
-      pkt_tx_byte += PKT_LEN;
+      pkt_tx_byte += pkt_len;
     }
   } else {
-    port.TxPacket(packet, PKT_LEN, last_pkt_sent + period);
+    port.TxPacket(packet, pkt_len, last_pkt_sent + period);
   }
   // if not sync: send packet
   // else: send packet periodically until allowed time
@@ -412,7 +415,7 @@ int main(int argc, char *argv[]) {
   SimbricksNetIfDefaultParams(&netParams);
 
   // Parse command line argument
-  while ((c = getopt(argc, argv, "s:h:uS:E:p:n:b:")) != -1 && !bad_option) {
+  while ((c = getopt(argc, argv, "s:h:uS:E:p:n:b:l:")) != -1 && !bad_option) {
     switch (c) {
       case 's': {
         NetPort *port = new NetPort;
@@ -467,15 +470,22 @@ int main(int argc, char *argv[]) {
       case 'b':
         brate = strtol(optarg, NULL, 0);
         fprintf(stderr, "bit rate set to: %d Gbps\n", brate);
-        if (brate == 0) {
-          period = ULLONG_MAX;
-        } else {
-          bit_rate = brate * 1000ULL * 1000ULL * 1000ULL;
-          period = (1E12 * 8 * PKT_LEN) / bit_rate;  // per packet
-        }
+        bit_rate = brate * 1000ULL * 1000ULL * 1000ULL;
         assert(brate < 200);
         break;
 
+      case 'l':
+        pkt_len = strtoull(optarg, NULL, 0);
+        if (pkt_len < 60 || pkt_len > SIMBRICKS_NET_MAX_FRAME_JUMBO) {
+          fprintf(stderr, "invalid packet length: %s\n", optarg);
+          bad_option = 1;
+          break;
+        }
+        // only affects the ports specified after this option
+        if (pkt_len > SIMBRICKS_NET_MAX_FRAME_DEFAULT)
+          SimbricksNetIfParamsMaxFrame(&netParams, pkt_len);
+        break;
+
       default:
         fprintf(stderr, "unknown option %c\n", c);
         bad_option = 1;
@@ -486,9 +496,11 @@ int main(int argc, char *argv[]) {
   if (ports.empty() || bad_option) {
     fprintf(stderr,
             "Usage: pktgen [-S SYNC-PERIOD] [-E ETH-LATENCY] "
-            "-s SOCKET-A [-s SOCKET-B ...] [-n my_num] [-b bitrate(GB)]\n");
+            "[-l PKT-LEN] -s SOCKET-A [-s SOCKET-B ...] [-n my_num] "
+            "[-b bitrate(GB)]\n");
     return EXIT_FAILURE;
   }
+  period = bit_rate ? (1E12 * 8 * pkt_len) / bit_rate : ULLONG_MAX;
 
   Port *pkt_port = ports.front();
   pkt_port->my_mac.addr[5] = my_num;
@@ -503,7 +515,7 @@ int main(int argc, char *argv[]) {
   mac_tmp->addr[5] = pkt_port->my_mac.addr[5];  // source mac
 
   int kk;
-  for (kk = 12; kk < PKT_LEN - 12; kk++) {
+  for (kk = 12; kk < (int)pkt_len - 12; kk++) {
     packet[kk] = 0xFF;
   }
 
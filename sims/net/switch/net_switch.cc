@@ -193,6 +193,10 @@ class NetPort {
   }
 
   bool TxPacket(const void *data, size_t len, uint64_t cur_ts) {
+    // the peer may have negotiated smaller messages than ours
+    if (len > SimbricksNetIfOutMaxFrame(&netif_))
+      return false;
+
     volatile union SimbricksProtoNetMsg *msg_to =
         SimbricksNetIfOutAlloc(&netif_, cur_ts);
     if (!msg_to && !sync_) {
@@ -410,7 +414,7 @@ int main(int argc, char *argv[]) {
   SimbricksNetIfDefaultParams(&netParams);
 
   // Parse command line argument
-  while ((c = getopt(argc, argv, "s:h:uS:E:p:")) != -1 && !bad_option) {
+  while ((c = getopt(argc, argv, "s:h:uS:E:p:J:")) != -1 && !bad_option) {
     switch (c) {
       case 's': {
         NetPort *port = new NetPort(optarg, sync_eth);
@@ -449,6 +453,17 @@ int main(int argc, char *argv[]) {
         dumpfile = pcap_dump_open(pc, optarg);
         break;
 
+      case 'J': {
+        unsigned long long max_frame = strtoull(optarg, NULL, 0);
+        if (max_frame < 64 || max_frame > UINT16_MAX) {
+          fprintf(stderr, "invalid maximal frame length: %s\n", optarg);
+          bad_option = 1;
+          break;
+        }
+        SimbricksNetIfParamsMaxFrame(&netParams, max_frame);
+        break;
+      }
+
       default:
         fprintf(stderr, "unknown option %c\n", c);
         bad_option = 1;
@@ -459,7 +474,7 @@ int main(int argc, char *argv[]) {
   if (ports.empty() || bad_option) {
     fprintf(stderr,
             "Usage: net_switch [-S SYNC-PERIOD] [-E ETH-LATENCY] "
-            "-s SOCKET-A [-s SOCKET-B ...]\n");
+            "[-J MAX-FRAME] -s SOCKET-A [-s SOCKET-B ...]\n");
     return EXIT_FAILURE;
   }
 
@@ -76,6 +76,13 @@ static void move_pkt(struct SimbricksNetIf *from, struct SimbricksNetIf *to) {
       pcap_dump((unsigned char *)dumpfile, &ph, (unsigned char *)tx->data);
     }
 
+    // both ends negotiate their message sizes, they might differ
+    if (tx->len > SimbricksNetIfOutMaxFrame(to)) {
+      fprintf(stderr, "move_pkt: dropping oversized packet (%u)\n", tx->len);
+      SimbricksNetIfInDone(from, msg_from);
+      return;
+    }
+
     msg_to = SimbricksNetIfOutAlloc(to, cur_ts);
     if (msg_to != NULL) {
       rx = &msg_to->packet;
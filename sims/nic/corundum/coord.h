@@ -128,6 +128,11 @@ class PCICoordinator {
     process();
   }
 
+  /* no operations waiting to be issued to the host */
+  bool idle() const {
+    return queue.empty();
+  }
+
   void mmio_comp_enqueue(MMIOOp *mmio_op) {
 #ifdef COORD_DEBUG
     std::cout << main_time << " enqueuing MMIO comp " << mmio_op << std::endl;
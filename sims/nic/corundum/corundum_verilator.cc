@@ -22,15 +22,16 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <pthread.h>
 #include <signal.h>
 #include <verilated.h>
+#include <verilated_fst_c.h>
 
+#include <algorithm>
+#include <chrono>
 #include <deque>
 #include <iostream>
 #include <set>
-#ifdef TRACE_ENABLED
-#include <verilated_vcd_c.h>
-#endif
 
 #include <simbricks/base/cxxatomicfix.h>
 extern "C" {
@@ -47,15 +48,30 @@ extern "C" {
 struct DMAOp;
 
 static uint64_t clock_period = 4 * 1000ULL;  // 4ns -> 250MHz
+/* cycles the design has to be quiescent before time is skipped, 0 (the
+ * default) simulates every cycle */
+static uint64_t idle_cycles = 0;
+static uint64_t skipped_cycles = 0;
 
 static volatile int exiting = 0;
 uint64_t main_time = 0;
 static struct SimbricksNicIf nicif;
 static bool pci_terminated = false;
 
-#ifdef TRACE_ENABLED
-static VerilatedVcdC *trace;
-#endif
+/* Waveform tracing is configured with CORUNDUM_TRACE (see trace_config) and
+ * toggled with SIGUSR1. The main loop only compares main_time to trace_next
+ * after each eval, trace_step does everything else. */
+static VerilatedFstC *trace = nullptr;
+static const char *trace_file;
+static bool tracing = false;
+static volatile uint64_t trace_next = UINT64_MAX;
+static volatile sig_atomic_t trace_toggle = 0;
+static uint64_t trace_start = 0;
+static uint64_t trace_end = UINT64_MAX;
+static uint64_t trace_len = UINT64_MAX;
+static uint64_t trace_stop_at;
+static uint64_t trace_pkts = 0;
+static uint64_t packets = 0;
 
 static volatile union SimbricksProtoPcieD2H *d2h_alloc(void);
 
@@ -64,13 +80,107 @@ static void sigint_handler(int dummy) {
 }
 
 static void sigusr1_handler(int dummy) {
-  fprintf(stderr, "main_time = %lu\n", main_time);
+  fprintf(stderr, "main_time = %lu skipped_cycles = %lu\n", main_time,
+          skipped_cycles);
+  if (trace) {
+    trace_toggle = 1;
+    trace_next = 0;
+  }
 }
 
 double sc_time_stamp() {
   return main_time;
 }
 
+/* parse FILE[,start=NS][,end=NS][,len=NS][,pkts=N][,signal]: trace to FILE
+ * once start is reached and pkts frames have been sent or received, for len
+ * but at most until end. signal disables this automatic start, SIGUSR1 turns
+ * tracing on and off in any case. */
+static int trace_config(const char *spec) {
+  char *s = strdup(spec);
+  char *save;
+  for (char *opt = strtok_r(s, ",", &save); opt;
+       opt = strtok_r(NULL, ",", &save)) {
+    if (!strncmp(opt, "start=", 6)) {
+      trace_start = strtoull(opt + 6, NULL, 0) * 1000ULL;
+    } else if (!strncmp(opt, "end=", 4)) {
+      trace_end = strtoull(opt + 4, NULL, 0) * 1000ULL;
+    } else if (!strncmp(opt, "len=", 4)) {
+      trace_len = strtoull(opt + 4, NULL, 0) * 1000ULL;
+    } else if (!strncmp(opt, "pkts=", 5)) {
+      trace_pkts = strtoull(opt + 5, NULL, 0);
+    } else if (!strcmp(opt, "signal")) {
+      trace_start = UINT64_MAX;
+    } else if (opt == s && !strchr(opt, '=')) {
+      trace_file = opt;
+    } else {
+      fprintf(stderr, "trace_config: invalid option '%s'\n", opt);
+      return -1;
+    }
+  }
+  if (!trace_file) {
+    fprintf(stderr, "trace_config: no trace file in '%s'\n", spec);
+    return -1;
+  }
+  return 0;
+}
+
+static void trace_open(Vinterface *top) {
+  trace = new VerilatedFstC;
+  top->trace(trace, 99);
+  trace->open(trace_file);
+  trace_next = 0;
+}
+
+static void trace_begin(uint64_t stop_at) {
+  fprintf(stderr, "trace: start main_time = %lu\n", main_time);
+  tracing = true;
+  trace_stop_at = stop_at;
+}
+
+static void trace_stop() {
+  fprintf(stderr, "trace: stop main_time = %lu\n", main_time);
+  tracing = false;
+  trace->flush();
+}
+
+/* called once main_time reaches trace_next: starts or stops tracing and dumps
+ * the model state while it is on */
+static void trace_step() {
+  if (trace_toggle) {
+    trace_toggle = 0;
+    if (tracing)
+      trace_stop();
+    else
+      trace_begin(UINT64_MAX);
+  } else if (!tracing && main_time >= trace_start && packets >= trace_pkts) {
+    /* the automatic start only happens once */
+    trace_start = UINT64_MAX;
+    trace_begin(main_time < trace_end && trace_len < trace_end - main_time
+                    ? main_time + trace_len
+                    : trace_end);
+  } else if (tracing && main_time >= trace_stop_at) {
+    trace_stop();
+  }
+
+  if (tracing) {
+    trace->dump(main_time);
+    trace_next = 0;
+  } else if (packets < trace_pkts)
+    trace_next = UINT64_MAX;  // re-armed by trace_packet
+  else
+    trace_next = trace_start;
+  /* SIGUSR1 raised in the meantime */
+  if (trace_toggle)
+    trace_next = 0;
+}
+
+/* count a frame sent or received for the pkts trigger */
+static void trace_packet() {
+  if (++packets == trace_pkts)
+    trace_next = 0;
+}
+
 static void reset_inputs(Vinterface *top) {
   top->clk = 0;
   top->rst = 0;
@@ -326,6 +436,10 @@ class MMIOInterface {
     }
   }
 
+  bool idle() const {
+    return !rCur && !wCur && queue.empty();
+  }
+
   void issueRead(uint64_t id, uint64_t addr, size_t len) {
     MMIOOp *op = new MMIOOp;
 #ifdef MMIO_DEBUG
@@ -608,6 +722,7 @@ class EthernetTx {
     packet->len = packet_len;
 
     SimbricksNetIfOutSend(&nicif.net, msg, SIMBRICKS_PROTO_NET_MSG_PACKET);
+    trace_packet();
 
 #ifdef ETH_DEBUG
     std::cerr << main_time << " EthernetTx: packet len=" << std::hex
@@ -619,6 +734,10 @@ class EthernetTx {
 #endif
   }
 
+  bool idle() const {
+    return packet_len == 0;
+  }
+
   void step() {
     top.tx_axis_tready = 1;
 
@@ -669,6 +788,7 @@ class EthernetRx {
 
     memcpy(fifo_bufs[fifo_pos_wr], data, len);
     fifo_lens[fifo_pos_wr] = len;
+    trace_packet();
 
 #ifdef ETH_DEBUG
     std::cout << main_time << " rx into " << fifo_pos_wr << std::endl;
@@ -683,6 +803,10 @@ class EthernetRx {
     fifo_pos_wr = (fifo_pos_wr + 1) % FIFO_SIZE;
   }
 
+  bool idle() const {
+    return fifo_lens[fifo_pos_rd] == 0;
+  }
+
   void step() {
     if (fifo_lens[fifo_pos_rd] != 0) {
       // we have data to send
@@ -724,7 +848,6 @@ class EthernetRx {
         top.rx_axis_tvalid = 1;
         top.rx_axis_tlast = (packet_off == fifo_lens[fifo_pos_rd]);
       }
-      //  trace->dump(main_time);
     } else {
       // no data
       top.rx_axis_tvalid = 0;
@@ -797,23 +920,121 @@ static void msi_step(Vinterface &top, PCICoordinator &coord) {
   }
 }
 
+/* no handshake or interrupt is active on any interface of the design */
+static bool rtl_idle(Vinterface &top) {
+  return !top.m_axis_ctrl_dma_read_desc_valid &&
+         !top.s_axis_ctrl_dma_read_desc_status_valid &&
+         !top.m_axis_ctrl_dma_write_desc_valid &&
+         !top.s_axis_ctrl_dma_write_desc_status_valid &&
+         !top.m_axis_data_dma_read_desc_valid &&
+         !top.s_axis_data_dma_read_desc_status_valid &&
+         !top.m_axis_data_dma_write_desc_valid &&
+         !top.s_axis_data_dma_write_desc_status_valid &&
+         !top.s_axil_awvalid && !top.s_axil_wvalid && !top.s_axil_bvalid &&
+         !top.s_axil_arvalid && !top.s_axil_rvalid &&
+         !top.m_axil_csr_awvalid && !top.m_axil_csr_wvalid &&
+         !top.m_axil_csr_arvalid && !top.ctrl_dma_ram_wr_cmd_valid &&
+         !top.ctrl_dma_ram_rd_cmd_valid && !top.ctrl_dma_ram_rd_resp_valid &&
+         !top.data_dma_ram_wr_cmd_valid && !top.data_dma_ram_rd_cmd_valid &&
+         !top.data_dma_ram_rd_resp_valid && !top.tx_axis_tvalid &&
+         !top.rx_axis_tvalid && !top.msi_irq;
+}
+
+/* earliest time a message arrives or a sync message is due, UINT64_MAX if
+ * neither interface is synchronized */
+static uint64_t next_input_time(bool sync_pci, bool sync_eth) {
+  uint64_t next = UINT64_MAX;
+  if (sync_pci) {
+    next = std::min(next, SimbricksPcieIfH2DInTimestamp(&nicif.pcie));
+    next = std::min(next, SimbricksPcieIfD2HOutNextSync(&nicif.pcie));
+  }
+  if (sync_eth) {
+    next = std::min(next, SimbricksNetIfInTimestamp(&nicif.net));
+    next = std::min(next, SimbricksNetIfOutNextSync(&nicif.net));
+  }
+  return next;
+}
+
+/* The worker threads of a multithreaded model start with the model and
+ * inherit our signal mask, block the signals meanwhile so only the main
+ * thread handles them. The workers only run inside eval(), all other state is
+ * accessed by the main thread alone. */
+static Vinterface *create_model() {
+  sigset_t set, old;
+  sigemptyset(&set);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &set, &old);
+  Vinterface *top = new Vinterface;
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  return top;
+}
+
+/* clock the model on its own with a stream of rx frames and report the
+ * simulation speed */
+static int bench_main(uint64_t cycles) {
+  Vinterface *top = create_model();
+  EthernetRx rx(*top);
+  uint8_t frame[1514];
+  memset(frame, 0, sizeof(frame));
+  memset(frame, 0xff, 6);
+  frame[12] = 0x08;
+
+  reset_inputs(top);
+  top->rst = 1;
+  top->eval();
+  top->clk = !top->clk;
+  top->eval();
+  top->rst = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < cycles; i++) {
+    /* dropped while the fifo is full */
+    rx.packet_received(frame, sizeof(frame));
+
+    top->clk = !top->clk;
+    main_time += clock_period / 2;
+    top->eval();
+
+    top->tx_axis_tready = 1;
+    rx.step();
+
+    top->clk = !top->clk;
+    main_time += clock_period / 2;
+    top->eval();
+  }
+  std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+
+  printf("corundum_verilator: cycles=%lu secs=%.2f cycles_per_s=%.0f\n",
+         cycles, secs.count(), cycles / secs.count());
+  top->final();
+  delete top;
+  return 0;
+}
+
 int main(int argc, char *argv[]) {
   char *vargs[2] = {argv[0], NULL};
   Verilated::commandArgs(1, vargs);
   struct SimbricksBaseIfParams netParams;
   struct SimbricksBaseIfParams pcieParams;
-#ifdef TRACE_ENABLED
-  Verilated::traceEverOn(true);
-#endif
+  const char *trace_spec = getenv("CORUNDUM_TRACE");
+  if (trace_spec) {
+    if (trace_config(trace_spec))
+      return EXIT_FAILURE;
+    Verilated::traceEverOn(true);
+  }
 
   SimbricksNetIfDefaultParams(&netParams);
   SimbricksPcieIfDefaultParams(&pcieParams);
 
-  if (argc < 4 && argc > 10) {
+  if (argc == 3 && !strcmp(argv[1], "--bench"))
+    return bench_main(strtoull(argv[2], NULL, 0));
+  if (argc < 4 || argc > 11) {
     fprintf(stderr,
             "Usage: corundum_verilator PCI-SOCKET ETH-SOCKET "
             "SHM [SYNC-MODE] [START-TICK] [SYNC-PERIOD] [PCI-LATENCY] "
-            "[ETH-LATENCY] [CLOCK-FREQ-MHZ]\n");
+            "[ETH-LATENCY] [CLOCK-FREQ-MHZ] [IDLE-CYCLES]\n"
+            "       corundum_verilator --bench CYCLES\n");
     return EXIT_FAILURE;
   }
   if (argc >= 6)
@@ -827,6 +1048,8 @@ int main(int argc, char *argv[]) {
     netParams.link_latency = strtoull(argv[8], NULL, 0) * 1000ULL;
   if (argc >= 10)
     clock_period = 1000000ULL / strtoull(argv[9], NULL, 0);
+  if (argc >= 11)
+    idle_cycles = strtoull(argv[10], NULL, 0);
 
   struct SimbricksProtoPcieDevIntro di;
   memset(&di, 0, sizeof(di));
@@ -854,12 +1077,9 @@ int main(int argc, char *argv[]) {
   signal(SIGINT, sigint_handler);
   signal(SIGUSR1, sigusr1_handler);
 
-  Vinterface *top = new Vinterface;
-#ifdef TRACE_ENABLED
-  trace = new VerilatedVcdC;
-  top->trace(trace, 99);
-  trace->open("debug.vcd");
-#endif
+  Vinterface *top = create_model();
+  if (trace_spec)
+    trace_open(top);
 
   MemWritePort p_mem_write_ctrl_dma(
       top->ctrl_dma_ram_wr_cmd_sel, top->ctrl_dma_ram_wr_cmd_be,
@@ -953,6 +1173,7 @@ int main(int argc, char *argv[]) {
 
   top->rst = 0;
 
+  uint64_t idle_streak = 0;
   while (!exiting) {
     int done;
     do {
@@ -982,6 +1203,8 @@ int main(int argc, char *argv[]) {
     top->clk = !top->clk;
     main_time += clock_period / 2;
     top->eval();
+    if (main_time >= trace_next)
+      trace_step();
 
     mmio.step();
 
@@ -1009,14 +1232,46 @@ int main(int argc, char *argv[]) {
     top->s_axis_rx_ptp_ts_valid = 1;
 
     top->eval();
+    if (main_time >= trace_next)
+      trace_step();
+
+    /* With IDLE-CYCLES set, once the design and our side of all its
+     * interfaces have been quiet for that many cycles, nothing changes until
+     * the next message from a peer arrives or a sync message is due, so
+     * whole clock cycles up to that point are skipped. Skipping stops short
+     * of a pending trace start, and does not happen at all while tracing. */
+    if (idle_cycles) {
+      if (rtl_idle(*top) && mmio.idle() && dma_read_ctrl.idle() &&
+          dma_write_ctrl.idle() && dma_read_data.idle() &&
+          dma_write_data.idle() && mem_control_writer.idle() &&
+          mem_control_reader.idle() && mem_data_writer.idle() &&
+          mem_data_reader.idle() && tx.idle() && rx.idle() &&
+          pci_coord_mmio.idle() && pci_coord_msi.idle() &&
+          pci_coord_rc.idle() && pci_coord_wc.idle() && pci_coord_rd.idle() &&
+          pci_coord_wd.idle())
+        idle_streak++;
+      else
+        idle_streak = 0;
+
+      uint64_t next = std::min(next_input_time(sync_pci, sync_eth),
+                               (uint64_t)trace_next);
+      if (idle_streak >= idle_cycles && next != UINT64_MAX &&
+          next > main_time) {
+        uint64_t n = (next - main_time) / clock_period;
+        main_time += n * clock_period;
+        skipped_cycles += n;
+      }
+    }
   }
   report_outputs(top);
   std::cout << std::endl << std::endl << "main_time:" << main_time << std::endl;
+  std::cout << "skipped_cycles:" << skipped_cycles << std::endl;
 
-#ifdef TRACE_ENABLED
-  trace->dump(main_time + 1);
-  trace->close();
-#endif
+  if (trace) {
+    if (tracing)
+      trace->dump(main_time + 1);
+    trace->close();
+  }
   top->final();
   delete top;
   return 0;
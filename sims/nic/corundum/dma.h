@@ -110,6 +110,10 @@ class DMAReader : public DMAEngine {
   virtual void pci_op_complete(DMAOp *op);
   virtual void mem_op_complete(DMAOp *op);
   void step();
+  /* no status to report, operations may still be in flight on PCIe */
+  bool idle() const {
+    return completed.empty();
+  }
 };
 
 class DMAWriter : public DMAEngine {
@@ -128,6 +132,10 @@ class DMAWriter : public DMAEngine {
   virtual void pci_op_complete(DMAOp *op);
   virtual void mem_op_complete(DMAOp *op);
   void step();
+  /* no status to report, operations may still be in flight on PCIe */
+  bool idle() const {
+    return completed.empty();
+  }
 };
 
 #endif  // DMA_H_
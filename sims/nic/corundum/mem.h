@@ -96,6 +96,9 @@ class MemReader {
 
   void step();
   void op_issue(DMAOp *op);
+  bool idle() const {
+    return !cur && pending.empty();
+  }
 };
 
 class MemWriter {
@@ -112,6 +115,9 @@ class MemWriter {
 
   void step();
   void op_issue(DMAOp *op);
+  bool idle() const {
+    return !cur && pending.empty();
+  }
 };
 
 #endif  // MEM_H_
@@ -28,6 +28,7 @@ bin_corundum := $(d)corundum_verilator
 verilator_dir_corundum := $(d)obj_dir
 verilator_src_corundum := $(verilator_dir_corundum)/Vinterface.cpp
 verilator_bin_corundum := $(verilator_dir_corundum)/Vinterface
+verilator_cfg_corundum := $(verilator_dir_corundum)/.model_config
 
 vsrcs_corundum := $(wildcard $(d)rtl/*.v $(d)lib/*/rtl/*.v \
     $(d)lib/*/lib/*/rtl/*.v)
@@ -36,9 +37,14 @@ OBJS := $(srcs_corundum:.cc=.o)
 
 $(OBJS): CPPFLAGS := $(CPPFLAGS) -I$(d)include/
 
-$(verilator_src_corundum): $(vsrcs_corundum)
-	$(VERILATOR) $(VFLAGS) --cc -O3 \
-	    -CFLAGS "-I$(abspath $(lib_dir)) -iquote $(abspath $(base_dir)) -O3 -g -Wall -Wno-maybe-uninitialized" \
+# rewritten only when the model build settings change
+$(verilator_cfg_corundum): FORCE
+	@mkdir -p $(@D)
+	@echo '$(VMODEL_CONFIG)' | cmp -s - $@ || echo '$(VMODEL_CONFIG)' > $@
+
+$(verilator_src_corundum): $(vsrcs_corundum) $(verilator_cfg_corundum)
+	$(VERILATOR) $(VFLAGS) $(VFLAGS_MODEL) --cc -O3 \
+	    -CFLAGS "-I$(abspath $(lib_dir)) -iquote $(abspath $(base_dir)) -O3 -g -Wall -Wno-maybe-uninitialized $(VCFLAGS_MODEL)" \
 	    --Mdir $(verilator_dir_corundum) \
 	    -y $(dir_corundum)rtl \
 	    -y $(dir_corundum)lib/axi/rtl \
@@ -58,5 +64,6 @@ CLEAN := $(bin_corundum) $(verilator_dir_corundum) $(OBJS)
 
 ifeq ($(ENABLE_VERILATOR),y)
 ALL := $(bin_corundum)
+VBENCH_ALL += $(bin_corundum)
 endif
 include mk/subdir_post.mk
@@ -31,6 +31,7 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
 
 // #define DEBUG 1
@@ -40,6 +41,50 @@ static nicbm::Runner *runner;
 
 namespace corundum {
 
+BatchConfig::BatchConfig() : descs(32), cpls(32) {
+}
+
+bool BatchConfig::Parse(const char *str) {
+  char *end;
+  unsigned long d = strtoul(str, &end, 10);
+  if (*end != ':' || d == 0 || d > MAX_DMA_LEN / DESC_SIZE)
+    return false;
+  unsigned long c = strtoul(end + 1, &end, 10);
+  if (*end || c == 0 || c > MAX_DMA_LEN / CPL_SIZE)
+    return false;
+
+  descs = d;
+  cpls = c;
+  return true;
+}
+
+SchedConfig::SchedConfig() : rate(0) {
+  for (unsigned i = 0; i < NUM_QUEUES; i++)
+    weights[i] = 1;
+}
+
+bool SchedConfig::Parse(const char *str) {
+  char *end;
+  unsigned long long mbps = strtoull(str, &end, 10);
+  if (end == str || (*end && *end != ':'))
+    return false;
+
+  unsigned w[NUM_QUEUES];
+  for (unsigned i = 0; i < NUM_QUEUES; i++)
+    w[i] = 1;
+  for (unsigned i = 0; *end; i++) {
+    const char *s = end + 1;
+    unsigned long v = strtoul(s, &end, 10);
+    if (end == s || v == 0 || i >= NUM_QUEUES || (*end && *end != ','))
+      return false;
+    w[i] = v;
+  }
+
+  rate = mbps * 1000000ULL;
+  memcpy(weights, w, sizeof(weights));
+  return true;
+}
+
 DescRing::DescRing()
     : _dmaAddr(0),
       _sizeLog(0),
@@ -51,7 +96,8 @@ DescRing::DescRing()
       _currHead(0),
       _currTail(0),
       active(false),
-      armed(false) {
+      armed(false),
+      _batch(1) {
 }
 
 DescRing::~DescRing() {
@@ -77,6 +123,10 @@ ptr_t DescRing::tailPtr() {
   return this->_tailPtr;
 }
 
+bool DescRing::isActive() {
+  return this->active;
+}
+
 void DescRing::setDMALower(uint32_t addr) {
   this->_dmaAddr &= 0xFFFFFFFF00000000;
   this->_dmaAddr |= (addr_t)addr;
@@ -116,6 +166,10 @@ void DescRing::setTailPtr(ptr_t ptr) {
   this->_tailPtr = ptr;
 }
 
+void DescRing::setBatch(size_t batch) {
+  this->_batch = batch;
+}
+
 bool DescRing::empty() {
   return (this->_headPtr == this->_currTail);
 }
@@ -124,7 +178,17 @@ bool DescRing::full() {
   return (this->_currHead - this->_tailPtr >= (int)this->_size);
 }
 
-bool DescRing::updatePtr(ptr_t ptr, bool head) {
+size_t DescRing::batchLen(ptr_t ptr, size_t avail) {
+  /* batches end at the ring wrap */
+  size_t to_wrap = this->_size - (ptr & this->_sizeMask);
+  return std::min(std::min(avail, this->_batch), to_wrap);
+}
+
+bool DescRing::updatePtr(ptr_t ptr, bool head, size_t cnt) {
+  /* the loop below picks up entries after the first */
+  for (size_t i = 1; i < cnt; i++)
+    this->cplDma[(ptr + i) & this->_sizeMask] = true;
+
   ptr_t curr_ptr = head ? this->_headPtr : this->_tailPtr;
   if (ptr != curr_ptr) {
     // out of order completion
@@ -148,7 +212,7 @@ bool DescRing::updatePtr(ptr_t ptr, bool head) {
   return true;
 }
 
-EventRing::EventRing() {
+EventRing::EventRing(nicbm::IntModerator *intMod) : intMod(intMod) {
 }
 
 EventRing::~EventRing() {
@@ -159,7 +223,7 @@ void EventRing::dmaDone(DMAOp *op) {
   switch (op->type) {
     case DMA_TYPE_EVENT:
       if (updatePtr((ptr_t)op->tag, true)) {
-        runner->MsiIssue(0);
+        this->intMod->Event(this->_index % MSI_VECS);
       }
       delete op;
       break;
@@ -204,23 +268,33 @@ void EventRing::issueEvent(unsigned type, unsigned source) {
 #endif
 }
 
-CplRing::CplRing(EventRing *eventRing) : eventRing(eventRing) {
+CplRing::CplRing(EventRing **eventRings, unsigned id)
+    : eventRings(eventRings), id(id), writing(false) {
 }
 
 CplRing::~CplRing() {
 }
 
+void CplRing::setTailPtr(ptr_t ptr) {
+  DescRing::setTailPtr(ptr);
+  /* completions may be waiting for space in the ring */
+  flush();
+}
+
 void CplRing::dmaDone(DMAOp *op) {
   assert(op->write_);
   switch (op->type) {
     case DMA_TYPE_TX_CPL:
     case DMA_TYPE_RX_CPL: {
-      if (updatePtr((ptr_t)op->tag, true)) {
+      /* one event for the whole batch */
+      if (updatePtr((ptr_t)op->tag, true, op->len_ / CPL_SIZE)) {
         unsigned type =
             op->type == DMA_TYPE_TX_CPL ? EVENT_TYPE_TX_CPL : EVENT_TYPE_RX_CPL;
-        this->eventRing->issueEvent(type, 0);
+        this->eventRings[this->_index % NUM_QUEUES]->issueEvent(type, this->id);
       }
       delete op;
+      this->writing = false;
+      flush();
       break;
     }
     default:
@@ -229,35 +303,60 @@ void CplRing::dmaDone(DMAOp *op) {
   }
 }
 
-void CplRing::complete(unsigned index, size_t len, bool tx) {
+void CplRing::complete(unsigned queue, unsigned index, size_t len, bool tx) {
   CplData data;
+  data.queue = queue;
   data.index = index;
   data.len = len;
   data.tx = tx;
   this->pending.push_back(data);
-  while (!full() && !this->pending.empty()) {
+  flush();
+}
+
+void CplRing::flush() {
+  /* completions arriving while a write is in flight go into the next batch */
+  if (this->writing || this->pending.empty() || full())
+    return;
+
+  size_t space = this->_size - (ptr_t)(this->_currHead - this->_tailPtr);
+  size_t n = batchLen(this->_currHead, std::min(space, this->pending.size()));
+  bool tx = this->pending.front().tx;
+  addr_t dma_addr =
+      this->_dmaAddr + (this->_currHead & this->_sizeMask) * CPL_SIZE;
+  /* Issue DMA write */
+  DMAOp *op = new DMAOp;
+  op->type = tx ? DMA_TYPE_TX_CPL : DMA_TYPE_RX_CPL;
+  op->dma_addr_ = dma_addr;
+  op->ring = this;
+  op->tag = this->_currHead;
+  op->write_ = true;
+  Cpl *cpl = (Cpl *)op->data_;
+  memset(cpl, 0, n * sizeof(Cpl));
+  size_t i;
+  for (i = 0; i < n && this->pending.front().tx == tx; i++) {
     CplData &data = this->pending.front();
-    addr_t dma_addr =
-        this->_dmaAddr + (this->_currHead & this->_sizeMask) * CPL_SIZE;
-    /* Issue DMA write */
-    DMAOp *op = new DMAOp;
-    op->type = data.tx ? DMA_TYPE_TX_CPL : DMA_TYPE_RX_CPL;
-    op->dma_addr_ = dma_addr;
-    op->len_ = CPL_SIZE;
-    op->ring = this;
-    op->tag = this->_currHead;
-    op->write_ = true;
-    Cpl *cpl = (Cpl *)op->data_;
-    memset(cpl, 0, sizeof(Cpl));
-    cpl->index = data.index;
-    cpl->len = data.len;
+    cpl[i].queue = data.queue;
+    cpl[i].index = data.index;
+    cpl[i].len = data.len;
     this->pending.pop_front();
-    runner->IssueDma(*op);
-    this->_currHead++;
   }
+  op->len_ = i * CPL_SIZE;
+#ifdef DEBUG
+  printf("corundum_bm: cpl ring issue dma addr %lx index %lu len %lu\n",
+         op->dma_addr_, op->tag, op->len_);
+#endif
+  runner->IssueDma(*op);
+  this->_currHead += i;
+  this->writing = true;
 }
 
-TxRing::TxRing(CplRing *cplRing) : txCplRing(cplRing) {
+TxRing::TxRing(CplRing **cplRings, Port *ports, TxScheduler *scheds,
+               unsigned id)
+    : txCplRings(cplRings),
+      ports(ports),
+      scheds(scheds),
+      id(id),
+      nextPort(0) {
 }
 
 TxRing::~TxRing() {
@@ -269,13 +368,15 @@ void TxRing::setHeadPtr(ptr_t ptr) {
 #endif
   DescRing::setHeadPtr(ptr);
   while (this->_currTail != this->_headPtr) {
+    size_t n =
+        batchLen(this->_currTail, (ptr_t)(this->_headPtr - this->_currTail));
     unsigned index = this->_currTail & this->_sizeMask;
     addr_t dma_addr = this->_dmaAddr + index * DESC_SIZE;
     /* Issue DMA read */
     DMAOp *op = new DMAOp;
     op->type = DMA_TYPE_DESC;
     op->dma_addr_ = dma_addr;
-    op->len_ = DESC_SIZE;
+    op->len_ = n * DESC_SIZE;
     op->ring = this;
     op->tag = this->_currTail;
     op->write_ = false;
@@ -284,65 +385,356 @@ void TxRing::setHeadPtr(ptr_t ptr) {
            op->dma_addr_, op->tag, op->len_);
 #endif
     runner->IssueDma(*op);
-    this->_currTail++;
+    this->_currTail += n;
+  }
+}
+
+void TxRing::fetchPayload(const Desc &desc, ptr_t ptr) {
+#ifdef DEBUG
+  printf("corundum_bm: tx dma desc done addr %lx index %u len %u\n",
+         desc.addr, ptr, desc.len);
+#endif
+  DMAOp *op = new DMAOp;
+  op->type = DMA_TYPE_MEM;
+  op->dma_addr_ = desc.addr;
+  op->len_ = std::min<size_t>(desc.len, MAX_FRAME_LEN);
+  op->ring = this;
+  op->tag = ptr;
+  op->write_ = false;
+  if (op->len_ > MAX_DMA_LEN) {
+    op->frame = new Frame;
+    op->data_ = op->frame->data;
   }
+  runner->IssueDma(*op);
 }
 
 void TxRing::dmaDone(DMAOp *op) {
   switch (op->type) {
     case DMA_TYPE_DESC: {
       assert(!op->write_);
-      Desc *desc = (Desc *)op->data_;
-#ifdef DEBUG
-      printf("corundum_bm: tx dma desc done addr %lx index %lu len %u\n",
-             desc->addr, op->tag, desc->len);
-#endif
-      op->type = DMA_TYPE_MEM;
-      op->dma_addr_ = desc->addr;
-      op->len_ = desc->len;
-      op->write_ = false;
-      runner->IssueDma(*op);
+      Desc *descs = (Desc *)op->data_;
+      for (size_t i = 0; i < op->len_ / DESC_SIZE; i++)
+        fetchPayload(descs[i], op->tag + i);
+      delete op;
       break;
     }
-    case DMA_TYPE_MEM:
+    case DMA_TYPE_MEM: {
       assert(!op->write_);
 #ifdef DEBUG
       printf("corundum_bm: tx dma memory done index %lu len %lu\n", op->tag,
              op->len_);
 #endif
-      runner->EthSend(op->data_, op->len_);
-      updatePtr((ptr_t)op->tag, false);
-      this->txCplRing->complete(op->tag, op->len_, true);
-      delete op;
+      /* completed once the port's scheduler sent the frame */
+      this->scheds[txPort()].enqueue(this->id, op);
       break;
+    }
     default:
       fprintf(stderr, "Unknown DMA type %d\n", op->type);
       abort();
   }
 }
 
-RxRing::RxRing(CplRing *cplRing) : rxCplRing(cplRing) {
+void TxRing::sent(DMAOp *op) {
+  updatePtr((ptr_t)op->tag, false);
+  this->txCplRings[this->_index % NUM_QUEUES]->complete(this->id, op->tag,
+                                                       op->len_, true);
+  delete op;
+}
+
+unsigned TxRing::txPort() {
+  /* all ports with an enabled scheduler pull from the queue, round robin */
+  unsigned n = runner->NumEthPorts();
+  for (unsigned i = 0; i < n; i++) {
+    unsigned p = (this->nextPort + i) % n;
+    if (this->ports[p].txEnabled()) {
+      this->nextPort = (p + 1) % n;
+      return p;
+    }
+  }
+  return 0;
+}
+
+/* preamble, start delimiter, FCS, and inter-frame gap on the wire */
+static const uint64_t kEthOverhead = 24;
+
+TxScheduler::TxScheduler()
+    : port(0),
+      queued(0),
+      current(0),
+      visiting(false),
+      linkFree(0),
+      armed(false),
+      started(false),
+      startTime(0),
+      busyTime(0),
+      oversizeDrops(0) {
+  for (Queue &q : this->queues) {
+    q.bytes = 0;
+    q.deficit = 0;
+    q.sent = 0;
+    q.sentBytes = 0;
+    q.maxFrames = 0;
+    q.maxBytes = 0;
+    q.frameTime = 0;
+    q.lastChange = 0;
+  }
+}
+
+TxScheduler::~TxScheduler() {
+  for (Queue &q : this->queues) {
+    for (DMAOp *op : q.frames)
+      delete op;
+  }
+}
+
+void TxScheduler::setPort(unsigned port) {
+  this->port = port;
+}
+
+void TxScheduler::setConfig(const SchedConfig &cfg) {
+  this->cfg = cfg;
+}
+
+void TxScheduler::account(Queue &q) {
+  uint64_t now = runner->TimePs();
+  q.frameTime += q.frames.size() * (now - q.lastChange);
+  q.lastChange = now;
+}
+
+void TxScheduler::enqueue(unsigned queue, DMAOp *op) {
+  if (!this->started) {
+    this->started = true;
+    this->startTime = runner->TimePs();
+    for (Queue &q : this->queues)
+      q.lastChange = this->startTime;
+  }
+
+  Queue &q = this->queues[queue];
+  account(q);
+  q.frames.push_back(op);
+  q.bytes += op->len_;
+  q.maxFrames = std::max(q.maxFrames, q.frames.size());
+  q.maxBytes = std::max(q.maxBytes, q.bytes);
+  this->queued++;
+  if (!this->armed)
+    run();
+}
+
+void TxScheduler::timed() {
+  this->armed = false;
+  run();
+}
+
+DMAOp *TxScheduler::dequeue() {
+  if (!this->queued)
+    return nullptr;
+
+  for (;;) {
+    Queue &q = this->queues[this->current];
+    if (!q.frames.empty()) {
+      if (!this->visiting) {
+        q.deficit += this->cfg.weights[this->current] * MAX_DMA_LEN;
+        this->visiting = true;
+      }
+      DMAOp *op = q.frames.front();
+      if (q.deficit >= op->len_) {
+        account(q);
+        q.frames.pop_front();
+        q.bytes -= op->len_;
+        q.deficit -= op->len_;
+        q.sent++;
+        q.sentBytes += op->len_;
+        this->queued--;
+        /* an idle queue does not save up credit */
+        if (q.frames.empty()) {
+          q.deficit = 0;
+          this->current = (this->current + 1) % NUM_QUEUES;
+          this->visiting = false;
+        }
+        return op;
+      }
+    } else {
+      q.deficit = 0;
+    }
+    this->current = (this->current + 1) % NUM_QUEUES;
+    this->visiting = false;
+  }
+}
+
+void TxScheduler::run() {
+  uint64_t now = runner->TimePs();
+  while (this->queued) {
+    if (this->cfg.rate && this->linkFree > now) {
+      if (!this->armed) {
+        this->time_ = this->linkFree;
+        this->armed = true;
+        runner->EventSchedule(*this);
+      }
+      return;
+    }
+
+    DMAOp *op = dequeue();
+    // frames that do not fit into a network message are dropped
+    if (op->len_ <= runner->EthSendMaxLen(this->port))
+      runner->EthSend(this->port, op->data_, op->len_);
+    else
+      this->oversizeDrops++;
+    if (this->cfg.rate) {
+      uint64_t ser =
+          (op->len_ + kEthOverhead) * 8 * 1000000000000ULL / this->cfg.rate;
+      this->linkFree = now + ser;
+      this->busyTime += ser;
+    }
+    static_cast<TxRing *>(op->ring)->sent(op);
+  }
+}
+
+void TxScheduler::printStats(FILE *f) {
+  uint64_t now = runner->TimePs();
+  uint64_t frames = 0;
+  for (Queue &q : this->queues)
+    frames += q.sent;
+  if (!frames)
+    return;
+
+  double elapsed = now - this->startTime;
+  fprintf(f,
+          "tx sched port %u: rate=%lu frames=%lu oversize_drops=%lu "
+          "link_busy=%.1f%%\n",
+          this->port, this->cfg.rate, frames, this->oversizeDrops,
+          elapsed > 0 ? 100. * this->busyTime / elapsed : 0.);
+  for (unsigned i = 0; i < NUM_QUEUES; i++) {
+    Queue &q = this->queues[i];
+    if (!q.sent)
+      continue;
+    account(q);
+    fprintf(f,
+            "  queue %u: weight=%u frames=%lu bytes=%lu max_frames=%zu "
+            "max_bytes=%zu avg_frames=%.2f\n",
+            i, this->cfg.weights[i], q.sent, q.sentBytes, q.maxFrames,
+            q.maxBytes, elapsed > 0 ? q.frameTime / elapsed : 0.);
+  }
+}
+
+RxFifo::RxFifo()
+    : frames(0),
+      bytes(0),
+      overflowDrops(0),
+      overflowBytes(0),
+      inactiveDrops(0),
+      oversizeDrops(0),
+      buf(nullptr),
+      capacity(0),
+      tail(0),
+      used(0),
+      maxUsed(0) {
+  setCapacity(RX_FIFO_SIZE);
+}
+
+RxFifo::~RxFifo() {
+  delete[] this->buf;
+}
+
+void RxFifo::setCapacity(size_t capacity) {
+  assert(this->entries.empty());
+  delete[] this->buf;
+  this->buf = new uint8_t[capacity];
+  this->capacity = capacity;
+  this->tail = 0;
+}
+
+uint8_t *RxFifo::alloc(size_t len) {
+  /* frames are contiguous, the space at the end is skipped if too small */
+  size_t off;
+  if (this->entries.empty()) {
+    off = 0;
+  } else {
+    size_t head = this->entries.front().off;
+    if (this->tail > head && this->capacity - this->tail >= len)
+      off = this->tail;
+    else if (this->tail > head && head >= len)
+      off = 0;
+    else if (this->tail <= head && head - this->tail >= len)
+      off = this->tail;
+    else
+      off = SIZE_MAX;
+  }
+  if (off == SIZE_MAX || len > this->capacity) {
+    this->overflowDrops++;
+    this->overflowBytes += len;
+    return nullptr;
+  }
+
+  this->entries.push_back({off, len, false});
+  this->tail = off + len;
+  this->used += len;
+  this->maxUsed = std::max(this->maxUsed, this->used);
+  this->frames++;
+  this->bytes += len;
+  return this->buf + off;
+}
+
+void RxFifo::release(const uint8_t *frame) {
+  size_t off = frame - this->buf;
+  for (Entry &e : this->entries) {
+    if (e.off == off && !e.released) {
+      e.released = true;
+      break;
+    }
+  }
+  while (!this->entries.empty() && this->entries.front().released) {
+    this->used -= this->entries.front().len;
+    this->entries.pop_front();
+  }
+}
+
+void RxFifo::printStats(FILE *f) const {
+  fprintf(f,
+          "rx fifo: frames=%lu bytes=%lu overflow_drops=%lu "
+          "overflow_bytes=%lu inactive_drops=%lu oversize_drops=%lu "
+          "max_used=%zu capacity=%zu\n",
+          this->frames, this->bytes, this->overflowDrops, this->overflowBytes,
+          this->inactiveDrops, this->oversizeDrops, this->maxUsed,
+          this->capacity);
+}
+
+RxRing::RxRing(CplRing **cplRings, RxFifo *fifo, unsigned id)
+    : rxCplRings(cplRings), fifo(fifo), id(id), descsFetching(0), gen(0) {
 }
 
 RxRing::~RxRing() {
 }
 
+void RxRing::setSizeLog(size_t size_log) {
+  DescRing::setSizeLog(size_log);
+  /* drops the waiting frames if the queue was shut down */
+  drain();
+}
+
+void RxRing::setHeadPtr(ptr_t ptr) {
+  DescRing::setHeadPtr(ptr);
+  /* frames may be waiting for these descriptors */
+  drain();
+}
+
 void RxRing::dmaDone(DMAOp *op) {
   switch (op->type) {
     case DMA_TYPE_DESC: {
       assert(!op->write_);
-      Desc *desc = (Desc *)op->data_;
+      if (op->gen != this->gen) {
+        delete op;
+        break;
+      }
+      Desc *descs = (Desc *)op->data_;
+      size_t n = op->len_ / DESC_SIZE;
 #ifdef DEBUG
-      printf("corundum_bm: rx dma desc done addr %lx index %lu len %lu\n",
-             desc->addr, op->tag, op->rx_data->len);
+      printf("corundum_bm: rx dma desc done index %lu cnt %zu\n", op->tag, n);
 #endif
-      op->type = DMA_TYPE_MEM;
-      op->dma_addr_ = desc->addr;
-      op->len_ = op->rx_data->len;
-      memcpy((void *)op->data_, (void *)op->rx_data->data, op->len_);
-      delete op->rx_data;
-      op->write_ = true;
-      runner->IssueDma(*op);
+      for (size_t i = 0; i < n; i++)
+        this->descCache.push_back({descs[i], (ptr_t)(op->tag + i)});
+      this->descsFetching -= n;
+      delete op;
+      drain();
       break;
     }
     case DMA_TYPE_MEM:
@@ -352,7 +744,9 @@ void RxRing::dmaDone(DMAOp *op) {
              op->len_);
 #endif
       updatePtr((ptr_t)op->tag, false);
-      this->rxCplRing->complete(op->tag, op->len_, false);
+      this->rxCplRings[this->_index % NUM_QUEUES]->complete(this->id, op->tag,
+                                                           op->len_, false);
+      this->fifo->release((uint8_t *)op->data_);
       delete op;
       break;
     default:
@@ -361,28 +755,88 @@ void RxRing::dmaDone(DMAOp *op) {
   }
 }
 
-void RxRing::rx(RxData *rx_data) {
-  if (empty()) {
-    delete rx_data;
+void RxRing::rx(uint8_t *data, size_t len) {
+  this->frames.push_back({data, len});
+  drain();
+}
+
+void RxRing::drain() {
+  /* frames of a queue that is shut down will not be delivered */
+  if (!this->active) {
+    for (const FifoFrame &frame : this->frames) {
+      this->fifo->inactiveDrops++;
+      this->fifo->release(frame.data);
+    }
+    this->frames.clear();
+
+    /* descriptors fetched but not used yet are fetched again once the
+     * queue is back up */
+    this->_currTail -= this->descCache.size() + this->descsFetching;
+    this->descCache.clear();
+    if (this->descsFetching) {
+      this->descsFetching = 0;
+      this->gen++;
+    }
     return;
   }
+
+  while (!this->frames.empty() && !this->descCache.empty()) {
+    const FifoFrame &frame = this->frames.front();
+    /* frames longer than the posted buffer are dropped, the descriptor is
+     * kept for the next frame */
+    if (frame.len > this->descCache.front().desc.len) {
+      this->fifo->oversizeDrops++;
+      this->fifo->release(frame.data);
+    } else {
+      writePayload(frame, this->descCache.front());
+      this->descCache.pop_front();
+    }
+    this->frames.pop_front();
+  }
+  /* frames beyond the descriptors in flight need another fetch, the rest
+   * waits in the fifo until the host posts more */
+  while (this->frames.size() > this->descsFetching && fetchDescs()) {
+  }
+}
+
+bool RxRing::fetchDescs() {
+  if (empty())
+    return false;
+
+  size_t n =
+      batchLen(this->_currTail, (ptr_t)(this->_headPtr - this->_currTail));
   addr_t dma_addr =
       this->_dmaAddr + (this->_currTail & this->_sizeMask) * DESC_SIZE;
   /* Issue DMA read */
   DMAOp *op = new DMAOp;
   op->type = DMA_TYPE_DESC;
   op->dma_addr_ = dma_addr;
-  op->len_ = DESC_SIZE;
+  op->len_ = n * DESC_SIZE;
   op->ring = this;
-  op->rx_data = rx_data;
   op->tag = this->_currTail;
+  op->gen = this->gen;
   op->write_ = false;
 #ifdef DEBUG
   printf("corundum_bm: rx issue dma addr %lx index %lu len %lu\n",
          op->dma_addr_, op->tag, op->len_);
 #endif
   runner->IssueDma(*op);
-  this->_currTail++;
+  this->_currTail += n;
+  this->descsFetching += n;
+  return true;
+}
+
+void RxRing::writePayload(const FifoFrame &frame, const CachedDesc &cd) {
+  DMAOp *op = new DMAOp;
+  op->type = DMA_TYPE_MEM;
+  op->dma_addr_ = cd.desc.addr;
+  op->len_ = frame.len;
+  op->ring = this;
+  /* written straight from the fifo, released once done */
+  op->data_ = frame.data;
+  op->tag = cd.ptr;
+  op->write_ = true;
+  runner->IssueDma(*op);
 }
 
 Port::Port()
@@ -396,6 +850,8 @@ Port::Port()
       _rssMask(0),
       _schedEnable(false),
       _queueEnable(false) {
+  for (unsigned i = 0; i < RSS_TABLE_SIZE; i++)
+    this->_rssTable[i] = i % NUM_QUEUES;
 }
 
 Port::~Port() {
@@ -433,6 +889,14 @@ unsigned Port::rssMask() {
   return this->_rssMask;
 }
 
+unsigned Port::rssEntry(unsigned idx) {
+  return this->_rssTable[idx];
+}
+
+unsigned Port::rssQueue(uint32_t hash) {
+  return this->_rssTable[hash & this->_rssMask & (RSS_TABLE_SIZE - 1)];
+}
+
 void Port::setId(unsigned id) {
   this->_id = id;
 }
@@ -467,6 +931,10 @@ void Port::setRssMask(unsigned mask) {
   this->_rssMask = mask;
 }
 
+void Port::setRssEntry(unsigned idx, unsigned queue) {
+  this->_rssTable[idx] = queue % NUM_QUEUES;
+}
+
 void Port::schedEnable() {
   this->_schedEnable = true;
 }
@@ -483,28 +951,72 @@ void Port::queueDisable() {
   this->_queueEnable = false;
 }
 
+bool Port::txEnabled() {
+  return this->_schedEnable && this->_queueEnable;
+}
+
 Corundum::Corundum()
-    : txRing(&this->txCplRing),
-      txCplRing(&this->eventRing),
-      rxRing(&this->rxCplRing),
-      rxCplRing(&this->eventRing),
-      features(0) {
-  this->port.setId(0);
-  this->port.setFeatures(this->features);
-  this->port.setMtu(2048);
-  this->port.setSchedCount(1);
-  this->port.setSchedOffset(0x100000);
-  this->port.setSchedStride(0x100000);
-  this->port.setSchedType(0);
-  this->port.setRssMask(0);
-  this->port.schedDisable();
+    : intMod(*this, MSI_VECS, [](unsigned vec) { runner->MsiIssue(vec); }),
+      features(IF_FEATURE_RSS) {
+  for (unsigned i = 0; i < NUM_QUEUES; i++) {
+    this->eventRings[i] = new EventRing(&this->intMod);
+    this->txCplRings[i] = new CplRing(this->eventRings, i);
+    this->rxCplRings[i] = new CplRing(this->eventRings, i);
+    this->txRings[i] =
+        new TxRing(this->txCplRings, this->ports, this->txScheds, i);
+    this->rxRings[i] = new RxRing(this->rxCplRings, &this->rxFifo, i);
+  }
+  for (unsigned i = 0; i < MAX_PORTS; i++) {
+    Port &port = this->ports[i];
+    port.setId(i);
+    port.setFeatures(this->features);
+    port.setMtu(MAX_FRAME_LEN);
+    port.setSchedCount(1);
+    port.setSchedOffset(0x100000);
+    port.setSchedStride(0x100000);
+    port.setSchedType(0);
+    port.setRssMask(0);
+    port.schedDisable();
+    this->txScheds[i].setPort(i);
+  }
+  setBatch(BatchConfig());
 }
 
 Corundum::~Corundum() {
+  this->intMod.PrintStats(stderr);
+  this->rxFifo.printStats(stderr);
+  for (TxScheduler &sched : this->txScheds)
+    sched.printStats(stderr);
+  for (unsigned i = 0; i < NUM_QUEUES; i++) {
+    delete this->txRings[i];
+    delete this->rxRings[i];
+    delete this->txCplRings[i];
+    delete this->rxCplRings[i];
+    delete this->eventRings[i];
+  }
+}
+
+addr_t Corundum::queueReg(addr_t addr, unsigned &q) {
+  static const addr_t kBases[] = {
+      EVENT_QUEUE_BASE_ADDR_REG, TX_QUEUE_BASE_ADDR_REG,
+      TX_CPL_QUEUE_BASE_ADDR_REG, RX_QUEUE_BASE_ADDR_REG,
+      RX_CPL_QUEUE_BASE_ADDR_REG};
+  for (addr_t base : kBases) {
+    if (addr >= base && addr < base + NUM_QUEUES * QUEUE_STRIDE) {
+      q = (addr - base) / QUEUE_STRIDE;
+      return base + (addr - base) % QUEUE_STRIDE;
+    }
+  }
+  q = 0;
+  return addr;
 }
 
 reg_t Corundum::RegRead(uint8_t bar, addr_t addr) {
-  switch (addr) {
+  if (addr >= PORT_BASE)
+    return portRegRead(addr);
+
+  unsigned q;
+  switch (queueReg(addr, q)) {
     case REG_FW_ID:
       return 32;
     case REG_FW_VER:
@@ -536,57 +1048,76 @@ reg_t Corundum::RegRead(uint8_t bar, addr_t addr) {
     case IF_REG_IF_FEATURES:
       return this->features;
     case IF_REG_EVENT_QUEUE_COUNT:
-      return 1;
+      return NUM_QUEUES;
     case IF_REG_EVENT_QUEUE_OFFSET:
       return 0x100000;
     case IF_REG_TX_QUEUE_COUNT:
-      return 1;
+      return NUM_QUEUES;
     case IF_REG_TX_QUEUE_OFFSET:
       return 0x200000;
     case IF_REG_TX_CPL_QUEUE_COUNT:
-      return 1;
+      return NUM_QUEUES;
     case IF_REG_TX_CPL_QUEUE_OFFSET:
       return 0x400000;
     case IF_REG_RX_QUEUE_COUNT:
-      return 1;
+      return NUM_QUEUES;
     case IF_REG_RX_QUEUE_OFFSET:
       return 0x600000;
     case IF_REG_RX_CPL_QUEUE_COUNT:
-      return 1;
+      return NUM_QUEUES;
     case IF_REG_RX_CPL_QUEUE_OFFSET:
       return 0x700000;
     case IF_REG_PORT_COUNT:
-      return 1;
+      return runner->NumEthPorts();
     case IF_REG_PORT_OFFSET:
-      return 0x800000;
+      return PORT_BASE;
     case IF_REG_PORT_STRIDE:
-      return 0x200000;
+      return PORT_STRIDE;
     case EVENT_QUEUE_HEAD_PTR_REG:
-      return this->eventRing.headPtr();
+      return this->eventRings[q]->headPtr();
     case TX_QUEUE_ACTIVE_LOG_SIZE_REG:
-      return this->txRing.sizeLog();
+      return this->txRings[q]->sizeLog();
     case TX_QUEUE_TAIL_PTR_REG:
-      return this->txRing.tailPtr();
+      return this->txRings[q]->tailPtr();
     case TX_CPL_QUEUE_HEAD_PTR_REG:
-      return this->txCplRing.headPtr();
+      return this->txCplRings[q]->headPtr();
     case RX_QUEUE_TAIL_PTR_REG:
-      return this->rxRing.tailPtr();
+      return this->rxRings[q]->tailPtr();
     case RX_CPL_QUEUE_HEAD_PTR_REG:
-      return this->rxCplRing.headPtr();
+      return this->rxCplRings[q]->headPtr();
+    default:
+      fprintf(stderr, "Unknown register read %lx\n", addr);
+      abort();
+  }
+}
+
+reg_t Corundum::portRegRead(addr_t addr) {
+  unsigned idx = (addr - PORT_BASE) / PORT_STRIDE;
+  if (idx >= runner->NumEthPorts()) {
+    fprintf(stderr, "Unknown register read %lx\n", addr);
+    abort();
+  }
+  Port &port = this->ports[idx];
+  addr_t reg = addr - idx * PORT_STRIDE;
+  if (reg >= PORT_REG_RSS_TABLE &&
+      reg < PORT_REG_RSS_TABLE + RSS_TABLE_SIZE * 4)
+    return port.rssEntry((reg - PORT_REG_RSS_TABLE) / 4);
+
+  switch (reg) {
     case PORT_REG_PORT_ID:
-      return this->port.id();
+      return port.id();
     case PORT_REG_PORT_FEATURES:
-      return this->port.features();
+      return port.features();
     case PORT_REG_PORT_MTU:
-      return this->port.mtu();
+      return port.mtu();
     case PORT_REG_SCHED_COUNT:
-      return this->port.schedCount();
+      return port.schedCount();
     case PORT_REG_SCHED_OFFSET:
-      return this->port.schedOffset();
+      return port.schedOffset();
     case PORT_REG_SCHED_STRIDE:
-      return this->port.schedStride();
+      return port.schedStride();
     case PORT_REG_SCHED_TYPE:
-      return this->port.schedType();
+      return port.schedType();
     default:
       fprintf(stderr, "Unknown register read %lx\n", addr);
       abort();
@@ -594,7 +1125,13 @@ reg_t Corundum::RegRead(uint8_t bar, addr_t addr) {
 }
 
 void Corundum::RegWrite(uint8_t bar, uint64_t addr, reg_t val) {
-  switch (addr) {
+  if (addr >= PORT_BASE) {
+    portRegWrite(addr, val);
+    return;
+  }
+
+  unsigned q;
+  switch (queueReg(addr, q)) {
     case REG_FW_ID:
     case REG_FW_VER:
     case REG_BOARD_ID:
@@ -612,110 +1149,131 @@ void Corundum::RegWrite(uint8_t bar, uint64_t addr, reg_t val) {
     case PHC_REG_PTP_SET_SEC_H:
       break;
     case EVENT_QUEUE_BASE_ADDR_REG:
-      this->eventRing.setDMALower(val);
+      this->eventRings[q]->setDMALower(val);
       break;
     case EVENT_QUEUE_BASE_ADDR_REG + 4:
-      this->eventRing.setDMAUpper(val);
+      this->eventRings[q]->setDMAUpper(val);
       break;
     case EVENT_QUEUE_ACTIVE_LOG_SIZE_REG:
-      this->eventRing.setSizeLog(val);
+      this->eventRings[q]->setSizeLog(val);
       break;
     case EVENT_QUEUE_INTERRUPT_INDEX_REG:
-      this->eventRing.setIndex(val);
+      this->eventRings[q]->setIndex(val);
       break;
     case EVENT_QUEUE_HEAD_PTR_REG:
-      this->eventRing.setHeadPtr(val);
+      this->eventRings[q]->setHeadPtr(val);
       break;
     case EVENT_QUEUE_TAIL_PTR_REG:
-      this->eventRing.setTailPtr(val);
+      this->eventRings[q]->setTailPtr(val);
       break;
     case TX_QUEUE_BASE_ADDR_REG:
-      this->txRing.setDMALower(val);
+      this->txRings[q]->setDMALower(val);
       break;
     case TX_QUEUE_BASE_ADDR_REG + 4:
-      this->txRing.setDMAUpper(val);
+      this->txRings[q]->setDMAUpper(val);
       break;
     case TX_QUEUE_ACTIVE_LOG_SIZE_REG:
-      this->txRing.setSizeLog(val);
+      this->txRings[q]->setSizeLog(val);
       break;
     case TX_QUEUE_CPL_QUEUE_INDEX_REG:
-      this->txRing.setIndex(val);
+      this->txRings[q]->setIndex(val);
       break;
     case TX_QUEUE_HEAD_PTR_REG:
-      this->txRing.setHeadPtr(val);
+      this->txRings[q]->setHeadPtr(val);
       break;
     case TX_QUEUE_TAIL_PTR_REG:
-      this->txRing.setTailPtr(val);
+      this->txRings[q]->setTailPtr(val);
       break;
     case TX_CPL_QUEUE_BASE_ADDR_REG:
-      this->txCplRing.setDMALower(val);
+      this->txCplRings[q]->setDMALower(val);
       break;
     case TX_CPL_QUEUE_BASE_ADDR_REG + 4:
-      this->txCplRing.setDMAUpper(val);
+      this->txCplRings[q]->setDMAUpper(val);
       break;
     case TX_CPL_QUEUE_ACTIVE_LOG_SIZE_REG:
-      this->txCplRing.setSizeLog(val);
+      this->txCplRings[q]->setSizeLog(val);
       break;
     case TX_CPL_QUEUE_INTERRUPT_INDEX_REG:
-      this->txCplRing.setIndex(val);
+      this->txCplRings[q]->setIndex(val);
       break;
     case TX_CPL_QUEUE_HEAD_PTR_REG:
-      this->txCplRing.setHeadPtr(val);
+      this->txCplRings[q]->setHeadPtr(val);
       break;
     case TX_CPL_QUEUE_TAIL_PTR_REG:
-      this->txCplRing.setTailPtr(val);
+      this->txCplRings[q]->setTailPtr(val);
       break;
     case RX_QUEUE_BASE_ADDR_REG:
-      this->rxRing.setDMALower(val);
+      this->rxRings[q]->setDMALower(val);
       break;
     case RX_QUEUE_BASE_ADDR_REG + 4:
-      this->rxRing.setDMAUpper(val);
+      this->rxRings[q]->setDMAUpper(val);
       break;
     case RX_QUEUE_ACTIVE_LOG_SIZE_REG:
-      this->rxRing.setSizeLog(val);
+      this->rxRings[q]->setSizeLog(val);
       break;
     case RX_QUEUE_CPL_QUEUE_INDEX_REG:
-      this->rxRing.setIndex(val);
+      this->rxRings[q]->setIndex(val);
       break;
     case RX_QUEUE_HEAD_PTR_REG:
-      this->rxRing.setHeadPtr(val);
+      this->rxRings[q]->setHeadPtr(val);
       break;
     case RX_QUEUE_TAIL_PTR_REG:
-      this->rxRing.setTailPtr(val);
+      this->rxRings[q]->setTailPtr(val);
       break;
     case RX_CPL_QUEUE_BASE_ADDR_REG:
-      this->rxCplRing.setDMALower(val);
+      this->rxCplRings[q]->setDMALower(val);
       break;
     case RX_CPL_QUEUE_BASE_ADDR_REG + 4:
-      this->rxCplRing.setDMAUpper(val);
+      this->rxCplRings[q]->setDMAUpper(val);
       break;
     case RX_CPL_QUEUE_ACTIVE_LOG_SIZE_REG:
-      this->rxCplRing.setSizeLog(val);
+      this->rxCplRings[q]->setSizeLog(val);
       break;
     case RX_CPL_QUEUE_INTERRUPT_INDEX_REG:
-      this->rxCplRing.setIndex(val);
+      this->rxCplRings[q]->setIndex(val);
       break;
     case RX_CPL_QUEUE_HEAD_PTR_REG:
-      this->rxCplRing.setHeadPtr(val);
+      this->rxCplRings[q]->setHeadPtr(val);
       break;
     case RX_CPL_QUEUE_TAIL_PTR_REG:
-      this->rxCplRing.setTailPtr(val);
+      this->rxCplRings[q]->setTailPtr(val);
       break;
+    default:
+      fprintf(stderr, "Unknown register write %lx\n", addr);
+      abort();
+  }
+}
+
+void Corundum::portRegWrite(addr_t addr, reg_t val) {
+  unsigned idx = (addr - PORT_BASE) / PORT_STRIDE;
+  if (idx >= runner->NumEthPorts()) {
+    fprintf(stderr, "Unknown register write %lx\n", addr);
+    abort();
+  }
+  Port &port = this->ports[idx];
+  addr_t reg = addr - idx * PORT_STRIDE;
+  if (reg >= PORT_REG_RSS_TABLE &&
+      reg < PORT_REG_RSS_TABLE + RSS_TABLE_SIZE * 4) {
+    port.setRssEntry((reg - PORT_REG_RSS_TABLE) / 4, val);
+    return;
+  }
+
+  switch (reg) {
     case PORT_REG_SCHED_ENABLE:
       if (val) {
-        this->port.schedEnable();
+        port.schedEnable();
       } else {
-        this->port.schedDisable();
+        port.schedDisable();
       }
       break;
     case PORT_REG_RSS_MASK:
-      this->port.setRssMask(val);
+      port.setRssMask(val);
       break;
     case PORT_QUEUE_ENABLE:
       if (val) {
-        this->port.queueEnable();
+        port.queueEnable();
       } else {
-        this->port.queueDisable();
+        port.queueDisable();
       }
       break;
     default:
@@ -725,6 +1283,15 @@ void Corundum::RegWrite(uint8_t bar, uint64_t addr, reg_t val) {
 }
 
 void Corundum::SetupIntro(struct SimbricksProtoPcieDevIntro &di) {
+  // the rings access the runner through the global, this is the first
+  // callback after the runner is set up
+  runner = this->runner_;
+
+  if (runner->NumEthPorts() > MAX_PORTS) {
+    fprintf(stderr, "corundum_bm: at most %u ports supported\n", MAX_PORTS);
+    abort();
+  }
+
   di.bars[0].len = 1 << 24;
   di.bars[0].flags = SIMBRICKS_PROTO_PCIE_BAR_64;
   di.pci_vendor_id = 0x5543;
@@ -732,7 +1299,7 @@ void Corundum::SetupIntro(struct SimbricksProtoPcieDevIntro &di) {
   di.pci_class = 0x02;
   di.pci_subclass = 0x00;
   di.pci_revision = 0x00;
-  di.pci_msi_nvecs = 32;
+  di.pci_msi_nvecs = MSI_VECS;
 }
 
 void Corundum::DmaComplete(nicbm::DMAOp &op) {
@@ -740,19 +1307,139 @@ void Corundum::DmaComplete(nicbm::DMAOp &op) {
   op_->ring->dmaDone(op_);
 }
 
+/* Toeplitz hash over `len` bytes of `input` with the fixed hardware key */
+static uint32_t toeplitz(const uint8_t *input, size_t len) {
+  static const uint8_t key[] = {
+      0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2, 0x41, 0x67,
+      0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0, 0xd0, 0xca, 0x2b, 0xcb};
+  assert(len <= sizeof(key) - 4);
+
+  uint32_t hash = 0;
+  uint32_t window = (key[0] << 24) | (key[1] << 16) | (key[2] << 8) | key[3];
+  for (size_t i = 0; i < len; i++) {
+    for (int b = 7; b >= 0; b--) {
+      if (input[i] & (1 << b))
+        hash ^= window;
+      window = (window << 1) | ((key[i + 4] >> b) & 1);
+    }
+  }
+  return hash;
+}
+
+/*
+ * RSS hash of a frame: the IPv4 addresses, plus the ports of TCP and UDP
+ * packets that are not fragmented. 0 for other frames.
+ */
+static uint32_t rssHash(const uint8_t *frame, size_t len) {
+  size_t off = 12;
+  if (len >= off + 2 && frame[off] == 0x81 && frame[off + 1] == 0x00)
+    off += 4;
+  if (len < off + 2 + 20 || frame[off] != 0x08 || frame[off + 1] != 0x00)
+    return 0;
+
+  const uint8_t *ip = frame + off + 2;
+  size_t ihl = (ip[0] & 0xf) * 4;
+  uint8_t input[12];
+  memcpy(input, ip + 12, 8);
+  bool frag = ((ip[6] & 0x3f) | ip[7]) != 0;
+  bool l4 = ihl >= 20 && (ip[9] == 6 || ip[9] == 17) && !frag;
+  if (!l4 || len < off + 2 + ihl + 4)
+    return toeplitz(input, 8);
+
+  memcpy(input + 8, ip + ihl, 4);
+  return toeplitz(input, 12);
+}
+
 void Corundum::EthRx(uint8_t port, const void *data, size_t len) {
-  RxData *rx_data = new RxData;
-  memcpy((void *)rx_data->data, data, len);
-  rx_data->len = len;
-  rxRing.rx(rx_data);
+  unsigned queue = 0;
+  if (this->ports[port].rssMask())
+    queue = this->ports[port].rssQueue(
+        rssHash(static_cast<const uint8_t *>(data), len));
+  RxRing *ring = this->rxRings[queue];
+  if (!ring->isActive()) {
+    this->rxFifo.inactiveDrops++;
+    return;
+  }
+
+  /* frames the fifo has no room for are dropped like on the device */
+  uint8_t *buf = this->rxFifo.alloc(len);
+  if (!buf)
+    return;
+  memcpy(buf, data, len);
+  ring->rx(buf, len);
 }
 
-}  // namespace corundum
+void Corundum::Timed(nicbm::TimedEvent &te) {
+  if (this->intMod.Timed(te))
+    return;
 
-int main(int argc, char *argv[]) {
-  corundum::Corundum dev;
-  runner = new nicbm::Runner(dev);
-  if (runner->ParseArgs(argc, argv))
-    return -1;
-  return runner->RunMain();
+  TxScheduler *sched = dynamic_cast<TxScheduler *>(&te);
+  if (!sched) {
+    fprintf(stderr, "Unknown timed event\n");
+    abort();
+  }
+  sched->timed();
+}
+
+void Corundum::AddOptions(nicbm::Options &opts) {
+  opts.Add("intmod", "none|adaptive|static:DELAY-NS:EVENTS",
+           "interrupt moderation", [this](const char *arg) {
+             nicbm::IntModConfig cfg;
+             if (!cfg.Parse(arg))
+               return false;
+             this->setIntMod(cfg);
+             return true;
+           });
+  opts.Add("batch", "DESCS:CPLS",
+           "descriptors and completions per DMA, at most one DMA buffer",
+           [this](const char *arg) {
+             BatchConfig cfg;
+             if (!cfg.Parse(arg))
+               return false;
+             this->setBatch(cfg);
+             return true;
+           });
+  opts.Add("rx-fifo", "BYTES",
+           "rx buffer size, at least the maximum frame length",
+           [this](const char *arg) {
+             char *end;
+             unsigned long long size = strtoull(arg, &end, 0);
+             if (*end || size < MAX_FRAME_LEN)
+               return false;
+             this->setRxFifoSize(size);
+             return true;
+           });
+  opts.Add("tx-sched", "RATE-MBPS[:W0,W1,...]",
+           "tx rate limit (0 for none) and per queue weights",
+           [this](const char *arg) {
+             SchedConfig cfg;
+             if (!cfg.Parse(arg))
+               return false;
+             this->setSched(cfg);
+             return true;
+           });
+}
+
+void Corundum::setIntMod(const nicbm::IntModConfig &cfg) {
+  this->intMod.SetDefaults(cfg);
+}
+
+void Corundum::setSched(const SchedConfig &cfg) {
+  for (TxScheduler &sched : this->txScheds)
+    sched.setConfig(cfg);
 }
+
+void Corundum::setRxFifoSize(size_t size) {
+  this->rxFifo.setCapacity(size);
+}
+
+void Corundum::setBatch(const BatchConfig &cfg) {
+  for (unsigned i = 0; i < NUM_QUEUES; i++) {
+    this->txRings[i]->setBatch(cfg.descs);
+    this->rxRings[i]->setBatch(cfg.descs);
+    this->txCplRings[i]->setBatch(cfg.cpls);
+    this->rxCplRings[i]->setBatch(cfg.cpls);
+  }
+}
+
+}  // namespace corundum
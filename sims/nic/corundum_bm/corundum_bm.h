@@ -25,10 +25,13 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdio.h>
 
+#include <deque>
 #include <list>
 #include <vector>
 
+#include <simbricks/nicbm/intmod.h>
 #include <simbricks/nicbm/nicbm.h>
 
 typedef uint32_t reg_t;
@@ -80,6 +83,10 @@ typedef uint16_t ptr_t;
 #define QUEUE_ARM_MASK 0x80000000
 #define QUEUE_CONT_MASK 0x40000000
 
+/* queues of each type, their registers are QUEUE_STRIDE apart */
+#define NUM_QUEUES 32
+#define QUEUE_STRIDE 0x20
+
 #define EVENT_QUEUE_BASE_ADDR_REG 0x100000
 #define EVENT_QUEUE_ACTIVE_LOG_SIZE_REG 0x100008
 #define EVENT_QUEUE_INTERRUPT_INDEX_REG 0x10000C
@@ -119,18 +126,64 @@ typedef uint16_t ptr_t;
 #define PORT_REG_SCHED_TYPE 0x80001C
 #define PORT_REG_SCHED_ENABLE 0x800040
 #define PORT_REG_RSS_MASK 0x800080
+/* rx queue for each masked hash value, initialized to the identity */
+#define PORT_REG_RSS_TABLE 0x800100
+#define RSS_TABLE_SIZE 128
 
 #define PORT_QUEUE_ENABLE 0x900000
 
+/* register blocks of the individual ports, port 0 starts at PORT_BASE */
+#define PORT_BASE 0x800000
+#define PORT_STRIDE 0x200000
+#define MAX_PORTS 4
+
+#define MSI_VECS 32
+
 namespace corundum {
 
 #define DESC_SIZE 16
 #define CPL_SIZE 32
 #define EVENT_SIZE 32
 #define MAX_DMA_LEN 2048
+/* largest frame, jumbo frames fit into a single DMA */
+#define MAX_FRAME_LEN SIMBRICKS_NET_MAX_FRAME_JUMBO
+/* default size of the rx packet buffer */
+#define RX_FIFO_SIZE (128 * 1024)
 
 class DescRing;
 
+/** Limits for batched descriptor fetches and completion writes */
+struct BatchConfig {
+  /** descriptors fetched with one DMA, at most MAX_DMA_LEN / DESC_SIZE */
+  size_t descs;
+  /** completions written with one DMA, at most MAX_DMA_LEN / CPL_SIZE */
+  size_t cpls;
+
+  BatchConfig();
+
+  /**
+   * Parse "DESCS:CPLS".
+   * Returns false if the string is invalid.
+   */
+  bool Parse(const char *str);
+};
+
+/** Transmit scheduler settings, applied to every port */
+struct SchedConfig {
+  /** link rate in bits per second, 0 sends frames without pacing */
+  uint64_t rate;
+  /** deficit round robin weight of each tx queue, at least 1 */
+  unsigned weights[NUM_QUEUES];
+
+  SchedConfig();
+
+  /**
+   * Parse "RATE-MBPS[:W0,W1,...]", queues without a weight keep weight 1.
+   * Returns false if the string is invalid.
+   */
+  bool Parse(const char *str);
+};
+
 struct Desc {
   uint16_t rsvd0;
   uint16_t tx_csum_cmd;
@@ -163,9 +216,9 @@ struct Event {
   uint16_t source;
 } __attribute__((packed));
 
-struct RxData {
+struct Frame {
   size_t len;
-  uint8_t data[MAX_DMA_LEN];
+  uint8_t data[MAX_FRAME_LEN];
 };
 
 #define DMA_TYPE_DESC 0
@@ -175,41 +228,52 @@ struct RxData {
 #define DMA_TYPE_EVENT 4
 
 struct DMAOp : public nicbm::DMAOp {
-  DMAOp() {
+  DMAOp() : frame(nullptr), gen(0) {
     data_ = databuf;
   }
+  ~DMAOp() {
+    delete frame;
+  }
 
   uint8_t type;
   DescRing *ring;
-  RxData *rx_data;
+  /* payload of packet transfers, owned by the op */
+  Frame *frame;
   uint64_t tag;
+  /* ring generation the op was issued in, see RxRing */
+  unsigned gen;
   uint8_t databuf[MAX_DMA_LEN];
 };
 
 class DescRing {
  public:
   DescRing();
-  ~DescRing();
+  virtual ~DescRing();
 
   addr_t dmaAddr();
   size_t sizeLog();
   unsigned index();
   ptr_t headPtr();
   ptr_t tailPtr();
+  bool isActive();
 
   void setDMALower(uint32_t addr);
   void setDMAUpper(uint32_t addr);
-  void setSizeLog(size_t size_log);
+  virtual void setSizeLog(size_t size_log);
   void setIndex(unsigned index);
   virtual void setHeadPtr(ptr_t ptr);
-  void setTailPtr(ptr_t ptr);
+  virtual void setTailPtr(ptr_t ptr);
+  void setBatch(size_t batch);
 
   virtual void dmaDone(DMAOp *op) = 0;
 
  protected:
   bool empty();
   bool full();
-  bool updatePtr(ptr_t ptr, bool head);
+  /* `cnt` entries starting at `ptr` are done */
+  bool updatePtr(ptr_t ptr, bool head, size_t cnt = 1);
+  /* entries of at most `avail` from `ptr` that fit in one batch */
+  size_t batchLen(ptr_t ptr, size_t avail);
 
   addr_t _dmaAddr;
   size_t _sizeLog;
@@ -222,58 +286,215 @@ class DescRing {
   ptr_t _currTail;
   bool active;
   bool armed;
+  size_t _batch;
   std::vector<bool> cplDma;
 };
 
+/* event rings raise the MSI vector set as their index */
 class EventRing : public DescRing {
  public:
-  EventRing();
+  explicit EventRing(nicbm::IntModerator *intMod);
   ~EventRing();
 
   void dmaDone(DMAOp *op) override;
   void issueEvent(unsigned type, unsigned source);
+
+ private:
+  nicbm::IntModerator *intMod;
 };
 
+/* completion rings post events to the event ring set as their index */
 class CplRing : public DescRing {
  public:
-  explicit CplRing(EventRing *eventRing);
+  CplRing(EventRing **eventRings, unsigned id);
   ~CplRing();
 
+  void setTailPtr(ptr_t ptr) override;
   void dmaDone(DMAOp *op) override;
-  void complete(unsigned index, size_t len, bool tx);
+  void complete(unsigned queue, unsigned index, size_t len, bool tx);
 
  private:
   struct CplData {
+    unsigned queue;
     unsigned index;
     size_t len;
     bool tx;
   };
-  EventRing *eventRing;
+  /* write pending completions, one batch at a time */
+  void flush();
+
+  EventRing **eventRings;
+  unsigned id;
   std::list<CplData> pending;
+  bool writing;
 };
 
+class Port;
+
+/**
+ * On-NIC rx packet buffer. Frames are stored back to back in a fixed byte
+ * ring until they are written to the host. Space is reclaimed in arrival
+ * order, so a frame waiting for a descriptor holds up the space of frames
+ * after it.
+ */
+class RxFifo {
+ public:
+  RxFifo();
+  ~RxFifo();
+
+  /* change the capacity, only while empty */
+  void setCapacity(size_t capacity);
+  /* space for a frame of `len` bytes, nullptr if the buffer is full */
+  uint8_t *alloc(size_t len);
+  /* release a frame returned by alloc, frames can be released in any order */
+  void release(const uint8_t *frame);
+  void printStats(FILE *f) const;
+
+  uint64_t frames;
+  uint64_t bytes;
+  /* frames dropped because the buffer was full */
+  uint64_t overflowDrops;
+  uint64_t overflowBytes;
+  /* frames dropped because their queue was not active */
+  uint64_t inactiveDrops;
+  /* frames dropped because they exceed the buffer of their descriptor */
+  uint64_t oversizeDrops;
+
+ private:
+  struct Entry {
+    size_t off;
+    size_t len;
+    bool released;
+  };
+
+  uint8_t *buf;
+  size_t capacity;
+  /* offset after the newest frame */
+  size_t tail;
+  size_t used;
+  size_t maxUsed;
+  std::deque<Entry> entries;
+};
+
+/**
+ * Transmit scheduler of a port. Frames fetched by the tx queues wait here
+ * until the link is free, the queues take turns deficit round robin with a
+ * quantum proportional to their weight. With a link rate set, every frame
+ * occupies the link for its serialization time including preamble, FCS,
+ * and inter-frame gap, and the scheduler sleeps until the link is free.
+ */
+class TxScheduler : public nicbm::TimedEvent {
+ public:
+  TxScheduler();
+  ~TxScheduler();
+
+  void setPort(unsigned port);
+  void setConfig(const SchedConfig &cfg);
+  /* frame in `op`, fetched by tx queue `queue`, is ready to be sent */
+  void enqueue(unsigned queue, DMAOp *op);
+  /* the link is free again */
+  void timed();
+  void printStats(FILE *f);
+
+ private:
+  struct Queue {
+    std::deque<DMAOp *> frames;
+    size_t bytes;
+    size_t deficit;
+
+    /* statistics */
+    uint64_t sent;
+    uint64_t sentBytes;
+    size_t maxFrames;
+    size_t maxBytes;
+    /* integral of the occupancy in frames over time [ps] */
+    uint64_t frameTime;
+    uint64_t lastChange;
+  };
+  /* send frames until the link is busy or no frames are left */
+  void run();
+  /* next frame to send in round robin order, nullptr if none left */
+  DMAOp *dequeue();
+  /* account the occupancy of `q` before it changes */
+  void account(Queue &q);
+
+  unsigned port;
+  SchedConfig cfg;
+  Queue queues[NUM_QUEUES];
+  size_t queued;
+  /* queue whose turn it is, and whether it already got its quantum */
+  unsigned current;
+  bool visiting;
+  /* time the link finishes the current frame [ps] */
+  uint64_t linkFree;
+  bool armed;
+  /* statistics, from the first frame on */
+  bool started;
+  uint64_t startTime;
+  uint64_t busyTime;
+  /* frames dropped because they do not fit into a network message */
+  uint64_t oversizeDrops;
+};
+
+/* tx and rx rings complete to the completion ring set as their index */
 class TxRing : public DescRing {
  public:
-  explicit TxRing(CplRing *cplRing);
+  TxRing(CplRing **cplRings, Port *ports, TxScheduler *scheds, unsigned id);
   ~TxRing();
 
   void setHeadPtr(ptr_t ptr) override;
   void dmaDone(DMAOp *op) override;
+  /* the scheduler sent the frame in `op` */
+  void sent(DMAOp *op);
 
  private:
-  CplRing *txCplRing;
+  unsigned txPort();
+  void fetchPayload(const Desc &desc, ptr_t ptr);
+
+  CplRing **txCplRings;
+  Port *ports;
+  TxScheduler *scheds;
+  unsigned id;
+  unsigned nextPort;
 };
 
 class RxRing : public DescRing {
  public:
-  explicit RxRing(CplRing *cplRing);
+  RxRing(CplRing **cplRings, RxFifo *fifo, unsigned id);
   ~RxRing();
 
+  void setSizeLog(size_t size_log) override;
+  void setHeadPtr(ptr_t ptr) override;
   void dmaDone(DMAOp *op) override;
-  void rx(RxData *rx_data);
+  /* frame of `len` bytes in the rx fifo */
+  void rx(uint8_t *data, size_t len);
 
  private:
-  CplRing *rxCplRing;
+  struct CachedDesc {
+    Desc desc;
+    ptr_t ptr;
+  };
+  struct FifoFrame {
+    uint8_t *data;
+    size_t len;
+  };
+  /* fetch the next batch of posted descriptors */
+  bool fetchDescs();
+  /* fetch descriptors for waiting frames, and write those that have one */
+  void drain();
+  void writePayload(const FifoFrame &frame, const CachedDesc &cd);
+
+  CplRing **rxCplRings;
+  RxFifo *fifo;
+  unsigned id;
+  /* fetched descriptors not used yet */
+  std::deque<CachedDesc> descCache;
+  /* frames in the fifo waiting for a descriptor */
+  std::deque<FifoFrame> frames;
+  size_t descsFetching;
+  /* bumped when the queue is shut down, descriptor fetches issued before
+   * are discarded when they complete */
+  unsigned gen;
 };
 
 class Port {
@@ -289,6 +510,9 @@ class Port {
   addr_t schedStride();
   unsigned schedType();
   unsigned rssMask();
+  unsigned rssEntry(unsigned idx);
+  /* rx queue for a packet with RSS hash `hash` */
+  unsigned rssQueue(uint32_t hash);
 
   void setId(unsigned id);
   void setFeatures(unsigned features);
@@ -298,10 +522,12 @@ class Port {
   void setSchedStride(addr_t stride);
   void setSchedType(unsigned type);
   void setRssMask(unsigned mask);
+  void setRssEntry(unsigned idx, unsigned queue);
   void schedEnable();
   void schedDisable();
   void queueEnable();
   void queueDisable();
+  bool txEnabled();
 
  private:
   unsigned _id;
@@ -312,6 +538,7 @@ class Port {
   addr_t _schedStride;
   unsigned _schedType;
   unsigned _rssMask;
+  unsigned _rssTable[RSS_TABLE_SIZE];
   bool _schedEnable;
   bool _queueEnable;
 };
@@ -326,14 +553,29 @@ class Corundum : public nicbm::SimpleDevice<reg_t> {
   void RegWrite(uint8_t bar, addr_t addr, reg_t val) override;
   void DmaComplete(nicbm::DMAOp &op) override;
   void EthRx(uint8_t port, const void *data, size_t len) override;
+  void Timed(nicbm::TimedEvent &te) override;
+  void AddOptions(nicbm::Options &opts) override;
+
+  void setIntMod(const nicbm::IntModConfig &cfg);
+  void setBatch(const BatchConfig &cfg);
+  void setRxFifoSize(size_t size);
+  void setSched(const SchedConfig &cfg);
 
  private:
-  EventRing eventRing;
-  TxRing txRing;
-  CplRing txCplRing;
-  RxRing rxRing;
-  CplRing rxCplRing;
-  Port port;
+  reg_t portRegRead(addr_t addr);
+  void portRegWrite(addr_t addr, reg_t val);
+  /* map queue registers to those of queue 0, returns the queue in `q` */
+  static addr_t queueReg(addr_t addr, unsigned &q);
+
+  nicbm::IntModerator intMod;
+  EventRing *eventRings[NUM_QUEUES];
+  TxRing *txRings[NUM_QUEUES];
+  CplRing *txCplRings[NUM_QUEUES];
+  RxRing *rxRings[NUM_QUEUES];
+  CplRing *rxCplRings[NUM_QUEUES];
+  RxFifo rxFifo;
+  Port ports[MAX_PORTS];
+  TxScheduler txScheds[MAX_PORTS];
   uint32_t features;
 };
 
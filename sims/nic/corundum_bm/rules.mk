@@ -25,7 +25,9 @@ include mk/subdir_pre.mk
 bin_corundum_bm := $(d)corundum_bm
 bin_corundum_bm_tester := $(d)tester
 
-objs_corundum_bm := $(d)corundum_bm.o
+# the device model without main, also linked into the nicbm benchmark
+objs_corundum_bm_dev := $(d)corundum_bm.o
+objs_corundum_bm := $(objs_corundum_bm_dev) $(d)corundum_bm_main.o
 objs_corundum_bm_tester := $(d)tester.o
 OBJS := $(objs_corundum_bm) $(objs_corundum_bm_tester)
 
@@ -35,6 +35,7 @@ namespace headers {
 
 #define ETH_TYPE_IP 0x0800
 #define ETH_TYPE_ARP 0x0806
+#define ETH_TYPE_IPV6 0x86DD
 
 struct eth_addr {
   uint8_t addr[ETH_ADDR_LEN];
@@ -60,6 +61,9 @@ struct eth_hdr {
 
 #define IP_HLEN 20
 
+#define IP_MF 0x2000
+#define IP_OFFMASK 0x1fff
+
 #define IP_PROTO_IP 0
 #define IP_PROTO_ICMP 1
 #define IP_PROTO_IGMP 2
@@ -96,6 +100,26 @@ struct ip_hdr {
   uint32_t dest;
 } __attribute__((packed));
 
+/******************************************************************************/
+/* IPv6 */
+
+#define IP6_HLEN 40
+#define IP6_PROTO_FRAG 44
+
+struct ip6_hdr {
+  /* version / traffic class / flow label */
+  uint32_t _v_tc_fl;
+  /* payload length */
+  uint16_t len;
+  /* next header */
+  uint8_t next;
+  /* hop limit */
+  uint8_t hop_limit;
+  /* source and destination IP addresses */
+  uint8_t src[16];
+  uint8_t dest[16];
+} __attribute__((packed));
+
 /******************************************************************************/
 /* ARP */
 
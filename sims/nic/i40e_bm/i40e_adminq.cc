@@ -25,8 +25,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
 #include <cassert>
-#include <iostream>
+#include <vector>
 
 #include "sims/nic/i40e_bm/i40e_base_wrapper.h"
 #include "sims/nic/i40e_bm/i40e_bm.h"
@@ -35,8 +36,8 @@ namespace i40e {
 
 queue_admin_tx::queue_admin_tx(i40e_bm &dev_, uint64_t &reg_base_,
                                uint32_t &reg_len_, uint32_t &reg_head_,
-                               uint32_t &reg_tail_)
-    : queue_base("atx", reg_head_, reg_tail_, dev_),
+                               uint32_t &reg_tail_, const std::string &qname_)
+    : queue_base(qname_, reg_head_, reg_tail_, dev_),
       reg_base(reg_base_),
       reg_len(reg_len_) {
   desc_len = 32;
@@ -52,14 +53,10 @@ void queue_admin_tx::reg_updated() {
   len = (reg_len & I40E_GL_ATQLEN_ATQLEN_MASK) >> I40E_GL_ATQLEN_ATQLEN_SHIFT;
 
   if (!enabled && (reg_len & I40E_GL_ATQLEN_ATQENABLE_MASK)) {
-#ifdef DEBUG_ADMINQ
-    log << " enable base=" << base << " len=" << len << logger::endl;
-#endif
+    I40E_LOG(log, kAdminq, " enable base=%x len=%x", base, len);
     enabled = true;
   } else if (enabled && !(reg_len & I40E_GL_ATQLEN_ATQENABLE_MASK)) {
-#ifdef DEBUG_ADMINQ
-    log << " disable" << logger::endl;
-#endif
+    I40E_LOG(log, kAdminq, " disable");
     enabled = false;
   }
 
@@ -84,10 +81,8 @@ void queue_admin_tx::admin_desc_ctx::desc_compl_prepare(uint16_t retval,
     d->flags |= I40E_AQ_FLAG_ERR;
   d->retval = retval;
 
-#ifdef DEBUG_ADMINQ
-  queue.log << " desc_compl_prepare index=" << index << " retval=" << retval
-            << logger::endl;
-#endif
+  I40E_LOG(queue.log, kAdminq, " desc_compl_prepare index=%x retval=%x", index,
+           retval);
 }
 
 void queue_admin_tx::admin_desc_ctx::desc_complete(uint16_t retval,
@@ -102,8 +97,10 @@ void queue_admin_tx::admin_desc_ctx::desc_complete_indir(uint16_t retval,
                                                          uint16_t extra_flags,
                                                          bool ignore_datalen) {
   if (!ignore_datalen && len > d->datalen) {
-    queue.log << "queue_admin_tx::desc_complete_indir: data too long (" << len
-              << ") got buffer for (" << d->datalen << ")" << logger::endl;
+    I40E_LOG(queue.log, kErr,
+             "queue_admin_tx::desc_complete_indir: data too long (%x) got "
+             "buffer for (%x)",
+             len, d->datalen);
     abort();
   }
   d->datalen = len;
@@ -119,10 +116,8 @@ void queue_admin_tx::admin_desc_ctx::prepare() {
   if ((d->flags & I40E_AQ_FLAG_RD)) {
     uint64_t addr = d->params.external.addr_low |
                     (((uint64_t)d->params.external.addr_high) << 32);
-#ifdef DEBUG_ADMINQ
-    queue.log << " desc with buffer opc=" << d->opcode << " addr=" << addr
-              << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, " desc with buffer opc=%x addr=%x", d->opcode,
+             addr);
     data_fetch(addr, d->datalen);
   } else {
     prepared();
@@ -130,14 +125,10 @@ void queue_admin_tx::admin_desc_ctx::prepare() {
 }
 
 void queue_admin_tx::admin_desc_ctx::process() {
-#ifdef DEBUG_ADMINQ
-  queue.log << " descriptor " << index << " fetched" << logger::endl;
-#endif
+  I40E_LOG(queue.log, kAdminq, " descriptor %x fetched", index);
 
   if (d->opcode == i40e_aqc_opc_get_version) {
-#ifdef DEBUG_ADMINQ
-    queue.log << "  get version" << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "  get version");
     struct i40e_aqc_get_version *gv =
         reinterpret_cast<struct i40e_aqc_get_version *>(d->params.raw);
     gv->rom_ver = 0;
@@ -149,43 +140,31 @@ void queue_admin_tx::admin_desc_ctx::process() {
 
     desc_complete(0);
   } else if (d->opcode == i40e_aqc_opc_request_resource) {
-#ifdef DEBUG_ADMINQ
-    queue.log << "  request resource" << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "  request resource");
     struct i40e_aqc_request_resource *rr =
         reinterpret_cast<struct i40e_aqc_request_resource *>(d->params.raw);
     rr->timeout = 180000;
-#ifdef DEBUG_ADMINQ
-    queue.log << "    res_id=" << rr->resource_id << logger::endl;
-    queue.log << "    res_nu=" << rr->resource_number << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "    res_id=%x", rr->resource_id);
+    I40E_LOG(queue.log, kAdminq, "    res_nu=%x", rr->resource_number);
     desc_complete(0);
   } else if (d->opcode == i40e_aqc_opc_release_resource) {
-#ifdef DEBUG_ADMINQ
-    queue.log << "  release resource" << logger::endl;
-#endif
-#ifdef DEBUG_ADMINQ
+    I40E_LOG(queue.log, kAdminq, "  release resource");
     struct i40e_aqc_request_resource *rr =
         reinterpret_cast<struct i40e_aqc_request_resource *>(d->params.raw);
-    queue.log << "    res_id=" << rr->resource_id << logger::endl;
-    queue.log << "    res_nu=" << rr->resource_number << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "    res_id=%x", rr->resource_id);
+    I40E_LOG(queue.log, kAdminq, "    res_nu=%x", rr->resource_number);
     desc_complete(0);
   } else if (d->opcode == i40e_aqc_opc_clear_pxe_mode) {
-#ifdef DEBUG_ADMINQ
-    queue.log << "  clear PXE mode" << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "  clear PXE mode");
     dev.regs.gllan_rctl_0 &= ~I40E_GLLAN_RCTL_0_PXE_MODE_MASK;
     desc_complete(0);
   } else if (d->opcode == i40e_aqc_opc_list_func_capabilities ||
              d->opcode == i40e_aqc_opc_list_dev_capabilities) {
-#ifdef DEBUG_ADMINQ
-    queue.log << "  get dev/fun caps" << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "  get dev/fun caps");
     struct i40e_aqc_list_capabilites *lc =
         reinterpret_cast<struct i40e_aqc_list_capabilites *>(d->params.raw);
 
-    struct i40e_aqc_list_capabilities_element_resp caps[] = {
+    std::vector<struct i40e_aqc_list_capabilities_element_resp> caps = {
         {I40E_AQ_CAP_ID_RSS, 1, 0, 512, 6, 0, {}},
         {I40E_AQ_CAP_ID_RXQ, 1, 0, dev.NUM_QUEUES, 0, 0, {}},
         {I40E_AQ_CAP_ID_TXQ, 1, 0, dev.NUM_QUEUES, 0, 0, {}},
@@ -193,49 +172,49 @@ void queue_admin_tx::admin_desc_ctx::process() {
         {I40E_AQ_CAP_ID_VSI, 1, 0, dev.NUM_VSIS, 0, 0, {}},
         {I40E_AQ_CAP_ID_DCB, 1, 0, 1, 1, 1, {}},
     };
-    size_t num_caps = sizeof(caps) / sizeof(caps[0]);
+    if (!dev.vfs.empty()) {
+      // SR-IOV 1.1, VFs numbered from 0
+      caps.push_back({I40E_AQ_CAP_ID_SRIOV, 1, 0, 1, 0, 0, {}});
+      caps.push_back(
+          {I40E_AQ_CAP_ID_VF, 1, 0, (uint32_t)dev.vfs.size(), 0, 0, {}});
+    }
+    // guaranteed and best effort filters, opt-in
+    if (dev.fd_enable) {
+      caps.push_back(
+          {I40E_AQ_CAP_ID_FLOW_DIRECTOR, 1, 0, lan::FD_MAX_FILTERS, 0, 0, {}});
+    }
+    size_t num_caps = caps.size();
+    size_t caps_len = num_caps * sizeof(caps[0]);
 
-    if (sizeof(caps) <= d->datalen) {
-#ifdef DEBUG_ADMINQ
-      queue.log << "    data fits" << logger::endl;
-#endif
+    if (caps_len <= d->datalen) {
+      I40E_LOG(queue.log, kAdminq, "    data fits");
       // data fits within the buffer
       lc->count = num_caps;
-      desc_complete_indir(0, caps, sizeof(caps));
+      desc_complete_indir(0, caps.data(), caps_len);
     } else {
-#ifdef DEBUG_ADMINQ
-      queue.log << "    data doesn't fit" << logger::endl;
-#endif
+      I40E_LOG(queue.log, kAdminq, "    data doesn't fit");
       // data does not fit
-      d->datalen = sizeof(caps);
+      d->datalen = caps_len;
       desc_complete(I40E_AQ_RC_ENOMEM);
     }
   } else if (d->opcode == i40e_aqc_opc_lldp_stop) {
-#ifdef DEBUG_ADMINQ
-    queue.log << "  lldp stop" << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "  lldp stop");
     desc_complete(0);
   } else if (d->opcode == i40e_aqc_opc_mac_address_read) {
-#ifdef DEBUG_ADMINQ
-    queue.log << "  read mac" << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "  read mac");
     struct i40e_aqc_mac_address_read *ar =
         reinterpret_cast<struct i40e_aqc_mac_address_read *>(d->params.raw);
 
     struct i40e_aqc_mac_address_read_data ard;
     uint64_t mac = dev.runner_->GetMacAddr();
-#ifdef DEBUG_ADMINQ
-    queue.log << "    mac = " << mac << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "    mac = %x", mac);
     memcpy(ard.pf_lan_mac, &mac, 6);
     memcpy(ard.port_mac, &mac, 6);
 
     ar->command_flags = I40E_AQC_LAN_ADDR_VALID | I40E_AQC_PORT_ADDR_VALID;
     desc_complete_indir(0, &ard, sizeof(ard));
   } else if (d->opcode == i40e_aqc_opc_get_phy_abilities) {
-#ifdef DEBUG_ADMINQ
-    queue.log << "  get phy abilities" << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "  get phy abilities");
     struct i40e_aq_get_phy_abilities_resp par;
     memset(&par, 0, sizeof(par));
 
@@ -249,9 +228,7 @@ void queue_admin_tx::admin_desc_ctx::process() {
 
     desc_complete_indir(0, &par, sizeof(par), 0, true);
   } else if (d->opcode == i40e_aqc_opc_get_link_status) {
-#ifdef DEBUG_ADMINQ
-    queue.log << "  link status" << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "  link status");
     struct i40e_aqc_get_link_status *gls =
         reinterpret_cast<struct i40e_aqc_get_link_status *>(d->params.raw);
 
@@ -271,9 +248,7 @@ void queue_admin_tx::admin_desc_ctx::process() {
 
     desc_complete(0);
   } else if (d->opcode == i40e_aqc_opc_get_switch_config) {
-#ifdef DEBUG_ADMINQ
-    queue.log << "  get switch config" << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "  get switch config");
     struct i40e_aqc_switch_seid *sw =
         reinterpret_cast<struct i40e_aqc_switch_seid *>(d->params.raw);
     struct i40e_aqc_get_switch_config_header_resp hr;
@@ -328,10 +303,8 @@ void queue_admin_tx::admin_desc_ctx::process() {
     memset(&hr, 0, sizeof(hr));
     hr.num_reported = report;
     hr.num_total = cnt;
-#ifdef DEBUG_ADMINQ
-    queue.log << "    report=" << report << " cnt=" << cnt
-              << "  seid=" << sw->seid << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "    report=%x cnt=%x  seid=%x", report, cnt,
+             sw->seid);
 
     // create temporary contiguous buffer
     size_t buflen = sizeof(hr) + sizeof(els[0]) * report;
@@ -341,9 +314,7 @@ void queue_admin_tx::admin_desc_ctx::process() {
 
     desc_complete_indir(0, buf, buflen);
   } else if (d->opcode == i40e_aqc_opc_set_switch_config) {
-#ifdef DEBUG_ADMINQ
-    queue.log << "  set switch config" << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "  set switch config");
     /* TODO: lots of interesting things here like l2 filtering etc. that are
      * relevant.
     struct i40e_aqc_set_switch_config *sc =
@@ -351,10 +322,37 @@ void queue_admin_tx::admin_desc_ctx::process() {
                 d->params.raw);
     */
     desc_complete(0);
+  } else if (d->opcode == i40e_aqc_opc_add_vsi) {
+    I40E_LOG(queue.log, kAdminq, "  add vsi");
+    struct i40e_aqc_add_get_update_vsi *v =
+        reinterpret_cast<struct i40e_aqc_add_get_update_vsi *>(d->params.raw);
+    struct i40e_aqc_add_get_update_vsi_completion *vc =
+        reinterpret_cast<struct i40e_aqc_add_get_update_vsi_completion *>(
+            d->params.raw);
+    I40E_LOG(queue.log, kAdminq, "    uplink=%x flags=%x", v->uplink_seid,
+             v->vsi_flags);
+
+    // only the seid and owning VF are tracked: the properties in the buffer
+    // are ignored as for update vsi parameters, and queues are steered by the
+    // lan manager
+    if (dev.vsis_added + 1u >= dev.NUM_VSIS) {
+      desc_complete(I40E_AQ_RC_ENOSPC);
+    } else {
+      dev.vsis_added++;
+      bool vf_vsi = (v->vsi_flags & I40E_AQ_VSI_TYPE_MASK) ==
+                    I40E_AQ_VSI_TYPE_VF;
+      dev.vsi_vf[dev.vsis_added] =
+          vf_vsi && v->vf_id < dev.vfs.size() ? v->vf_id : -1;
+      // seids of added VSIs follow the PF VSI's (512)
+      vc->seid = 512 + dev.vsis_added;
+      vc->vsi_number = dev.vsis_added;
+      vc->vsi_used = dev.vsis_added + 1;
+      vc->vsi_free = dev.NUM_VSIS - vc->vsi_used;
+      I40E_LOG(queue.log, kAdminq, "    seid=%x", vc->seid);
+      desc_complete(0);
+    }
   } else if (d->opcode == i40e_aqc_opc_get_vsi_parameters) {
-#ifdef DEBUG_ADMINQ
-    queue.log << "  get vsi parameters" << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "  get vsi parameters");
     /*struct i40e_aqc_add_get_update_vsi *v =
         reinterpret_cast<struct i40e_aqc_add_get_update_vsi *>(
                 d->params.raw);*/
@@ -366,58 +364,290 @@ void queue_admin_tx::admin_desc_ctx::process() {
         I40E_AQ_VSI_PROP_QUEUE_OPT_VALID | I40E_AQ_VSI_PROP_SCHED_VALID;
     desc_complete_indir(0, &pd, sizeof(pd));
   } else if (d->opcode == i40e_aqc_opc_update_vsi_parameters) {
-#ifdef DEBUG_ADMINQ
-    queue.log << "  update vsi parameters" << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "  update vsi parameters");
     /* TODO */
     desc_complete(0);
   } else if (d->opcode == i40e_aqc_opc_set_dcb_parameters) {
-#ifdef DEBUG_ADMINQ
-    queue.log << "  set dcb parameters" << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "  set dcb parameters");
     /* TODO */
     desc_complete(0);
   } else if (d->opcode == i40e_aqc_opc_configure_vsi_bw_limit) {
-#ifdef DEBUG_ADMINQ
-    queue.log << "  configure vsi bw limit" << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "  configure vsi bw limit");
     desc_complete(0);
   } else if (d->opcode == i40e_aqc_opc_query_vsi_bw_config) {
-#ifdef DEBUG_ADMINQ
-    queue.log << "  query vsi bw config" << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "  query vsi bw config");
     struct i40e_aqc_query_vsi_bw_config_resp bwc;
     memset(&bwc, 0, sizeof(bwc));
     for (size_t i = 0; i < 8; i++)
       bwc.qs_handles[i] = 0xffff;
     desc_complete_indir(0, &bwc, sizeof(bwc));
   } else if (d->opcode == i40e_aqc_opc_query_vsi_ets_sla_config) {
-#ifdef DEBUG_ADMINQ
-    queue.log << "  query vsi ets sla config" << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "  query vsi ets sla config");
     struct i40e_aqc_query_vsi_ets_sla_config_resp sla;
     memset(&sla, 0, sizeof(sla));
     for (size_t i = 0; i < 8; i++)
       sla.share_credits[i] = 127;
     desc_complete_indir(0, &sla, sizeof(sla));
+  } else if (d->opcode == i40e_aqc_opc_rx_ctl_reg_read ||
+             d->opcode == i40e_aqc_opc_rx_ctl_reg_write) {
+    // rx control registers (e.g. RSS) are accessed through the admin queue
+    // by newer drivers
+    struct i40e_aqc_rx_ctl_reg_read_write *rw =
+        reinterpret_cast<struct i40e_aqc_rx_ctl_reg_read_write *>(
+            d->params.raw);
+    I40E_LOG(queue.log, kAdminq, "  rx ctl reg %x", rw->address);
+    if (d->opcode == i40e_aqc_opc_rx_ctl_reg_read)
+      rw->value = dev.RegRead32(i40e_bm::BAR_REGS, rw->address);
+    else
+      dev.RegWrite32(i40e_bm::BAR_REGS, rw->address, rw->value);
+    desc_complete(0);
+  } else if (d->opcode == i40e_aqc_opc_add_macvlan) {
+    I40E_LOG(queue.log, kAdminq, "  add macvlan");
+    struct i40e_aqc_macvlan *m =
+        reinterpret_cast<struct i40e_aqc_macvlan *>(d->params.raw);
+    struct i40e_aqc_add_macvlan_element_data *ave =
+        reinterpret_cast<struct i40e_aqc_add_macvlan_element_data *>(data);
+    // addresses of VF VSIs steer received and locally sent frames to the VF
+    int16_t vf = dev.vsi_vf_get(m->seid[0]);
+    size_t n = std::min<size_t>(m->num_addresses, d->datalen / sizeof(*ave));
+    for (size_t i = 0; i < n; i++) {
+      if (vf >= 0)
+        dev.lanmgr.vf_mac_add(ave[i].mac_addr, vf);
+      ave[i].match_method = I40E_AQC_MM_PERFECT_MATCH;
+    }
+
+    desc_complete_indir(0, data, d->datalen);
   } else if (d->opcode == i40e_aqc_opc_remove_macvlan) {
-#ifdef DEBUG_ADMINQ
-    queue.log << "  remove macvlan" << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "  remove macvlan");
     struct i40e_aqc_macvlan *m =
         reinterpret_cast<struct i40e_aqc_macvlan *>(d->params.raw);
     struct i40e_aqc_remove_macvlan_element_data *rve =
         reinterpret_cast<struct i40e_aqc_remove_macvlan_element_data *>(data);
-    for (uint16_t i = 0; i < m->num_addresses; i++)
+    int16_t vf = dev.vsi_vf_get(m->seid[0]);
+    for (uint16_t i = 0; i < m->num_addresses; i++) {
+      if (vf >= 0)
+        dev.lanmgr.vf_mac_remove(rve[i].mac_addr);
       rve[i].error_code = I40E_AQC_REMOVE_MACVLAN_SUCCESS;
+    }
 
     desc_complete_indir(0, data, d->datalen);
+  } else if (d->opcode == i40e_aqc_opc_send_msg_to_vf) {
+    struct i40e_aqc_pf_vf_message *vm =
+        reinterpret_cast<struct i40e_aqc_pf_vf_message *>(d->params.raw);
+    I40E_LOG(queue.log, kAdminq, "  send msg to vf %x len=%x", vm->id,
+             d->datalen);
+    if (vm->id >= dev.vfs.size()) {
+      desc_complete(I40E_AQ_RC_EINVAL);
+    } else {
+      bool buf = d->flags & I40E_AQ_FLAG_RD;
+      dev.vfs[vm->id]->arq.post(*d, data, buf ? d->datalen : 0);
+      desc_complete(0);
+    }
   } else {
-#ifdef DEBUG_ADMINQ
-    queue.log << "  uknown opcode=" << d->opcode << logger::endl;
-#endif
+    I40E_LOG(queue.log, kAdminq, "  uknown opcode=%x", d->opcode);
     // desc_complete(I40E_AQ_RC_ESRCH);
     desc_complete(0);
   }
 }
+
+queue_vf_admin_tx::queue_vf_admin_tx(vf_func &vf_, uint64_t &reg_base_,
+                                     uint32_t &reg_len_, uint32_t &reg_head_,
+                                     uint32_t &reg_tail_)
+    : queue_admin_tx(vf_.dev, reg_base_, reg_len_, reg_head_, reg_tail_,
+                     "vf" + std::to_string(vf_.id) + ".atx"),
+      vf(vf_) {
+  // the base constructor created its contexts before this override existed
+  for (size_t i = 0; i < MAX_ACTIVE_DESCS; i++)
+    delete desc_ctxs[i];
+  ctxs_init();
+}
+
+queue_base::desc_ctx &queue_vf_admin_tx::desc_ctx_create() {
+  return *new vf_desc_ctx(*this, dev);
+}
+
+queue_vf_admin_tx::vf_desc_ctx::vf_desc_ctx(queue_vf_admin_tx &queue_,
+                                            i40e_bm &dev_)
+    : admin_desc_ctx(queue_, dev_), vf(queue_.vf) {
+}
+
+void queue_vf_admin_tx::vf_desc_ctx::process() {
+  I40E_LOG(queue.log, kAdminq, " descriptor %x fetched", index);
+
+  if (d->opcode == i40e_aqc_opc_send_msg_to_pf) {
+    I40E_LOG(queue.log, kAdminq, "  send msg to pf len=%x", d->datalen);
+    // the PF driver finds the sending VF in the return value
+    struct i40e_aq_desc ev = *d;
+    ev.retval = vf.id;
+    bool buf = d->flags & I40E_AQ_FLAG_RD;
+    dev.pf_arq.post(ev, data, buf ? d->datalen : 0);
+    desc_complete(0);
+  } else {
+    I40E_LOG(queue.log, kAdminq, "  unknown opcode=%x", d->opcode);
+    desc_complete(0);
+  }
+}
+
+queue_admin_rx::queue_admin_rx(const std::string &qname, i40e_bm &dev_,
+                               uint64_t &reg_base_, uint32_t &reg_len_,
+                               uint32_t &reg_head_, uint32_t &reg_tail_)
+    : dev(dev_),
+      log(qname, dev_),
+      reg_base(reg_base_),
+      reg_len(reg_len_),
+      reg_head(reg_head_),
+      reg_tail(reg_tail_),
+      busy(false),
+      gen(0) {
+}
+
+queue_admin_rx::~queue_admin_rx() {
+}
+
+void queue_admin_rx::reset() {
+  I40E_LOG(log, kAdminq, "reset");
+  pending.clear();
+  busy = false;
+  gen++;
+}
+
+void queue_admin_rx::reg_updated() {
+  trigger();
+}
+
+void queue_admin_rx::post(const i40e_aq_desc &desc, const void *data,
+                          size_t len) {
+  if (len > MAX_MSG_LEN) {
+    I40E_LOG(log, kErr, "post: message too long (%x), truncating", len);
+    len = MAX_MSG_LEN;
+  }
+
+  pending.emplace_back();
+  event &ev = pending.back();
+  memcpy(ev.desc, &desc, sizeof(ev.desc));
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(data);
+  ev.data.assign(p, p + len);
+  I40E_LOG(log, kAdminq, "post opc=%x len=%x pending=%x", desc.opcode, len,
+           pending.size());
+  trigger();
+}
+
+void queue_admin_rx::trigger() {
+  uint32_t len = (reg_len & I40E_PF_ARQLEN_ARQLEN_MASK) >>
+                 I40E_PF_ARQLEN_ARQLEN_SHIFT;
+  if (busy || pending.empty() || !(reg_len & I40E_PF_ARQLEN_ARQENABLE_MASK) ||
+      len == 0)
+    return;
+
+  // the driver posts buffers up to the one before the tail
+  uint32_t head = reg_head & I40E_PF_ARQH_ARQH_MASK;
+  if (head == (reg_tail & I40E_PF_ARQT_ARQT_MASK) || head >= len)
+    return;
+
+  busy = true;
+  dma_arq *dma = new dma_arq(*this, dma_arq::ARQ_FETCH, sizeof(event::desc));
+  dma->write_ = false;
+  dma->dma_addr_ = reg_base + head * sizeof(event::desc);
+  dev.runner_->IssueDma(*dma);
+}
+
+void queue_admin_rx::desc_fetched(const void *host_desc) {
+  const struct i40e_aq_desc *hd =
+      reinterpret_cast<const struct i40e_aq_desc *>(host_desc);
+  event &ev = pending.front();
+  struct i40e_aq_desc *d = reinterpret_cast<struct i40e_aq_desc *>(ev.desc);
+
+  uint64_t addr = hd->params.external.addr_low |
+                  (((uint64_t)hd->params.external.addr_high) << 32);
+  size_t len = ev.data.size();
+  if (len > hd->datalen) {
+    I40E_LOG(log, kErr, "event longer (%x) than the buffer (%x), truncating",
+             len, hd->datalen);
+    len = hd->datalen;
+  }
+
+  d->flags = I40E_AQ_FLAG_DD | I40E_AQ_FLAG_CMP;
+  if (len)
+    d->flags |= I40E_AQ_FLAG_BUF;
+  d->datalen = len;
+  d->params.external.addr_high = hd->params.external.addr_high;
+  d->params.external.addr_low = hd->params.external.addr_low;
+
+  // DMAs are issued and completed in order, the buffer is written before the
+  // descriptor
+  if (len) {
+    dma_arq *data = new dma_arq(*this, dma_arq::ARQ_DATA, len);
+    data->write_ = true;
+    data->dma_addr_ = addr;
+    memcpy(data->data_, ev.data.data(), len);
+    dev.runner_->IssueDma(*data);
+  }
+
+  uint32_t head = reg_head & I40E_PF_ARQH_ARQH_MASK;
+  dma_arq *wb = new dma_arq(*this, dma_arq::ARQ_WB, sizeof(ev.desc));
+  wb->write_ = true;
+  wb->dma_addr_ = reg_base + head * sizeof(ev.desc);
+  memcpy(wb->data_, ev.desc, sizeof(ev.desc));
+  dev.runner_->IssueDma(*wb);
+}
+
+void queue_admin_rx::event_written() {
+  uint32_t len = (reg_len & I40E_PF_ARQLEN_ARQLEN_MASK) >>
+                 I40E_PF_ARQLEN_ARQLEN_SHIFT;
+  reg_head = ((reg_head & I40E_PF_ARQH_ARQH_MASK) + 1) % len;
+  pending.pop_front();
+  busy = false;
+  I40E_LOG(log, kAdminq, "event written head=%x pending=%x", reg_head,
+           pending.size());
+
+  interrupt();
+  trigger();
+}
+
+void queue_admin_rx::interrupt() {
+}
+
+queue_admin_rx::dma_arq::dma_arq(queue_admin_rx &aq_, step st_, size_t len)
+    : aq(aq_), st(st_), gen(aq_.gen) {
+  data_ = new uint8_t[len];
+  len_ = len;
+}
+
+queue_admin_rx::dma_arq::~dma_arq() {
+  delete[]((uint8_t *)data_);
+}
+
+void queue_admin_rx::dma_arq::done() {
+  // completions from before a reset of the queue are dropped
+  if (gen == aq.gen) {
+    if (st == ARQ_FETCH)
+      aq.desc_fetched(data_);
+    else if (st == ARQ_WB)
+      aq.event_written();
+  }
+  delete this;
+}
+
+queue_pf_admin_rx::queue_pf_admin_rx(i40e_bm &dev_, uint64_t &reg_base_,
+                                     uint32_t &reg_len_, uint32_t &reg_head_,
+                                     uint32_t &reg_tail_)
+    : queue_admin_rx("arx", dev_, reg_base_, reg_len_, reg_head_, reg_tail_) {
+}
+
+void queue_pf_admin_rx::interrupt() {
+  uint32_t ena = dev.regs.pfint_icr0_ena;
+  uint32_t gctl = dev.regs.pfint_dyn_ctl0;
+  if (!(ena & I40E_PFINT_ICR0_ENA_ADMINQ_MASK) ||
+      !(gctl & I40E_PFINT_DYN_CTL0_INTENA_MASK)) {
+    I40E_LOG(log, kAdminq, " interrupt cause disabled");
+    return;
+  }
+
+  dev.regs.pfint_icr0 |=
+      I40E_PFINT_ICR0_INTEVENT_MASK | I40E_PFINT_ICR0_ADMINQ_MASK;
+  uint8_t itr = (dev.regs.pfint_stat_ctl0 &
+                 I40E_PFINT_STAT_CTL0_OTHER_ITR_INDX_MASK) >>
+                I40E_PFINT_STAT_CTL0_OTHER_ITR_INDX_SHIFT;
+  dev.SignalInterrupt(0, itr);
+}
 }  // namespace i40e
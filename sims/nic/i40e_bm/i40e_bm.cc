@@ -24,20 +24,23 @@
 
 #include "sims/nic/i40e_bm/i40e_bm.h"
 
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
 #include <cassert>
-#include <iostream>
 
-#include "lib/simbricks/nicbm/multinic.h"
 #include "sims/nic/i40e_bm/i40e_base_wrapper.h"
 
 namespace i40e {
 
 i40e_bm::i40e_bm()
-    : log("i40e", *this),
+    : fd_enable(false),
+      log("i40e", *this),
       pf_atq(*this, regs.pf_atqba, regs.pf_atqlen, regs.pf_atqh, regs.pf_atqt),
+      pf_arq(*this, regs.pf_arqba, regs.pf_arqlen, regs.pf_arqh, regs.pf_arqt),
       hmc(*this),
       shram(*this),
       lanmgr(*this, NUM_QUEUES) {
@@ -45,6 +48,14 @@ i40e_bm::i40e_bm()
 }
 
 i40e_bm::~i40e_bm() {
+  lanmgr.print_stats(stderr);
+  for (vf_func *vf : vfs)
+    delete vf;
+}
+
+void i40e_bm::set_vfs(uint16_t n) {
+  for (uint16_t i = vfs.size(); i < n && i < MAX_VFS; i++)
+    vfs.push_back(new vf_func(*this, i));
 }
 
 void i40e_bm::SetupIntro(struct SimbricksProtoPcieDevIntro &di) {
@@ -55,6 +66,14 @@ void i40e_bm::SetupIntro(struct SimbricksProtoPcieDevIntro &di) {
   di.bars[BAR_MSIX].len = 32 * 1024;
   di.bars[BAR_MSIX].flags =
       SIMBRICKS_PROTO_PCIE_BAR_64 | SIMBRICKS_PROTO_PCIE_BAR_DUMMY;
+  if (!vfs.empty()) {
+    // one register window per VF, the bar size a power of two
+    uint64_t len = VF_WINDOW;
+    while (len < vfs.size() * VF_WINDOW)
+      len *= 2;
+    di.bars[BAR_VF].len = len;
+    di.bars[BAR_VF].flags = 0;
+  }
 
   di.pci_vendor_id = I40E_INTEL_VENDOR_ID;
   di.pci_device_id = I40E_DEV_ID_QSFP_A;
@@ -73,16 +92,12 @@ void i40e_bm::SetupIntro(struct SimbricksProtoPcieDevIntro &di) {
 
 void i40e_bm::DmaComplete(nicbm::DMAOp &op) {
   dma_base &dma = dynamic_cast<dma_base &>(op);
-#ifdef DEBUG_DEV
-  log << "dma_complete(" << &op << ")" << logger::endl;
-#endif
+  I40E_LOG(log, kDev, "dma_complete(%p)", &op);
   dma.done();
 }
 
 void i40e_bm::EthRx(uint8_t port, const void *data, size_t len) {
-#ifdef DEBUG_DEV
-  log << "i40e: received packet len=" << len << logger::endl;
-#endif
+  I40E_LOG(log, kDev, "received packet len=%x", len);
   lanmgr.packet_received(data, len);
 }
 
@@ -95,8 +110,8 @@ void i40e_bm::RegRead(uint8_t bar, uint64_t addr, void *dest, size_t len) {
     dest_p[0] = RegRead32(bar, addr);
     dest_p[1] = RegRead32(bar, addr + 4);
   } else {
-    log << "currently we only support 4/8B reads (got " << len << ")"
-        << logger::endl;
+    I40E_LOG(log, kErr, "currently we only support 4/8B reads (got %x)",
+             len);
     abort();
   }
 }
@@ -106,8 +121,15 @@ uint32_t i40e_bm::RegRead32(uint8_t bar, uint64_t addr) {
     return reg_mem_read32(addr);
   } else if (bar == BAR_IO) {
     return reg_io_read(addr);
+  } else if (bar == BAR_VF) {
+    uint64_t pf_addr;
+    if (addr / VF_WINDOW < vfs.size() &&
+        vfs[addr / VF_WINDOW]->reg_map(addr % VF_WINDOW, pf_addr))
+      return reg_mem_read32(pf_addr);
+    I40E_LOG(log, kDev, "unhandled vf read addr=%x", addr);
+    return 0;
   } else {
-    log << "invalid BAR " << (int)bar << logger::endl;
+    I40E_LOG(log, kErr, "invalid BAR %d", bar);
     abort();
   }
 }
@@ -122,8 +144,8 @@ void i40e_bm::RegWrite(uint8_t bar, uint64_t addr, const void *src,
     RegWrite32(bar, addr, src_p[0]);
     RegWrite32(bar, addr + 4, src_p[1]);
   } else {
-    log << "currently we only support 4/8B writes (got " << len << ")"
-        << logger::endl;
+    I40E_LOG(log, kErr, "currently we only support 4/8B writes (got %x)",
+             len);
     abort();
   }
 }
@@ -133,82 +155,116 @@ void i40e_bm::RegWrite32(uint8_t bar, uint64_t addr, uint32_t val) {
     reg_mem_write32(addr, val);
   } else if (bar == BAR_IO) {
     reg_io_write(addr, val);
+  } else if (bar == BAR_VF) {
+    uint64_t pf_addr;
+    if (addr / VF_WINDOW < vfs.size() &&
+        vfs[addr / VF_WINDOW]->reg_map(addr % VF_WINDOW, pf_addr))
+      reg_mem_write32(pf_addr, val);
+    else
+      I40E_LOG(log, kDev, "unhandled vf write addr=%x val=%x", addr, val);
   } else {
-    log << "invalid BAR " << (int)bar << logger::endl;
+    I40E_LOG(log, kErr, "invalid BAR %d", bar);
     abort();
   }
 }
 
 uint32_t i40e_bm::reg_io_read(uint64_t addr) {
-  log << "unhandled io read addr=" << addr << logger::endl;
+  I40E_LOG(log, kErr, "unhandled io read addr=%x", addr);
   return 0;
 }
 
 void i40e_bm::reg_io_write(uint64_t addr, uint32_t val) {
-  log << "unhandled io write addr=" << addr << " val=" << val << logger::endl;
+  I40E_LOG(log, kErr, "unhandled io write addr=%x val=%x", addr, val);
+}
+
+#define REG_ARRAY(first, field, stride, hook)                               \
+  {(first), (first) + (sizeof(i40e_regs::field) / 4 - 1) * (stride), (stride), \
+   offsetof(i40e_regs, field), (hook)}
+
+constexpr i40e_bm::reg_array i40e_bm::reg_arrays[] = {
+    REG_ARRAY(I40E_PFINT_ITRN(0, 0), pfint_itrn[0], 4, RA_HOOK_NONE),
+    REG_ARRAY(I40E_PFINT_ITRN(1, 0), pfint_itrn[1], 4, RA_HOOK_NONE),
+    REG_ARRAY(I40E_PFINT_ITRN(2, 0), pfint_itrn[2], 4, RA_HOOK_NONE),
+    REG_ARRAY(I40E_PFINT_DYN_CTLN(0), pfint_dyn_ctln, 4, RA_HOOK_NONE),
+    REG_ARRAY(I40E_PFINT_LNKLSTN(0), pfint_lnklstn, 4, RA_HOOK_NONE),
+    REG_ARRAY(I40E_PFINT_RATEN(0), pfint_raten, 4, RA_HOOK_NONE),
+    REG_ARRAY(I40E_QINT_RQCTL(0), qint_rqctl, 4, RA_HOOK_NONE),
+    REG_ARRAY(I40E_QINT_TQCTL(0), qint_tqctl, 4, RA_HOOK_NONE),
+    REG_ARRAY(I40E_VPLAN_QTABLE(0, 0), vplan_qtable[0], 4, RA_HOOK_VF_QMAP),
+    REG_ARRAY(I40E_VPLAN_QTABLE(1, 0), vplan_qtable[1], 4, RA_HOOK_VF_QMAP),
+    REG_ARRAY(I40E_VPLAN_QTABLE(2, 0), vplan_qtable[2], 4, RA_HOOK_VF_QMAP),
+    REG_ARRAY(I40E_VPLAN_QTABLE(3, 0), vplan_qtable[3], 4, RA_HOOK_VF_QMAP),
+    REG_ARRAY(I40E_VPLAN_QTABLE(4, 0), vplan_qtable[4], 4, RA_HOOK_VF_QMAP),
+    REG_ARRAY(I40E_VPLAN_QTABLE(5, 0), vplan_qtable[5], 4, RA_HOOK_VF_QMAP),
+    REG_ARRAY(I40E_VPLAN_QTABLE(6, 0), vplan_qtable[6], 4, RA_HOOK_VF_QMAP),
+    REG_ARRAY(I40E_VPLAN_QTABLE(7, 0), vplan_qtable[7], 4, RA_HOOK_VF_QMAP),
+    REG_ARRAY(I40E_VPLAN_QTABLE(8, 0), vplan_qtable[8], 4, RA_HOOK_VF_QMAP),
+    REG_ARRAY(I40E_VPLAN_QTABLE(9, 0), vplan_qtable[9], 4, RA_HOOK_VF_QMAP),
+    REG_ARRAY(I40E_VPLAN_QTABLE(10, 0), vplan_qtable[10], 4, RA_HOOK_VF_QMAP),
+    REG_ARRAY(I40E_VPLAN_QTABLE(11, 0), vplan_qtable[11], 4, RA_HOOK_VF_QMAP),
+    REG_ARRAY(I40E_VPLAN_QTABLE(12, 0), vplan_qtable[12], 4, RA_HOOK_VF_QMAP),
+    REG_ARRAY(I40E_VPLAN_QTABLE(13, 0), vplan_qtable[13], 4, RA_HOOK_VF_QMAP),
+    REG_ARRAY(I40E_VPLAN_QTABLE(14, 0), vplan_qtable[14], 4, RA_HOOK_VF_QMAP),
+    REG_ARRAY(I40E_VPLAN_QTABLE(15, 0), vplan_qtable[15], 4, RA_HOOK_VF_QMAP),
+    REG_ARRAY(I40E_VPLAN_MAPENA(0), vplan_mapena, 4, RA_HOOK_VF_QMAP),
+    REG_ARRAY(I40E_VFGEN_RSTAT1(0), vfgen_rstat1, 4, RA_HOOK_NONE),
+    REG_ARRAY(I40E_VF_ATQBAL(0), vf_atqbal, 4, RA_HOOK_VF_ATQ),
+    REG_ARRAY(I40E_VF_ARQBAL(0), vf_arqbal, 4, RA_HOOK_VF_ARQ),
+    REG_ARRAY(I40E_VF_ATQBAH(0), vf_atqbah, 4, RA_HOOK_VF_ATQ),
+    REG_ARRAY(I40E_VF_ARQBAH(0), vf_arqbah, 4, RA_HOOK_VF_ARQ),
+    REG_ARRAY(I40E_VF_ATQLEN(0), vf_atqlen, 4, RA_HOOK_VF_ATQ),
+    REG_ARRAY(I40E_VF_ARQLEN(0), vf_arqlen, 4, RA_HOOK_VF_ARQ),
+    REG_ARRAY(I40E_VF_ATQH(0), vf_atqh, 4, RA_HOOK_VF_ATQ),
+    REG_ARRAY(I40E_VF_ARQH(0), vf_arqh, 4, RA_HOOK_VF_ARQ),
+    REG_ARRAY(I40E_VF_ATQT(0), vf_atqt, 4, RA_HOOK_VF_ATQ),
+    REG_ARRAY(I40E_VF_ARQT(0), vf_arqt, 4, RA_HOOK_VF_ARQ),
+    REG_ARRAY(I40E_VPGEN_VFRTRIG(0), vpgen_vfrtrig, 4, RA_HOOK_VF_RESET),
+    REG_ARRAY(I40E_VPGEN_VFRSTAT(0), vpgen_vfrstat, 4, RA_HOOK_NONE),
+    REG_ARRAY(I40E_GLHMC_LANTXBASE(0), glhmc_lantxbase, 4, RA_HOOK_NONE),
+    REG_ARRAY(I40E_GLHMC_LANTXCNT(0), glhmc_lantxcnt, 4, RA_HOOK_NONE),
+    REG_ARRAY(I40E_GLHMC_LANRXBASE(0), glhmc_lanrxbase, 4, RA_HOOK_NONE),
+    REG_ARRAY(I40E_GLHMC_LANRXCNT(0), glhmc_lanrxcnt, 4, RA_HOOK_NONE),
+    REG_ARRAY(I40E_GLLAN_TXPRE_QDIS(0), gllan_txpre_qdis, 4, RA_HOOK_NONE),
+    REG_ARRAY(I40E_QTX_ENA(0), qtx_ena, 4, RA_HOOK_QTX_ENA),
+    REG_ARRAY(I40E_QTX_CTL(0), qtx_ctl, 4, RA_HOOK_NONE),
+    REG_ARRAY(I40E_QTX_TAIL(0), qtx_tail, 4, RA_HOOK_QTX_TAIL),
+    REG_ARRAY(I40E_QRX_ENA(0), qrx_ena, 4, RA_HOOK_QRX_ENA),
+    REG_ARRAY(I40E_QRX_TAIL(0), qrx_tail, 4, RA_HOOK_QRX_TAIL),
+    REG_ARRAY(I40E_PFQF_HLUT(0), pfqf_hlut, 128, RA_HOOK_NONE),
+    REG_ARRAY(I40E_PFQF_HKEY(0), pfqf_hkey, 128, RA_HOOK_RSS_KEY),
+    REG_ARRAY(I40E_PFQF_HENA(0), pfqf_hena, 128, RA_HOOK_NONE),
+    REG_ARRAY(I40E_GLQF_PCNT(0), glqf_pcnt, 4, RA_HOOK_NONE),
+};
+constexpr size_t i40e_bm::NUM_REG_ARRAYS =
+    sizeof(i40e_bm::reg_arrays) / sizeof(i40e_bm::reg_arrays[0]);
+
+#undef REG_ARRAY
+
+const i40e_bm::reg_array *i40e_bm::reg_array_lookup(uint64_t addr) {
+  constexpr auto sorted = []() {
+    for (size_t i = 1; i < NUM_REG_ARRAYS; i++) {
+      if (reg_arrays[i].first <= reg_arrays[i - 1].last)
+        return false;
+    }
+    return true;
+  };
+  static_assert(sorted(), "register arrays must be sorted and not overlap");
+
+  // last array starting at or before addr
+  const reg_array *end = reg_arrays + NUM_REG_ARRAYS;
+  const reg_array *ra = std::upper_bound(
+      reg_arrays, end, addr,
+      [](uint64_t a, const reg_array &r) { return a < r.first; });
+  if (ra == reg_arrays || addr > (--ra)->last)
+    return nullptr;
+  return ra;
 }
 
 uint32_t i40e_bm::reg_mem_read32(uint64_t addr) {
   uint32_t val = 0;
 
-  if (addr >= I40E_PFINT_DYN_CTLN(0) &&
-      addr < I40E_PFINT_DYN_CTLN(NUM_PFINTS - 1)) {
-    val = regs.pfint_dyn_ctln[(addr - I40E_PFINT_DYN_CTLN(0)) / 4];
-  } else if (addr >= I40E_PFINT_LNKLSTN(0) &&
-             addr <= I40E_PFINT_LNKLSTN(NUM_PFINTS - 1)) {
-    val = regs.pfint_lnklstn[(addr - I40E_PFINT_LNKLSTN(0)) / 4];
-  } else if (addr >= I40E_PFINT_RATEN(0) &&
-             addr <= I40E_PFINT_RATEN(NUM_PFINTS - 1)) {
-    val = regs.pfint_raten[(addr - I40E_PFINT_RATEN(0)) / 4];
-
-  } else if (addr >= I40E_GLLAN_TXPRE_QDIS(0) &&
-             addr < I40E_GLLAN_TXPRE_QDIS(12)) {
-    val = regs.gllan_txpre_qdis[(addr - I40E_GLLAN_TXPRE_QDIS(0)) / 4];
-  } else if (addr >= I40E_QINT_TQCTL(0) &&
-             addr <= I40E_QINT_TQCTL(NUM_QUEUES - 1)) {
-    val = regs.qint_tqctl[(addr - I40E_QINT_TQCTL(0)) / 4];
-  } else if (addr >= I40E_QTX_ENA(0) && addr <= I40E_QTX_ENA(NUM_QUEUES - 1)) {
-    val = regs.qtx_ena[(addr - I40E_QTX_ENA(0)) / 4];
-  } else if (addr >= I40E_QTX_TAIL(0) &&
-             addr <= I40E_QTX_TAIL(NUM_QUEUES - 1)) {
-    val = regs.qtx_tail[(addr - I40E_QTX_TAIL(0)) / 4];
-  } else if (addr >= I40E_QTX_CTL(0) && addr <= I40E_QTX_CTL(NUM_QUEUES - 1)) {
-    val = regs.qtx_ctl[(addr - I40E_QTX_CTL(0)) / 4];
-  } else if (addr >= I40E_QINT_RQCTL(0) &&
-             addr <= I40E_QINT_RQCTL(NUM_QUEUES - 1)) {
-    val = regs.qint_rqctl[(addr - I40E_QINT_RQCTL(0)) / 4];
-  } else if (addr >= I40E_QRX_ENA(0) && addr <= I40E_QRX_ENA(NUM_QUEUES - 1)) {
-    val = regs.qrx_ena[(addr - I40E_QRX_ENA(0)) / 4];
-  } else if (addr >= I40E_QRX_TAIL(0) &&
-             addr <= I40E_QRX_TAIL(NUM_QUEUES - 1)) {
-    val = regs.qrx_tail[(addr - I40E_QRX_TAIL(0)) / 4];
-  } else if (addr >= I40E_GLHMC_LANTXBASE(0) &&
-             addr <= I40E_GLHMC_LANTXBASE(I40E_GLHMC_LANTXBASE_MAX_INDEX)) {
-    val = regs.glhmc_lantxbase[(addr - I40E_GLHMC_LANTXBASE(0)) / 4];
-  } else if (addr >= I40E_GLHMC_LANTXCNT(0) &&
-             addr <= I40E_GLHMC_LANTXCNT(I40E_GLHMC_LANTXCNT_MAX_INDEX)) {
-    val = regs.glhmc_lantxcnt[(addr - I40E_GLHMC_LANTXCNT(0)) / 4];
-  } else if (addr >= I40E_GLHMC_LANRXBASE(0) &&
-             addr <= I40E_GLHMC_LANRXBASE(I40E_GLHMC_LANRXBASE_MAX_INDEX)) {
-    val = regs.glhmc_lanrxbase[(addr - I40E_GLHMC_LANRXBASE(0)) / 4];
-  } else if (addr >= I40E_GLHMC_LANRXCNT(0) &&
-             addr <= I40E_GLHMC_LANRXCNT(I40E_GLHMC_LANRXCNT_MAX_INDEX)) {
-    val = regs.glhmc_lanrxcnt[(addr - I40E_GLHMC_LANRXCNT(0)) / 4];
-  } else if (addr >= I40E_PFQF_HKEY(0) &&
-             addr <= I40E_PFQF_HKEY(I40E_PFQF_HKEY_MAX_INDEX)) {
-    val = regs.pfqf_hkey[(addr - I40E_PFQF_HKEY(0)) / 128];
-  } else if (addr >= I40E_PFQF_HLUT(0) &&
-             addr <= I40E_PFQF_HLUT(I40E_PFQF_HLUT_MAX_INDEX)) {
-    val = regs.pfqf_hlut[(addr - I40E_PFQF_HLUT(0)) / 128];
-  } else if (addr >= I40E_PFINT_ITRN(0, 0) &&
-             addr <= I40E_PFINT_ITRN(0, NUM_PFINTS - 1)) {
-    val = regs.pfint_itrn[0][(addr - I40E_PFINT_ITRN(0, 0)) / 4];
-  } else if (addr >= I40E_PFINT_ITRN(1, 0) &&
-             addr <= I40E_PFINT_ITRN(1, NUM_PFINTS - 1)) {
-    val = regs.pfint_itrn[1][(addr - I40E_PFINT_ITRN(1, 0)) / 4];
-  } else if (addr >= I40E_PFINT_ITRN(2, 0) &&
-             addr <= I40E_PFINT_ITRN(2, NUM_PFINTS - 1)) {
-    val = regs.pfint_itrn[2][(addr - I40E_PFINT_ITRN(2, 0)) / 4];
+  if (const reg_array *ra = reg_array_lookup(addr)) {
+    val = reg_array_elem(*ra, (addr - ra->first) / ra->stride);
   } else {
     switch (addr) {
       case I40E_PFGEN_CTRL:
@@ -300,7 +356,11 @@ uint32_t i40e_bm::reg_mem_read32(uint64_t addr) {
         break;
 
       case I40E_PF_VT_PFALLOC:
-        val = 0;  // we don't currently support VFs
+        if (!vfs.empty()) {
+          val = (0 << I40E_PF_VT_PFALLOC_FIRSTVF_SHIFT) |
+                ((vfs.size() - 1) << I40E_PF_VT_PFALLOC_LASTVF_SHIFT) |
+                I40E_PF_VT_PFALLOC_VALID_MASK;
+        }
         break;
 
       case I40E_PFGEN_PORTNUM:
@@ -399,6 +459,10 @@ uint32_t i40e_bm::reg_mem_read32(uint64_t addr) {
         val = regs.pfqf_ctl_0;
         break;
 
+      case I40E_PFQF_FDSTAT:
+        val = lanmgr.fd_filter_count() << I40E_PFQF_FDSTAT_GUARANT_CNT_SHIFT;
+        break;
+
       case I40E_PRTDCB_FCCFG:
         val = regs.prtdcb_fccfg;
         break;
@@ -426,9 +490,7 @@ uint32_t i40e_bm::reg_mem_read32(uint64_t addr) {
         break;
 
       default:
-#ifdef DEBUG_DEV
-        log << "unhandled mem read addr=" << addr << logger::endl;
-#endif
+        I40E_LOG(log, kDev, "unhandled mem read addr=%x", addr);
         break;
     }
   }
@@ -437,72 +499,40 @@ uint32_t i40e_bm::reg_mem_read32(uint64_t addr) {
 }
 
 void i40e_bm::reg_mem_write32(uint64_t addr, uint32_t val) {
-  if (addr >= I40E_PFINT_DYN_CTLN(0) &&
-      addr <= I40E_PFINT_DYN_CTLN(NUM_PFINTS - 1)) {
-    regs.pfint_dyn_ctln[(addr - I40E_PFINT_DYN_CTLN(0)) / 4] = val;
-  } else if (addr >= I40E_PFINT_LNKLSTN(0) &&
-             addr <= I40E_PFINT_LNKLSTN(NUM_PFINTS - 1)) {
-    regs.pfint_lnklstn[(addr - I40E_PFINT_LNKLSTN(0)) / 4] = val;
-  } else if (addr >= I40E_PFINT_RATEN(0) &&
-             addr <= I40E_PFINT_RATEN(NUM_PFINTS - 1)) {
-    regs.pfint_raten[(addr - I40E_PFINT_RATEN(0)) / 4] = val;
-  } else if (addr >= I40E_GLLAN_TXPRE_QDIS(0) &&
-             addr <= I40E_GLLAN_TXPRE_QDIS(11)) {
-    regs.gllan_txpre_qdis[(addr - I40E_GLLAN_TXPRE_QDIS(0)) / 4] = val;
-  } else if (addr >= I40E_QINT_TQCTL(0) &&
-             addr <= I40E_QINT_TQCTL(NUM_QUEUES - 1)) {
-    regs.qint_tqctl[(addr - I40E_QINT_TQCTL(0)) / 4] = val;
-  } else if (addr >= I40E_QTX_ENA(0) && addr <= I40E_QTX_ENA(NUM_QUEUES - 1)) {
-    size_t idx = (addr - I40E_QTX_ENA(0)) / 4;
-    regs.qtx_ena[idx] = val;
-    lanmgr.qena_updated(idx, false);
-  } else if (addr >= I40E_QTX_TAIL(0) &&
-             addr <= I40E_QTX_TAIL(NUM_QUEUES - 1)) {
-    size_t idx = (addr - I40E_QTX_TAIL(0)) / 4;
-    regs.qtx_tail[idx] = val;
-    lanmgr.tail_updated(idx, false);
-  } else if (addr >= I40E_QTX_CTL(0) && addr <= I40E_QTX_CTL(NUM_QUEUES - 1)) {
-    regs.qtx_ctl[(addr - I40E_QTX_CTL(0)) / 4] = val;
-  } else if (addr >= I40E_QINT_RQCTL(0) &&
-             addr <= I40E_QINT_RQCTL(NUM_QUEUES - 1)) {
-    regs.qint_rqctl[(addr - I40E_QINT_RQCTL(0)) / 4] = val;
-  } else if (addr >= I40E_QRX_ENA(0) && addr <= I40E_QRX_ENA(NUM_QUEUES - 1)) {
-    size_t idx = (addr - I40E_QRX_ENA(0)) / 4;
-    regs.qrx_ena[idx] = val;
-    lanmgr.qena_updated(idx, true);
-  } else if (addr >= I40E_QRX_TAIL(0) &&
-             addr <= I40E_QRX_TAIL(NUM_QUEUES - 1)) {
-    size_t idx = (addr - I40E_QRX_TAIL(0)) / 4;
-    regs.qrx_tail[idx] = val;
-    lanmgr.tail_updated(idx, true);
-  } else if (addr >= I40E_GLHMC_LANTXBASE(0) &&
-             addr <= I40E_GLHMC_LANTXBASE(I40E_GLHMC_LANTXBASE_MAX_INDEX)) {
-    regs.glhmc_lantxbase[(addr - I40E_GLHMC_LANTXBASE(0)) / 4] = val;
-  } else if (addr >= I40E_GLHMC_LANTXCNT(0) &&
-             addr <= I40E_GLHMC_LANTXCNT(I40E_GLHMC_LANTXCNT_MAX_INDEX)) {
-    regs.glhmc_lantxcnt[(addr - I40E_GLHMC_LANTXCNT(0)) / 4] = val;
-  } else if (addr >= I40E_GLHMC_LANRXBASE(0) &&
-             addr <= I40E_GLHMC_LANRXBASE(I40E_GLHMC_LANRXBASE_MAX_INDEX)) {
-    regs.glhmc_lanrxbase[(addr - I40E_GLHMC_LANRXBASE(0)) / 4] = val;
-  } else if (addr >= I40E_GLHMC_LANRXCNT(0) &&
-             addr <= I40E_GLHMC_LANRXCNT(I40E_GLHMC_LANRXCNT_MAX_INDEX)) {
-    regs.glhmc_lanrxcnt[(addr - I40E_GLHMC_LANRXCNT(0)) / 4] = val;
-  } else if (addr >= I40E_PFQF_HKEY(0) &&
-             addr <= I40E_PFQF_HKEY(I40E_PFQF_HKEY_MAX_INDEX)) {
-    regs.pfqf_hkey[(addr - I40E_PFQF_HKEY(0)) / 128] = val;
-    lanmgr.rss_key_updated();
-  } else if (addr >= I40E_PFQF_HLUT(0) &&
-             addr <= I40E_PFQF_HLUT(I40E_PFQF_HLUT_MAX_INDEX)) {
-    regs.pfqf_hlut[(addr - I40E_PFQF_HLUT(0)) / 128] = val;
-  } else if (addr >= I40E_PFINT_ITRN(0, 0) &&
-             addr <= I40E_PFINT_ITRN(0, NUM_PFINTS - 1)) {
-    regs.pfint_itrn[0][(addr - I40E_PFINT_ITRN(0, 0)) / 4] = val;
-  } else if (addr >= I40E_PFINT_ITRN(1, 0) &&
-             addr <= I40E_PFINT_ITRN(1, NUM_PFINTS - 1)) {
-    regs.pfint_itrn[1][(addr - I40E_PFINT_ITRN(1, 0)) / 4] = val;
-  } else if (addr >= I40E_PFINT_ITRN(2, 0) &&
-             addr <= I40E_PFINT_ITRN(2, NUM_PFINTS - 1)) {
-    regs.pfint_itrn[2][(addr - I40E_PFINT_ITRN(2, 0)) / 4] = val;
+  if (const reg_array *ra = reg_array_lookup(addr)) {
+    size_t idx = (addr - ra->first) / ra->stride;
+    reg_array_elem(*ra, idx) = val;
+    switch (ra->hook) {
+      case RA_HOOK_QTX_ENA:
+        lanmgr.qena_updated(idx, false);
+        break;
+      case RA_HOOK_QTX_TAIL:
+        lanmgr.tail_updated(idx, false);
+        break;
+      case RA_HOOK_QRX_ENA:
+        lanmgr.qena_updated(idx, true);
+        break;
+      case RA_HOOK_QRX_TAIL:
+        lanmgr.tail_updated(idx, true);
+        break;
+      case RA_HOOK_RSS_KEY:
+        lanmgr.rss_key_updated();
+        break;
+      case RA_HOOK_VF_QMAP:
+        lanmgr.vf_qmap_updated();
+        break;
+      case RA_HOOK_VF_RESET:
+        if (idx < vfs.size() && (val & I40E_VPGEN_VFRTRIG_VFSWR_MASK))
+          vfs[idx]->reset();
+        break;
+      case RA_HOOK_VF_ATQ:
+      case RA_HOOK_VF_ARQ:
+        if (idx < vfs.size())
+          vfs[idx]->mailbox_updated(ra->hook == RA_HOOK_VF_ARQ);
+        break;
+      case RA_HOOK_NONE:
+        break;
+    }
   } else {
     switch (addr) {
       case I40E_PFGEN_CTRL:
@@ -596,19 +626,24 @@ void i40e_bm::reg_mem_write32(uint64_t addr, uint32_t val) {
         break;
 
       case I40E_PF_ARQBAL:
-        regs.pf_arqba = val | (regs.pf_atqba & 0xffffffff00000000ULL);
+        regs.pf_arqba = val | (regs.pf_arqba & 0xffffffff00000000ULL);
+        pf_arq.reg_updated();
         break;
       case I40E_PF_ARQBAH:
         regs.pf_arqba = ((uint64_t)val << 32) | (regs.pf_arqba & 0xffffffffULL);
+        pf_arq.reg_updated();
         break;
       case I40E_PF_ARQLEN:
         regs.pf_arqlen = val;
+        pf_arq.reg_updated();
         break;
       case I40E_PF_ARQH:
         regs.pf_arqh = val;
+        pf_arq.reg_updated();
         break;
       case I40E_PF_ARQT:
         regs.pf_arqt = val;
+        pf_arq.reg_updated();
         break;
 
       case I40E_PFQF_CTL_0:
@@ -641,33 +676,68 @@ void i40e_bm::reg_mem_write32(uint64_t addr, uint32_t val) {
         regs.glrpb_plw = val;
         break;
       default:
-#ifdef DEBUG_DEV
-        log << "unhandled mem write addr=" << addr << " val=" << val
-            << logger::endl;
-#endif
+        I40E_LOG(log, kDev, "unhandled mem write addr=%x val=%x", addr, val);
         break;
     }
   }
 }
 
 void i40e_bm::Timed(nicbm::TimedEvent &ev) {
-  int_ev &iev = *((int_ev *)&ev);
-#ifdef DEBUG_DEV
-  log << "timed_event: triggering interrupt (" << iev.vec << ")"
-      << logger::endl;
-#endif
+  // all events scheduled by the device are timed_ev
+  timed_ev &tev = static_cast<timed_ev &>(ev);
+  if (tev.type == timed_ev::EV_DESC_TIMER) {
+    static_cast<desc_timer &>(tev).queue.timed();
+    return;
+  }
+
+  int_ev &iev = static_cast<int_ev &>(tev);
+  I40E_LOG(log, kDev, "timed_event: triggering interrupt (%x)", iev.vec);
   iev.armed = false;
 
   if (int_msix_en_) {
     runner_->MsiXIssue(iev.vec);
   } else if (iev.vec > 0) {
-    log << "timed_event: MSI-X disabled, but vec != 0" << logger::endl;
+    I40E_LOG(log, kErr, "timed_event: MSI-X disabled, but vec != 0");
     abort();
   } else {
     runner_->MsiIssue(0);
   }
 }
 
+void i40e_bm::AddOptions(nicbm::Options &opts) {
+  opts.Add("desc-thresh", "PTHRESH:HTHRESH:WTHRESH[:TIMEOUT-NS]",
+           "descriptor thresholds for the LAN queues",
+           [this](const char *arg) { return lan_desc_thresh.parse(arg); });
+  opts.Add("flow-director", nullptr, "advertise the flow director capability",
+           [this](const char *arg) {
+             fd_enable = true;
+             return true;
+           });
+  opts.Add("vfs", "N", "virtual functions in BAR 5 (at most 128)",
+           [this](const char *arg) {
+             char *end;
+             unsigned long n = strtoul(arg, &end, 10);
+             if (*end || n == 0 || n > MAX_VFS)
+               return false;
+             set_vfs(n);
+             return true;
+           });
+}
+
+bool i40e_bm::vf_queue_map(uint16_t vf, uint16_t i, uint16_t &q) const {
+  if (!(regs.vplan_mapena[vf] & I40E_VPLAN_MAPENA_TXRX_ENA_MASK))
+    return false;
+  // unused entries hold the largest index
+  q = regs.vplan_qtable[i][vf] & I40E_VPLAN_QTABLE_QINDEX_MASK;
+  return q < NUM_QUEUES;
+}
+
+int16_t i40e_bm::vsi_vf_get(uint16_t seid) const {
+  // seids of VSIs follow the PF VSI's (512)
+  uint16_t vsi = (seid & I40E_AQC_MACVLAN_CMD_SEID_NUM_MASK) - 512;
+  return vsi < NUM_VSIS ? vsi_vf[vsi] : -1;
+}
+
 void i40e_bm::SignalInterrupt(uint16_t vec, uint8_t itr) {
   int_ev &iev = intevs[vec];
 
@@ -683,7 +753,7 @@ void i40e_bm::SignalInterrupt(uint16_t vec, uint8_t itr) {
     // noitr
     mindelay = 0;
   } else {
-    log << "signal_interrupt() invalid itr (" << itr << ")" << logger::endl;
+    I40E_LOG(log, kErr, "signal_interrupt() invalid itr (%x)", itr);
     abort();
   }
 
@@ -691,10 +761,7 @@ void i40e_bm::SignalInterrupt(uint16_t vec, uint8_t itr) {
   uint64_t newtime = curtime + mindelay;
   if (iev.armed && iev.time_ <= newtime) {
     // already armed and this is not scheduled sooner
-#ifdef DEBUG_DEV
-    log << "signal_interrupt: vec " << vec << " already scheduled"
-        << logger::endl;
-#endif
+    I40E_LOG(log, kDev, "signal_interrupt: vec %x already scheduled", vec);
     return;
   } else if (iev.armed) {
     // need to reschedule
@@ -704,26 +771,32 @@ void i40e_bm::SignalInterrupt(uint16_t vec, uint8_t itr) {
   iev.armed = true;
   iev.time_ = newtime;
 
-#ifdef DEBUG_DEV
-  log << "signal_interrupt: scheduled vec " << vec << " for time=" << newtime
-      << " (itr " << itr << ")" << logger::endl;
-#endif
+  I40E_LOG(log, kDev,
+           "signal_interrupt: scheduled vec %x for time=%x (itr %x)", vec,
+           newtime, itr);
 
   runner_->EventSchedule(iev);
 }
 
 void i40e_bm::reset(bool indicate_done) {
-#ifdef DEBUG_DEV
-  std::cout << "reset triggered" << logger::endl;
-#endif
+  I40E_LOG(log, kDev, "reset triggered");
 
   pf_atq.reset();
+  pf_arq.reset();
+  for (vf_func *vf : vfs)
+    vf->reset();
   hmc.reset();
   lanmgr.reset();
+  vsis_added = 0;
+  vsi_vf.assign(NUM_VSIS, -1);
 
   memset(&regs, 0, sizeof(regs));
   if (indicate_done)
     regs.glnvm_srctl = I40E_GLNVM_SRCTL_DONE_MASK;
+  for (uint16_t i = 0; i < VF_QUEUES; i++) {
+    for (uint16_t vf = 0; vf < MAX_VFS; vf++)
+      regs.vplan_qtable[i][vf] = I40E_VPLAN_QTABLE_QINDEX_MASK;
+  }
 
   for (uint16_t i = 0; i < NUM_PFINTS; i++) {
     intevs[i].vec = i;
@@ -734,6 +807,18 @@ void i40e_bm::reset(bool indicate_done) {
     intevs[i].time_ = 0;
   }
 
+  // hash all supported packet types until the driver says otherwise
+  uint64_t hena = (1ULL << I40E_FILTER_PCTYPE_NONF_IPV4_TCP) |
+                  (1ULL << I40E_FILTER_PCTYPE_NONF_IPV4_UDP) |
+                  (1ULL << I40E_FILTER_PCTYPE_NONF_IPV4_OTHER) |
+                  (1ULL << I40E_FILTER_PCTYPE_FRAG_IPV4) |
+                  (1ULL << I40E_FILTER_PCTYPE_NONF_IPV6_TCP) |
+                  (1ULL << I40E_FILTER_PCTYPE_NONF_IPV6_UDP) |
+                  (1ULL << I40E_FILTER_PCTYPE_NONF_IPV6_OTHER) |
+                  (1ULL << I40E_FILTER_PCTYPE_FRAG_IPV6);
+  regs.pfqf_hena[0] = hena;
+  regs.pfqf_hena[1] = hena >> 32;
+
   // add default hash key
   regs.pfqf_hkey[0] = 0xda565a6d;
   regs.pfqf_hkey[1] = 0xc20e5b25;
@@ -768,9 +853,7 @@ void shadow_ram::reg_updated() {
   addr = (val & I40E_GLNVM_SRCTL_ADDR_MASK) >> I40E_GLNVM_SRCTL_ADDR_SHIFT;
   is_write = (val & I40E_GLNVM_SRCTL_WRITE_MASK);
 
-#ifdef DEBUG_DEV
-  log << "shadow ram op addr=" << addr << " w=" << is_write << logger::endl;
-#endif
+  I40E_LOG(log, kDev, "shadow ram op addr=%x w=%d", addr, is_write);
 
   if (is_write) {
     write(addr, (dev.regs.glnvm_srdata & I40E_GLNVM_SRDATA_WRDATA_MASK) >>
@@ -802,9 +885,7 @@ uint16_t shadow_ram::read(uint16_t addr) {
       return 0xbaba;
 
     default:
-#ifdef DEBUG_DEV
-      log << "TODO shadow memory read addr=" << addr << logger::endl;
-#endif
+      I40E_LOG(log, kDev, "TODO shadow memory read addr=%x", addr);
       break;
   }
 
@@ -812,28 +893,103 @@ uint16_t shadow_ram::read(uint16_t addr) {
 }
 
 void shadow_ram::write(uint16_t addr, uint16_t val) {
-#ifdef DEBUG_DEV
-  log << "TODO shadow memory write addr=" << addr << " val=" << val
-      << logger::endl;
-#endif
+  I40E_LOG(log, kDev, "TODO shadow memory write addr=%x val=%x", addr, val);
 }
 
-int_ev::int_ev() {
-  armed = false;
-  time_ = 0;
+vf_func::vf_func(i40e_bm &dev_, uint16_t id_)
+    : dev(dev_),
+      id(id_),
+      atq_base(0),
+      arq_base(0),
+      atq(*this, atq_base, dev_.regs.vf_atqlen[id_], dev_.regs.vf_atqh[id_],
+          dev_.regs.vf_atqt[id_]),
+      arq("vf" + std::to_string(id_) + ".arx", dev_, arq_base,
+          dev_.regs.vf_arqlen[id_], dev_.regs.vf_arqh[id_],
+          dev_.regs.vf_arqt[id_]) {
 }
 
-}  // namespace i40e
+void vf_func::reset() {
+  I40E_LOG(dev.log, kDev, "vf %x reset", id);
+  atq.reset();
+  arq.reset();
+  atq_base = arq_base = 0;
+
+  i40e_bm::i40e_regs &r = dev.regs;
+  r.vf_atqbal[id] = r.vf_atqbah[id] = r.vf_atqlen[id] = 0;
+  r.vf_atqh[id] = r.vf_atqt[id] = 0;
+  r.vf_arqbal[id] = r.vf_arqbah[id] = r.vf_arqlen[id] = 0;
+  r.vf_arqh[id] = r.vf_arqt[id] = 0;
+  // we always simulate immediate reset
+  r.vpgen_vfrstat[id] = I40E_VPGEN_VFRSTAT_VFRD_MASK;
+}
 
-class i40e_factory : public nicbm::MultiNicRunner::DeviceFactory {
- public:
-  nicbm::Runner::Device &create() override {
-    return *new i40e::i40e_bm;
+void vf_func::mailbox_updated(bool rx) {
+  i40e_bm::i40e_regs &r = dev.regs;
+  if (rx) {
+    arq_base = r.vf_arqbal[id] | ((uint64_t)r.vf_arqbah[id] << 32);
+    arq.reg_updated();
+  } else {
+    atq_base = r.vf_atqbal[id] | ((uint64_t)r.vf_atqbah[id] << 32);
+    atq.reg_updated();
   }
-};
+}
+
+bool vf_func::reg_map(uint64_t addr, uint64_t &pf_addr) {
+  switch (addr) {
+    case I40E_VF_ATQBAL1:
+      pf_addr = I40E_VF_ATQBAL(id);
+      return true;
+    case I40E_VF_ATQBAH1:
+      pf_addr = I40E_VF_ATQBAH(id);
+      return true;
+    case I40E_VF_ATQLEN1:
+      pf_addr = I40E_VF_ATQLEN(id);
+      return true;
+    case I40E_VF_ATQH1:
+      pf_addr = I40E_VF_ATQH(id);
+      return true;
+    case I40E_VF_ATQT1:
+      pf_addr = I40E_VF_ATQT(id);
+      return true;
+    case I40E_VF_ARQBAL1:
+      pf_addr = I40E_VF_ARQBAL(id);
+      return true;
+    case I40E_VF_ARQBAH1:
+      pf_addr = I40E_VF_ARQBAH(id);
+      return true;
+    case I40E_VF_ARQLEN1:
+      pf_addr = I40E_VF_ARQLEN(id);
+      return true;
+    case I40E_VF_ARQH1:
+      pf_addr = I40E_VF_ARQH(id);
+      return true;
+    case I40E_VF_ARQT1:
+      pf_addr = I40E_VF_ARQT(id);
+      return true;
+    case I40E_VFGEN_RSTAT:
+      pf_addr = I40E_VFGEN_RSTAT1(id);
+      return true;
+  }
+
+  // queue tails, only while the PF maps the queue to this VF
+  uint16_t q;
+  if (addr % 4 == 0 && addr <= I40E_QTX_TAIL1(dev.VF_QUEUES - 1) &&
+      dev.vf_queue_map(id, (addr - I40E_QTX_TAIL1(0)) / 4, q)) {
+    pf_addr = I40E_QTX_TAIL(q);
+    return true;
+  }
+  if (addr % 4 == 0 && addr >= I40E_QRX_TAIL1(0) &&
+      addr <= I40E_QRX_TAIL1(dev.VF_QUEUES - 1) &&
+      dev.vf_queue_map(id, (addr - I40E_QRX_TAIL1(0)) / 4, q)) {
+    pf_addr = I40E_QRX_TAIL(q);
+    return true;
+  }
+  return false;
+}
 
-int main(int argc, char *argv[]) {
-  i40e_factory fact;
-  nicbm::MultiNicRunner mr(fact);
-  return mr.RunMain(argc, argv);
+int_ev::int_ev() : timed_ev(EV_INT) {
+  armed = false;
+  time_ = 0;
 }
+
+}  // namespace i40e
@@ -27,26 +27,24 @@
 #include <stdint.h>
 
 #include <deque>
-#include <sstream>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 extern "C" {
 #include <simbricks/pcie/proto.h>
 }
 #include <simbricks/nicbm/nicbm.h>
 
-// #define DEBUG_DEV
-// #define DEBUG_ADMINQ
-// #define DEBUG_LAN
-// #define DEBUG_HMC
-// #define DEBUG_QUEUES
-
 struct i40e_aq_desc;
 struct i40e_tx_desc;
+struct i40e_filter_program_desc;
 
 namespace i40e {
 
 class i40e_bm;
 class lan;
+class vf_func;
 
 class dma_base : public nicbm::DMAOp {
  public:
@@ -54,7 +52,21 @@ class dma_base : public nicbm::DMAOp {
   virtual void done() = 0;
 };
 
-class int_ev : public nicbm::TimedEvent {
+/** Timed event of the device, tagged with its type for dispatch */
+class timed_ev : public nicbm::TimedEvent {
+ public:
+  enum ev_type : uint8_t {
+    EV_INT,
+    EV_DESC_TIMER,
+  };
+  const ev_type type;
+
+ protected:
+  explicit timed_ev(ev_type type_) : type(type_) {
+  }
+};
+
+class int_ev : public timed_ev {
  public:
   uint16_t vec;
   bool armed;
@@ -62,29 +74,103 @@ class int_ev : public nicbm::TimedEvent {
   int_ev();
 };
 
-class logger : public std::ostream {
+class queue_base;
+
+/** Timer issuing a queue's deferred descriptor fetches and write-backs */
+class desc_timer : public timed_ev {
  public:
-  static const char endl = '\n';
+  queue_base &queue;
+  bool armed;
+
+  explicit desc_timer(queue_base &queue_);
+};
+
+/**
+ * Descriptor cache thresholds of a queue, modeled on the PTHRESH, HTHRESH,
+ * and WTHRESH fields of the real hardware. Larger batches need fewer PCIe
+ * transactions. The defaults fetch and write back as early as possible.
+ */
+struct desc_thresh {
+  // fetch any number of descriptors while at most this many fetched ones
+  // are not processed yet
+  uint32_t prefetch;
+  // otherwise wait until at least this many can be fetched at once
+  uint32_t host;
+  // write back once at least this many descriptors are processed
+  uint32_t writeback;
+  // max delay of a fetch or write-back deferred by the thresholds [ps]
+  uint64_t timeout;
+
+  desc_thresh() : prefetch(0), host(1), writeback(1), timeout(2000000) {
+  }
+
+  /**
+   * Parse "PTHRESH:HTHRESH:WTHRESH[:TIMEOUT-NS]".
+   * Returns false if the string is invalid.
+   */
+  bool parse(const char *str);
+};
+
+/**
+ * Debug logger for printf-style messages with integer arguments, used through
+ * `I40E_LOG`. Arguments are passed as 64 bit values, so formats need no length
+ * modifiers. If the runner has an event log (`-l`), messages are recorded
+ * there as binary records with the format string id and the raw arguments and
+ * formatted offline by `trace/evlog_dump`. Otherwise they go to stderr.
+ */
+class logger {
+ public:
+  /* message classes, all but `kErr` are disabled unless listed in the
+   * comma-separated I40E_DEBUG environment variable, or it is `all` */
+  enum {
+    kErr = 1 << 0,
+    kDev = 1 << 1,
+    kAdminq = 1 << 2,
+    kHmc = 1 << 3,
+    kLan = 1 << 4,
+    kQueues = 1 << 5,
+  };
+  static uint32_t enabled;
 
  protected:
   std::string label;
+  uint32_t label_id;
   nicbm::Runner::Device &dev;
-  nicbm::Runner *runner;
-  std::stringstream ss;
+
+  template <typename T>
+  static uint64_t arg(T v) {
+    if constexpr (std::is_pointer<T>::value)
+      return reinterpret_cast<uintptr_t>(v);
+    else
+      return static_cast<uint64_t>(v);
+  }
+
+  void emit(uint32_t fmt_id, const uint64_t *args, unsigned n);
 
  public:
   explicit logger(const std::string &label_, nicbm::Runner::Device &dev_);
-  logger &operator<<(char c);
-  logger &operator<<(int32_t c);
-  logger &operator<<(uint8_t i);
-  logger &operator<<(uint16_t i);
-  logger &operator<<(uint32_t i);
-  logger &operator<<(uint64_t i);
-  logger &operator<<(bool c);
-  logger &operator<<(const char *str);
-  logger &operator<<(void *str);
+
+  template <typename... Args>
+  void msg(uint32_t fmt_id, Args... args) {
+    static_assert(sizeof...(args) <= nicbm::EvLog::kMsgMaxArgs,
+                  "too many log message arguments");
+    const uint64_t a[] = {0, arg(args)...};
+    emit(fmt_id, a + 1, sizeof...(args));
+  }
 };
 
+/**
+ * Log message of class `cls` to `lg`. Arguments are only evaluated if the
+ * class is enabled, and the format string is registered once per call site.
+ */
+#define I40E_LOG(lg, cls, fmt, ...)                                      \
+  do {                                                                   \
+    if (::i40e::logger::enabled & ::i40e::logger::cls) {                 \
+      static const uint32_t log_fmt_id_ = ::nicbm::EvLog::StrId(fmt);    \
+      (lg).msg(log_fmt_id_, ##__VA_ARGS__);                              \
+    }                                                                    \
+  } while (0)
+
 /**
  * Base-class for descriptor queues (RX/TX, Admin RX/TX).
  *
@@ -93,11 +179,16 @@ class logger : public std::ostream {
  *      - fetch: descriptor is read from host memory. This can be done in
  *        batches, while the batch sizes is limited by the minimum of
  *        MAX_ACTIVE_DESCS, max_active_capacity(), and max_fetch_capacity().
- *        Fetch is implemented by this base class.
+ *        Batches wrapping around the end of the ring are fetched with two
+ *        DMAs issued together. When fetches start is governed by the
+ *        prefetch and host thresholds in desc_thresh. Fetch is implemented
+ *        by this base class.
  *
  *      - prepare: to be implemented in the sub class, but typically involves
  *        fetching buffer contents. Not guaranteed to happen in order. If
- *        overriden subclass must call desc_prepared() when done.
+ *        overriden subclass must call desc_prepared() when done. Buffers are
+ *        transferred in MAX_DMA_SIZE parts that are all issued at once, up to
+ *        MAX_DATA_DMAS per queue.
  *
  *      - process: to be implemented in the sub class. Guaranteed to be called
  *        in order. In case of tx, this actually sends the packet, in rx
@@ -105,11 +196,18 @@ class logger : public std::ostream {
  *        subclass must call desc_processed() when done.
  *
  *      - write back: descriptor is written back to host-memory. Write-back
- *        capacity
+ *        capacity is limited by max_writeback_capacity(), and deferred until
+ *        the write-back threshold in desc_thresh is reached.
+ *
+ * Fetches and write-backs deferred by the thresholds are issued regardless
+ * once desc_thresh::timeout has passed.
  */
 class queue_base {
  protected:
   static const uint32_t MAX_ACTIVE_DESCS = 128;
+  // payload DMA parts in flight per queue, as many as the runner issues at
+  // once (DMA_MAX_PENDING), further parts wait for a slot
+  static const uint32_t MAX_DATA_DMAS = 64;
 
   class desc_ctx {
     friend class queue_base;
@@ -128,6 +226,10 @@ class queue_base {
 
    protected:
     queue_base &queue;
+    // parts of the current data_fetch or data_write still in flight
+    uint32_t data_parts_pending;
+    uint64_t data_dma_addr;
+    size_t data_dma_len;
 
    public:
     enum state state;
@@ -155,24 +257,29 @@ class queue_base {
     virtual void process() = 0;
   };
 
+  // descriptor fetches are reused through fetch_free, buffers are grown as
+  // needed
   class dma_fetch : public dma_base {
    protected:
     queue_base &queue;
 
    public:
     uint32_t pos;
-    dma_fetch(queue_base &queue_, size_t len);
+    size_t capacity;
+    explicit dma_fetch(queue_base &queue_);
     virtual ~dma_fetch();
     virtual void done();
   };
 
+  // descriptor write-backs are reused through wb_free, like dma_fetch
   class dma_wb : public dma_base {
    protected:
     queue_base &queue;
 
    public:
     uint32_t pos;
-    dma_wb(queue_base &queue_, size_t len);
+    size_t capacity;
+    explicit dma_wb(queue_base &queue_);
     virtual ~dma_wb();
     virtual void done();
   };
@@ -182,8 +289,6 @@ class queue_base {
     desc_ctx &ctx;
 
    public:
-    size_t total_len;
-    size_t part_offset;
     dma_data_fetch(desc_ctx &ctx_, size_t len, void *buffer);
     virtual ~dma_data_fetch();
     virtual void done();
@@ -194,8 +299,6 @@ class queue_base {
     desc_ctx &ctx;
 
    public:
-    size_t total_len;
-    size_t part_offset;
     dma_data_wb(desc_ctx &ctx_, size_t len);
     virtual ~dma_data_wb();
     virtual void done();
@@ -219,9 +322,34 @@ class queue_base {
 
   bool enabled;
   size_t desc_len;
+  // DMA operations in flight that reference this queue
+  uint32_t dma_pending;
+  // payload DMA parts issued, and those waiting for a free slot
+  uint32_t data_dmas_active;
+  std::deque<dma_base *> data_dmas_waiting;
+  // idle descriptor DMA operations
+  std::vector<dma_fetch *> fetch_free;
+  std::vector<dma_wb *> wb_free;
+
+  desc_thresh thresh;
+  desc_timer timer;
+  // set while the timer forces deferred fetches and write-backs
+  bool thresh_flush;
 
   void ctxs_init();
 
+  void data_dma_issue(dma_base &dma);
+  void data_dma_done();
+
+  // issue a fetch of `cnt` descriptors that does not wrap around the ring
+  void fetch_issue(uint32_t idx, uint32_t pos, uint32_t cnt);
+  // issue a write-back of `cnt` descriptors that does not wrap either
+  void wb_issue(uint32_t idx, uint32_t pos, uint32_t cnt);
+  // count fetched descriptors that are not processed yet
+  uint32_t unprocessed_cnt();
+  // arm the timer to issue deferred fetches and write-backs
+  void thresh_defer();
+
   void trigger_fetch();
   void trigger_process();
   void trigger_writeback();
@@ -248,9 +376,14 @@ class queue_base {
  public:
   queue_base(const std::string &qname_, uint32_t &reg_head_,
              uint32_t &reg_tail_, i40e_bm &dev_);
+  virtual ~queue_base();
   virtual void reset();
   void reg_updated();
   bool is_enabled();
+  // true if no DMA operation still references the queue
+  bool is_idle();
+  // called by i40e_bm when the timer is due
+  void timed();
 };
 
 class queue_admin_tx : public queue_base {
@@ -286,8 +419,132 @@ class queue_admin_tx : public queue_base {
 
  public:
   queue_admin_tx(i40e_bm &dev_, uint64_t &reg_base_, uint32_t &reg_len_,
-                 uint32_t &reg_head_, uint32_t &reg_tail_);
+                 uint32_t &reg_head_, uint32_t &reg_tail_,
+                 const std::string &qname_ = "atx");
+  void reg_updated();
+};
+
+/**
+ * Admin send queue of a VF: messages of the VF driver go to the PF's admin
+ * receive queue, other commands are completed without effect.
+ */
+class queue_vf_admin_tx : public queue_admin_tx {
+ protected:
+  class vf_desc_ctx : public admin_desc_ctx {
+   protected:
+    vf_func &vf;
+
+   public:
+    vf_desc_ctx(queue_vf_admin_tx &queue_, i40e_bm &dev);
+    virtual void process();
+  };
+
+  vf_func &vf;
+
+  virtual desc_ctx &desc_ctx_create();
+
+ public:
+  queue_vf_admin_tx(vf_func &vf_, uint64_t &reg_base_, uint32_t &reg_len_,
+                    uint32_t &reg_head_, uint32_t &reg_tail_);
+};
+
+/**
+ * Admin receive queue: the device posts events, e.g. mailbox messages, to the
+ * buffers the driver provided, one at a time and in order. Events wait while
+ * the queue is disabled or has no free descriptor.
+ */
+class queue_admin_rx {
+ public:
+  // largest buffer the drivers post, longer messages are truncated
+  static const size_t MAX_MSG_LEN = 4096;
+
+ protected:
+  struct event {
+    uint8_t desc[32];
+    std::vector<uint8_t> data;
+  };
+
+  class dma_arq : public dma_base {
+   protected:
+    queue_admin_rx &aq;
+
+   public:
+    enum step {
+      ARQ_FETCH,
+      ARQ_DATA,
+      ARQ_WB,
+    };
+    const step st;
+    // generation of the queue when issued, completions of older ones are
+    // ignored
+    const uint32_t gen;
+
+    dma_arq(queue_admin_rx &aq_, step st_, size_t len);
+    virtual ~dma_arq();
+    virtual void done();
+  };
+
+  i40e_bm &dev;
+  logger log;
+  uint64_t &reg_base;
+  uint32_t &reg_len;
+  uint32_t &reg_head;
+  uint32_t &reg_tail;
+  std::deque<event> pending;
+  // the front event is being written
+  bool busy;
+  uint32_t gen;
+
+  void trigger();
+  void desc_fetched(const void *host_desc);
+  void event_written();
+
+  // dummy function, needs to be overriden if interrupts are required
+  virtual void interrupt();
+
+ public:
+  queue_admin_rx(const std::string &qname, i40e_bm &dev_, uint64_t &reg_base_,
+                 uint32_t &reg_len_, uint32_t &reg_head_, uint32_t &reg_tail_);
+  virtual ~queue_admin_rx();
+  void reset();
   void reg_updated();
+  /** Post an event with descriptor `desc` and `len` bytes of `data` */
+  void post(const i40e_aq_desc &desc, const void *data, size_t len);
+};
+
+/** Admin receive queue of the PF, raises the admin queue interrupt cause */
+class queue_pf_admin_rx : public queue_admin_rx {
+ protected:
+  virtual void interrupt();
+
+ public:
+  queue_pf_admin_rx(i40e_bm &dev_, uint64_t &reg_base_, uint32_t &reg_len_,
+                    uint32_t &reg_head_, uint32_t &reg_tail_);
+};
+
+/**
+ * Virtual function: a window of BAR_VF with the VF's mailbox registers, its
+ * reset status, and the tails of the LAN queues the PF mapped to it. Each
+ * VF register is backed by the PF register the PF driver sees, e.g.
+ * VF_ATQLEN1 by VF_ATQLEN(vf) and QTX_TAIL1(i) by QTX_TAIL(VPLAN_QTABLE(i,
+ * vf)). Queue and mailbox interrupts of VFs are not modeled, VF drivers have
+ * to poll.
+ */
+class vf_func {
+ public:
+  i40e_bm &dev;
+  const uint16_t id;
+  uint64_t atq_base;
+  uint64_t arq_base;
+  queue_vf_admin_tx atq;
+  queue_admin_rx arq;
+
+  vf_func(i40e_bm &dev_, uint16_t id_);
+  void reset();
+  // mailbox registers of the send (`rx` false) or receive queue written
+  void mailbox_updated(bool rx);
+  // PF register backing offset `addr` of the VF window, false if none does
+  bool reg_map(uint64_t addr, uint64_t &pf_addr);
 };
 
 // host memory cache
@@ -303,6 +560,7 @@ class host_mem_cache {
   };
 
   i40e_bm &dev;
+  logger log;
   segment segs[MAX_SEGMENTS];
 
  public:
@@ -326,6 +584,7 @@ class lan_queue_base : public queue_base {
     lan_queue_base &lq;
 
     explicit qctx_fetch(lan_queue_base &lq_);
+    virtual ~qctx_fetch();
     virtual void done();
   };
 
@@ -351,11 +610,19 @@ class lan_queue_base : public queue_base {
   lan_queue_base(lan &lanmgr_, const std::string &qtype, uint32_t &reg_tail,
                  size_t idx_, uint32_t &reg_ena_, uint32_t &fpm_basereg,
                  uint32_t &reg_intqctl, uint16_t ctx_size);
+  virtual ~lan_queue_base();
   virtual void reset();
   void enable();
   void disable();
 };
 
+// checksums over the headers of a TSO unit without the fields that change
+// between segments
+struct tso_xsum_state {
+  uint16_t ip_sum;
+  uint16_t tcp_sum;
+};
+
 class lan_queue_tx : public lan_queue_base {
  protected:
   static const uint16_t MTU = 9024;
@@ -388,9 +655,10 @@ class lan_queue_tx : public lan_queue_base {
     virtual void done();
   };
 
+  // headers of the current TSO unit, updated after each segment
   uint8_t pktbuf[MTU];
   uint32_t tso_off;
-  uint32_t tso_len;
+  tso_xsum_state tso_xsum;
   std::deque<tx_desc_ctx *> ready_segments;
 
   bool hwb;
@@ -420,7 +688,9 @@ class lan_queue_rx : public lan_queue_base {
    public:
     explicit rx_desc_ctx(lan_queue_rx &queue_);
     virtual void process();
-    void packet_received(const void *data, size_t len, bool last);
+    void packet_received(const void *data, size_t len, bool last,
+                         uint32_t hash, uint64_t status);
+    void prog_status(uint32_t fd_id, uint64_t error);
   };
 
   uint16_t dbuff_size;
@@ -437,24 +707,61 @@ class lan_queue_rx : public lan_queue_base {
   lan_queue_rx(lan &lanmgr_, uint32_t &reg_tail, size_t idx, uint32_t &reg_ena,
                uint32_t &fpm_basereg, uint32_t &reg_intqctl);
   virtual void reset();
-  void packet_received(const void *data, size_t len, uint32_t hash);
+  // `hash` goes to the hash/filter id field, `status` is or-ed into the
+  // status bits of the last descriptor
+  void packet_received(const void *data, size_t len, uint32_t hash,
+                       uint64_t status);
+  // write a flow director programming status descriptor
+  void prog_status(uint32_t fd_id, uint64_t error);
 };
 
+// Toeplitz hash with one precomputed table per input byte position, built
+// lazily from the key registers
 class rss_key_cache {
+ public:
+  // big enough for 2x ipv6 + 2x port (2x16 + 2x2 bytes)
+  static const size_t max_input = 36;
+
  protected:
   static const size_t key_len = 52;
-  // big enough for 2x ipv6 (2x128 + 2x16)
-  static const size_t cache_len = 288;
   bool cache_dirty;
   const uint32_t (&key)[key_len / 4];
-  uint32_t cache[cache_len];
+  uint32_t tables[max_input][256];
 
   void build();
 
  public:
   explicit rss_key_cache(const uint32_t (&key_)[key_len / 4]);
   void set_dirty();
-  uint32_t hash_ipv4(uint32_t sip, uint32_t dip, uint16_t sp, uint16_t dp);
+  /** hash `len` bytes of `input` in network byte order */
+  uint32_t hash(const uint8_t *input, size_t len);
+};
+
+// flow director perfect match key: packet classifier type and flow fields of
+// the received packet in network byte order (ipv4 addresses in the first 4
+// bytes, ports only for tcp and udp)
+struct fd_key {
+  uint8_t src[16];
+  uint8_t dst[16];
+  uint16_t sport;
+  uint16_t dport;
+  uint8_t pctype;
+  bool ipv6;
+
+  bool operator==(const fd_key &o) const;
+};
+
+struct fd_key_hash {
+  size_t operator()(const fd_key &k) const;
+};
+
+struct fd_filter {
+  uint32_t fd_id;
+  uint16_t queue;
+  uint16_t cnt_idx;
+  uint8_t dest;
+  uint8_t fd_status;
+  bool cnt_ena;
 };
 
 // rx tx management
@@ -468,19 +775,72 @@ class lan {
   logger log;
   rss_key_cache rss_kc;
   const size_t num_qs;
+  // queues are only instantiated while enabled (nullptr otherwise), with a
+  // bit set in the live map of their direction
   lan_queue_rx **rxqs;
   lan_queue_tx **txqs;
-
-  bool rss_steering(const void *data, size_t len, uint16_t &queue,
-                    uint32_t &hash);
+  std::vector<uint64_t> live_map[2];
+  // disabled queues waiting for their DMA operations before being released
+  std::vector<lan_queue_base *> release_qs;
+
+  lan_queue_base *queue_get(uint16_t idx, bool rx);
+  lan_queue_base &queue_create(uint16_t idx, bool rx);
+  void queue_release(uint16_t idx, bool rx);
+  void release_idle();
+  template <typename F>
+  void for_each_live(bool rx, F f);
+
+  // VF owning each queue through VPLAN_QTABLE, -1 for the PF, and the VF of
+  // each unicast address added to a VF VSI
+  std::vector<int16_t> queue_vf;
+  bool vf_queues;
+  std::unordered_map<uint64_t, uint16_t> vf_macs;
+  // frames switched between the functions instead of sent to the network
+  uint64_t veb_frames;
+  std::vector<uint8_t> veb_buf;
+
+  static uint64_t mac_key(const uint8_t *mac);
+  bool vf_steering(const void *data, size_t len, uint16_t &queue);
+  // whether a frame to `dst` sent on queue `txq` stays within the device
+  bool veb_local(const uint8_t *dst, uint16_t txq);
+  // deliver a frame switched within the device
+  void veb_switch(const void *data, size_t len);
+
+  std::unordered_map<fd_key, fd_filter, fd_key_hash> fd_table;
+  // received ip packets matching a filter / not matching any, and packets
+  // dropped by a filter
+  uint64_t fd_hits;
+  uint64_t fd_misses;
+  uint64_t fd_drops;
+  // frames dropped for exceeding the queue's receive limit or the network
+  // message size
+  uint64_t oversize_drops;
+
+  static bool flow_parse(const void *data, size_t len, fd_key &key);
+  bool rss_steering(const fd_key &key, uint16_t &queue, uint32_t &hash);
+  // add or remove the filter for the flow of `pkt`: for ATR that's the
+  // reverse of the transmitted packet, otherwise the packet itself
+  void fd_program(const i40e_filter_program_desc &fdd, const void *pkt,
+                  size_t len, bool atr, uint16_t txq);
 
  public:
+  // largest filter count PFQF_FDSTAT can report
+  static const size_t FD_MAX_FILTERS = 8191;
+
   lan(i40e_bm &dev, size_t num_qs);
   void reset();
   void qena_updated(uint16_t idx, bool rx);
   void tail_updated(uint16_t idx, bool rx);
   void rss_key_updated();
+  void vf_qmap_updated();
+  void vf_mac_add(const uint8_t *mac, uint16_t vf);
+  void vf_mac_remove(const uint8_t *mac);
   void packet_received(const void *data, size_t len);
+  size_t fd_filter_count() const;
+  uint64_t veb_frame_count() const {
+    return veb_frames;
+  }
+  void print_stats(FILE *f) const;
 };
 
 class shadow_ram {
@@ -498,6 +858,9 @@ class shadow_ram {
 class i40e_bm : public nicbm::Runner::Device {
  protected:
   friend class queue_admin_tx;
+  friend class queue_vf_admin_tx;
+  friend class queue_pf_admin_rx;
+  friend class vf_func;
   friend class host_mem_cache;
   friend class lan;
   friend class lan_queue_base;
@@ -508,12 +871,18 @@ class i40e_bm : public nicbm::Runner::Device {
   static const unsigned BAR_REGS = 0;
   static const unsigned BAR_IO = 2;
   static const unsigned BAR_MSIX = 3;
+  static const unsigned BAR_VF = 5;
 
   static const uint32_t NUM_QUEUES = 1536;
   static const uint32_t NUM_PFINTS = 128;
   static const uint32_t NUM_VSIS = 384;
-  static const uint16_t MAX_MTU = 2048;
+  // largest frame the MAC supports, jumbo frames included
+  static const uint16_t MAX_MTU = 9728;
   static const uint8_t NUM_ITR = 3;
+  static const uint16_t MAX_VFS = 128;
+  // queues per VF, and size of its window in BAR_VF
+  static const uint16_t VF_QUEUES = 16;
+  static const uint32_t VF_WINDOW = 64 * 1024;
 
   struct i40e_regs {
     uint32_t glgen_rstctl;
@@ -543,6 +912,24 @@ class i40e_bm : public nicbm::Runner::Device {
     uint32_t qrx_ena[NUM_QUEUES];
     uint32_t qrx_tail[NUM_QUEUES];
 
+    uint32_t vplan_qtable[VF_QUEUES][MAX_VFS];
+    uint32_t vplan_mapena[MAX_VFS];
+    uint32_t vfgen_rstat1[MAX_VFS];
+    uint32_t vpgen_vfrtrig[MAX_VFS];
+    uint32_t vpgen_vfrstat[MAX_VFS];
+
+    // VF mailboxes as seen by the PF
+    uint32_t vf_atqbal[MAX_VFS];
+    uint32_t vf_atqbah[MAX_VFS];
+    uint32_t vf_atqlen[MAX_VFS];
+    uint32_t vf_atqh[MAX_VFS];
+    uint32_t vf_atqt[MAX_VFS];
+    uint32_t vf_arqbal[MAX_VFS];
+    uint32_t vf_arqbah[MAX_VFS];
+    uint32_t vf_arqlen[MAX_VFS];
+    uint32_t vf_arqh[MAX_VFS];
+    uint32_t vf_arqt[MAX_VFS];
+
     uint32_t glhmc_lantxbase[16];
     uint32_t glhmc_lantxcnt[16];
     uint32_t glhmc_lanrxbase[16];
@@ -567,8 +954,10 @@ class i40e_bm : public nicbm::Runner::Device {
 
     uint32_t pfqf_ctl_0;
 
+    uint32_t pfqf_hena[2];
     uint32_t pfqf_hkey[13];
     uint32_t pfqf_hlut[128];
+    uint32_t glqf_pcnt[512];
 
     uint32_t prtdcb_fccfg;
     uint32_t prtdcb_mflcn;
@@ -581,6 +970,36 @@ class i40e_bm : public nicbm::Runner::Device {
     uint32_t glrpb_plw;
   };
 
+  /** Side effect of a write to a register array element */
+  enum reg_array_hook : uint8_t {
+    RA_HOOK_NONE,
+    RA_HOOK_QTX_ENA,
+    RA_HOOK_QTX_TAIL,
+    RA_HOOK_QRX_ENA,
+    RA_HOOK_QRX_TAIL,
+    RA_HOOK_RSS_KEY,
+    RA_HOOK_VF_QMAP,
+    RA_HOOK_VF_RESET,
+    RA_HOOK_VF_ATQ,
+    RA_HOOK_VF_ARQ,
+  };
+
+  /**
+   * Per-queue/per-vector register array in the memory bar, mapping
+   * [first, last] to the uint32_t array at byte offset `field` in i40e_regs.
+   */
+  struct reg_array {
+    uint32_t first;
+    uint32_t last;
+    uint32_t stride;
+    uint32_t field;
+    reg_array_hook hook;
+  };
+
+  /** Register arrays sorted by address, searched by `reg_array_lookup` */
+  static const reg_array reg_arrays[];
+  static const size_t NUM_REG_ARRAYS;
+
  public:
   i40e_bm();
   ~i40e_bm();
@@ -594,16 +1013,32 @@ class i40e_bm : public nicbm::Runner::Device {
   void DmaComplete(nicbm::DMAOp &op) override;
   void EthRx(uint8_t port, const void *data, size_t len) override;
   void Timed(nicbm::TimedEvent &ev) override;
+  void AddOptions(nicbm::Options &opts) override;
 
   virtual void SignalInterrupt(uint16_t vector, uint8_t itr);
 
+  /** Descriptor thresholds for LAN queues, set before the simulation runs */
+  desc_thresh lan_desc_thresh;
+  /** Advertise the flow director capability, set before the simulation runs.
+   * Off by default, as drivers then add a flow director VSI. */
+  bool fd_enable;
+
+  /** Create `n` VFs (at most MAX_VFS), before the simulation runs */
+  void set_vfs(uint16_t n);
+
  protected:
   logger log;
   i40e_regs regs;
   queue_admin_tx pf_atq;
+  queue_pf_admin_rx pf_arq;
   host_mem_cache hmc;
   shadow_ram shram;
   lan lanmgr;
+  // VSIs added through the admin queue after the PF VSI, and the VF each
+  // belongs to (-1 for the PF)
+  uint16_t vsis_added;
+  std::vector<int16_t> vsi_vf;
+  std::vector<vf_func *> vfs;
 
   int_ev intevs[NUM_PFINTS];
 
@@ -617,18 +1052,43 @@ class i40e_bm : public nicbm::Runner::Device {
   /** 32-bit write to the memory bar (should be the default) */
   virtual void reg_mem_write32(uint64_t addr, uint32_t val);
 
+  /** Find the register array containing `addr`, or nullptr if none does */
+  static const reg_array *reg_array_lookup(uint64_t addr);
+  /** Element `idx` of register array `ra` in `regs` */
+  uint32_t &reg_array_elem(const reg_array &ra, size_t idx) {
+    return reinterpret_cast<uint32_t *>(reinterpret_cast<uint8_t *>(&regs) +
+                                        ra.field)[idx];
+  }
+
+  /** PF queue of queue `i` of VF `vf`, false if it is not mapped */
+  bool vf_queue_map(uint16_t vf, uint16_t i, uint16_t &q) const;
+  /** VF of VSI `seid`, -1 for the PF or unknown VSIs */
+  int16_t vsi_vf_get(uint16_t seid) const;
+
   void reset(bool indicate_done);
 };
 
+// one's complement sum over `len` bytes at `buf`, folded to 16 bits (uses
+// AVX2/SSE2 where available)
+uint16_t xsum_raw(const void *buf, size_t len);
+
+// portable implementation of xsum_raw
+uint16_t xsum_raw_scalar(const void *buf, size_t len);
+
 // places the tcp checksum in the packet (assuming ipv4)
 void xsum_tcp(void *tcphdr, size_t l4len);
 
 // places the udpp checksum in the packet (assuming ipv4)
 void xsum_udp(void *udpphdr, size_t l4len);
 
-// calculates the full ipv4 & tcp checksum without assuming any pseudo header
-// xsums
-void xsum_tcpip_tso(void *iphdr, uint8_t iplen, uint8_t l4len, uint16_t paylen);
+// calculates the header checksum state from the first segment's headers
+void tso_xsum_init(tso_xsum_state &st, const void *iphdr, uint8_t iplen,
+                   uint8_t l4len);
+
+// sets the ip length and the ipv4 & tcp checksums of a segment with `paylen`
+// bytes of payload following the headers, from the state of its unit
+void tso_xsum_segment(const tso_xsum_state &st, void *iphdr, uint8_t iplen,
+                      uint8_t l4len, uint16_t paylen);
 
 void tso_postupdate_header(void *iphdr, uint8_t iplen, uint8_t l4len,
                            uint16_t paylen);
@@ -26,14 +26,13 @@
 #include <string.h>
 
 #include <cassert>
-#include <iostream>
 
 #include "sims/nic/i40e_bm/i40e_base_wrapper.h"
 #include "sims/nic/i40e_bm/i40e_bm.h"
 
 namespace i40e {
 
-host_mem_cache::host_mem_cache(i40e_bm &dev_) : dev(dev_) {
+host_mem_cache::host_mem_cache(i40e_bm &dev_) : dev(dev_), log("hmc", dev_) {
   reset();
 }
 
@@ -57,9 +56,7 @@ void host_mem_cache::reg_updated(uint64_t addr) {
     uint32_t hi = dev.regs.pfhmc_sddatahigh;
     if ((cmd & I40E_PFHMC_SDCMD_PMSDWR_MASK)) {
       // write
-#ifdef DEBUG_HMC
-      std::cerr << "hmc: writing descriptor " << idx << std::endl;
-#endif
+      I40E_LOG(log, kHmc, "writing descriptor %x", idx);
 
       segs[idx].addr = ((lo & I40E_PFHMC_SDDATALOW_PMSDDATALOW_MASK) >>
                         I40E_PFHMC_SDDATALOW_PMSDDATALOW_SHIFT)
@@ -70,17 +67,12 @@ void host_mem_cache::reg_updated(uint64_t addr) {
       segs[idx].valid = !!(lo & I40E_PFHMC_SDDATALOW_PMSDVALID_MASK);
       segs[idx].direct = !!(lo & I40E_PFHMC_SDDATALOW_PMSDTYPE_MASK);
 
-#ifdef DEBUG_HMC
-      std::cerr << "    addr=" << segs[idx].addr
-                << " pgcount=" << segs[idx].pgcount
-                << " valid=" << segs[idx].valid
-                << " direct=" << segs[idx].direct << std::endl;
-#endif
+      I40E_LOG(log, kHmc, "    addr=%x pgcount=%x valid=%d direct=%d",
+               segs[idx].addr, segs[idx].pgcount, segs[idx].valid,
+               segs[idx].direct);
     } else {
       // read
-#ifdef DEBUG_HMC
-      std::cerr << "hmc: reading descriptor " << idx << std::endl;
-#endif
+      I40E_LOG(log, kHmc, "reading descriptor %x", idx);
 
       dev.regs.pfhmc_sddatalow =
           ((segs[idx].addr >> 12) << I40E_PFHMC_SDDATALOW_PMSDDATALOW_SHIFT) &
@@ -105,36 +97,33 @@ void host_mem_cache::issue_mem_op(mem_op &op) {
   struct segment *seg = &segs[seg_idx];
 
   if (seg_idx >= MAX_SEGMENTS) {
-    std::cerr << "hmc issue_mem_op: seg index too high " << seg_idx
-              << std::endl;
+    I40E_LOG(log, kErr, "issue_mem_op: seg index too high %x", seg_idx);
     abort();
   }
 
   if (!seg->valid) {
     // TODO(antoinek): errorinfo and data registers
-    std::cerr << "hmc issue_mem_op: segment invalid addr=" << addr << std::endl;
+    I40E_LOG(log, kErr, "issue_mem_op: segment invalid addr=%x", addr);
     op.failed = true;
     return;
   }
 
   if (seg_idx != seg_idx_last) {
-    std::cerr << "hmc issue_mem_op: operation crosses segs addr=" << addr
-              << " len=" << op.len_ << std::endl;
+    I40E_LOG(log, kErr, "issue_mem_op: operation crosses segs addr=%x len=%x",
+             addr, op.len_);
     abort();
   }
 
   if (!seg->direct) {
-    std::cerr << "hmc issue_mem_op: TODO paged ops addr=" << addr << std::endl;
+    I40E_LOG(log, kErr, "issue_mem_op: TODO paged ops addr=%x", addr);
     abort();
   }
 
   op.failed = false;
   op.dma_addr_ = seg->addr + dir_off;
 
-#ifdef DEBUG_HMC
-  std::cerr << "hmc issue_mem_op: hmc_addr=" << addr
-            << " dma_addr=" << op.dma_addr_ << " len=" << op.len_ << std::endl;
-#endif
+  I40E_LOG(log, kHmc, "issue_mem_op: hmc_addr=%x dma_addr=%x len=%x", addr,
+           op.dma_addr_, op.len_);
   dev.runner_->IssueDma(op);
 }
 }  // namespace i40e
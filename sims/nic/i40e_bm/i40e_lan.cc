@@ -26,8 +26,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
 #include <cassert>
-#include <iostream>
+#include <utility>
 
 #include "sims/nic/i40e_bm/headers.h"
 #include "sims/nic/i40e_bm/i40e_base_wrapper.h"
@@ -39,103 +40,437 @@ lan::lan(i40e_bm &dev_, size_t num_qs_)
     : dev(dev_),
       log("lan", dev_),
       rss_kc(dev_.regs.pfqf_hkey),
-      num_qs(num_qs_) {
-  rxqs = new lan_queue_rx *[num_qs];
-  txqs = new lan_queue_tx *[num_qs];
+      num_qs(num_qs_),
+      queue_vf(num_qs_, -1),
+      vf_queues(false),
+      veb_frames(0),
+      fd_hits(0),
+      fd_misses(0),
+      fd_drops(0),
+      oversize_drops(0) {
+  rxqs = new lan_queue_rx *[num_qs]();
+  txqs = new lan_queue_tx *[num_qs]();
+  live_map[0].resize((num_qs + 63) / 64);
+  live_map[1].resize((num_qs + 63) / 64);
+}
+
+lan_queue_base *lan::queue_get(uint16_t idx, bool rx) {
+  return rx ? static_cast<lan_queue_base *>(rxqs[idx])
+            : static_cast<lan_queue_base *>(txqs[idx]);
+}
+
+lan_queue_base &lan::queue_create(uint16_t idx, bool rx) {
+  lan_queue_base *q = queue_get(idx, rx);
+  if (q) {
+    // re-enabled before its release
+    for (auto it = release_qs.begin(); it != release_qs.end(); ++it) {
+      if (*it == q) {
+        release_qs.erase(it);
+        break;
+      }
+    }
+    return *q;
+  }
+
+  I40E_LOG(log, kLan, " instantiating queue idx=%x rx=%d", idx, rx);
+  if (rx) {
+    q = rxqs[idx] = new lan_queue_rx(
+        *this, dev.regs.qrx_tail[idx], idx, dev.regs.qrx_ena[idx],
+        dev.regs.glhmc_lanrxbase[0], dev.regs.qint_rqctl[idx]);
+  } else {
+    q = txqs[idx] = new lan_queue_tx(
+        *this, dev.regs.qtx_tail[idx], idx, dev.regs.qtx_ena[idx],
+        dev.regs.glhmc_lantxbase[0], dev.regs.qint_tqctl[idx]);
+  }
+  live_map[rx][idx / 64] |= 1ULL << (idx % 64);
+  return *q;
+}
+
+void lan::queue_release(uint16_t idx, bool rx) {
+  lan_queue_base *q = queue_get(idx, rx);
+  if (!q->is_idle()) {
+    // dma operations still reference the queue, try again later
+    release_qs.push_back(q);
+    return;
+  }
+
+  I40E_LOG(log, kLan, " releasing queue idx=%x rx=%d", idx, rx);
+  if (rx) {
+    delete rxqs[idx];
+    rxqs[idx] = nullptr;
+  } else {
+    delete txqs[idx];
+    txqs[idx] = nullptr;
+  }
+  live_map[rx][idx / 64] &= ~(1ULL << (idx % 64));
+}
 
-  for (size_t i = 0; i < num_qs; i++) {
-    rxqs[i] =
-        new lan_queue_rx(*this, dev.regs.qrx_tail[i], i, dev.regs.qrx_ena[i],
-                         dev.regs.glhmc_lanrxbase[0], dev.regs.qint_rqctl[i]);
-    txqs[i] =
-        new lan_queue_tx(*this, dev.regs.qtx_tail[i], i, dev.regs.qtx_ena[i],
-                         dev.regs.glhmc_lantxbase[0], dev.regs.qint_tqctl[i]);
+void lan::release_idle() {
+  std::vector<lan_queue_base *> pending;
+  pending.swap(release_qs);
+  for (lan_queue_base *q : pending) {
+    bool rx = q == queue_get(q->idx, true);
+    queue_release(q->idx, rx);
+  }
+}
+
+template <typename F>
+void lan::for_each_live(bool rx, F f) {
+  for (size_t w = 0; w < live_map[rx].size(); w++) {
+    for (uint64_t m = live_map[rx][w]; m != 0; m &= m - 1)
+      f(w * 64 + __builtin_ctzll(m));
   }
 }
 
 void lan::reset() {
   rss_kc.set_dirty();
-  for (size_t i = 0; i < num_qs; i++) {
-    rxqs[i]->reset();
-    txqs[i]->reset();
+  std::fill(queue_vf.begin(), queue_vf.end(), -1);
+  vf_queues = false;
+  vf_macs.clear();
+  fd_table.clear();
+  release_qs.clear();
+  for (bool rx : {false, true}) {
+    for_each_live(rx, [this, rx](uint16_t idx) {
+      queue_get(idx, rx)->reset();
+      queue_release(idx, rx);
+    });
   }
 }
 
 void lan::qena_updated(uint16_t idx, bool rx) {
   uint32_t &reg = (rx ? dev.regs.qrx_ena[idx] : dev.regs.qtx_ena[idx]);
-#ifdef DEBUG_LAN
-  log << " qena updated idx=" << idx << " rx=" << rx << " reg=" << reg
-      << logger::endl;
-#endif
-  lan_queue_base &q = (rx ? static_cast<lan_queue_base &>(*rxqs[idx])
-                          : static_cast<lan_queue_base &>(*txqs[idx]));
-
-  if ((reg & I40E_QRX_ENA_QENA_REQ_MASK) && !q.is_enabled()) {
-    q.enable();
-  } else if (!(reg & I40E_QRX_ENA_QENA_REQ_MASK) && q.is_enabled()) {
-    q.disable();
+  I40E_LOG(log, kLan, " qena updated idx=%x rx=%d reg=%x", idx, rx, reg);
+  release_idle();
+
+  lan_queue_base *q = queue_get(idx, rx);
+  if ((reg & I40E_QRX_ENA_QENA_REQ_MASK) &&
+      (!q || !(q->is_enabled() || q->enabling))) {
+    lan_queue_base &nq = queue_create(idx, rx);
+    nq.enable();
+    // context fetch could not be issued
+    if (!nq.enabling && !nq.is_enabled())
+      queue_release(idx, rx);
+  } else if (!(reg & I40E_QRX_ENA_QENA_REQ_MASK) && q &&
+             (q->is_enabled() || q->enabling)) {
+    q->disable();
+    queue_release(idx, rx);
   }
 }
 
 void lan::tail_updated(uint16_t idx, bool rx) {
-#ifdef DEBUG_LAN
-  log << " tail updated idx=" << idx << " rx=" << rx << logger::endl;
-#endif
-
-  lan_queue_base &q = (rx ? static_cast<lan_queue_base &>(*rxqs[idx])
-                          : static_cast<lan_queue_base &>(*txqs[idx]));
+  I40E_LOG(log, kLan, " tail updated idx=%x rx=%d", idx, rx);
 
-  if (q.is_enabled())
-    q.reg_updated();
+  lan_queue_base *q = queue_get(idx, rx);
+  if (q && q->is_enabled())
+    q->reg_updated();
 }
 
 void lan::rss_key_updated() {
   rss_kc.set_dirty();
 }
 
-bool lan::rss_steering(const void *data, size_t len, uint16_t &queue,
-                       uint32_t &hash) {
-  hash = 0;
+void lan::vf_qmap_updated() {
+  std::fill(queue_vf.begin(), queue_vf.end(), -1);
+  vf_queues = false;
+  for (uint16_t vf = 0; vf < dev.vfs.size(); vf++) {
+    for (uint16_t i = 0; i < dev.VF_QUEUES; i++) {
+      uint16_t q;
+      if (dev.vf_queue_map(vf, i, q)) {
+        queue_vf[q] = vf;
+        vf_queues = true;
+      }
+    }
+  }
+}
+
+uint64_t lan::mac_key(const uint8_t *mac) {
+  uint64_t k = 0;
+  memcpy(&k, mac, 6);
+  return k;
+}
+
+void lan::vf_mac_add(const uint8_t *mac, uint16_t vf) {
+  I40E_LOG(log, kLan, " vf %x mac added", vf);
+  vf_macs[mac_key(mac)] = vf;
+}
+
+void lan::vf_mac_remove(const uint8_t *mac) {
+  vf_macs.erase(mac_key(mac));
+}
+
+bool lan::vf_steering(const void *data, size_t len, uint16_t &queue) {
+  const uint8_t *dst = reinterpret_cast<const uint8_t *>(data);
+  if (len < 6)
+    return false;
+  auto it = vf_macs.find(mac_key(dst));
+  if (it == vf_macs.end())
+    return false;
+
+  // spread flows over the queues mapped to the VF
+  uint16_t qs[i40e_bm::VF_QUEUES];
+  uint16_t n = 0;
+  for (uint16_t i = 0; i < dev.VF_QUEUES; i++) {
+    if (dev.vf_queue_map(it->second, i, qs[n]))
+      n++;
+  }
+  fd_key key;
+  size_t h = flow_parse(data, len, key) ? fd_key_hash()(key) : 0;
+  // without queues the frame is dropped
+  queue = n ? qs[h % n] : num_qs;
+  I40E_LOG(log, kLan, "  vf=%x q=%x", it->second, queue);
+  return true;
+}
+
+bool lan::veb_local(const uint8_t *dst, uint16_t txq) {
+  // multicast and broadcast frames only go to the network
+  if (dst[0] & 1)
+    return false;
+
+  int16_t src = queue_vf[txq];
+  uint64_t k = mac_key(dst);
+  auto it = vf_macs.find(k);
+  if (it != vf_macs.end())
+    return it->second != src;
+  return src >= 0 && k == (dev.runner_->GetMacAddr() & 0xffffffffffffULL);
+}
+
+void lan::veb_switch(const void *data, size_t len) {
+  I40E_LOG(log, kLan, " switching frame len=%x locally", len);
+  veb_frames++;
+  packet_received(data, len);
+}
+
+bool fd_key::operator==(const fd_key &o) const {
+  return !memcmp(this, &o, sizeof(*this));
+}
+
+size_t fd_key_hash::operator()(const fd_key &k) const {
+  // FNV-1a over the whole key, flow_parse zeroes unused bytes
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(&k);
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < sizeof(k); i++)
+    h = (h ^ p[i]) * 0x100000001b3ULL;
+  return h;
+}
+
+bool lan::flow_parse(const void *data, size_t len, fd_key &key) {
+  const uint8_t *pkt = reinterpret_cast<const uint8_t *>(data);
+  const headers::eth_hdr *eth = reinterpret_cast<const headers::eth_hdr *>(pkt);
+  size_t l3_off = sizeof(*eth);
+  size_t l4_off;
+  uint8_t proto;
+
+  memset(&key, 0, sizeof(key));
+  if (len < l3_off)
+    return false;
 
-  const headers::pkt_tcp *tcp =
-      reinterpret_cast<const headers::pkt_tcp *>(data);
-  const headers::pkt_udp *udp =
-      reinterpret_cast<const headers::pkt_udp *>(data);
-
-  // should actually determine packet type and mask with enabled packet types
-  // TODO(antoinek): ipv6
-  if (tcp->eth.type == htons(ETH_TYPE_IP) && tcp->ip.proto == IP_PROTO_TCP) {
-    hash = rss_kc.hash_ipv4(ntohl(tcp->ip.src), ntohl(tcp->ip.dest),
-                            ntohs(tcp->tcp.src), ntohs(tcp->tcp.dest));
-  } else if (udp->eth.type == htons(ETH_TYPE_IP) &&
-             udp->ip.proto == IP_PROTO_UDP) {
-    hash = rss_kc.hash_ipv4(ntohl(udp->ip.src), ntohl(udp->ip.dest),
-                            ntohs(udp->udp.src), ntohs(udp->udp.dest));
-  } else if (udp->eth.type == htons(ETH_TYPE_IP)) {
-    hash = rss_kc.hash_ipv4(ntohl(udp->ip.src), ntohl(udp->ip.dest), 0, 0);
+  if (eth->type == htons(ETH_TYPE_IP) && len >= l3_off + IP_HLEN) {
+    const headers::ip_hdr *ip =
+        reinterpret_cast<const headers::ip_hdr *>(pkt + l3_off);
+    memcpy(key.src, &ip->src, 4);
+    memcpy(key.dst, &ip->dest, 4);
+    l4_off = l3_off + IPH_HL(ip) * 4;
+    proto = ip->proto;
+
+    if (ntohs(ip->offset) & (IP_MF | IP_OFFMASK))
+      key.pctype = I40E_FILTER_PCTYPE_FRAG_IPV4;
+    else if (proto == IP_PROTO_TCP && len >= l4_off + 4)
+      key.pctype = I40E_FILTER_PCTYPE_NONF_IPV4_TCP;
+    else if (proto == IP_PROTO_UDP && len >= l4_off + 4)
+      key.pctype = I40E_FILTER_PCTYPE_NONF_IPV4_UDP;
+    else
+      key.pctype = I40E_FILTER_PCTYPE_NONF_IPV4_OTHER;
+  } else if (eth->type == htons(ETH_TYPE_IPV6) &&
+             len >= l3_off + IP6_HLEN) {
+    const headers::ip6_hdr *ip6 =
+        reinterpret_cast<const headers::ip6_hdr *>(pkt + l3_off);
+    memcpy(key.src, ip6->src, 16);
+    memcpy(key.dst, ip6->dest, 16);
+    key.ipv6 = true;
+    l4_off = l3_off + IP6_HLEN;
+    proto = ip6->next;
+
+    // other extension headers are treated as l3 only
+    if (proto == IP6_PROTO_FRAG)
+      key.pctype = I40E_FILTER_PCTYPE_FRAG_IPV6;
+    else if (proto == IP_PROTO_TCP && len >= l4_off + 4)
+      key.pctype = I40E_FILTER_PCTYPE_NONF_IPV6_TCP;
+    else if (proto == IP_PROTO_UDP && len >= l4_off + 4)
+      key.pctype = I40E_FILTER_PCTYPE_NONF_IPV6_UDP;
+    else
+      key.pctype = I40E_FILTER_PCTYPE_NONF_IPV6_OTHER;
   } else {
     return false;
   }
 
+  if (key.pctype == I40E_FILTER_PCTYPE_NONF_IPV4_TCP ||
+      key.pctype == I40E_FILTER_PCTYPE_NONF_IPV4_UDP ||
+      key.pctype == I40E_FILTER_PCTYPE_NONF_IPV6_TCP ||
+      key.pctype == I40E_FILTER_PCTYPE_NONF_IPV6_UDP) {
+    // source and destination port are at the same offset for tcp and udp
+    memcpy(&key.sport, pkt + l4_off, 2);
+    memcpy(&key.dport, pkt + l4_off + 2, 2);
+  }
+  return true;
+}
+
+bool lan::rss_steering(const fd_key &key, uint16_t &queue, uint32_t &hash) {
+  uint8_t input[rss_key_cache::max_input];
+  size_t alen = key.ipv6 ? 16 : 4;
+  size_t in_len;
+
+  hash = 0;
+  uint64_t hena =
+      dev.regs.pfqf_hena[0] | ((uint64_t)dev.regs.pfqf_hena[1] << 32);
+  if (!(hena & (1ULL << key.pctype)))
+    return false;
+
+  // the hash input is the addresses, followed by the ports for tcp and udp
+  memcpy(input, key.src, alen);
+  memcpy(input + alen, key.dst, alen);
+  in_len = 2 * alen;
+  if (key.pctype == I40E_FILTER_PCTYPE_NONF_IPV4_TCP ||
+      key.pctype == I40E_FILTER_PCTYPE_NONF_IPV4_UDP ||
+      key.pctype == I40E_FILTER_PCTYPE_NONF_IPV6_TCP ||
+      key.pctype == I40E_FILTER_PCTYPE_NONF_IPV6_UDP) {
+    memcpy(input + in_len, &key.sport, 2);
+    memcpy(input + in_len + 2, &key.dport, 2);
+    in_len += 4;
+  }
+  hash = rss_kc.hash(input, in_len);
+
   uint16_t luts =
       (!(dev.regs.pfqf_ctl_0 & I40E_PFQF_CTL_0_HASHLUTSIZE_MASK) ? 128 : 512);
   uint16_t idx = hash % luts;
   queue = (dev.regs.pfqf_hlut[idx / 4] >> (8 * (idx % 4))) & 0x3f;
-#ifdef DEBUG_LAN
-  log << "  q=" << queue << " h=" << hash << " i=" << idx << logger::endl;
-#endif
+  I40E_LOG(log, kLan, "  q=%x h=%x i=%x", queue, hash, idx);
   return true;
 }
 
+void lan::fd_program(const struct i40e_filter_program_desc &fdd,
+                     const void *pkt, size_t len, bool atr, uint16_t txq) {
+  uint32_t qw0 = fdd.qindex_flex_ptype_vsi;
+  uint32_t qw1 = fdd.dtype_cmd_cntindex;
+  uint8_t pcmd = (qw1 & I40E_TXD_FLTR_QW1_PCMD_MASK) >>
+                 I40E_TXD_FLTR_QW1_PCMD_SHIFT;
+
+  fd_filter f;
+  f.fd_id = fdd.fd_id;
+  f.queue =
+      (qw0 & I40E_TXD_FLTR_QW0_QINDEX_MASK) >> I40E_TXD_FLTR_QW0_QINDEX_SHIFT;
+  f.dest = (qw1 & I40E_TXD_FLTR_QW1_DEST_MASK) >> I40E_TXD_FLTR_QW1_DEST_SHIFT;
+  f.fd_status = (qw1 & I40E_TXD_FLTR_QW1_FD_STATUS_MASK) >>
+                I40E_TXD_FLTR_QW1_FD_STATUS_SHIFT;
+  f.cnt_ena = (qw1 >> I40E_TXD_FLTR_QW1_CNT_ENA_SHIFT) & 1;
+  f.cnt_idx = (qw1 & I40E_TXD_FLTR_QW1_CNTINDEX_MASK) >>
+              I40E_TXD_FLTR_QW1_CNTINDEX_SHIFT;
+
+  fd_key key;
+  if (!flow_parse(pkt, len, key)) {
+    I40E_LOG(log, kErr, "fd_program: filter packet is not ip, ignoring");
+    return;
+  }
+  // the driver's packet classifier type wins over the parsed one
+  key.pctype =
+      (qw0 & I40E_TXD_FLTR_QW0_PCTYPE_MASK) >> I40E_TXD_FLTR_QW0_PCTYPE_SHIFT;
+  if (atr) {
+    uint8_t tmp[16];
+    memcpy(tmp, key.src, 16);
+    memcpy(key.src, key.dst, 16);
+    memcpy(key.dst, tmp, 16);
+    std::swap(key.sport, key.dport);
+  }
+
+  uint64_t error = 0;
+  if (pcmd == I40E_FILTER_PROGRAM_DESC_PCMD_ADD_UPDATE) {
+    auto it = fd_table.find(key);
+    if (it != fd_table.end())
+      it->second = f;
+    else if (fd_table.size() >= FD_MAX_FILTERS)
+      error = 1 << I40E_RX_PROG_STATUS_DESC_FD_TBL_FULL_SHIFT;
+    else
+      fd_table.emplace(key, f);
+  } else if (pcmd == I40E_FILTER_PROGRAM_DESC_PCMD_REMOVE) {
+    if (!fd_table.erase(key))
+      error = 1 << I40E_RX_PROG_STATUS_DESC_NO_FD_ENTRY_SHIFT;
+  }
+
+  I40E_LOG(log, kLan,
+           " fd program pcmd=%x atr=%x q=%x dest=%x id=%x err=%x filters=%x",
+           pcmd, atr, f.queue, f.dest, f.fd_id, error, fd_table.size());
+
+  // status goes to the rx queue paired with the programming tx queue, for ATR
+  // only failures are reported
+  if ((!atr || error) && rxqs[txq])
+    rxqs[txq]->prog_status(f.fd_id, error);
+}
+
+size_t lan::fd_filter_count() const {
+  return fd_table.size();
+}
+
+void lan::print_stats(FILE *f) const {
+  if (oversize_drops)
+    fprintf(f, "lan: oversized frames dropped=%lu\n", oversize_drops);
+  if (veb_frames)
+    fprintf(f, "lan: frames switched between functions=%lu\n", veb_frames);
+  if (!fd_hits && !fd_table.size())
+    return;
+  fprintf(f, "flow director: filters=%zu hits=%lu misses=%lu drops=%lu\n",
+          fd_table.size(), fd_hits, fd_misses, fd_drops);
+}
+
 void lan::packet_received(const void *data, size_t len) {
-#ifdef DEBUG_LAN
-  log << " packet received len=" << len << logger::endl;
-#endif
+  I40E_LOG(log, kLan, " packet received len=%x", len);
 
+  fd_key key;
   uint32_t hash = 0;
+  uint64_t status = 0;
   uint16_t queue = 0;
-  rss_steering(data, len, queue, hash);
-  rxqs[queue]->packet_received(data, len, hash);
+  bool steered = false;
+
+  // frames to a VF address bypass the PF's filters and rss
+  bool to_vf = !vf_macs.empty() && vf_steering(data, len, queue);
+  if (!to_vf && flow_parse(data, len, key)) {
+    // perfect match filters take precedence over rss
+    auto it = fd_table.empty() ? fd_table.end() : fd_table.find(key);
+    if (it == fd_table.end()) {
+      fd_misses++;
+    } else {
+      const fd_filter &f = it->second;
+      fd_hits++;
+      if (f.cnt_ena)
+        dev.regs.glqf_pcnt[f.cnt_idx]++;
+      if (f.dest == I40E_FILTER_PROGRAM_DESC_DEST_DROP_PACKET) {
+        I40E_LOG(log, kLan, " dropped by flow director id=%x", f.fd_id);
+        fd_drops++;
+        return;
+      }
+      if (f.fd_status != I40E_FILTER_PROGRAM_DESC_FD_STATUS_NONE) {
+        hash = f.fd_id;
+        status = (1ULL << I40E_RX_DESC_STATUS_FLM_SHIFT) |
+                 ((uint64_t)I40E_RX_DESC_FLTSTAT_RSV_FD_ID
+                  << I40E_RX_DESC_STATUS_FLTSTAT_SHIFT);
+      }
+      if (f.dest == I40E_FILTER_PROGRAM_DESC_DEST_DIRECT_PACKET_QINDEX) {
+        queue = f.queue;
+        steered = true;
+      }
+    }
+
+    uint32_t rss_hash;
+    if (!steered && rss_steering(key, queue, rss_hash) && !status) {
+      hash = rss_hash;
+      status = (uint64_t)I40E_RX_DESC_FLTSTAT_RSS_HASH
+               << I40E_RX_DESC_STATUS_FLTSTAT_SHIFT;
+    }
+  }
+
+  if (queue >= num_qs || !rxqs[queue]) {
+    I40E_LOG(log, kLan, " queue %x not enabled, dropping", queue);
+    return;
+  }
+  rxqs[queue]->packet_received(data, len, hash, status);
 }
 
 lan_queue_base::lan_queue_base(lan &lanmgr_, const std::string &qtype,
@@ -152,6 +487,11 @@ lan_queue_base::lan_queue_base(lan &lanmgr_, const std::string &qtype,
       reg_intqctl(reg_intqctl_),
       ctx_size(ctx_size_) {
   ctx = new uint8_t[ctx_size_];
+  thresh = lanmgr.dev.lan_desc_thresh;
+}
+
+lan_queue_base::~lan_queue_base() {
+  delete[]((uint8_t *)ctx);
 }
 
 void lan_queue_base::reset() {
@@ -163,9 +503,7 @@ void lan_queue_base::enable() {
   if (enabling || enabled)
     return;
 
-#ifdef DEBUG_LAN
-  log << " lan enabling queue " << idx << logger::endl;
-#endif
+  I40E_LOG(log, kLan, " lan enabling queue %x", idx);
   enabling = true;
 
   qctx_fetch *qf = new qctx_fetch(*this);
@@ -178,12 +516,18 @@ void lan_queue_base::enable() {
   qf->data_ = ctx;
 
   lanmgr.dev.hmc.issue_mem_op(*qf);
+  if (qf->failed) {
+    enabling = false;
+    delete qf;
+  }
 }
 
 void lan_queue_base::ctx_fetched() {
-#ifdef DEBUG_LAN
-  log << " lan ctx fetched " << idx << logger::endl;
-#endif
+  I40E_LOG(log, kLan, " lan ctx fetched %x", idx);
+  if (!enabling) {
+    // disabled or reset in the meantime
+    return;
+  }
 
   initialize();
 
@@ -195,10 +539,9 @@ void lan_queue_base::ctx_fetched() {
 }
 
 void lan_queue_base::disable() {
-#ifdef DEBUG_LAN
-  log << " lan disabling queue " << idx << logger::endl;
-#endif
+  I40E_LOG(log, kLan, " lan disabling queue %x", idx);
   enabled = false;
+  enabling = false;
   // TODO(antoinek): write back
   reg_ena &= ~I40E_QRX_ENA_QENA_STAT_MASK;
 }
@@ -206,9 +549,12 @@ void lan_queue_base::disable() {
 void lan_queue_base::interrupt() {
   uint32_t qctl = reg_intqctl;
   uint32_t gctl = lanmgr.dev.regs.pfint_dyn_ctl0;
-#ifdef DEBUG_LAN
-  log << " interrupt qctl=" << qctl << " gctl=" << gctl << logger::endl;
-#endif
+  I40E_LOG(log, kLan, " interrupt qctl=%x gctl=%x", qctl, gctl);
+
+  if (lanmgr.queue_vf[idx] >= 0) {
+    I40E_LOG(log, kLan, " queue mapped to vf, not signalled");
+    return;
+  }
 
   uint16_t msix_idx = (qctl & I40E_QINT_TQCTL_MSIX_INDX_MASK) >>
                       I40E_QINT_TQCTL_MSIX_INDX_SHIFT;
@@ -218,16 +564,12 @@ void lan_queue_base::interrupt() {
   bool cause_ena = !!(qctl & I40E_QINT_TQCTL_CAUSE_ENA_MASK) &&
                    !!(gctl & I40E_PFINT_DYN_CTL0_INTENA_MASK);
   if (!cause_ena) {
-#ifdef DEBUG_LAN
-    log << " interrupt cause disabled" << logger::endl;
-#endif
+    I40E_LOG(log, kLan, " interrupt cause disabled");
     return;
   }
 
   if (msix_idx == 0) {
-#ifdef DEBUG_LAN
-    log << "   setting int0.qidx=" << msix0_idx << logger::endl;
-#endif
+    I40E_LOG(log, kLan, "   setting int0.qidx=%x", msix0_idx);
     lanmgr.dev.regs.pfint_icr0 |=
         I40E_PFINT_ICR0_INTEVENT_MASK |
         (1 << (I40E_PFINT_ICR0_QUEUE_0_SHIFT + msix0_idx));
@@ -239,6 +581,11 @@ void lan_queue_base::interrupt() {
 }
 
 lan_queue_base::qctx_fetch::qctx_fetch(lan_queue_base &lq_) : lq(lq_) {
+  lq.dma_pending++;
+}
+
+lan_queue_base::qctx_fetch::~qctx_fetch() {
+  lq.dma_pending--;
 }
 
 void lan_queue_base::qctx_fetch::done() {
@@ -262,9 +609,7 @@ void lan_queue_rx::reset() {
 }
 
 void lan_queue_rx::initialize() {
-#ifdef DEBUG_LAN
-  log << " initialize()" << logger::endl;
-#endif
+  I40E_LOG(log, kLan, " initialize()");
   uint8_t *ctx_p = reinterpret_cast<uint8_t *>(ctx);
 
   uint16_t *head_p = reinterpret_cast<uint16_t *>(ctx_p + 0);
@@ -288,17 +633,15 @@ void lan_queue_rx::initialize() {
   rxmax = (((*rxmax_p) >> 6) & ((1 << 14) - 1)) * 128;
 
   if (dtype != 0) {
-    log << "lan_queue_rx::initialize: no header split supported"
-        << logger::endl;
+    I40E_LOG(log, kErr, "lan_queue_rx::initialize: no header split supported");
     abort();
   }
 
-#ifdef DEBUG_LAN
-  log << "  head=" << reg_dummy_head << " base=" << base << " len=" << len
-      << " dbsz=" << dbuff_size << " hbsz=" << hbuff_size
-      << " dtype=" << (unsigned)dtype << " longdesc=" << longdesc
-      << " crcstrip=" << crc_strip << " rxmax=" << rxmax << logger::endl;
-#endif
+  I40E_LOG(log, kLan,
+           "  head=%x base=%x len=%x dbsz=%x hbsz=%x dtype=%x longdesc=%d"
+           " crcstrip=%d rxmax=%x",
+           reg_dummy_head, base, len, dbuff_size, hbuff_size, dtype, longdesc,
+           crc_strip, rxmax);
 }
 
 queue_base::desc_ctx &lan_queue_rx::desc_ctx_create() {
@@ -306,39 +649,52 @@ queue_base::desc_ctx &lan_queue_rx::desc_ctx_create() {
 }
 
 void lan_queue_rx::packet_received(const void *data, size_t pktlen,
-                                   uint32_t h) {
+                                   uint32_t hash, uint64_t status) {
   size_t num_descs = (pktlen + dbuff_size - 1) / dbuff_size;
 
   if (!enabled)
     return;
 
+  if (rxmax && pktlen > rxmax) {
+    I40E_LOG(log, kLan, " packet longer than rxmax (%x), dropping", pktlen);
+    lanmgr.oversize_drops++;
+    return;
+  }
+
   if (dcache.size() < num_descs) {
-#ifdef DEBUG_LAN
-    log << " not enough rx descs (" << num_descs << ", dropping packet"
-        << logger::endl;
-#endif
+    I40E_LOG(log, kLan, " not enough rx descs (%x), dropping packet",
+             num_descs);
     return;
   }
 
   for (size_t i = 0; i < num_descs; i++) {
     rx_desc_ctx &ctx = *dcache.front();
 
-#ifdef DEBUG_LAN
-    log << " packet part=" << i << " received didx=" << ctx.index
-        << " cnt=" << dcache.size() << logger::endl;
-#endif
+    I40E_LOG(log, kLan, " packet part=%x received didx=%x cnt=%x", i, ctx.index,
+             dcache.size());
     dcache.pop_front();
 
     const uint8_t *buf = (const uint8_t *)data + (dbuff_size * i);
     if (i == num_descs - 1) {
       // last packet
-      ctx.packet_received(buf, pktlen - dbuff_size * i, true);
+      ctx.packet_received(buf, pktlen - dbuff_size * i, true, hash, status);
     } else {
-      ctx.packet_received(buf, dbuff_size, false);
+      ctx.packet_received(buf, dbuff_size, false, 0, 0);
     }
   }
 }
 
+void lan_queue_rx::prog_status(uint32_t fd_id, uint64_t error) {
+  if (!enabled || dcache.empty()) {
+    I40E_LOG(log, kLan, " no rx desc for programming status, dropping");
+    return;
+  }
+
+  rx_desc_ctx &ctx = *dcache.front();
+  dcache.pop_front();
+  ctx.prog_status(fd_id, error);
+}
+
 lan_queue_rx::rx_desc_ctx::rx_desc_ctx(lan_queue_rx &queue_)
     : desc_ctx(queue_), rq(queue_) {
 }
@@ -352,7 +708,8 @@ void lan_queue_rx::rx_desc_ctx::process() {
 }
 
 void lan_queue_rx::rx_desc_ctx::packet_received(const void *data, size_t pktlen,
-                                                bool last) {
+                                                bool last, uint32_t hash,
+                                                uint64_t status) {
   // we only use fields in the lowest 16b anyways, even if set to 32b
   union i40e_16byte_rx_desc *rxd =
       reinterpret_cast<union i40e_16byte_rx_desc *>(desc);
@@ -371,10 +728,28 @@ void lan_queue_rx::rx_desc_ctx::packet_received(const void *data, size_t pktlen,
     rxd->wb.qword1.status_error_len |= (1 << I40E_RX_DESC_STATUS_EOF_SHIFT);
     // TODO(antoinek): only if checksums are correct
     rxd->wb.qword1.status_error_len |= (1 << I40E_RX_DESC_STATUS_L3L4P_SHIFT);
+    rxd->wb.qword1.status_error_len |= status;
+    rxd->wb.qword0.hi_dword.rss = hash;
   }
   data_write(addr, pktlen, data);
 }
 
+void lan_queue_rx::rx_desc_ctx::prog_status(uint32_t fd_id, uint64_t error) {
+  union i40e_16byte_rx_desc *rxd =
+      reinterpret_cast<union i40e_16byte_rx_desc *>(desc);
+
+  memset(desc, 0, desc_len);
+  rxd->wb.qword0.hi_dword.fd_id = fd_id;
+  rxd->wb.qword1.status_error_len =
+      (1ULL << I40E_RX_PROG_STATUS_DESC_DD_SHIFT) |
+      ((uint64_t)I40E_RX_PROG_STATUS_DESC_FD_FILTER_STATUS
+       << I40E_RX_PROG_STATUS_DESC_QW1_PROGID_SHIFT) |
+      (error << I40E_RX_PROG_STATUS_DESC_QW1_ERROR_SHIFT) |
+      ((uint64_t)I40E_RX_PROG_STATUS_DESC_LENGTH
+       << I40E_RX_PROG_STATUS_DESC_LENGTH_SHIFT);
+  processed();
+}
+
 lan_queue_tx::lan_queue_tx(lan &lanmgr_, uint32_t &reg_tail_, size_t idx_,
                            uint32_t &reg_ena_, uint32_t &reg_fpmbase_,
                            uint32_t &reg_intqctl)
@@ -386,15 +761,12 @@ lan_queue_tx::lan_queue_tx(lan &lanmgr_, uint32_t &reg_tail_, size_t idx_,
 
 void lan_queue_tx::reset() {
   tso_off = 0;
-  tso_len = 0;
   ready_segments.clear();
   queue_base::reset();
 }
 
 void lan_queue_tx::initialize() {
-#ifdef DEBUG_LAN
-  log << " initialize()" << logger::endl;
-#endif
+  I40E_LOG(log, kLan, " initialize()");
   uint8_t *ctx_p = reinterpret_cast<uint8_t *>(ctx);
 
   uint16_t *head_p = reinterpret_cast<uint16_t *>(ctx_p + 0);
@@ -410,10 +782,8 @@ void lan_queue_tx::initialize() {
   hwb = !!(*hwb_qlen_p & (1 << 0));
   hwb_addr = *hwb_addr_p;
 
-#ifdef DEBUG_LAN
-  log << "  head=" << reg_dummy_head << " base=" << base << " len=" << len
-      << " hwb=" << hwb << " hwb_addr=" << hwb_addr << logger::endl;
-#endif
+  I40E_LOG(log, kLan, "  head=%x base=%x len=%x hwb=%d hwb_addr=%x",
+           reg_dummy_head, base, len, hwb, hwb_addr);
 }
 
 queue_base::desc_ctx &lan_queue_tx::desc_ctx_create() {
@@ -430,9 +800,7 @@ void lan_queue_tx::do_writeback(uint32_t first_idx, uint32_t first_pos,
     dma_hwb *dma = new dma_hwb(*this, first_pos, cnt, (first_idx + cnt) % len);
     dma->dma_addr_ = hwb_addr;
 
-#ifdef DEBUG_LAN
-    log << " hwb=" << *((uint32_t *)dma->data_) << logger::endl;
-#endif
+    I40E_LOG(log, kLan, " hwb=%x", *((uint32_t *)dma->data_));
     dev.runner_->IssueDma(*dma);
   }
 }
@@ -443,7 +811,7 @@ bool lan_queue_tx::trigger_tx_packet() {
   bool eop = false;
   uint64_t d1;
   uint32_t iipt, l4t, pkt_len, total_len = 0, data_limit;
-  bool tso = false;
+  bool tso = false, dummy = false;
   uint32_t tso_mss = 0, tso_paylen = 0;
   uint16_t maclen = 0, iplen = 0, l4len = 0;
 
@@ -451,11 +819,9 @@ bool lan_queue_tx::trigger_tx_packet() {
   if (n == 0)
     return false;
 
-#ifdef DEBUG_LAN
-  log << "trigger_tx_packet(n=" << n
-      << ", firstidx=" << ready_segments.at(0)->index << ")" << logger::endl;
-  log << "  tso_off=" << tso_off << " tso_len=" << tso_len << logger::endl;
-#endif
+  I40E_LOG(log, kLan, "trigger_tx_packet(n=%x, firstidx=%x)", n,
+           ready_segments.at(0)->index);
+  I40E_LOG(log, kLan, "  tso_off=%x", tso_off);
 
   // check if we have a context descriptor first
   tx_desc_ctx *rd = ready_segments.at(0);
@@ -471,31 +837,41 @@ bool lan_queue_tx::trigger_tx_packet() {
     tso = !!(cmd & I40E_TX_CTX_DESC_TSO);
     tso_mss = (d1 & I40E_TXD_CTX_QW1_MSS_MASK) >> I40E_TXD_CTX_QW1_MSS_SHIFT;
 
-#ifdef DEBUG_LAN
-    log << "  tso=" << tso << " mss=" << tso_mss << logger::endl;
-#endif
+    I40E_LOG(log, kLan, "  tso=%d mss=%x", tso, tso_mss);
 
     d_skip = 1;
   }
 
+  // followed by an optional flow director filter programming descriptor
+  struct i40e_filter_program_desc *fdd = nullptr;
+  if (d_skip < n) {
+    rd = ready_segments.at(d_skip);
+    dtype = (rd->d->cmd_type_offset_bsz & I40E_TXD_QW1_DTYPE_MASK) >>
+            I40E_TXD_QW1_DTYPE_SHIFT;
+    if (dtype == I40E_TX_DESC_DTYPE_FILTER_PROG) {
+      fdd = reinterpret_cast<struct i40e_filter_program_desc *>(rd->d);
+      d_skip++;
+    }
+  }
+
   // find EOP descriptor
   for (dcnt = d_skip; dcnt < n && !eop; dcnt++) {
     tx_desc_ctx *rd = ready_segments.at(dcnt);
     d1 = rd->d->cmd_type_offset_bsz;
 
-#ifdef DEBUG_LAN
-    log << " data fetched didx=" << rd->index << " d1=" << d1 << logger::endl;
-#endif
+    I40E_LOG(log, kLan, " data fetched didx=%x d1=%x", rd->index, d1);
 
     dtype = (d1 & I40E_TXD_QW1_DTYPE_MASK) >> I40E_TXD_QW1_DTYPE_SHIFT;
     if (dtype != I40E_TX_DESC_DTYPE_DATA) {
-      log << "trigger tx desc is not a data descriptor idx=" << rd->index
-          << " d1=" << d1 << logger::endl;
+      I40E_LOG(log, kErr,
+               "trigger tx desc is not a data descriptor idx=%x d1=%x",
+               rd->index, d1);
       abort();
     }
 
     uint16_t cmd = (d1 & I40E_TXD_QW1_CMD_MASK) >> I40E_TXD_QW1_CMD_SHIFT;
     eop = (cmd & I40E_TX_DESC_CMD_EOP);
+    dummy |= !!(cmd & I40E_TX_DESC_CMD_DUMMY);
     iipt = cmd & (I40E_TX_DESC_CMD_IIPT_MASK);
     l4t = (cmd & I40E_TX_DESC_CMD_L4T_EOFT_MASK);
 
@@ -517,9 +893,7 @@ bool lan_queue_tx::trigger_tx_packet() {
         (d1 & I40E_TXD_QW1_TX_BUF_SZ_MASK) >> I40E_TXD_QW1_TX_BUF_SZ_SHIFT;
     total_len += pkt_len;
 
-#ifdef DEBUG_LAN
-    log << "    eop=" << eop << " len=" << pkt_len << logger::endl;
-#endif
+    I40E_LOG(log, kLan, "    eop=%d len=%x", eop, pkt_len);
   }
 
   // Unit not completely fetched yet
@@ -536,104 +910,142 @@ bool lan_queue_tx::trigger_tx_packet() {
       data_limit = total_len;
     }
   } else {
-    if (total_len > MTU) {
-      log << "    packet is longer (" << total_len << ") than MTU (" << MTU
-          << ")" << logger::endl;
-      abort();
-    }
     data_limit = total_len;
   }
 
-#ifdef DEBUG_LAN
-  log << "    iipt=" << iipt << " l4t=" << l4t << " maclen=" << maclen
-      << " iplen=" << iplen << " l4len=" << l4len << " total_len=" << total_len
-      << " data_limit=" << data_limit << logger::endl;
-
-#else
-  (void)iipt;
-#endif
+  I40E_LOG(log, kLan,
+           "    iipt=%x l4t=%x maclen=%x iplen=%x l4len=%x total_len=%x"
+           " data_limit=%x",
+           iipt, l4t, maclen, iplen, l4len, total_len, data_limit);
+
+  // copy bytes [start, end) of the unit's data to dst
+  auto gather = [this, d_skip, n](uint8_t *dst, uint32_t start, uint32_t end) {
+    uint32_t off = 0;
+    for (size_t i = d_skip; i < n && off < end; i++) {
+      tx_desc_ctx *rd = ready_segments.at(i);
+      uint16_t pkt_len =
+          (rd->d->cmd_type_offset_bsz & I40E_TXD_QW1_TX_BUF_SZ_MASK) >>
+          I40E_TXD_QW1_TX_BUF_SZ_SHIFT;
+
+      if (off + pkt_len > start) {
+        uint32_t s = start > off ? start : off;
+        uint32_t e = off + pkt_len < end ? off + pkt_len : end;
+
+        I40E_LOG(log, kLan,
+                 "    copying data from off=%x idx=%x start=%x end=%x", off,
+                 rd->index, s, e);
+
+        memcpy(dst, (uint8_t *)rd->data + (s - off), e - s);
+        dst += e - s;
+      }
+      off += pkt_len;
+    }
+  };
+
+  if (fdd && tso_off == 0) {
+    // a dummy packet describes the flow to filter, otherwise the filter is
+    // for the reverse flow of the packet sent (ATR)
+    uint8_t hdrs[128];
+    uint32_t hlen = total_len < sizeof(hdrs) ? total_len : sizeof(hdrs);
+    gather(hdrs, 0, hlen);
+    lanmgr.fd_program(*fdd, hdrs, hlen, !dummy, idx);
+  }
 
-  // copy data for this segment
-  uint32_t off = 0;
-  for (dcnt = d_skip; dcnt < n && off < data_limit; dcnt++) {
-    tx_desc_ctx *rd = ready_segments.at(dcnt);
-    d1 = rd->d->cmd_type_offset_bsz;
-    uint16_t pkt_len =
-        (d1 & I40E_TXD_QW1_TX_BUF_SZ_MASK) >> I40E_TXD_QW1_TX_BUF_SZ_SHIFT;
+  // frames that do not fit into a network message are dropped, as they
+  // would be by a link with a smaller MTU
+  uint16_t hdrlen = maclen + iplen + l4len;
+  uint32_t seg_max =
+      tso && tso_off ? hdrlen + data_limit - tso_off : data_limit;
+  bool oversized = !dummy && seg_max > dev.runner_->EthSendMaxLen(0);
+  if (oversized) {
+    I40E_LOG(log, kLan,
+             "    segment is longer (%x) than the network message size, "
+             "dropping",
+             seg_max);
+    lanmgr.oversize_drops++;
+  }
 
-    if (off <= tso_off && off + pkt_len > tso_off) {
-      uint32_t start = tso_off;
-      uint32_t end = off + pkt_len;
-      if (end > data_limit)
-        end = data_limit;
-
-#ifdef DEBUG_LAN
-      log << "    copying data from off=" << off << " idx=" << rd->index
-          << " start=" << start << " end=" << end << " tso_len=" << tso_len
-          << logger::endl;
-#endif
-
-      memcpy(pktbuf + tso_len, (uint8_t *)rd->data + (start - off),
-             end - start);
-      tso_off = end;
-      tso_len += end - start;
+  if (dummy || oversized) {
+    // only used for programming or dropped, not sent out
+    tso_off = 0;
+    while (dcnt-- > 0) {
+      ready_segments.front()->processed();
+      ready_segments.pop_front();
     }
+    return true;
+  }
 
-    off += pkt_len;
+  if (tso && tso_off == 0) {
+    // keep the headers of the unit around for the following segments
+    gather(pktbuf, 0, hdrlen);
+    tso_off = hdrlen;
+    tso_xsum_init(tso_xsum, pktbuf + maclen, iplen, l4len);
   }
 
-  assert(tso_len <= MTU);
+  // frames between the functions of the device are switched internally,
+  // others are assembled directly in the outgoing message slot
+  bool local = false;
+  if (lanmgr.vf_queues || !lanmgr.vf_macs.empty()) {
+    uint8_t dst[6];
+    gather(dst, 0, sizeof(dst));
+    local = lanmgr.veb_local(dst, idx);
+  }
+  uint8_t *buf;
+  if (local) {
+    lanmgr.veb_buf.resize(seg_max);
+    buf = lanmgr.veb_buf.data();
+  } else {
+    buf = reinterpret_cast<uint8_t *>(dev.runner_->EthSendAlloc(0));
+  }
+  auto send = [&](uint32_t seg_len) {
+    if (local)
+      lanmgr.veb_switch(buf, seg_len);
+    else
+      dev.runner_->EthSendCommit(0, seg_len);
+  };
+  uint32_t seg_len = 0;
+  if (tso) {
+    memcpy(buf, pktbuf, hdrlen);
+    seg_len = hdrlen;
+  }
+  gather(buf + seg_len, tso_off, data_limit);
+  seg_len += data_limit - tso_off;
+  tso_off = data_limit;
 
   if (!tso) {
-#ifdef DEBUG_LAN
-    log << "    normal non-tso packet" << logger::endl;
-#endif
+    I40E_LOG(log, kLan, "    normal non-tso packet");
 
     if (l4t == I40E_TX_DESC_CMD_L4T_EOFT_TCP) {
       uint16_t tcp_off = maclen + iplen;
-      xsum_tcp(pktbuf + tcp_off, tso_len - tcp_off);
+      xsum_tcp(buf + tcp_off, seg_len - tcp_off);
     } else if (l4t == I40E_TX_DESC_CMD_L4T_EOFT_UDP) {
       uint16_t udp_off = maclen + iplen;
-      xsum_udp(pktbuf + udp_off, tso_len - udp_off);
+      xsum_udp(buf + udp_off, seg_len - udp_off);
     }
 
-    dev.runner_->EthSend(pktbuf, tso_len);
+    send(seg_len);
   } else {
-#ifdef DEBUG_LAN
-    log << "    tso packet off=" << tso_off << " len=" << tso_len
-        << logger::endl;
-#endif
+    I40E_LOG(log, kLan, "    tso packet off=%x len=%x", tso_off, seg_len);
 
     // TSO gets hairier
-    uint16_t hdrlen = maclen + iplen + l4len;
-
-    // calculate payload size
-    tso_paylen = tso_len - hdrlen;
-    if (tso_paylen > tso_mss)
-      tso_paylen = tso_mss;
+    tso_paylen = seg_len - hdrlen;
+    tso_xsum_segment(tso_xsum, buf + maclen, iplen, l4len, tso_paylen);
 
-    xsum_tcpip_tso(pktbuf + maclen, iplen, l4len, tso_paylen);
-
-    dev.runner_->EthSend(pktbuf, tso_len);
+    send(seg_len);
 
     tso_postupdate_header(pktbuf + maclen, iplen, l4len, tso_paylen);
 
     // not done yet with this TSO unit
-    if (tso && tso_off < total_len) {
-      tso_len = hdrlen;
+    if (tso_off < total_len)
       return true;
-    }
   }
 
-#ifdef DEBUG_LAN
-  log << "    unit done" << logger::endl;
-#endif
+  I40E_LOG(log, kLan, "    unit done");
   while (dcnt-- > 0) {
     ready_segments.front()->processed();
     ready_segments.pop_front();
   }
 
-  tso_len = 0;
   tso_off = 0;
 
   return true;
@@ -652,33 +1064,35 @@ lan_queue_tx::tx_desc_ctx::tx_desc_ctx(lan_queue_tx &queue_)
 void lan_queue_tx::tx_desc_ctx::prepare() {
   uint64_t d1 = d->cmd_type_offset_bsz;
 
-#ifdef DEBUG_LAN
-  queue.log << " desc fetched didx=" << index << " d1=" << d1 << logger::endl;
-#endif
+  I40E_LOG(queue.log, kLan, " desc fetched didx=%x d1=%x", index, d1);
 
   uint8_t dtype = (d1 & I40E_TXD_QW1_DTYPE_MASK) >> I40E_TXD_QW1_DTYPE_SHIFT;
   if (dtype == I40E_TX_DESC_DTYPE_DATA) {
     uint16_t len =
         (d1 & I40E_TXD_QW1_TX_BUF_SZ_MASK) >> I40E_TXD_QW1_TX_BUF_SZ_SHIFT;
 
-#ifdef DEBUG_LAN
-    queue.log << "  bufaddr=" << d->buffer_addr << " len=" << len
-              << logger::endl;
-#endif
+    I40E_LOG(queue.log, kLan, "  bufaddr=%x len=%x", d->buffer_addr, len);
 
     data_fetch(d->buffer_addr, len);
   } else if (dtype == I40E_TX_DESC_DTYPE_CONTEXT) {
-#ifdef DEBUG_LAN
     struct i40e_tx_context_desc *ctxd =
         reinterpret_cast<struct i40e_tx_context_desc *>(d);
-    queue.log << "  context descriptor: tp=" << ctxd->tunneling_params
-              << " l2t=" << ctxd->l2tag2 << " tctm=" << ctxd->type_cmd_tso_mss
-              << logger::endl;
-#endif
+    I40E_LOG(queue.log, kLan, "  context descriptor: tp=%x l2t=%x tctm=%x",
+             ctxd->tunneling_params, ctxd->l2tag2, ctxd->type_cmd_tso_mss);
+
+    prepared();
+  } else if (dtype == I40E_TX_DESC_DTYPE_FILTER_PROG) {
+    struct i40e_filter_program_desc *fdd =
+        reinterpret_cast<struct i40e_filter_program_desc *>(d);
+    I40E_LOG(queue.log, kLan,
+             "  filter programming descriptor: qw0=%x qw1=%x id=%x",
+             fdd->qindex_flex_ptype_vsi, fdd->dtype_cmd_cntindex, fdd->fd_id);
 
     prepared();
   } else {
-    queue.log << "txq: only support context & data descriptors" << logger::endl;
+    I40E_LOG(queue.log, kErr,
+             "txq: only support context, filter programming & data "
+             "descriptors");
     abort();
   }
 }
@@ -700,15 +1114,15 @@ lan_queue_tx::dma_hwb::dma_hwb(lan_queue_tx &queue_, uint32_t pos_,
   data_ = &next_head;
   len_ = 4;
   write_ = true;
+  queue.dma_pending++;
 }
 
 lan_queue_tx::dma_hwb::~dma_hwb() {
+  queue.dma_pending--;
 }
 
 void lan_queue_tx::dma_hwb::done() {
-#ifdef DEBUG_LAN
-  queue.log << " tx head written back" << logger::endl;
-#endif
+  I40E_LOG(queue.log, kLan, " tx head written back");
   queue.writeback_done(pos, cnt);
   queue.trigger();
   delete this;
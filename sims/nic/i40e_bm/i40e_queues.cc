@@ -27,13 +27,41 @@
 
 #include <algorithm>
 #include <cassert>
-#include <iostream>
 
 #include "sims/nic/i40e_bm/i40e_base_wrapper.h"
 #include "sims/nic/i40e_bm/i40e_bm.h"
 
 namespace i40e {
 
+bool desc_thresh::parse(const char *str) {
+  char *end;
+  unsigned long p = strtoul(str, &end, 10);
+  if (*end != ':')
+    return false;
+  unsigned long h = strtoul(end + 1, &end, 10);
+  if (*end != ':' || h == 0)
+    return false;
+  unsigned long w = strtoul(end + 1, &end, 10);
+  if ((*end && *end != ':') || w == 0)
+    return false;
+  uint64_t timeout_ns = timeout / 1000;
+  if (*end) {
+    timeout_ns = strtoull(end + 1, &end, 10);
+    if (*end)
+      return false;
+  }
+
+  prefetch = p;
+  host = h;
+  writeback = w;
+  timeout = timeout_ns * 1000ULL;
+  return true;
+}
+
+desc_timer::desc_timer(queue_base &queue_)
+    : timed_ev(EV_DESC_TIMER), queue(queue_), armed(false) {
+}
+
 queue_base::queue_base(const std::string &qname_, uint32_t &reg_head_,
                        uint32_t &reg_tail_, i40e_bm &dev_)
     : qname(qname_),
@@ -47,12 +75,29 @@ queue_base::queue_base(const std::string &qname_, uint32_t &reg_head_,
       reg_head(reg_head_),
       reg_tail(reg_tail_),
       enabled(false),
-      desc_len(0) {
+      desc_len(0),
+      dma_pending(0),
+      data_dmas_active(0),
+      timer(*this),
+      thresh_flush(false) {
   for (size_t i = 0; i < MAX_ACTIVE_DESCS; i++) {
     desc_ctxs[i] = nullptr;
   }
 }
 
+queue_base::~queue_base() {
+  assert(dma_pending == 0);
+  if (timer.armed)
+    dev.runner_->EventCancel(timer);
+  for (size_t i = 0; i < MAX_ACTIVE_DESCS; i++) {
+    delete desc_ctxs[i];
+  }
+  for (dma_fetch *dma : fetch_free)
+    delete dma;
+  for (dma_wb *dma : wb_free)
+    delete dma;
+}
+
 void queue_base::ctxs_init() {
   for (size_t i = 0; i < MAX_ACTIVE_DESCS; i++) {
     desc_ctxs[i] = &desc_ctx_create();
@@ -66,24 +111,26 @@ void queue_base::trigger_fetch() {
   // calculate how many we can fetch
   uint32_t next_idx = (active_first_idx + active_cnt) % len;
   uint32_t desc_avail = (reg_tail - next_idx) % len;
-  uint32_t fetch_cnt = desc_avail;
-  fetch_cnt = std::min(fetch_cnt, MAX_ACTIVE_DESCS - active_cnt);
+  uint32_t room = MAX_ACTIVE_DESCS - active_cnt;
   if (max_active_capacity() <= active_cnt)
-    fetch_cnt = std::min(fetch_cnt, max_active_capacity() - active_cnt);
-  fetch_cnt = std::min(fetch_cnt, max_fetch_capacity());
-
-  if (next_idx + fetch_cnt > len)
-    fetch_cnt = len - next_idx;
+    room = std::min(room, max_active_capacity() - active_cnt);
+  room = std::min(room, max_fetch_capacity());
+  uint32_t fetch_cnt = std::min(desc_avail, room);
 
-#ifdef DEBUG_QUEUES
-  log << "fetching avail=" << desc_avail << " cnt=" << fetch_cnt
-      << " idx=" << next_idx << logger::endl;
-#endif
+  I40E_LOG(log, kQueues, "fetching avail=%x cnt=%x idx=%x", desc_avail,
+           fetch_cnt, next_idx);
 
   // abort if nothign to fetch
   if (fetch_cnt == 0)
     return;
 
+  // small batches wait for more descriptors while enough are left to work on
+  if (!thresh_flush && fetch_cnt < std::min(thresh.host, room) &&
+      unprocessed_cnt() > thresh.prefetch) {
+    thresh_defer();
+    return;
+  }
+
   // mark descriptor contexts as fetching
   uint32_t first_pos = (active_first_pos + active_cnt) % MAX_ACTIVE_DESCS;
   for (uint32_t i = 0; i < fetch_cnt; i++) {
@@ -95,17 +142,64 @@ void queue_base::trigger_fetch() {
   }
   active_cnt += fetch_cnt;
 
-  // prepare & issue dma
-  dma_fetch *dma = new dma_fetch(*this, desc_len * fetch_cnt);
+  // a batch wrapping around the end of the ring needs a second dma
+  uint32_t first_cnt = std::min(fetch_cnt, len - next_idx);
+  fetch_issue(next_idx, first_pos, first_cnt);
+  if (first_cnt < fetch_cnt)
+    fetch_issue(0, (first_pos + first_cnt) % MAX_ACTIVE_DESCS,
+                fetch_cnt - first_cnt);
+}
+
+void queue_base::fetch_issue(uint32_t idx, uint32_t pos, uint32_t cnt) {
+  dma_fetch *dma;
+  if (fetch_free.empty()) {
+    dma = new dma_fetch(*this);
+  } else {
+    dma = fetch_free.back();
+    fetch_free.pop_back();
+  }
+
+  size_t dma_len = desc_len * cnt;
+  if (dma->capacity < dma_len) {
+    delete[]((char *)dma->data_);
+    dma->data_ = new char[dma_len];
+    dma->capacity = dma_len;
+  }
   dma->write_ = false;
-  dma->dma_addr_ = base + next_idx * desc_len;
-  dma->pos = first_pos;
-#ifdef DEBUG_QUEUES
-  log << "    dma = " << dma << logger::endl;
-#endif
+  dma->dma_addr_ = base + idx * desc_len;
+  dma->len_ = dma_len;
+  dma->pos = pos;
+  dma_pending++;
+  I40E_LOG(log, kQueues, "    dma = %p idx=%x cnt=%x", dma, idx, cnt);
   dev.runner_->IssueDma(*dma);
 }
 
+uint32_t queue_base::unprocessed_cnt() {
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < active_cnt; i++)
+    if (desc_ctxs[(active_first_pos + i) % MAX_ACTIVE_DESCS]->state <
+        desc_ctx::DESC_PROCESSED)
+      n++;
+  return n;
+}
+
+void queue_base::thresh_defer() {
+  if (timer.armed)
+    return;
+
+  timer.time_ = dev.runner_->TimePs() + thresh.timeout;
+  timer.armed = true;
+  dev.runner_->EventSchedule(timer);
+}
+
+void queue_base::timed() {
+  I40E_LOG(log, kQueues, "threshold timeout");
+  timer.armed = false;
+  thresh_flush = true;
+  trigger();
+  thresh_flush = false;
+}
+
 void queue_base::trigger_process() {
   if (!enabled)
     return;
@@ -125,9 +219,7 @@ void queue_base::trigger_process() {
       break;
 
     ctx.state = desc_ctx::DESC_PROCESSING;
-#ifdef DEBUG_QUEUES
-    log << "processing desc " << ctx.index << logger::endl;
-#endif
+    I40E_LOG(log, kQueues, "processing desc %x", ctx.index);
     ctx.process();
   }
 }
@@ -144,17 +236,20 @@ void queue_base::trigger_writeback() {
       break;
 
   uint32_t cnt = std::min(avail, max_writeback_capacity());
-  if (active_first_idx + cnt > len)
-    cnt = len - active_first_idx;
 
-#ifdef DEBUG_QUEUES
-  log << "writing back avail=" << avail << " cnt=" << cnt
-      << " idx=" << active_first_idx << logger::endl;
-#endif
+  I40E_LOG(log, kQueues, "writing back avail=%x cnt=%x idx=%x", avail, cnt,
+           active_first_idx);
 
   if (cnt == 0)
     return;
 
+  if (!thresh_flush &&
+      cnt < std::min({thresh.writeback, max_writeback_capacity(),
+                      MAX_ACTIVE_DESCS})) {
+    thresh_defer();
+    return;
+  }
+
   // mark these descriptors as writing back
   for (uint32_t i = 0; i < cnt; i++) {
     desc_ctx &ctx = *desc_ctxs[(active_first_pos + i) % MAX_ACTIVE_DESCS];
@@ -171,25 +266,26 @@ void queue_base::trigger() {
 }
 
 void queue_base::reset() {
-#ifdef DEBUG_QUEUES
-  log << "reset" << logger::endl;
-#endif
+  I40E_LOG(log, kQueues, "reset");
 
   enabled = false;
   active_first_pos = 0;
   active_first_idx = 0;
   active_cnt = 0;
 
+  if (timer.armed) {
+    dev.runner_->EventCancel(timer);
+    timer.armed = false;
+  }
+
   for (size_t i = 0; i < MAX_ACTIVE_DESCS; i++) {
     desc_ctxs[i]->state = desc_ctx::DESC_EMPTY;
   }
 }
 
 void queue_base::reg_updated() {
-#ifdef DEBUG_QUEUES
-  log << "reg_updated: tail=" << reg_tail << " enabled=" << (int)enabled
-      << logger::endl;
-#endif
+  I40E_LOG(log, kQueues, "reg_updated: tail=%x enabled=%d", reg_tail,
+           enabled);
   if (!enabled)
     return;
 
@@ -200,6 +296,10 @@ bool queue_base::is_enabled() {
   return enabled;
 }
 
+bool queue_base::is_idle() {
+  return dma_pending == 0;
+}
+
 uint32_t queue_base::max_fetch_capacity() {
   return UINT32_MAX;
 }
@@ -217,18 +317,41 @@ void queue_base::interrupt() {
 
 void queue_base::do_writeback(uint32_t first_idx, uint32_t first_pos,
                               uint32_t cnt) {
-  dma_wb *dma = new dma_wb(*this, desc_len * cnt);
+  // like fetches, write-backs wrapping around the ring need a second dma
+  uint32_t first_cnt = std::min(cnt, len - first_idx);
+  wb_issue(first_idx, first_pos, first_cnt);
+  if (first_cnt < cnt)
+    wb_issue(0, (first_pos + first_cnt) % MAX_ACTIVE_DESCS, cnt - first_cnt);
+}
+
+void queue_base::wb_issue(uint32_t idx, uint32_t pos, uint32_t cnt) {
+  dma_wb *dma;
+  if (wb_free.empty()) {
+    dma = new dma_wb(*this);
+  } else {
+    dma = wb_free.back();
+    wb_free.pop_back();
+  }
+
+  size_t dma_len = desc_len * cnt;
+  if (dma->capacity < dma_len) {
+    delete[]((char *)dma->data_);
+    dma->data_ = new char[dma_len];
+    dma->capacity = dma_len;
+  }
   dma->write_ = true;
-  dma->dma_addr_ = base + first_idx * desc_len;
-  dma->pos = first_pos;
+  dma->dma_addr_ = base + idx * desc_len;
+  dma->len_ = dma_len;
+  dma->pos = pos;
 
   uint8_t *buf = reinterpret_cast<uint8_t *>(dma->data_);
   for (uint32_t i = 0; i < cnt; i++) {
-    desc_ctx &ctx = *desc_ctxs[(first_pos + i) % MAX_ACTIVE_DESCS];
+    desc_ctx &ctx = *desc_ctxs[(pos + i) % MAX_ACTIVE_DESCS];
     assert(ctx.state == desc_ctx::DESC_WRITING_BACK);
     memcpy(buf + i * desc_len, ctx.desc, desc_len);
   }
 
+  dma_pending++;
   dev.runner_->IssueDma(*dma);
 }
 
@@ -243,11 +366,8 @@ void queue_base::writeback_done(uint32_t first_pos, uint32_t cnt) {
     ctx.state = desc_ctx::DESC_WRITTEN_BACK;
   }
 
-#ifdef DEBUG_QUEUES
-  log << "written back afi=" << active_first_idx << " afp=" << active_first_pos
-      << " acnt=" << active_cnt << " pos=" << first_pos << " cnt=" << cnt
-      << logger::endl;
-#endif
+  I40E_LOG(log, kQueues, "written back afi=%x afp=%x acnt=%x pos=%x cnt=%x",
+           active_first_idx, active_first_pos, active_cnt, first_pos, cnt);
 
   // then start at the beginning and check how many are written back and then
   // free those
@@ -260,9 +380,7 @@ void queue_base::writeback_done(uint32_t first_pos, uint32_t cnt) {
 
     ctx.state = desc_ctx::DESC_EMPTY;
   }
-#ifdef DEBUG_QUEUES
-  log << "   bump_cnt=" << bump_cnt << logger::endl;
-#endif
+  I40E_LOG(log, kQueues, "   bump_cnt=%x", bump_cnt);
 
   active_first_pos = (active_first_pos + bump_cnt) % MAX_ACTIVE_DESCS;
   active_first_idx = (active_first_idx + bump_cnt) % len;
@@ -274,6 +392,9 @@ void queue_base::writeback_done(uint32_t first_pos, uint32_t cnt) {
 
 queue_base::desc_ctx::desc_ctx(queue_base &queue_)
     : queue(queue_),
+      data_parts_pending(0),
+      data_dma_addr(0),
+      data_dma_len(0),
       state(DESC_EMPTY),
       index(0),
       desc_len(queue_.desc_len),
@@ -294,28 +415,41 @@ void queue_base::desc_ctx::prepare() {
 }
 
 void queue_base::desc_ctx::prepared() {
-#ifdef DEBUG_QUEUES
-  queue.log << "prepared desc " << index << logger::endl;
-#endif
+  I40E_LOG(queue.log, kQueues, "prepared desc %x", index);
   assert(state == DESC_PREPARING);
   state = DESC_PREPARED;
 }
 
 void queue_base::desc_ctx::processed() {
-#ifdef DEBUG_QUEUES
-  queue.log << "processed desc " << index << logger::endl;
-#endif
+  I40E_LOG(queue.log, kQueues, "processed desc %x", index);
   assert(state == DESC_PROCESSING);
   state = DESC_PROCESSED;
 }
 
 #define MAX_DMA_SIZE ((size_t)9024)
 
+void queue_base::data_dma_issue(dma_base &dma) {
+  if (data_dmas_active < MAX_DATA_DMAS) {
+    data_dmas_active++;
+    dev.runner_->IssueDma(dma);
+  } else {
+    data_dmas_waiting.push_back(&dma);
+  }
+}
+
+void queue_base::data_dma_done() {
+  data_dmas_active--;
+  if (!data_dmas_waiting.empty()) {
+    dma_base *dma = data_dmas_waiting.front();
+    data_dmas_waiting.pop_front();
+    data_dmas_active++;
+    dev.runner_->IssueDma(*dma);
+  }
+}
+
 void queue_base::desc_ctx::data_fetch(uint64_t addr, size_t data_len) {
   if (data_capacity < data_len) {
-#ifdef DEBUG_QUEUES
-    queue.log << "data_fetch allocating" << logger::endl;
-#endif
+    I40E_LOG(queue.log, kQueues, "data_fetch allocating");
     if (data_capacity != 0)
       delete[]((uint8_t *)data);
 
@@ -323,19 +457,25 @@ void queue_base::desc_ctx::data_fetch(uint64_t addr, size_t data_len) {
     data_capacity = data_len;
   }
 
-  dma_data_fetch *dma =
-      new dma_data_fetch(*this, std::min(data_len, MAX_DMA_SIZE), data);
-  dma->part_offset = 0;
-  dma->total_len = data_len;
-  dma->write_ = false;
-  dma->dma_addr_ = addr;
-
-#ifdef DEBUG_QUEUES
-  queue.log << "fetching data idx=" << index << " addr=" << addr
-            << " len=" << data_len << logger::endl;
-  queue.log << "  dma = " << dma << " data=" << data << logger::endl;
-#endif
-  queue.dev.runner_->IssueDma(*dma);
+  I40E_LOG(queue.log, kQueues, "fetching data idx=%x addr=%x len=%x", index,
+           addr, data_len);
+
+  // all parts are issued right away, each lands at its offset in the buffer
+  data_dma_addr = addr;
+  data_dma_len = data_len;
+  data_parts_pending =
+      std::max<size_t>(1, (data_len + MAX_DMA_SIZE - 1) / MAX_DMA_SIZE);
+  size_t off = 0;
+  do {
+    size_t part = std::min(data_len - off, MAX_DMA_SIZE);
+    dma_data_fetch *dma =
+        new dma_data_fetch(*this, part, (uint8_t *)data + off);
+    dma->write_ = false;
+    dma->dma_addr_ = addr + off;
+    I40E_LOG(queue.log, kQueues, "  dma = %p off=%x", dma, off);
+    queue.data_dma_issue(*dma);
+    off += part;
+  } while (off < data_len);
 }
 
 void queue_base::desc_ctx::data_fetched(uint64_t addr, size_t len) {
@@ -344,30 +484,33 @@ void queue_base::desc_ctx::data_fetched(uint64_t addr, size_t len) {
 
 void queue_base::desc_ctx::data_write(uint64_t addr, size_t data_len,
                                       const void *buf) {
-#ifdef DEBUG_QUEUES
-  queue.log << "data_write(addr=" << addr << " datalen=" << data_len << ")"
-            << logger::endl;
-#endif
-  dma_data_wb *data_dma = new dma_data_wb(*this, data_len);
-  data_dma->write_ = true;
-  data_dma->dma_addr_ = addr;
-  memcpy(data_dma->data_, buf, data_len);
-
-  queue.dev.runner_->IssueDma(*data_dma);
+  I40E_LOG(queue.log, kQueues, "data_write(addr=%x datalen=%x)", addr,
+           data_len);
+  data_dma_addr = addr;
+  data_dma_len = data_len;
+  data_parts_pending =
+      std::max<size_t>(1, (data_len + MAX_DMA_SIZE - 1) / MAX_DMA_SIZE);
+  size_t off = 0;
+  do {
+    size_t part = std::min(data_len - off, MAX_DMA_SIZE);
+    dma_data_wb *data_dma = new dma_data_wb(*this, part);
+    data_dma->write_ = true;
+    data_dma->dma_addr_ = addr + off;
+    memcpy(data_dma->data_, (const uint8_t *)buf + off, part);
+    queue.data_dma_issue(*data_dma);
+    off += part;
+  } while (off < data_len);
 }
 
 void queue_base::desc_ctx::data_written(uint64_t addr, size_t len) {
-#ifdef DEBUG_QUEUES
-  queue.log << "data_written(addr=" << addr << " datalen=" << len << ")"
-            << logger::endl;
-#endif
+  I40E_LOG(queue.log, kQueues, "data_written(addr=%x datalen=%x)", addr, len);
   processed();
 }
 
-queue_base::dma_fetch::dma_fetch(queue_base &queue_, size_t len)
-    : queue(queue_) {
-  data_ = new char[len];
-  len_ = len;
+queue_base::dma_fetch::dma_fetch(queue_base &queue_)
+    : queue(queue_), pos(0), capacity(0) {
+  data_ = nullptr;
+  len_ = 0;
 }
 
 queue_base::dma_fetch::~dma_fetch() {
@@ -380,14 +523,13 @@ void queue_base::dma_fetch::done() {
     desc_ctx &ctx = *queue.desc_ctxs[(pos + i) % queue.MAX_ACTIVE_DESCS];
     memcpy(ctx.desc, buf + queue.desc_len * i, queue.desc_len);
 
-#ifdef DEBUG_QUEUES
-    queue.log << "preparing desc " << ctx.index << logger::endl;
-#endif
+    I40E_LOG(queue.log, kQueues, "preparing desc %x", ctx.index);
     ctx.state = desc_ctx::DESC_PREPARING;
     ctx.prepare();
   }
+  queue.dma_pending--;
+  queue.fetch_free.push_back(this);
   queue.trigger();
-  delete this;
 }
 
 queue_base::dma_data_fetch::dma_data_fetch(desc_ctx &ctx_, size_t len,
@@ -395,32 +537,26 @@ queue_base::dma_data_fetch::dma_data_fetch(desc_ctx &ctx_, size_t len,
     : ctx(ctx_) {
   data_ = buffer;
   len_ = len;
+  ctx.queue.dma_pending++;
 }
 
 queue_base::dma_data_fetch::~dma_data_fetch() {
+  ctx.queue.dma_pending--;
 }
 
 void queue_base::dma_data_fetch::done() {
-  part_offset += len_;
-  dma_addr_ += len_;
-  data_ = (uint8_t *)data_ + len_;
-
-  if (part_offset < total_len) {
-#ifdef DEBUG_QUEUES
-    ctx.queue.log << "  dma_fetch: next part of multi part dma" << logger::endl;
-#endif
-    len_ = std::min(total_len - part_offset, MAX_DMA_SIZE);
-    ctx.queue.dev.runner_->IssueDma(*this);
-    return;
+  ctx.queue.data_dma_done();
+  if (--ctx.data_parts_pending == 0) {
+    ctx.data_fetched(ctx.data_dma_addr, ctx.data_dma_len);
+    ctx.queue.trigger();
   }
-  ctx.data_fetched(dma_addr_ - part_offset, total_len);
-  ctx.queue.trigger();
   delete this;
 }
 
-queue_base::dma_wb::dma_wb(queue_base &queue_, size_t len) : queue(queue_) {
-  data_ = new char[len];
-  len_ = len;
+queue_base::dma_wb::dma_wb(queue_base &queue_)
+    : queue(queue_), pos(0), capacity(0) {
+  data_ = nullptr;
+  len_ = 0;
 }
 
 queue_base::dma_wb::~dma_wb() {
@@ -429,22 +565,29 @@ queue_base::dma_wb::~dma_wb() {
 
 void queue_base::dma_wb::done() {
   queue.writeback_done(pos, len_ / queue.desc_len);
+  queue.dma_pending--;
+  queue.wb_free.push_back(this);
   queue.trigger();
-  delete this;
 }
 
-queue_base::dma_data_wb::dma_data_wb(desc_ctx &ctx_, size_t len) : ctx(ctx_) {
+queue_base::dma_data_wb::dma_data_wb(desc_ctx &ctx_, size_t len)
+    : ctx(ctx_) {
   data_ = new char[len];
   len_ = len;
+  ctx.queue.dma_pending++;
 }
 
 queue_base::dma_data_wb::~dma_data_wb() {
   delete[]((char *)data_);
+  ctx.queue.dma_pending--;
 }
 
 void queue_base::dma_data_wb::done() {
-  ctx.data_written(dma_addr_, len_);
-  ctx.queue.trigger();
+  ctx.queue.data_dma_done();
+  if (--ctx.data_parts_pending == 0) {
+    ctx.data_written(ctx.data_dma_addr, ctx.data_dma_len);
+    ctx.queue.trigger();
+  }
   delete this;
 }
 }  // namespace i40e
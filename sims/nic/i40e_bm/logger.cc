@@ -22,77 +22,78 @@
  * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <stdlib.h>
+
 #include <iostream>
+#include <string>
 
 #include "sims/nic/i40e_bm/i40e_bm.h"
 
 namespace i40e {
 
-logger::logger(const std::string &label_, nicbm::Runner::Device &dev_)
-    : label(label_), dev(dev_), runner(dev_.runner_) {
-  ss << std::hex;
-}
+static uint32_t parse_debug_env() {
+  static const struct {
+    const char *name;
+    uint32_t cls;
+  } classes[] = {
+      {"dev", logger::kDev},       {"adminq", logger::kAdminq},
+      {"hmc", logger::kHmc},       {"lan", logger::kLan},
+      {"queues", logger::kQueues},
+  };
+
+  uint32_t en = logger::kErr;
+  const char *env = getenv("I40E_DEBUG");
+  if (!env)
+    return en;
 
-logger &logger::operator<<(char c) {
-  if (c == endl) {
-    uint64_t ts;
+  std::string list(env);
+  size_t pos = 0;
+  while (pos <= list.size()) {
+    size_t end = list.find(',', pos);
+    if (end == std::string::npos)
+      end = list.size();
+    std::string name = list.substr(pos, end - pos);
+    pos = end + 1;
 
-    /* runner might not be initialized yet if called from a constructor
-     * somewhere, in that case see if it's set now otherwise just take 0 as the
-     * current timestamp. */
-    if (!runner) {
-      runner = dev.runner_;
-      ts = runner ? runner->TimePs() : 0;
-    } else {
-      ts = runner->TimePs();
+    if (name.empty())
+      continue;
+    if (name == "all") {
+      en = ~0u;
+      continue;
     }
 
-    std::cerr << ts << " " << label << ": " << ss.str() << std::endl;
-    ss.str(std::string());
-    ss << std::hex;
-  } else {
-    ss << c;
+    bool found = false;
+    for (auto &c : classes) {
+      if (name == c.name) {
+        en |= c.cls;
+        found = true;
+      }
+    }
+    if (!found)
+      std::cerr << "I40E_DEBUG: unknown message class " << name << std::endl;
   }
-  return *this;
-}
-
-logger &logger::operator<<(int32_t i) {
-  ss << i;
-  return *this;
-}
-
-logger &logger::operator<<(uint8_t i) {
-  ss << (unsigned)i;
-  return *this;
-}
-
-logger &logger::operator<<(uint16_t i) {
-  ss << i;
-  return *this;
+  return en;
 }
 
-logger &logger::operator<<(uint32_t i) {
-  ss << i;
-  return *this;
-}
+uint32_t logger::enabled = parse_debug_env();
 
-logger &logger::operator<<(uint64_t i) {
-  ss << i;
-  return *this;
+logger::logger(const std::string &label_, nicbm::Runner::Device &dev_)
+    : label(label_), label_id(nicbm::EvLog::StrId(label_.c_str())), dev(dev_) {
 }
 
-logger &logger::operator<<(bool b) {
-  ss << b;
-  return *this;
-}
+void logger::emit(uint32_t fmt_id, const uint64_t *args, unsigned n) {
+  /* runner might not be initialized yet if called from a constructor
+   * somewhere, in that case just take 0 as the current timestamp. */
+  nicbm::Runner *runner = dev.runner_;
+  uint64_t ts = runner ? runner->TimePs() : 0;
 
-logger &logger::operator<<(const char *str) {
-  ss << str;
-  return *this;
-}
+  if (runner && runner->EventLog().Enabled()) {
+    runner->EventLog().Msg(ts, label_id, fmt_id, args, n);
+    return;
+  }
 
-logger &logger::operator<<(void *ptr) {
-  ss << ptr;
-  return *this;
+  std::cerr << ts << " " << label << ": "
+            << nicbm::EvLog::Format(nicbm::EvLog::Str(fmt_id), args, n)
+            << std::endl;
 }
 }  // namespace i40e
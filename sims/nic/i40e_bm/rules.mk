@@ -24,8 +24,9 @@ include mk/subdir_pre.mk
 
 bin_i40e_bm := $(d)i40e_bm
 
-OBJS := $(addprefix $(d),i40e_bm.o i40e_queues.o i40e_adminq.o i40e_hmc.o \
-    i40e_lan.o xsums.o rss.o logger.o)
+objs_i40e_bm_dev := $(addprefix $(d),i40e_bm.o i40e_queues.o i40e_adminq.o \
+    i40e_hmc.o i40e_lan.o xsums.o rss.o logger.o)
+OBJS := $(objs_i40e_bm_dev) $(d)i40e_bm_main.o
 
 $(OBJS): CPPFLAGS := $(CPPFLAGS) -I$(d)include/
 
@@ -13,6 +13,10 @@
 #include <cassert>
 #include <iostream>
 
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
 #include "sims/nic/i40e_bm/i40e_bm.h"
 
 namespace i40e {
@@ -52,8 +56,8 @@ struct ipv4_hdr {
   uint32_t dst_addr;        /**< destination address */
 } __attribute__((packed));
 
-static inline uint32_t __rte_raw_cksum(const void *buf, size_t len,
-                                       uint32_t sum) {
+static inline uint64_t __rte_raw_cksum(const void *buf, size_t len,
+                                       uint64_t sum) {
   /* workaround gcc strict-aliasing warning */
   uintptr_t ptr = (uintptr_t)buf;
   typedef uint16_t __attribute__((__may_alias__)) u16_p;
@@ -83,74 +87,143 @@ static inline uint32_t __rte_raw_cksum(const void *buf, size_t len,
   return sum;
 }
 
-static inline uint16_t __rte_raw_cksum_reduce(uint32_t sum) {
-  sum = ((sum & 0xffff0000) >> 16) + (sum & 0xffff);
-  sum = ((sum & 0xffff0000) >> 16) + (sum & 0xffff);
+static inline uint16_t xsum_fold(uint64_t sum) {
+  sum = (sum >> 32) + (sum & 0xffffffff);
+  while (sum >> 16)
+    sum = (sum >> 16) + (sum & 0xffff);
   return (uint16_t)sum;
 }
 
-static inline uint16_t rte_raw_cksum(const void *buf, size_t len) {
-  uint32_t sum;
+#ifdef __x86_64__
+/*
+ * The vector variants sum the even and odd bytes of each little-endian 16-bit
+ * word separately with psadbw into 64-bit lanes, so there is no overflow to
+ * handle, and combine them as even + (odd << 8). They process whole vectors
+ * and leave the remainder to the scalar loop, which keeps word alignment
+ * since the vector length is even.
+ */
+__attribute__((target("avx2"))) static uint64_t raw_sum_avx2(
+    const uint8_t *p, size_t len) {
+  const __m256i mask = _mm256_set1_epi16(0x00ff);
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i even = zero, odd = zero;
+
+  for (; len >= 64; p += 64, len -= 64) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32));
+    even = _mm256_add_epi64(
+        even, _mm256_sad_epu8(_mm256_and_si256(a, mask), zero));
+    odd = _mm256_add_epi64(odd,
+                           _mm256_sad_epu8(_mm256_srli_epi16(a, 8), zero));
+    even = _mm256_add_epi64(
+        even, _mm256_sad_epu8(_mm256_and_si256(b, mask), zero));
+    odd = _mm256_add_epi64(odd,
+                           _mm256_sad_epu8(_mm256_srli_epi16(b, 8), zero));
+  }
+  if (len >= 32) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    even = _mm256_add_epi64(
+        even, _mm256_sad_epu8(_mm256_and_si256(a, mask), zero));
+    odd = _mm256_add_epi64(odd,
+                           _mm256_sad_epu8(_mm256_srli_epi16(a, 8), zero));
+    p += 32;
+    len -= 32;
+  }
+
+  __m256i s = _mm256_add_epi64(even, _mm256_slli_epi64(odd, 8));
+  __m128i t = _mm_add_epi64(_mm256_castsi256_si128(s),
+                            _mm256_extracti128_si256(s, 1));
+  t = _mm_add_epi64(t, _mm_unpackhi_epi64(t, t));
+  return __rte_raw_cksum(p, len, (uint64_t)_mm_cvtsi128_si64(t));
+}
+
+static uint64_t raw_sum_sse2(const uint8_t *p, size_t len) {
+  const __m128i mask = _mm_set1_epi16(0x00ff);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i even = zero, odd = zero;
 
-  sum = __rte_raw_cksum(buf, len, 0);
-  return __rte_raw_cksum_reduce(sum);
+  for (; len >= 16; p += 16, len -= 16) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    even = _mm_add_epi64(even, _mm_sad_epu8(_mm_and_si128(a, mask), zero));
+    odd = _mm_add_epi64(odd, _mm_sad_epu8(_mm_srli_epi16(a, 8), zero));
+  }
+
+  __m128i t = _mm_add_epi64(even, _mm_slli_epi64(odd, 8));
+  t = _mm_add_epi64(t, _mm_unpackhi_epi64(t, t));
+  return __rte_raw_cksum(p, len, (uint64_t)_mm_cvtsi128_si64(t));
 }
 
-static inline uint16_t rte_ipv4_phdr_cksum(const struct ipv4_hdr *ipv4_hdr) {
-  struct ipv4_psd_header {
-    uint32_t src_addr; /* IP address of source host. */
-    uint32_t dst_addr; /* IP address of destination host. */
-    uint8_t zero;      /* zero. */
-    uint8_t proto;     /* L4 protocol type. */
-    uint16_t len;      /* L4 length. */
-  } psd_hdr;
-
-  psd_hdr.src_addr = ipv4_hdr->src_addr;
-  psd_hdr.dst_addr = ipv4_hdr->dst_addr;
-  psd_hdr.zero = 0;
-  psd_hdr.proto = ipv4_hdr->next_proto_id;
-  psd_hdr.len = htons(
-      (uint16_t)(ntohs(ipv4_hdr->total_length) - sizeof(struct ipv4_hdr)));
-  return rte_raw_cksum(&psd_hdr, sizeof(psd_hdr));
+// selected on first use, as static initializers of other translation units
+// may already checksum before a namespace-scope initializer here has run
+static uint64_t raw_sum(const uint8_t *p, size_t len) {
+  static uint64_t (*const impl)(const uint8_t *, size_t) = []() {
+    // the cpu model may not be set up yet during static initialization
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? raw_sum_avx2 : raw_sum_sse2;
+  }();
+  return impl(p, len);
+}
+#endif
+
+uint16_t xsum_raw(const void *buf, size_t len) {
+#ifdef __x86_64__
+  return xsum_fold(raw_sum(reinterpret_cast<const uint8_t *>(buf), len));
+#else
+  return xsum_raw_scalar(buf, len);
+#endif
+}
+
+uint16_t xsum_raw_scalar(const void *buf, size_t len) {
+  return xsum_fold(__rte_raw_cksum(buf, len, 0));
 }
 
 void xsum_udp(void *udphdr, size_t l4_len) {
   struct rte_udp_hdr *udph = reinterpret_cast<struct rte_udp_hdr *>(udphdr);
-  uint32_t cksum = rte_raw_cksum(udphdr, l4_len);
-  cksum = ((cksum & 0xffff0000) >> 16) + (cksum & 0xffff);
-  cksum = (~cksum) & 0xffff;
-  udph->dgram_cksum = cksum;
+  udph->dgram_cksum = ~xsum_raw(udphdr, l4_len);
 }
 
 void xsum_tcp(void *tcphdr, size_t l4_len) {
   struct rte_tcp_hdr *tcph = reinterpret_cast<struct rte_tcp_hdr *>(tcphdr);
-  uint32_t cksum = rte_raw_cksum(tcphdr, l4_len);
-  cksum = ((cksum & 0xffff0000) >> 16) + (cksum & 0xffff);
-  cksum = (~cksum) & 0xffff;
-  tcph->cksum = cksum;
+  tcph->cksum = ~xsum_raw(tcphdr, l4_len);
 }
 
-void xsum_tcpip_tso(void *iphdr, uint8_t iplen, uint8_t l4len,
-                    uint16_t paylen) {
+void tso_xsum_init(tso_xsum_state &st, const void *iphdr, uint8_t iplen,
+                   uint8_t l4len) {
+  uint8_t hdr[64];
+  assert(iplen <= sizeof(hdr) && l4len <= sizeof(hdr));
+
+  // ip header without length, id, and checksum
+  memcpy(hdr, iphdr, iplen);
+  struct ipv4_hdr *ih = reinterpret_cast<struct ipv4_hdr *>(hdr);
+  ih->total_length = 0;
+  ih->packet_id = 0;
+  ih->hdr_checksum = 0;
+  st.ip_sum = xsum_raw(hdr, iplen);
+
+  // tcp header without sequence number and checksum, plus the pseudo header
+  // without the length
+  uint64_t sum = xsum_raw(&ih->src_addr, 8) + htons(ih->next_proto_id);
+  memcpy(hdr, (const uint8_t *)iphdr + iplen, l4len);
+  struct rte_tcp_hdr *tcph = reinterpret_cast<struct rte_tcp_hdr *>(hdr);
+  tcph->sent_seq = 0;
+  tcph->cksum = 0;
+  st.tcp_sum = xsum_fold(sum + xsum_raw(hdr, l4len));
+}
+
+void tso_xsum_segment(const tso_xsum_state &st, void *iphdr, uint8_t iplen,
+                      uint8_t l4len, uint16_t paylen) {
   struct ipv4_hdr *ih = (struct ipv4_hdr *)iphdr;
   struct rte_tcp_hdr *tcph = (struct rte_tcp_hdr *)((uint8_t *)iphdr + iplen);
-  uint32_t cksum;
+  uint64_t sum;
 
-  // calculate ip xsum
   ih->total_length = htons(iplen + l4len + paylen);
-  ih->hdr_checksum = 0;
-  cksum = rte_raw_cksum(iphdr, iplen);
-  cksum = ((cksum & 0xffff0000) >> 16) + (cksum & 0xffff);
-  cksum = (~cksum) & 0xffff;
-  ih->hdr_checksum = cksum;
+  sum = (uint64_t)st.ip_sum + ih->total_length + ih->packet_id;
+  ih->hdr_checksum = ~xsum_fold(sum);
 
-  // calculate tcp xsum
-  tcph->cksum = 0;
-  cksum = rte_raw_cksum(tcph, l4len + paylen);
-  cksum += rte_ipv4_phdr_cksum(ih);
-  cksum = ((cksum & 0xffff0000) >> 16) + (cksum & 0xffff);
-  cksum = (~cksum) & 0xffff;
-  tcph->cksum = cksum;
+  uint32_t seq = tcph->sent_seq;
+  sum = (uint64_t)st.tcp_sum + (seq >> 16) + (seq & 0xffff) +
+        htons(l4len + paylen) + xsum_raw((uint8_t *)tcph + l4len, paylen);
+  tcph->cksum = ~xsum_fold(sum);
 }
 
 void tso_postupdate_header(void *iphdr, uint8_t iplen, uint8_t l4len,
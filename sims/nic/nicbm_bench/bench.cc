@@ -0,0 +1,371 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "sims/nic/nicbm_bench/bench.h"
+
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+
+namespace nicbm_bench {
+
+static uint64_t WallNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+HostStub::HostStub(size_t mem_size)
+    : mem_(mem_size, 0),
+      drv_(nullptr),
+      read_val_(0),
+      read_done_(false),
+      msgs(0),
+      dma_bytes(0),
+      interrupts(0) {
+  memset(&pcie_, 0, sizeof(pcie_));
+}
+
+uint8_t *HostStub::Mem(uint64_t addr, size_t len) {
+  if (addr + len > mem_.size()) {
+    fprintf(stderr, "HostStub: DMA out of bounds (addr=%lx len=%zu)\n", addr,
+            len);
+    abort();
+  }
+  return mem_.data() + addr;
+}
+
+volatile union SimbricksProtoPcieH2D *HostStub::H2DAlloc() {
+  volatile union SimbricksProtoPcieH2D *msg;
+  while ((msg = SimbricksPcieIfH2DOutAlloc(&pcie_, 0)) == NULL) {
+  }
+  msgs++;
+  return msg;
+}
+
+void HostStub::MmioWrite32(uint8_t bar, uint64_t addr, uint32_t val) {
+  volatile union SimbricksProtoPcieH2D *msg = H2DAlloc();
+  volatile struct SimbricksProtoPcieH2DWrite *write = &msg->write;
+  write->req_id = 0;
+  write->offset = addr;
+  write->len = sizeof(val);
+  write->bar = bar;
+  memcpy((void *)write->data, &val, sizeof(val));
+  SimbricksPcieIfH2DOutSend(&pcie_, msg,
+                            SIMBRICKS_PROTO_PCIE_H2D_MSG_WRITE_POSTED);
+}
+
+uint32_t HostStub::MmioRead32(uint8_t bar, uint64_t addr) {
+  volatile union SimbricksProtoPcieH2D *msg = H2DAlloc();
+  volatile struct SimbricksProtoPcieH2DRead *read = &msg->read;
+  read->req_id = 0;
+  read->offset = addr;
+  read->len = 4;
+  read->bar = bar;
+  read_done_ = false;
+  SimbricksPcieIfH2DOutSend(&pcie_, msg, SIMBRICKS_PROTO_PCIE_H2D_MSG_READ);
+
+  while (!read_done_)
+    Poll();
+  return read_val_;
+}
+
+void HostStub::HandleD2H(volatile union SimbricksProtoPcieD2H *msg,
+                         uint8_t type) {
+  switch (type) {
+    case SIMBRICKS_PROTO_PCIE_D2H_MSG_READ: {
+      volatile struct SimbricksProtoPcieD2HRead *read = &msg->read;
+      volatile union SimbricksProtoPcieH2D *out = H2DAlloc();
+      out->readcomp.req_id = read->req_id;
+      memcpy((void *)out->readcomp.data, Mem(read->offset, read->len),
+             read->len);
+      dma_bytes += read->len;
+      SimbricksPcieIfH2DOutSend(&pcie_, out,
+                                SIMBRICKS_PROTO_PCIE_H2D_MSG_READCOMP);
+      break;
+    }
+
+    case SIMBRICKS_PROTO_PCIE_D2H_MSG_WRITE: {
+      volatile struct SimbricksProtoPcieD2HWrite *write = &msg->write;
+      memcpy(Mem(write->offset, write->len), (const void *)write->data,
+             write->len);
+      dma_bytes += write->len;
+      drv_->DmaWritten(*this, write->offset, write->len);
+
+      volatile union SimbricksProtoPcieH2D *out = H2DAlloc();
+      out->writecomp.req_id = write->req_id;
+      SimbricksPcieIfH2DOutSend(&pcie_, out,
+                                SIMBRICKS_PROTO_PCIE_H2D_MSG_WRITECOMP);
+      break;
+    }
+
+    case SIMBRICKS_PROTO_PCIE_D2H_MSG_INTERRUPT:
+      interrupts++;
+      drv_->Interrupt(*this, msg->interrupt.vector);
+      break;
+
+    case SIMBRICKS_PROTO_PCIE_D2H_MSG_READCOMP:
+      memcpy(&read_val_, (const void *)msg->readcomp.data, 4);
+      read_done_ = true;
+      break;
+
+    case SIMBRICKS_PROTO_PCIE_D2H_MSG_WRITECOMP:
+    case SIMBRICKS_PROTO_MSG_TYPE_SYNC:
+    case SIMBRICKS_PROTO_MSG_TYPE_TERMINATE:
+      break;
+
+    default:
+      fprintf(stderr, "HostStub: unsupported type=%u\n", type);
+  }
+}
+
+bool HostStub::Poll() {
+  volatile union SimbricksProtoPcieD2H *msg =
+      SimbricksPcieIfD2HInPoll(&pcie_, 0);
+  if (msg == NULL)
+    return false;
+
+  msgs++;
+  HandleD2H(msg, SimbricksPcieIfD2HInType(&pcie_, msg));
+  SimbricksPcieIfD2HInDone(&pcie_, msg);
+  return true;
+}
+
+NetStub::NetStub() : msgs(0), drops(0) {
+  memset(&net_, 0, sizeof(net_));
+}
+
+bool NetStub::Poll() {
+  volatile union SimbricksProtoNetMsg *msg = SimbricksNetIfInPoll(&net_, 0);
+  if (msg == NULL)
+    return false;
+
+  msgs++;
+  if (SimbricksNetIfInType(&net_, msg) == SIMBRICKS_PROTO_NET_MSG_PACKET) {
+    // drop instead of waiting if the device is not keeping up, it might be
+    // blocked on sending to us
+    volatile union SimbricksProtoNetMsg *out =
+        SimbricksNetIfOutAlloc(&net_, 0);
+    if (out) {
+      out->packet.port = 0;
+      out->packet.len = msg->packet.len;
+      memcpy((void *)out->packet.data, (const void *)msg->packet.data,
+             msg->packet.len);
+      SimbricksNetIfOutSend(&net_, out, SIMBRICKS_PROTO_NET_MSG_PACKET);
+      msgs++;
+    } else {
+      drops++;
+    }
+  }
+  SimbricksNetIfInDone(&net_, msg);
+  return true;
+}
+
+static void WaitForFile(const char *path) {
+  struct stat st;
+  while (stat(path, &st) != 0)
+    usleep(1000);
+}
+
+static int Connect(HostStub &host, NetStub &net, const char *pci_path,
+                   const char *eth_path) {
+  struct SimbricksBaseIfParams pcie_params;
+  SimbricksPcieIfDefaultParams(&pcie_params);
+  pcie_params.sock_path = pci_path;
+  pcie_params.sync_mode = kSimbricksBaseIfSyncDisabled;
+
+  struct SimbricksBaseIfParams net_params;
+  SimbricksNetIfDefaultParams(&net_params);
+  net_params.sock_path = eth_path;
+  net_params.sync_mode = kSimbricksBaseIfSyncDisabled;
+
+  if (SimbricksBaseIfInit(&host.If().base, &pcie_params) ||
+      SimbricksBaseIfInit(&net.If().base, &net_params)) {
+    perror("Connect: SimbricksBaseIfInit failed");
+    return -1;
+  }
+
+  WaitForFile(pci_path);
+  WaitForFile(eth_path);
+  if (SimbricksBaseIfConnect(&host.If().base) ||
+      SimbricksBaseIfConnect(&net.If().base)) {
+    perror("Connect: SimbricksBaseIfConnect failed");
+    return -1;
+  }
+
+  struct SimbricksProtoPcieDevIntro dev_intro;
+  struct SimbricksProtoPcieHostIntro host_intro;
+  struct SimbricksProtoNetIntro net_intro;
+  memset(&host_intro, 0, sizeof(host_intro));
+  memset(&net_intro, 0, sizeof(net_intro));
+
+  struct SimBricksBaseIfEstablishData ests[2];
+  ests[0].base_if = &host.If().base;
+  ests[0].tx_intro = &host_intro;
+  ests[0].tx_intro_len = sizeof(host_intro);
+  ests[0].rx_intro = &dev_intro;
+  ests[0].rx_intro_len = sizeof(dev_intro);
+  ests[1].base_if = &net.If().base;
+  ests[1].tx_intro = &net_intro;
+  ests[1].tx_intro_len = sizeof(net_intro);
+  ests[1].rx_intro = &net_intro;
+  ests[1].rx_intro_len = sizeof(net_intro);
+  return SimBricksBaseIfEstablish(ests, 2);
+}
+
+int BenchMain(int argc, char *argv[], nicbm::Runner::Device &dev,
+              HostStub &host, HostStub::Driver &drv) {
+  double duration = 5;
+  uint64_t rate = 0;
+  size_t pkt_len = 64;
+  int c;
+
+  while ((c = getopt(argc, argv, "d:r:l:")) != -1) {
+    switch (c) {
+      case 'd':
+        duration = strtod(optarg, NULL);
+        break;
+      case 'r':
+        rate = strtoull(optarg, NULL, 0);
+        break;
+      case 'l':
+        pkt_len = strtoull(optarg, NULL, 0);
+        break;
+      default:
+        fprintf(stderr,
+                "Usage: %s [-d DURATION-S] [-r TARGET-PPS] [-l PKT-LEN]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (pkt_len < 60 || pkt_len > SIMBRICKS_NET_MAX_FRAME_JUMBO) {
+    fprintf(stderr, "packet length must be between 60 and %u\n",
+            SIMBRICKS_NET_MAX_FRAME_JUMBO);
+    return EXIT_FAILURE;
+  }
+
+  char dir[] = "/tmp/nicbm_bench.XXXXXX";
+  if (!mkdtemp(dir)) {
+    perror("mkdtemp failed");
+    return EXIT_FAILURE;
+  }
+  std::string pci_path = std::string(dir) + "/pci";
+  std::string eth_path = std::string(dir) + "/eth";
+  std::string shm_path = std::string(dir) + "/shm";
+
+  // the device runs its unmodified main loop on a separate thread
+  std::atomic<bool> dev_done(false);
+  std::thread dev_thread([&]() {
+    nicbm::Runner runner(dev);
+    // size the network messages for the packets, the stub adopts them
+    std::string max_frame = std::to_string(
+        std::max<size_t>(pkt_len, SIMBRICKS_NET_MAX_FRAME_DEFAULT));
+    char *args[] = {argv[0],
+                    const_cast<char *>("-J"),
+                    const_cast<char *>(max_frame.c_str()),
+                    const_cast<char *>(pci_path.c_str()),
+                    const_cast<char *>(eth_path.c_str()),
+                    const_cast<char *>(shm_path.c_str()),
+                    nullptr};
+    if (runner.ParseArgs(6, args) == 0)
+      runner.RunMain();
+    dev_done = true;
+  });
+
+  NetStub net;
+  host.SetDriver(drv);
+  if (Connect(host, net, pci_path.c_str(), eth_path.c_str())) {
+    fprintf(stderr, "connecting to device failed\n");
+    abort();
+  }
+  drv.Setup(host, pkt_len);
+
+  uint64_t start = WallNs();
+  uint64_t end = start + duration * 1e9;
+  uint64_t now = start;
+  uint64_t posted = 0;
+  uint64_t tx_start = drv.tx_packets;
+  uint64_t rx_start = drv.rx_packets;
+  uint64_t host_msgs_start = host.msgs;
+  uint64_t net_msgs_start = net.msgs;
+  uint64_t ints_start = host.interrupts;
+  for (uint64_t iter = 0; now < end && !drv.Done(); iter++) {
+    bool active = host.Poll();
+    active |= net.Poll();
+
+    unsigned budget = ~0U;
+    if (rate) {
+      uint64_t allowed = (double)rate * (now - start) / 1e9;
+      budget = allowed > posted ? allowed - posted : 0;
+    }
+    unsigned n = budget > 0 ? drv.Post(host, budget) : 0;
+    posted += n;
+
+    // let the device thread run if it shares our core
+    if (!active && n == 0)
+      sched_yield();
+
+    // reading the clock on every iteration is too expensive
+    if ((iter & 0xff) == 0)
+      now = WallNs();
+  }
+  now = WallNs();
+  double secs = (now - start) / 1e9;
+  uint64_t tx = drv.tx_packets - tx_start;
+  uint64_t rx = drv.rx_packets - rx_start;
+
+  // stop the runner, but keep serving it until it is done
+  raise(SIGINT);
+  while (!dev_done) {
+    host.Poll();
+    net.Poll();
+  }
+  dev_thread.join();
+  unlink(pci_path.c_str());
+  unlink(eth_path.c_str());
+  unlink(shm_path.c_str());
+  rmdir(dir);
+
+  printf("%s: pkt_len=%zu target_pps=%lu duration=%.2fs\n", drv.Name(),
+         pkt_len, rate, secs);
+  printf("  tx_packets=%lu rx_packets=%lu net_drops=%lu interrupts=%lu\n", tx,
+         rx, net.drops, host.interrupts - ints_start);
+  printf("  rx_pps=%.0f pcie_msgs_per_s=%.0f net_msgs_per_s=%.0f "
+         "ns_per_packet=%.1f\n",
+         rx / secs, (host.msgs - host_msgs_start) / secs,
+         (net.msgs - net_msgs_start) / secs, rx ? secs * 1e9 / rx : 0.0);
+  return EXIT_SUCCESS;
+}
+
+}  // namespace nicbm_bench
@@ -0,0 +1,141 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include <simbricks/nicbm/nicbm.h>
+extern "C" {
+#include <simbricks/network/if.h>
+#include <simbricks/pcie/if.h>
+}
+
+namespace nicbm_bench {
+
+/**
+ * Host side of the benchmark: a PCIe peer that issues MMIO to the device,
+ * services its DMA from a local memory image, and forwards interrupts to the
+ * driver. DMA addresses are offsets into the memory image.
+ */
+class HostStub {
+ public:
+  class Driver;
+
+ protected:
+  struct SimbricksPcieIf pcie_;
+  std::vector<uint8_t> mem_;
+  Driver *drv_;
+  uint64_t read_val_;
+  bool read_done_;
+
+  volatile union SimbricksProtoPcieH2D *H2DAlloc();
+  void HandleD2H(volatile union SimbricksProtoPcieD2H *msg, uint8_t type);
+
+ public:
+  /* message counters, both directions */
+  uint64_t msgs;
+  uint64_t dma_bytes;
+  uint64_t interrupts;
+
+  explicit HostStub(size_t mem_size);
+
+  struct SimbricksPcieIf &If() {
+    return pcie_;
+  }
+  void SetDriver(Driver &drv) {
+    drv_ = &drv;
+  }
+
+  uint8_t *Mem(uint64_t addr, size_t len);
+
+  /** Posted MMIO write. */
+  void MmioWrite32(uint8_t bar, uint64_t addr, uint32_t val);
+  /** MMIO read, services other device messages while waiting. */
+  uint32_t MmioRead32(uint8_t bar, uint64_t addr);
+
+  /** Process one message from the device, returns false if none ready. */
+  bool Poll();
+};
+
+/** Device specific part of the benchmark: programs and drives the device. */
+class HostStub::Driver {
+ public:
+  /* packets transmitted and received back through the loopback */
+  uint64_t tx_packets;
+  uint64_t rx_packets;
+
+  Driver() : tx_packets(0), rx_packets(0) {
+  }
+  virtual ~Driver() = default;
+
+  /** Name used in the report. */
+  virtual const char *Name() = 0;
+  /** Program the device rings, called once the device is connected. */
+  virtual void Setup(HostStub &host, size_t pkt_len) = 0;
+  /** Post up to `budget` packets for transmission, returns number posted. */
+  virtual unsigned Post(HostStub &host, unsigned budget) = 0;
+  /** The device wrote `len` bytes at `addr` into host memory. */
+  virtual void DmaWritten(HostStub &host, uint64_t addr, size_t len) {
+  }
+  /** The device raised interrupt `vec`. */
+  virtual void Interrupt(HostStub &host, unsigned vec) = 0;
+  /** Whether the driver has nothing left to do, ends the run early. */
+  virtual bool Done() {
+    return false;
+  }
+};
+
+/** Network side: sends every packet from the device straight back. */
+class NetStub {
+ protected:
+  struct SimbricksNetIf net_;
+
+ public:
+  uint64_t msgs;
+  uint64_t drops;
+
+  NetStub();
+
+  struct SimbricksNetIf &If() {
+    return net_;
+  }
+
+  /** Loop back one packet, returns false if none ready. */
+  bool Poll();
+};
+
+/**
+ * Run the benchmark: `dev` is driven by a `nicbm::Runner` on a separate
+ * thread, connected to `host` and a loopback network over SHM queues. Runs
+ * for the duration given on the command line or until the driver is done.
+ * Parses the command line and prints the report to stdout.
+ */
+int BenchMain(int argc, char *argv[], nicbm::Runner::Device &dev,
+              HostStub &host, HostStub::Driver &drv);
+
+}  // namespace nicbm_bench
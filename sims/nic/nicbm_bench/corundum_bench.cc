@@ -0,0 +1,148 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "sims/nic/corundum_bm/corundum_bm.h"
+#include "sims/nic/nicbm_bench/bench.h"
+
+namespace {
+
+/* host memory layout, rings first and then one buffer per descriptor */
+const unsigned kRingLog = 10;
+const unsigned kRingSize = 1 << kRingLog;
+const size_t kBufSize = MAX_FRAME_LEN;
+const uint64_t kEventRing = 0x000000;
+const uint64_t kTxRing = 0x010000;
+const uint64_t kTxCplRing = 0x020000;
+const uint64_t kRxRing = 0x030000;
+const uint64_t kRxCplRing = 0x040000;
+const uint64_t kTxBufs = 0x100000;
+const uint64_t kRxBufs = kTxBufs + kRingSize * kBufSize;
+const size_t kMemSize = kRxBufs + kRingSize * kBufSize;
+
+/**
+ * Minimal corundum driver: one event, tx and rx queue each on port 0, with
+ * completions reaped from the interrupt handler.
+ */
+class CorundumDriver : public nicbm_bench::HostStub::Driver {
+ protected:
+  size_t pkt_len_;
+  uint64_t tx_posted_;
+  uint64_t events_;
+
+  void W(nicbm_bench::HostStub &host, uint64_t addr, uint32_t val) {
+    host.MmioWrite32(0, addr, val);
+  }
+
+  void SetupRing(nicbm_bench::HostStub &host, uint64_t reg, uint64_t base,
+                 size_t entry_size) {
+    memset(host.Mem(base, kRingSize * entry_size), 0, kRingSize * entry_size);
+    W(host, reg, base);
+    W(host, reg + 4, base >> 32);
+    W(host, reg + 8, QUEUE_ACTIVE_MASK | kRingLog);
+    W(host, reg + 12, 0);
+  }
+
+  void FillDesc(nicbm_bench::HostStub &host, uint64_t ring, unsigned idx,
+                uint64_t addr, uint32_t len) {
+    corundum::Desc *desc =
+        reinterpret_cast<corundum::Desc *>(host.Mem(ring + idx * DESC_SIZE,
+                                                    DESC_SIZE));
+    memset(desc, 0, sizeof(*desc));
+    desc->len = len;
+    desc->addr = addr;
+  }
+
+ public:
+  CorundumDriver() : pkt_len_(0), tx_posted_(0), events_(0) {
+  }
+
+  const char *Name() override {
+    return "corundum_bm";
+  }
+
+  void Setup(nicbm_bench::HostStub &host, size_t pkt_len) override {
+    pkt_len_ = pkt_len;
+    SetupRing(host, EVENT_QUEUE_BASE_ADDR_REG, kEventRing, EVENT_SIZE);
+    SetupRing(host, TX_CPL_QUEUE_BASE_ADDR_REG, kTxCplRing, CPL_SIZE);
+    SetupRing(host, TX_QUEUE_BASE_ADDR_REG, kTxRing, DESC_SIZE);
+    SetupRing(host, RX_CPL_QUEUE_BASE_ADDR_REG, kRxCplRing, CPL_SIZE);
+    SetupRing(host, RX_QUEUE_BASE_ADDR_REG, kRxRing, DESC_SIZE);
+    W(host, PORT_REG_SCHED_ENABLE, 1);
+    W(host, PORT_QUEUE_ENABLE, 1);
+
+    // broadcast frames with a recognizable payload
+    for (unsigned i = 0; i < kRingSize; i++) {
+      uint8_t *buf = host.Mem(kTxBufs + i * kBufSize, pkt_len);
+      memset(buf, 0xff, 6);
+      memset(buf + 6, 0, pkt_len - 6);
+      buf[11] = 1;
+      buf[12] = 0x88;
+      buf[13] = 0xb5;
+      FillDesc(host, kTxRing, i, kTxBufs + i * kBufSize, pkt_len);
+      FillDesc(host, kRxRing, i, kRxBufs + i * kBufSize, kBufSize);
+    }
+    W(host, RX_QUEUE_HEAD_PTR_REG, kRingSize);
+  }
+
+  unsigned Post(nicbm_bench::HostStub &host, unsigned budget) override {
+    unsigned n = kRingSize - (tx_posted_ - tx_packets);
+    if (n > budget)
+      n = budget;
+    if (n == 0)
+      return 0;
+
+    // descriptors are static, only the head pointer moves
+    tx_posted_ += n;
+    W(host, TX_QUEUE_HEAD_PTR_REG, tx_posted_ & 0xffff);
+    return n;
+  }
+
+  void DmaWritten(nicbm_bench::HostStub &host, uint64_t addr,
+                  size_t len) override {
+    if (addr >= kTxCplRing && addr < kTxCplRing + kRingSize * CPL_SIZE)
+      tx_packets += len / CPL_SIZE;
+    else if (addr >= kRxCplRing && addr < kRxCplRing + kRingSize * CPL_SIZE)
+      rx_packets += len / CPL_SIZE;
+    else if (addr >= kEventRing && addr < kEventRing + kRingSize * EVENT_SIZE)
+      events_ += len / EVENT_SIZE;
+  }
+
+  void Interrupt(nicbm_bench::HostStub &host, unsigned vec) override {
+    W(host, TX_CPL_QUEUE_TAIL_PTR_REG, tx_packets & 0xffff);
+    W(host, RX_CPL_QUEUE_TAIL_PTR_REG, rx_packets & 0xffff);
+    W(host, EVENT_QUEUE_TAIL_PTR_REG, events_ & 0xffff);
+    W(host, RX_QUEUE_HEAD_PTR_REG, (rx_packets + kRingSize) & 0xffff);
+  }
+};
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  corundum::Corundum dev;
+  CorundumDriver drv;
+  nicbm_bench::HostStub host(kMemSize);
+  return nicbm_bench::BenchMain(argc, argv, dev, host, drv);
+}
@@ -0,0 +1,292 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * RSS steering test for corundum_bm: loops frames of many distinct flows
+ * back to the device, with the RSS table spreading them over all rx queues,
+ * and checks that every frame of a flow lands on the same queue and that
+ * the flows are spread reasonably evenly.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "sims/nic/corundum_bm/corundum_bm.h"
+#include "sims/nic/nicbm_bench/bench.h"
+
+namespace {
+
+/* flows, each sent kRounds times, with at most kWindow frames in flight */
+const unsigned kFlows = 1024;
+const unsigned kRounds = 4;
+const unsigned kWindow = 64;
+/* offset of the flow id in the frames, past the longest (TCP) header */
+const size_t kIdOff = 14 + 20 + 20;
+
+/* host memory layout: rings, then tx buffers, then rx buffers per queue */
+const unsigned kRingLog = 8;
+const unsigned kRingSize = 1 << kRingLog;
+const size_t kRingLen = kRingSize * 32;
+const size_t kBufSize = 256;
+const uint64_t kEventRing = 0x000000;
+const uint64_t kTxRing = kEventRing + kRingLen;
+const uint64_t kTxCplRing = kTxRing + kRingLen;
+const uint64_t kRxRings = kTxCplRing + kRingLen;
+const uint64_t kRxCplRings = kRxRings + NUM_QUEUES * kRingLen;
+const uint64_t kTxBufs = kRxCplRings + NUM_QUEUES * kRingLen;
+const uint64_t kRxBufs = kTxBufs + kRingSize * kBufSize;
+const size_t kMemSize = kRxBufs + NUM_QUEUES * kRingSize * kBufSize;
+
+/**
+ * Corundum driver with all rx queues on port 0 and one tx queue, sharing
+ * event queue 0. Completions are reaped from the interrupt handler.
+ */
+class RssDriver : public nicbm_bench::HostStub::Driver {
+ protected:
+  size_t pkt_len_;
+  uint64_t tx_posted_;
+  uint64_t events_;
+  uint64_t rx_cpls_[NUM_QUEUES];
+  // queue each flow was first received on, frames received per flow
+  int flow_queue_[kFlows];
+  unsigned flow_frames_[kFlows];
+
+  void W(nicbm_bench::HostStub &host, uint64_t addr, uint32_t val) {
+    host.MmioWrite32(0, addr, val);
+  }
+
+  void SetupRing(nicbm_bench::HostStub &host, uint64_t reg, unsigned q,
+                 uint64_t base, unsigned idx) {
+    reg += q * QUEUE_STRIDE;
+    memset(host.Mem(base, kRingLen), 0, kRingLen);
+    W(host, reg, base);
+    W(host, reg + 4, base >> 32);
+    W(host, reg + 8, QUEUE_ACTIVE_MASK | kRingLog);
+    W(host, reg + 12, idx);
+  }
+
+  void FillDesc(nicbm_bench::HostStub &host, uint64_t ring, unsigned idx,
+                uint64_t addr, uint32_t len) {
+    corundum::Desc *desc = reinterpret_cast<corundum::Desc *>(
+        host.Mem(ring + idx * DESC_SIZE, DESC_SIZE));
+    memset(desc, 0, sizeof(*desc));
+    desc->len = len;
+    desc->addr = addr;
+  }
+
+  /* frame of flow `id`: TCP, UDP, or plain IPv4 with varying addresses */
+  void BuildFrame(uint8_t *buf, unsigned id) {
+    uint64_t r = 0x9e3779b97f4a7c15ULL * (id + 1);
+    r ^= r >> 29;
+    memset(buf, 0, pkt_len_);
+    memset(buf, 0xff, 6);
+    buf[11] = 1;
+    buf[12] = 0x08;
+    buf[13] = 0x00;
+
+    uint8_t *ip = buf + 14;
+    ip[0] = 0x45;
+    ip[2] = (pkt_len_ - 14) >> 8;
+    ip[3] = pkt_len_ - 14;
+    ip[8] = 64;
+    ip[9] = id % 3 == 0 ? 6 : id % 3 == 1 ? 17 : 1;
+    ip[12] = 10;
+    ip[13] = 0;
+    ip[14] = id >> 8;
+    ip[15] = id;
+    memcpy(ip + 16, &r, 4);
+    ip[16] = 10 + (ip[16] & 0x7f);
+    // ports, ignored for other protocols
+    memcpy(ip + 20, reinterpret_cast<uint8_t *>(&r) + 4, 4);
+
+    memcpy(buf + kIdOff, &id, sizeof(id));
+  }
+
+  void Fail(const char *what, unsigned flow) {
+    if (failures < 10)
+      fprintf(stderr, "corundum_rss_test: flow %u: %s\n", flow, what);
+    failures++;
+  }
+
+  void Received(nicbm_bench::HostStub &host, unsigned q,
+                const corundum::Cpl &cpl) {
+    uint64_t buf = kRxBufs + (q * kRingSize + cpl.index % kRingSize) * kBufSize;
+    unsigned id;
+    memcpy(&id, host.Mem(buf + kIdOff, sizeof(id)), sizeof(id));
+    if (id >= kFlows || cpl.queue != q) {
+      Fail("malformed completion", id);
+      return;
+    }
+
+    if (flow_queue_[id] < 0)
+      flow_queue_[id] = q;
+    else if (flow_queue_[id] != static_cast<int>(q))
+      Fail("received on more than one queue", id);
+    flow_frames_[id]++;
+  }
+
+ public:
+  unsigned failures;
+
+  RssDriver() : pkt_len_(0), tx_posted_(0), events_(0), failures(0) {
+    memset(rx_cpls_, 0, sizeof(rx_cpls_));
+    for (unsigned i = 0; i < kFlows; i++) {
+      flow_queue_[i] = -1;
+      flow_frames_[i] = 0;
+    }
+  }
+
+  const char *Name() override {
+    return "corundum_rss_test";
+  }
+
+  void Setup(nicbm_bench::HostStub &host, size_t pkt_len) override {
+    pkt_len_ = std::max(pkt_len, kIdOff + sizeof(unsigned));
+    SetupRing(host, EVENT_QUEUE_BASE_ADDR_REG, 0, kEventRing, 0);
+    SetupRing(host, TX_CPL_QUEUE_BASE_ADDR_REG, 0, kTxCplRing, 0);
+    SetupRing(host, TX_QUEUE_BASE_ADDR_REG, 0, kTxRing, 0);
+    for (unsigned q = 0; q < NUM_QUEUES; q++) {
+      SetupRing(host, RX_CPL_QUEUE_BASE_ADDR_REG, q,
+                kRxCplRings + q * kRingLen, 0);
+      SetupRing(host, RX_QUEUE_BASE_ADDR_REG, q, kRxRings + q * kRingLen, q);
+      for (unsigned i = 0; i < kRingSize; i++)
+        FillDesc(host, kRxRings + q * kRingLen, i,
+                 kRxBufs + (q * kRingSize + i) * kBufSize, kBufSize);
+      W(host, RX_QUEUE_HEAD_PTR_REG + q * QUEUE_STRIDE, kRingSize);
+    }
+    W(host, PORT_REG_SCHED_ENABLE, 1);
+    W(host, PORT_QUEUE_ENABLE, 1);
+
+    // spread the indirection table over all queues, as drivers do
+    W(host, PORT_REG_RSS_MASK, RSS_TABLE_SIZE - 1);
+    for (unsigned i = 0; i < RSS_TABLE_SIZE; i++)
+      W(host, PORT_REG_RSS_TABLE + 4 * i, i % NUM_QUEUES);
+  }
+
+  unsigned Post(nicbm_bench::HostStub &host, unsigned budget) override {
+    uint64_t limit = std::min<uint64_t>(rx_packets + kWindow,
+                                        kFlows * kRounds);
+    unsigned n = 0;
+    for (; tx_posted_ < limit && n < budget; tx_posted_++, n++) {
+      unsigned slot = tx_posted_ % kRingSize;
+      BuildFrame(host.Mem(kTxBufs + slot * kBufSize, pkt_len_),
+                 tx_posted_ % kFlows);
+      FillDesc(host, kTxRing, slot, kTxBufs + slot * kBufSize, pkt_len_);
+    }
+    if (n)
+      W(host, TX_QUEUE_HEAD_PTR_REG, tx_posted_ & 0xffff);
+    return n;
+  }
+
+  void DmaWritten(nicbm_bench::HostStub &host, uint64_t addr,
+                  size_t len) override {
+    if (addr >= kTxCplRing && addr < kTxCplRing + kRingLen) {
+      tx_packets += len / CPL_SIZE;
+    } else if (addr >= kRxCplRings &&
+               addr < kRxCplRings + NUM_QUEUES * kRingLen) {
+      unsigned q = (addr - kRxCplRings) / kRingLen;
+      for (size_t off = 0; off < len; off += CPL_SIZE) {
+        Received(host, q,
+                 *reinterpret_cast<const corundum::Cpl *>(
+                     host.Mem(addr + off, CPL_SIZE)));
+      }
+      rx_cpls_[q] += len / CPL_SIZE;
+      rx_packets += len / CPL_SIZE;
+    } else if (addr >= kEventRing && addr < kEventRing + kRingLen) {
+      events_ += len / EVENT_SIZE;
+    }
+  }
+
+  void Interrupt(nicbm_bench::HostStub &host, unsigned vec) override {
+    W(host, TX_CPL_QUEUE_TAIL_PTR_REG, tx_packets & 0xffff);
+    for (unsigned q = 0; q < NUM_QUEUES; q++) {
+      W(host, RX_CPL_QUEUE_TAIL_PTR_REG + q * QUEUE_STRIDE,
+        rx_cpls_[q] & 0xffff);
+      W(host, RX_QUEUE_HEAD_PTR_REG + q * QUEUE_STRIDE,
+        (rx_cpls_[q] + kRingSize) & 0xffff);
+    }
+    W(host, EVENT_QUEUE_TAIL_PTR_REG, events_ & 0xffff);
+  }
+
+  bool Done() override {
+    return rx_packets == kFlows * kRounds;
+  }
+
+  /* check that all frames arrived and the flows are spread evenly */
+  void Check() {
+    unsigned per_queue[NUM_QUEUES] = {};
+    for (unsigned i = 0; i < kFlows; i++) {
+      if (flow_frames_[i] != kRounds)
+        Fail("frames lost or duplicated", i);
+      else
+        per_queue[flow_queue_[i]]++;
+    }
+
+    // with a uniform hash each queue gets kFlows / NUM_QUEUES flows, allow
+    // half to twice that
+    const unsigned mean = kFlows / NUM_QUEUES;
+    unsigned lo = *std::min_element(per_queue, per_queue + NUM_QUEUES);
+    unsigned hi = *std::max_element(per_queue, per_queue + NUM_QUEUES);
+    if (lo < mean / 2 || hi > mean * 2) {
+      fprintf(stderr,
+              "corundum_rss_test: uneven spread, %u to %u flows per queue "
+              "(expected %u)\n",
+              lo, hi, mean);
+      failures++;
+    }
+    printf("corundum_rss_test: %u to %u flows per queue (expected %u)\n", lo,
+           hi, mean);
+  }
+};
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  // runs until the driver is done, the duration only bounds a hung run
+  static char duration[] = "60";
+  char *def_argv[] = {argv[0], const_cast<char *>("-d"), duration, nullptr};
+  if (argc == 1) {
+    argc = 3;
+    argv = def_argv;
+  }
+
+  corundum::Corundum dev;
+  RssDriver drv;
+  nicbm_bench::HostStub host(kMemSize);
+  if (nicbm_bench::BenchMain(argc, argv, dev, host, drv) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  drv.Check();
+  if (drv.failures) {
+    fprintf(stderr, "corundum_rss_test: %u failures\n", drv.failures);
+    return EXIT_FAILURE;
+  }
+  printf("corundum_rss_test: passed (%u flows, %u frames each)\n", kFlows,
+         kRounds);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,328 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Regression test for the concurrent payload DMAs of the i40e_bm queues: a
+ * test queue built on i40e::queue_base copies each descriptor's source
+ * buffer to its destination with data_fetch and data_write, and the host
+ * checks the result against what transferring the parts one at a time
+ * produces. Buffers span several MAX_DMA_SIZE parts, and a full batch of
+ * descriptors has far more than MAX_DATA_DMAS parts in flight, so parts also
+ * wait for a free slot.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "sims/nic/i40e_bm/i40e_bm.h"
+#include "sims/nic/nicbm_bench/bench.h"
+
+namespace {
+
+/* part size of payload DMAs in i40e_queues.cc */
+const size_t kPartSize = 9024;
+const size_t kMinLen = kPartSize + 1;
+const size_t kMaxLen = 8 * kPartSize;
+/* descriptors posted at once, as many as a queue has active */
+const unsigned kBatch = 128;
+const unsigned kRounds = 16;
+const unsigned kRingSize = 256;
+const uint8_t kCanary = 0xa5;
+
+/* host memory layout, one source and destination buffer per batch slot */
+const uint64_t kRing = 0x000000;
+const uint64_t kSrcBufs = 0x100000;
+const uint64_t kDstBufs = kSrcBufs + kBatch * kMaxLen;
+const size_t kMemSize = kDstBufs + kBatch * kMaxLen;
+
+/* registers of the test queue, above the ones of i40e_bm */
+const uint64_t kRegRingLo = 0x3ff000;
+const uint64_t kRegRingHi = 0x3ff004;
+const uint64_t kRegRingLen = 0x3ff008;
+const uint64_t kRegTail = 0x3ff00c;
+
+struct CopyDesc {
+  uint64_t src;
+  uint64_t dst;
+  uint32_t len;
+  uint32_t done;
+  uint64_t rsvd;
+} __attribute__((packed));
+static_assert(sizeof(CopyDesc) == 32, "copy descriptor size");
+
+class CopyQueue : public i40e::queue_base {
+ protected:
+  class copy_ctx : public desc_ctx {
+   protected:
+    CopyQueue &cq;
+
+    CopyDesc *d() {
+      return reinterpret_cast<CopyDesc *>(desc);
+    }
+
+    void data_written(uint64_t addr, size_t len) override {
+      d()->done = 1;
+      processed();
+    }
+
+   public:
+    explicit copy_ctx(CopyQueue &cq_) : desc_ctx(cq_), cq(cq_) {
+    }
+
+    void prepare() override {
+      data_fetch(d()->src, d()->len);
+      cq.max_waiting = std::max(cq.max_waiting, cq.data_dmas_waiting.size());
+    }
+
+    void process() override {
+      data_write(d()->dst, d()->len, data);
+    }
+  };
+
+  desc_ctx &desc_ctx_create() override {
+    return *new copy_ctx(*this);
+  }
+
+ public:
+  // most payload DMA parts seen waiting for a slot
+  size_t max_waiting;
+
+  CopyQueue(i40e::i40e_bm &dev_, uint32_t &reg_head_, uint32_t &reg_tail_)
+      : queue_base("copy", reg_head_, reg_tail_, dev_), max_waiting(0) {
+    desc_len = sizeof(CopyDesc);
+    ctxs_init();
+  }
+
+  void enable(uint64_t base_, uint32_t len_) {
+    base = base_;
+    len = len_;
+    enabled = true;
+  }
+};
+
+class CopyDev final : public i40e::i40e_bm {
+ protected:
+  uint64_t ring_base_;
+  uint32_t head_;
+  uint32_t tail_;
+
+ public:
+  CopyQueue q;
+
+  CopyDev() : ring_base_(0), head_(0), tail_(0), q(*this, head_, tail_) {
+  }
+
+  void RegWrite32(uint8_t bar, uint64_t addr, uint32_t val) override {
+    if (bar != BAR_REGS || addr < kRegRingLo) {
+      i40e_bm::RegWrite32(bar, addr, val);
+    } else if (addr == kRegRingLo) {
+      ring_base_ = (ring_base_ & ~0xffffffffULL) | val;
+    } else if (addr == kRegRingHi) {
+      ring_base_ = (ring_base_ & 0xffffffffULL) | ((uint64_t)val << 32);
+    } else if (addr == kRegRingLen) {
+      q.enable(ring_base_, val);
+    } else if (addr == kRegTail) {
+      tail_ = val;
+      q.reg_updated();
+    }
+  }
+};
+
+/**
+ * Posts batches of copies with random multi-part lengths and checks the
+ * written data and descriptors as the device writes them.
+ */
+class CopyDriver : public nicbm_bench::HostStub::Driver {
+ protected:
+  uint64_t rng_;
+  uint32_t lens_[kBatch];
+  // descriptors posted, written back, and highest one with data written
+  uint64_t posted_;
+  uint64_t written_back_;
+  uint64_t last_data_;
+
+  uint64_t Rand() {
+    rng_ ^= rng_ << 13;
+    rng_ ^= rng_ >> 7;
+    rng_ ^= rng_ << 17;
+    return rng_;
+  }
+
+  void Fail(const char *what, uint64_t desc) {
+    if (failures < 10)
+      fprintf(stderr, "i40e_dma_test: descriptor %lu: %s\n", desc, what);
+    failures++;
+  }
+
+  void CheckCopy(nicbm_bench::HostStub &host, unsigned slot, uint64_t seq) {
+    uint32_t len = lens_[slot];
+    const uint8_t *src = host.Mem(kSrcBufs + slot * kMaxLen, len);
+    const uint8_t *dst = host.Mem(kDstBufs + slot * kMaxLen, kMaxLen);
+    if (memcmp(src, dst, len))
+      Fail("payload differs from source", seq);
+    for (size_t i = len; i < kMaxLen; i++) {
+      if (dst[i] != kCanary) {
+        Fail("write beyond buffer length", seq);
+        break;
+      }
+    }
+  }
+
+ public:
+  unsigned failures;
+
+  CopyDriver()
+      : rng_(0x9e3779b97f4a7c15ULL),
+        posted_(0),
+        written_back_(0),
+        last_data_(0),
+        failures(0) {
+  }
+
+  const char *Name() override {
+    return "i40e_dma_test";
+  }
+
+  bool Done() override {
+    return written_back_ == kRounds * kBatch;
+  }
+
+  void Setup(nicbm_bench::HostStub &host, size_t pkt_len) override {
+    memset(host.Mem(kRing, kRingSize * sizeof(CopyDesc)), 0,
+           kRingSize * sizeof(CopyDesc));
+    host.MmioWrite32(0, kRegRingLo, kRing);
+    host.MmioWrite32(0, kRegRingHi, kRing >> 32);
+    host.MmioWrite32(0, kRegRingLen, kRingSize);
+  }
+
+  unsigned Post(nicbm_bench::HostStub &host, unsigned budget) override {
+    if (posted_ != written_back_ || posted_ == kRounds * kBatch)
+      return 0;
+
+    for (unsigned slot = 0; slot < kBatch; slot++) {
+      // exact multiples of the part size and one byte more, random otherwise
+      uint32_t len;
+      if (slot % 16 == 0)
+        len = kPartSize * (2 + slot / 16 % 7);
+      else if (slot % 16 == 1)
+        len = kMinLen;
+      else
+        len = kMinLen + Rand() % (kMaxLen - kMinLen + 1);
+      lens_[slot] = len;
+
+      uint8_t *src = host.Mem(kSrcBufs + slot * kMaxLen, len);
+      for (uint32_t i = 0; i < len; i += 8) {
+        uint64_t r = Rand();
+        memcpy(src + i, &r, std::min<size_t>(8, len - i));
+      }
+      memset(host.Mem(kDstBufs + slot * kMaxLen, kMaxLen), kCanary, kMaxLen);
+
+      unsigned idx = (posted_ + slot) % kRingSize;
+      CopyDesc *d = reinterpret_cast<CopyDesc *>(
+          host.Mem(kRing + idx * sizeof(CopyDesc), sizeof(CopyDesc)));
+      memset(d, 0, sizeof(*d));
+      d->src = kSrcBufs + slot * kMaxLen;
+      d->dst = kDstBufs + slot * kMaxLen;
+      d->len = len;
+    }
+    posted_ += kBatch;
+    tx_packets += kBatch;
+    host.MmioWrite32(0, kRegTail, posted_ % kRingSize);
+    return kBatch;
+  }
+
+  void DmaWritten(nicbm_bench::HostStub &host, uint64_t addr,
+                  size_t len) override {
+    uint64_t batch_first = posted_ - kBatch;
+    if (addr >= kDstBufs) {
+      // payload of a descriptor: in descriptor order, before its write-back
+      uint64_t seq = batch_first + (addr - kDstBufs) / kMaxLen;
+      if (seq < last_data_)
+        Fail("payload written after a later descriptor's", seq);
+      if (seq < written_back_)
+        Fail("payload written after the descriptor", seq);
+      last_data_ = std::max(last_data_, seq);
+      return;
+    }
+
+    for (uint64_t a = addr; a < addr + len; a += sizeof(CopyDesc)) {
+      uint64_t seq = written_back_++;
+      if ((a - kRing) / sizeof(CopyDesc) != seq % kRingSize) {
+        Fail("written back out of order", seq);
+        continue;
+      }
+      const CopyDesc *d = reinterpret_cast<const CopyDesc *>(
+          host.Mem(a, sizeof(CopyDesc)));
+      if (!d->done)
+        Fail("written back before its payload", seq);
+      CheckCopy(host, seq - batch_first, seq);
+    }
+    rx_packets = written_back_;
+  }
+
+  void Interrupt(nicbm_bench::HostStub &host, unsigned vec) override {
+  }
+};
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  // runs until the driver is done, the duration only bounds a hung run
+  static char duration[] = "60";
+  char *def_argv[] = {argv[0], const_cast<char *>("-d"), duration, nullptr};
+  if (argc == 1) {
+    argc = 3;
+    argv = def_argv;
+  }
+
+  // the device may still have DMAs in flight when the run ends, even once
+  // the host saw the last write-back, so it is never deleted
+  CopyDev *dev = new CopyDev;
+  CopyDriver drv;
+  nicbm_bench::HostStub host(kMemSize);
+  if (nicbm_bench::BenchMain(argc, argv, *dev, host, drv) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  if (!drv.Done()) {
+    fprintf(stderr, "i40e_dma_test: only %lu of %u descriptors completed\n",
+            drv.rx_packets, kRounds * kBatch);
+    return EXIT_FAILURE;
+  }
+  if (dev->q.max_waiting == 0) {
+    fprintf(stderr, "i40e_dma_test: no payload DMA waited for a slot\n");
+    return EXIT_FAILURE;
+  }
+  if (drv.failures) {
+    fprintf(stderr, "i40e_dma_test: %u failures\n", drv.failures);
+    return EXIT_FAILURE;
+  }
+  printf("i40e_dma_test: passed (%u descriptors, up to %zu parts waiting)\n",
+         kRounds * kBatch, dev->q.max_waiting);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,210 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Cross-check of the i40e_bm register array table: walks every 32-bit
+ * offset of BAR0 and compares the table lookup with the if/else chain the
+ * register decoder used before the table was introduced. A range missing
+ * from the table would otherwise read as 0 without any error.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sims/nic/i40e_bm/i40e_base_wrapper.h"
+#include "sims/nic/i40e_bm/i40e_bm.h"
+
+namespace {
+
+class RegProbe : public i40e::i40e_bm {
+ public:
+  using i40e_bm::reg_array;
+
+  /* one range of the old decoder, first match wins */
+  struct OldRange {
+    const char *name;
+    uint32_t first;
+    uint32_t last_read;  // inclusive
+    uint32_t last_write;
+    uint32_t stride;
+    uint32_t field;
+    uint32_t elems;
+    reg_array_hook hook;
+  };
+
+  static const OldRange kOld[];
+  static const size_t kNumOld;
+
+  static const reg_array *Lookup(uint64_t addr) {
+    return reg_array_lookup(addr);
+  }
+
+  /* arrays added to the table after the old decoder was replaced: flow
+   * director counters, and VF queue mapping, reset, and mailboxes */
+  static bool AddedLater(uint64_t addr) {
+    const uint64_t ranges[][2] = {
+        {I40E_GLQF_PCNT(0), I40E_GLQF_PCNT(I40E_GLQF_PCNT_MAX_INDEX)},
+        {I40E_VPLAN_QTABLE(0, 0), I40E_VFGEN_RSTAT1(MAX_VFS - 1)},
+        {I40E_VF_ATQBAL(0), I40E_VF_ARQT(MAX_VFS - 1)},
+        {I40E_VPGEN_VFRTRIG(0), I40E_VPGEN_VFRSTAT(MAX_VFS - 1)},
+    };
+    for (const auto &r : ranges) {
+      if (addr >= r[0] && addr <= r[1])
+        return true;
+    }
+    return false;
+  }
+};
+
+#define OLD(name, first, last_read, last_write, stride, field, hook)        \
+  {                                                                        \
+    name, (first), (last_read), (last_write), (stride),                    \
+        offsetof(i40e_regs, field),                                        \
+        sizeof(i40e_regs::field) / sizeof(uint32_t), RegProbe::hook        \
+  }
+#define OLD1(first, last, stride, field, hook) \
+  OLD(#field, first, last, last, stride, field, hook)
+
+const RegProbe::OldRange RegProbe::kOld[] = {
+    /* reads stopped one element early, writes did not */
+    OLD("pfint_dyn_ctln", I40E_PFINT_DYN_CTLN(0),
+        I40E_PFINT_DYN_CTLN(NUM_PFINTS - 2),
+        I40E_PFINT_DYN_CTLN(NUM_PFINTS - 1), 4, pfint_dyn_ctln,
+        RA_HOOK_NONE),
+    OLD1(I40E_PFINT_LNKLSTN(0), I40E_PFINT_LNKLSTN(NUM_PFINTS - 1), 4,
+         pfint_lnklstn, RA_HOOK_NONE),
+    OLD1(I40E_PFINT_RATEN(0), I40E_PFINT_RATEN(NUM_PFINTS - 1), 4,
+         pfint_raten, RA_HOOK_NONE),
+    OLD1(I40E_GLLAN_TXPRE_QDIS(0), I40E_GLLAN_TXPRE_QDIS(11), 4,
+         gllan_txpre_qdis, RA_HOOK_NONE),
+    OLD1(I40E_QINT_TQCTL(0), I40E_QINT_TQCTL(NUM_QUEUES - 1), 4, qint_tqctl,
+         RA_HOOK_NONE),
+    OLD1(I40E_QTX_ENA(0), I40E_QTX_ENA(NUM_QUEUES - 1), 4, qtx_ena,
+         RA_HOOK_QTX_ENA),
+    OLD1(I40E_QTX_TAIL(0), I40E_QTX_TAIL(NUM_QUEUES - 1), 4, qtx_tail,
+         RA_HOOK_QTX_TAIL),
+    OLD1(I40E_QTX_CTL(0), I40E_QTX_CTL(NUM_QUEUES - 1), 4, qtx_ctl,
+         RA_HOOK_NONE),
+    OLD1(I40E_QINT_RQCTL(0), I40E_QINT_RQCTL(NUM_QUEUES - 1), 4, qint_rqctl,
+         RA_HOOK_NONE),
+    OLD1(I40E_QRX_ENA(0), I40E_QRX_ENA(NUM_QUEUES - 1), 4, qrx_ena,
+         RA_HOOK_QRX_ENA),
+    OLD1(I40E_QRX_TAIL(0), I40E_QRX_TAIL(NUM_QUEUES - 1), 4, qrx_tail,
+         RA_HOOK_QRX_TAIL),
+    OLD1(I40E_GLHMC_LANTXBASE(0),
+         I40E_GLHMC_LANTXBASE(I40E_GLHMC_LANTXBASE_MAX_INDEX), 4,
+         glhmc_lantxbase, RA_HOOK_NONE),
+    OLD1(I40E_GLHMC_LANTXCNT(0),
+         I40E_GLHMC_LANTXCNT(I40E_GLHMC_LANTXCNT_MAX_INDEX), 4,
+         glhmc_lantxcnt, RA_HOOK_NONE),
+    OLD1(I40E_GLHMC_LANRXBASE(0),
+         I40E_GLHMC_LANRXBASE(I40E_GLHMC_LANRXBASE_MAX_INDEX), 4,
+         glhmc_lanrxbase, RA_HOOK_NONE),
+    OLD1(I40E_GLHMC_LANRXCNT(0),
+         I40E_GLHMC_LANRXCNT(I40E_GLHMC_LANRXCNT_MAX_INDEX), 4,
+         glhmc_lanrxcnt, RA_HOOK_NONE),
+    OLD1(I40E_PFQF_HENA(0), I40E_PFQF_HENA(I40E_PFQF_HENA_MAX_INDEX), 128,
+         pfqf_hena, RA_HOOK_NONE),
+    OLD1(I40E_PFQF_HKEY(0), I40E_PFQF_HKEY(I40E_PFQF_HKEY_MAX_INDEX), 128,
+         pfqf_hkey, RA_HOOK_RSS_KEY),
+    OLD1(I40E_PFQF_HLUT(0), I40E_PFQF_HLUT(I40E_PFQF_HLUT_MAX_INDEX), 128,
+         pfqf_hlut, RA_HOOK_NONE),
+    OLD1(I40E_PFINT_ITRN(0, 0), I40E_PFINT_ITRN(0, NUM_PFINTS - 1), 4,
+         pfint_itrn[0], RA_HOOK_NONE),
+    OLD1(I40E_PFINT_ITRN(1, 0), I40E_PFINT_ITRN(1, NUM_PFINTS - 1), 4,
+         pfint_itrn[1], RA_HOOK_NONE),
+    OLD1(I40E_PFINT_ITRN(2, 0), I40E_PFINT_ITRN(2, NUM_PFINTS - 1), 4,
+         pfint_itrn[2], RA_HOOK_NONE),
+};
+const size_t RegProbe::kNumOld = sizeof(kOld) / sizeof(kOld[0]);
+
+#undef OLD1
+#undef OLD
+
+unsigned failures = 0;
+
+void Fail(uint64_t addr, bool write, const char *fmt, const char *name) {
+  if (failures++ < 32) {
+    fprintf(stderr, "%s %#lx: ", write ? "write" : "read", addr);
+    fprintf(stderr, fmt, name);
+    fprintf(stderr, "\n");
+  }
+}
+
+/* compare the old decoder's result for `addr` with the table */
+void Check(uint64_t addr, bool write) {
+  const RegProbe::OldRange *old = nullptr;
+  for (size_t i = 0; i < RegProbe::kNumOld && !old; i++) {
+    const RegProbe::OldRange &r = RegProbe::kOld[i];
+    if (addr >= r.first && addr <= (write ? r.last_write : r.last_read))
+      old = &r;
+  }
+  const RegProbe::reg_array *ra = RegProbe::Lookup(addr);
+
+  if (!old) {
+    if (ra && !RegProbe::AddedLater(addr))
+      Fail(addr, write, "decoded by the table only%s", "");
+    return;
+  }
+
+  size_t idx = (addr - old->first) / old->stride;
+  if (idx >= old->elems) {
+    /* the old decoder indexed past the end of the array here */
+    if (ra)
+      Fail(addr, write, "out of bounds element of %s is decoded", old->name);
+    return;
+  }
+  if (!ra) {
+    Fail(addr, write, "%s missing from the table", old->name);
+    return;
+  }
+
+  size_t new_off = ra->field + (addr - ra->first) / ra->stride * 4;
+  if (new_off != old->field + idx * 4)
+    Fail(addr, write, "%s decoded to a different element", old->name);
+  if (write && ra->hook != old->hook)
+    Fail(addr, write, "%s has a different write hook", old->name);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  const uint64_t bar_len = 4 * 1024 * 1024;
+  uint64_t arrays = 0;
+  for (uint64_t addr = 0; addr < bar_len; addr += 4) {
+    Check(addr, false);
+    Check(addr, true);
+    arrays += RegProbe::Lookup(addr) != nullptr;
+  }
+
+  if (failures) {
+    fprintf(stderr, "i40e_reg_test: %u failures\n", failures);
+    return EXIT_FAILURE;
+  }
+  printf("i40e_reg_test: passed (%lu of %lu offsets in register arrays)\n",
+         arrays, bar_len / 4);
+  return EXIT_SUCCESS;
+}
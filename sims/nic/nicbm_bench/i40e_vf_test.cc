@@ -0,0 +1,645 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Functional test of the i40e_bm virtual functions: mailbox messages from
+ * VFs to the PF and back through the admin queues, VF queue tails in BAR_VF
+ * landing on the mapped PF queues, VF reset, and frames between the PF and a
+ * VF switched within the device instead of sent to the network.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sims/nic/i40e_bm/i40e_base_wrapper.h"
+#include "sims/nic/i40e_bm/i40e_bm.h"
+#include "sims/nic/nicbm_bench/bench.h"
+
+namespace {
+
+const uint8_t kBarRegs = 0;
+const uint8_t kBarVf = 5;
+const uint64_t kVfWindow = 64 * 1024;
+const uint16_t kNumVfs = 2;
+
+const unsigned kAqLen = 16;
+const size_t kAqBufSize = 4096;
+const unsigned kLanLen = 16;
+const size_t kLanBufSize = 2048;
+
+/* host memory layout */
+const uint64_t kAqRings = 0x000000;   // 32 rings of kAqLen descriptors
+const uint64_t kAqBufs = 0x010000;    // receive queue and message buffers
+const uint64_t kHmc = 0x200000;       // lan queue contexts, 2 MB aligned
+const uint64_t kRxCtxOff = 0x10000;   // rx contexts in the hmc
+const uint64_t kLanRings = 0x220000;  // 4 rings of kLanLen descriptors
+const uint64_t kLanBufs = 0x230000;
+const size_t kMemSize = 0x300000;
+
+/* lan queues of the PF and the one of VF 0 */
+const uint16_t kPfQueue = 0;
+const uint16_t kVf0Queue = 100;
+/* queues mapped to VF 1 */
+const uint16_t kVf1Queues[] = {200, 201};
+
+const uint8_t kVfMac[6] = {0x02, 0x00, 0x00, 0x00, 0x0f, 0x01};
+const uint16_t kEthType = 0x88b5;  // local experimental
+const size_t kFrameLen = 128;
+
+/* registers and host memory of one admin queue */
+struct AdminQueue {
+  uint8_t bar;
+  uint64_t win;
+  uint32_t bal, bah, len, head, tail;
+  uint64_t ring;
+  uint64_t bufs;
+  // next descriptor to post a command to, or to check for an event
+  unsigned next;
+};
+
+class VfDev final : public i40e::i40e_bm {
+ public:
+  VfDev() {
+    set_vfs(kNumVfs);
+  }
+
+  uint64_t MacAddr() {
+    return runner_->GetMacAddr();
+  }
+
+  uint64_t VebFrames() {
+    return lanmgr.veb_frame_count();
+  }
+};
+
+class VfDriver : public nicbm_bench::HostStub::Driver {
+ protected:
+  enum Step {
+    kMailbox,
+    kToVf,
+    kCaps,
+    kVsi,
+    kMacvlan,
+    kLanEnable,
+    kPfToVf,
+    kVfToPf,
+    kVfReset,
+    kDone,
+  };
+
+  VfDev &dev_;
+  Step step_;
+  AdminQueue pf_atq_, pf_arq_;
+  AdminQueue vf_atq_[kNumVfs], vf_arq_[kNumVfs];
+  uint16_t vsi_seid_;
+
+  void Fail(const char *what) {
+    fprintf(stderr, "i40e_vf_test: step %d: %s\n", step_, what);
+    failures++;
+  }
+
+  i40e_aq_desc *Desc(nicbm_bench::HostStub &host, const AdminQueue &q,
+                     unsigned idx) {
+    return reinterpret_cast<i40e_aq_desc *>(
+        host.Mem(q.ring + idx * sizeof(i40e_aq_desc), sizeof(i40e_aq_desc)));
+  }
+
+  uint8_t *Buf(nicbm_bench::HostStub &host, const AdminQueue &q,
+               unsigned idx) {
+    return host.Mem(q.bufs + idx * kAqBufSize, kAqBufSize);
+  }
+
+  static void Pattern(uint8_t *buf, size_t len, uint8_t seed) {
+    for (size_t i = 0; i < len; i++)
+      buf[i] = seed + i * 7;
+  }
+
+  static bool HasPattern(const uint8_t *buf, size_t len, uint8_t seed) {
+    for (size_t i = 0; i < len; i++) {
+      if (buf[i] != (uint8_t)(seed + i * 7))
+        return false;
+    }
+    return true;
+  }
+
+  void InitQueue(AdminQueue &q, uint8_t bar, uint64_t win, bool pf, bool rx,
+                 unsigned n) {
+    q.bar = bar;
+    q.win = win;
+    if (pf && !rx) {
+      q.bal = I40E_PF_ATQBAL, q.bah = I40E_PF_ATQBAH, q.len = I40E_PF_ATQLEN;
+      q.head = I40E_PF_ATQH, q.tail = I40E_PF_ATQT;
+    } else if (pf) {
+      q.bal = I40E_PF_ARQBAL, q.bah = I40E_PF_ARQBAH, q.len = I40E_PF_ARQLEN;
+      q.head = I40E_PF_ARQH, q.tail = I40E_PF_ARQT;
+    } else if (!rx) {
+      q.bal = I40E_VF_ATQBAL1, q.bah = I40E_VF_ATQBAH1;
+      q.len = I40E_VF_ATQLEN1, q.head = I40E_VF_ATQH1, q.tail = I40E_VF_ATQT1;
+    } else {
+      q.bal = I40E_VF_ARQBAL1, q.bah = I40E_VF_ARQBAH1;
+      q.len = I40E_VF_ARQLEN1, q.head = I40E_VF_ARQH1, q.tail = I40E_VF_ARQT1;
+    }
+    q.ring = kAqRings + n * kAqLen * sizeof(i40e_aq_desc);
+    q.bufs = kAqBufs + n * kAqLen * kAqBufSize;
+    q.next = 0;
+  }
+
+  void Write(nicbm_bench::HostStub &host, const AdminQueue &q, uint32_t reg,
+             uint32_t val) {
+    host.MmioWrite32(q.bar, q.win + reg, val);
+  }
+
+  /* enable a queue, receive queues with all but one buffer posted */
+  void Enable(nicbm_bench::HostStub &host, AdminQueue &q, bool rx) {
+    memset(Desc(host, q, 0), 0, kAqLen * sizeof(i40e_aq_desc));
+    for (unsigned i = 0; rx && i < kAqLen; i++) {
+      i40e_aq_desc *d = Desc(host, q, i);
+      d->flags = I40E_AQ_FLAG_BUF | I40E_AQ_FLAG_LB;
+      d->datalen = kAqBufSize;
+      uint64_t addr = q.bufs + i * kAqBufSize;
+      d->params.external.addr_high = addr >> 32;
+      d->params.external.addr_low = addr;
+    }
+    q.next = 0;
+    Write(host, q, q.bal, q.ring);
+    Write(host, q, q.bah, q.ring >> 32);
+    Write(host, q, q.head, 0);
+    Write(host, q, q.tail, rx ? kAqLen - 1 : 0);
+    Write(host, q, q.len, kAqLen | I40E_PF_ATQLEN_ATQENABLE_MASK);
+  }
+
+  /* post a command, with `len` bytes of the buffer if `len` > 0 */
+  i40e_aq_desc *Command(nicbm_bench::HostStub &host, AdminQueue &q,
+                        uint16_t opcode, size_t len) {
+    unsigned idx = q.next++;
+    i40e_aq_desc *d = Desc(host, q, idx);
+    memset(d, 0, sizeof(*d));
+    d->opcode = opcode;
+    if (len) {
+      d->flags = I40E_AQ_FLAG_BUF | I40E_AQ_FLAG_RD | I40E_AQ_FLAG_LB;
+      d->datalen = len;
+      uint64_t addr = q.bufs + idx * kAqBufSize;
+      d->params.external.addr_high = addr >> 32;
+      d->params.external.addr_low = addr;
+    }
+    return d;
+  }
+
+  void Submit(nicbm_bench::HostStub &host, AdminQueue &q) {
+    Write(host, q, q.tail, q.next);
+  }
+
+  bool Completed(nicbm_bench::HostStub &host, const AdminQueue &q,
+                 unsigned idx) {
+    return Desc(host, q, idx)->flags & I40E_AQ_FLAG_DD;
+  }
+
+  void SendToPf(nicbm_bench::HostStub &host, uint16_t vf, uint32_t v_op,
+                size_t len) {
+    AdminQueue &q = vf_atq_[vf];
+    unsigned idx = q.next;
+    i40e_aq_desc *d = Command(host, q, i40e_aqc_opc_send_msg_to_pf, len);
+    d->cookie_high = v_op;
+    d->cookie_low = vf + 7;
+    Pattern(Buf(host, q, idx), len, v_op);
+    Submit(host, q);
+  }
+
+  /* check the event posted for message `v_op` of length `len` */
+  void CheckEvent(nicbm_bench::HostStub &host, const AdminQueue &q,
+                  unsigned idx, uint16_t opcode, uint32_t v_op, size_t len) {
+    const i40e_aq_desc *d = Desc(host, q, idx);
+    uint16_t flags = I40E_AQ_FLAG_DD | I40E_AQ_FLAG_CMP | I40E_AQ_FLAG_BUF;
+    if ((d->flags & (flags | I40E_AQ_FLAG_ERR)) != flags)
+      Fail("event flags");
+    if (d->opcode != opcode || d->cookie_high != v_op)
+      Fail("event opcode");
+    if (d->datalen != len || !HasPattern(Buf(host, q, idx), len, v_op))
+      Fail("event data");
+  }
+
+  void LanSetup(nicbm_bench::HostStub &host) {
+    // one direct segment holds the contexts of all queues
+    host.MmioWrite32(kBarRegs, I40E_PFHMC_SDDATALOW,
+                     (kHmc >> 12) << I40E_PFHMC_SDDATALOW_PMSDDATALOW_SHIFT |
+                         I40E_PFHMC_SDDATALOW_PMSDVALID_MASK |
+                         I40E_PFHMC_SDDATALOW_PMSDTYPE_MASK |
+                         (512 << I40E_PFHMC_SDDATALOW_PMSDBPCOUNT_SHIFT));
+    host.MmioWrite32(kBarRegs, I40E_PFHMC_SDDATAHIGH, kHmc >> 32);
+    host.MmioWrite32(kBarRegs, I40E_PFHMC_SDCMD, I40E_PFHMC_SDCMD_PMSDWR_MASK);
+    host.MmioWrite32(kBarRegs, I40E_GLHMC_LANTXBASE(0), 0);
+    host.MmioWrite32(kBarRegs, I40E_GLHMC_LANRXBASE(0), kRxCtxOff / 512);
+
+    const uint16_t queues[] = {kPfQueue, kVf0Queue};
+    for (unsigned i = 0; i < 2; i++) {
+      uint16_t q = queues[i];
+      uint8_t *tx = host.Mem(kHmc + q * 128, 128);
+      memset(tx, 0, 128);
+      OrField(tx, 4, LanRing(i, false) / 128);
+      OrField(tx, 20, kLanLen << 1);
+
+      uint8_t *rx = host.Mem(kHmc + kRxCtxOff + q * 32, 32);
+      memset(rx, 0, 32);
+      OrField(rx, 4, LanRing(i, true) / 128);
+      OrField(rx, 11, kLanLen << 1);
+      OrField(rx, 12, (kLanBufSize / 128) << 6);
+
+      // rx descriptors, all but one buffer posted once enabled
+      for (unsigned j = 0; j < kLanLen; j++) {
+        uint64_t *d =
+            reinterpret_cast<uint64_t *>(host.Mem(LanDesc(i, true, j), 16));
+        d[0] = LanBuf(i, true, j);
+        d[1] = 0;
+      }
+
+      host.MmioWrite32(kBarRegs, I40E_QTX_ENA(q), I40E_QTX_ENA_QENA_REQ_MASK);
+      host.MmioWrite32(kBarRegs, I40E_QRX_ENA(q), I40E_QRX_ENA_QENA_REQ_MASK);
+    }
+  }
+
+  static void OrField(uint8_t *ctx, size_t off, uint64_t val) {
+    uint64_t v;
+    memcpy(&v, ctx + off, sizeof(v));
+    v |= val;
+    memcpy(ctx + off, &v, sizeof(v));
+  }
+
+  /* ring `i` (0 for the PF, 1 for VF 0) of the lan queues */
+  static uint64_t LanRing(unsigned i, bool rx) {
+    return kLanRings + (2 * i + rx) * kLanLen * 16;
+  }
+  static uint64_t LanDesc(unsigned i, bool rx, unsigned j) {
+    return LanRing(i, rx) + j * 16;
+  }
+  static uint64_t LanBuf(unsigned i, bool rx, unsigned j) {
+    return kLanBufs + ((2 * i + rx) * kLanLen + j) * kLanBufSize;
+  }
+
+  bool LanEnabled(nicbm_bench::HostStub &host) {
+    const uint16_t queues[] = {kPfQueue, kVf0Queue};
+    for (uint16_t q : queues) {
+      if (!(host.MmioRead32(kBarRegs, I40E_QTX_ENA(q)) &
+            I40E_QTX_ENA_QENA_STAT_MASK) ||
+          !(host.MmioRead32(kBarRegs, I40E_QRX_ENA(q)) &
+            I40E_QRX_ENA_QENA_STAT_MASK))
+        return false;
+    }
+    return true;
+  }
+
+  /* send one frame to `dst` from lan queue set `i` */
+  void SendFrame(nicbm_bench::HostStub &host, unsigned i, const uint8_t *dst,
+                 uint8_t seed) {
+    uint8_t *f = host.Mem(LanBuf(i, false, 0), kFrameLen);
+    Pattern(f, kFrameLen, seed);
+    memcpy(f, dst, 6);
+    f[12] = kEthType >> 8;
+    f[13] = kEthType & 0xff;
+
+    uint64_t *d = reinterpret_cast<uint64_t *>(host.Mem(LanDesc(i, false, 0),
+                                                        16));
+    d[0] = LanBuf(i, false, 0);
+    d[1] = I40E_TX_DESC_DTYPE_DATA |
+           ((uint64_t)(I40E_TX_DESC_CMD_EOP | I40E_TX_DESC_CMD_RS)
+            << I40E_TXD_QW1_CMD_SHIFT) |
+           ((uint64_t)kFrameLen << I40E_TXD_QW1_TX_BUF_SZ_SHIFT);
+  }
+
+  /* check the frame received by lan queue set `i` */
+  bool CheckFrame(nicbm_bench::HostStub &host, unsigned i, uint8_t seed) {
+    const uint64_t *d =
+        reinterpret_cast<const uint64_t *>(host.Mem(LanDesc(i, true, 0), 16));
+    if (!(d[1] & (1 << I40E_RX_DESC_STATUS_DD_SHIFT)))
+      return false;
+    size_t len = (d[1] >> I40E_RXD_QW1_LENGTH_PBUF_SHIFT) & 0x3fff;
+    const uint8_t *f = host.Mem(LanBuf(i, true, 0), kFrameLen);
+    if (len != kFrameLen)
+      Fail("received frame length");
+    for (size_t j = 14; j < kFrameLen; j++) {
+      if (f[j] != (uint8_t)(seed + j * 7)) {
+        Fail("received frame differs");
+        break;
+      }
+    }
+    return true;
+  }
+
+ public:
+  unsigned failures;
+
+  explicit VfDriver(VfDev &dev)
+      : dev_(dev), step_(kMailbox), vsi_seid_(0), failures(0) {
+  }
+
+  const char *Name() override {
+    return "i40e_vf_test";
+  }
+
+  bool Done() override {
+    return step_ == kDone;
+  }
+
+  void Setup(nicbm_bench::HostStub &host, size_t pkt_len) override {
+    InitQueue(pf_atq_, kBarRegs, 0, true, false, 0);
+    InitQueue(pf_arq_, kBarRegs, 0, true, true, 1);
+    Enable(host, pf_atq_, false);
+    Enable(host, pf_arq_, true);
+    host.MmioWrite32(kBarRegs, I40E_PFINT_ICR0_ENA,
+                     I40E_PFINT_ICR0_ENA_ADMINQ_MASK);
+    host.MmioWrite32(kBarRegs, I40E_PFINT_DYN_CTL0,
+                     I40E_PFINT_DYN_CTL0_INTENA_MASK);
+
+    for (uint16_t vf = 0; vf < kNumVfs; vf++) {
+      InitQueue(vf_atq_[vf], kBarVf, vf * kVfWindow, false, false, 2 + vf);
+      InitQueue(vf_arq_[vf], kBarVf, vf * kVfWindow, false, true, 4 + vf);
+      Enable(host, vf_atq_[vf], false);
+      Enable(host, vf_arq_[vf], true);
+    }
+
+    // VF 0 has one queue, VF 1 two
+    host.MmioWrite32(kBarRegs, I40E_VPLAN_QTABLE(0, 0), kVf0Queue);
+    host.MmioWrite32(kBarRegs, I40E_VPLAN_MAPENA(0),
+                     I40E_VPLAN_MAPENA_TXRX_ENA_MASK);
+    host.MmioWrite32(kBarRegs, I40E_VPLAN_QTABLE(0, 1), kVf1Queues[0]);
+    host.MmioWrite32(kBarRegs, I40E_VPLAN_QTABLE(1, 1), kVf1Queues[1]);
+    host.MmioWrite32(kBarRegs, I40E_VPLAN_MAPENA(1),
+                     I40E_VPLAN_MAPENA_TXRX_ENA_MASK);
+
+    SendToPf(host, 0, 0x1234, 64);
+    SendToPf(host, 1, 0x4321, 16);
+  }
+
+  unsigned Post(nicbm_bench::HostStub &host, unsigned budget) override {
+    switch (step_) {
+      case kMailbox: {
+        if (!Completed(host, vf_atq_[0], 0) ||
+            !Completed(host, vf_atq_[1], 0) || !Completed(host, pf_arq_, 0) ||
+            !Completed(host, pf_arq_, 1))
+          return 0;
+        if (Desc(host, vf_atq_[0], 0)->retval ||
+            Desc(host, vf_atq_[1], 0)->retval)
+          Fail("message to the PF failed");
+        // the PF finds the sending VF in the return value
+        bool seen[kNumVfs] = {};
+        for (unsigned i = 0; i < 2; i++) {
+          const i40e_aq_desc *d = Desc(host, pf_arq_, i);
+          uint16_t vf = d->retval;
+          if (vf >= kNumVfs || seen[vf] || d->cookie_low != vf + 7u) {
+            Fail("event from unexpected VF");
+            continue;
+          }
+          seen[vf] = true;
+          CheckEvent(host, pf_arq_, i, i40e_aqc_opc_send_msg_to_pf,
+                     vf ? 0x4321 : 0x1234, vf ? 16 : 64);
+        }
+        pf_arq_.next = 2;
+        if (!(host.MmioRead32(kBarRegs, I40E_PFINT_ICR0) &
+              I40E_PFINT_ICR0_ADMINQ_MASK) ||
+            !host.interrupts)
+          Fail("no admin queue interrupt");
+
+        // a valid and an invalid VF
+        i40e_aq_desc *d =
+            Command(host, pf_atq_, i40e_aqc_opc_send_msg_to_vf, 32);
+        reinterpret_cast<i40e_aqc_pf_vf_message *>(d->params.raw)->id = 1;
+        d->cookie_high = 0x55;
+        Pattern(Buf(host, pf_atq_, 0), 32, 0x55);
+        d = Command(host, pf_atq_, i40e_aqc_opc_send_msg_to_vf, 0);
+        reinterpret_cast<i40e_aqc_pf_vf_message *>(d->params.raw)->id = 7;
+        Submit(host, pf_atq_);
+        step_ = kToVf;
+        return 0;
+      }
+
+      case kToVf:
+        if (!Completed(host, pf_atq_, 0) || !Completed(host, pf_atq_, 1) ||
+            !Completed(host, vf_arq_[1], 0))
+          return 0;
+        if (Desc(host, pf_atq_, 0)->retval)
+          Fail("message to VF 1 failed");
+        if (Desc(host, pf_atq_, 1)->retval != I40E_AQ_RC_EINVAL)
+          Fail("message to a missing VF succeeded");
+        CheckEvent(host, vf_arq_[1], 0, i40e_aqc_opc_send_msg_to_vf, 0x55, 32);
+        if (Completed(host, vf_arq_[0], 0))
+          Fail("message went to VF 0");
+
+        Command(host, pf_atq_, i40e_aqc_opc_list_func_capabilities,
+                kAqBufSize);
+        Submit(host, pf_atq_);
+        step_ = kCaps;
+        return 0;
+
+      case kCaps: {
+        if (!Completed(host, pf_atq_, 2))
+          return 0;
+        const i40e_aq_desc *d = Desc(host, pf_atq_, 2);
+        uint32_t count =
+            reinterpret_cast<const i40e_aqc_list_capabilites *>(d->params.raw)
+                ->count;
+        const i40e_aqc_list_capabilities_element_resp *caps =
+            reinterpret_cast<const i40e_aqc_list_capabilities_element_resp *>(
+                Buf(host, pf_atq_, 2));
+        uint32_t sriov = 0, vfs = 0;
+        for (uint32_t i = 0; i < count; i++) {
+          if (caps[i].id == I40E_AQ_CAP_ID_SRIOV)
+            sriov = caps[i].number;
+          else if (caps[i].id == I40E_AQ_CAP_ID_VF)
+            vfs = caps[i].number;
+        }
+        if (sriov != 1 || vfs != kNumVfs)
+          Fail("VF capabilities missing");
+        if (host.MmioRead32(kBarRegs, I40E_PF_VT_PFALLOC) !=
+            (I40E_PF_VT_PFALLOC_VALID_MASK |
+             ((kNumVfs - 1) << I40E_PF_VT_PFALLOC_LASTVF_SHIFT)))
+          Fail("PF_VT_PFALLOC");
+
+        // VF queue tails land on the mapped PF queues, unmapped ones nowhere
+        uint64_t win = kVfWindow;
+        host.MmioWrite32(kBarVf, win + I40E_QTX_TAIL1(1), 42);
+        host.MmioWrite32(kBarVf, win + I40E_QRX_TAIL1(0), 7);
+        host.MmioWrite32(kBarVf, win + I40E_QTX_TAIL1(2), 9);
+        if (host.MmioRead32(kBarRegs, I40E_QTX_TAIL(kVf1Queues[1])) != 42 ||
+            host.MmioRead32(kBarRegs, I40E_QRX_TAIL(kVf1Queues[0])) != 7 ||
+            host.MmioRead32(kBarVf, win + I40E_QTX_TAIL1(1)) != 42)
+          Fail("VF queue tail not mapped");
+        if (host.MmioRead32(kBarVf, win + I40E_QTX_TAIL1(2)) ||
+            host.MmioRead32(kBarRegs, I40E_QTX_TAIL(0)))
+          Fail("unmapped VF queue tail written");
+        host.MmioWrite32(kBarRegs, I40E_VFGEN_RSTAT1(1), 2);
+        if (host.MmioRead32(kBarVf, win + I40E_VFGEN_RSTAT) != 2)
+          Fail("VFGEN_RSTAT");
+
+        // a VSI of VF 0
+        i40e_aq_desc *cmd = Command(host, pf_atq_, i40e_aqc_opc_add_vsi, 0);
+        i40e_aqc_add_get_update_vsi *v =
+            reinterpret_cast<i40e_aqc_add_get_update_vsi *>(cmd->params.raw);
+        v->vf_id = 0;
+        v->vsi_flags = I40E_AQ_VSI_TYPE_VF;
+        Submit(host, pf_atq_);
+        step_ = kVsi;
+        return 0;
+      }
+
+      case kVsi: {
+        if (!Completed(host, pf_atq_, 3))
+          return 0;
+        i40e_aq_desc *d = Desc(host, pf_atq_, 3);
+        if (d->retval)
+          Fail("add vsi failed");
+        vsi_seid_ = reinterpret_cast<i40e_aqc_add_get_update_vsi_completion *>(
+                        d->params.raw)
+                        ->seid;
+
+        d = Command(host, pf_atq_, i40e_aqc_opc_add_macvlan,
+                    sizeof(i40e_aqc_add_macvlan_element_data));
+        i40e_aqc_macvlan *m =
+            reinterpret_cast<i40e_aqc_macvlan *>(d->params.raw);
+        m->num_addresses = 1;
+        m->seid[0] = vsi_seid_ | I40E_AQC_MACVLAN_CMD_SEID_VALID;
+        i40e_aqc_add_macvlan_element_data *e =
+            reinterpret_cast<i40e_aqc_add_macvlan_element_data *>(
+                Buf(host, pf_atq_, 4));
+        memset(e, 0, sizeof(*e));
+        memcpy(e->mac_addr, kVfMac, 6);
+        e->flags = I40E_AQC_MACVLAN_ADD_PERFECT_MATCH;
+        Submit(host, pf_atq_);
+        step_ = kMacvlan;
+        return 0;
+      }
+
+      case kMacvlan: {
+        if (!Completed(host, pf_atq_, 4))
+          return 0;
+        const i40e_aqc_add_macvlan_element_data *e =
+            reinterpret_cast<const i40e_aqc_add_macvlan_element_data *>(
+                Buf(host, pf_atq_, 4));
+        if (Desc(host, pf_atq_, 4)->retval ||
+            e->match_method != I40E_AQC_MM_PERFECT_MATCH)
+          Fail("add macvlan failed");
+        LanSetup(host);
+        step_ = kLanEnable;
+        return 0;
+      }
+
+      case kLanEnable: {
+        if (!LanEnabled(host))
+          return 0;
+        // rx buffers of the PF through its registers, of VF 0 through its
+        // window
+        host.MmioWrite32(kBarRegs, I40E_QRX_TAIL(kPfQueue), kLanLen - 1);
+        host.MmioWrite32(kBarVf, I40E_QRX_TAIL1(0), kLanLen - 1);
+
+        SendFrame(host, 0, kVfMac, 0x10);
+        host.MmioWrite32(kBarRegs, I40E_QTX_TAIL(kPfQueue), 1);
+        tx_packets++;
+        step_ = kPfToVf;
+        return 1;
+      }
+
+      case kPfToVf: {
+        if (!CheckFrame(host, 1, 0x10))
+          return 0;
+        rx_packets++;
+        uint64_t mac = dev_.MacAddr();
+        SendFrame(host, 1, reinterpret_cast<const uint8_t *>(&mac), 0x20);
+        host.MmioWrite32(kBarVf, I40E_QTX_TAIL1(0), 1);
+        tx_packets++;
+        step_ = kVfToPf;
+        return 1;
+      }
+
+      case kVfToPf:
+        if (!CheckFrame(host, 0, 0x20))
+          return 0;
+        rx_packets++;
+        if (dev_.VebFrames() != 2)
+          Fail("frames not switched within the device");
+
+        // a reset VF starts over with a disabled mailbox
+        host.MmioWrite32(kBarRegs, I40E_VPGEN_VFRTRIG(0),
+                         I40E_VPGEN_VFRTRIG_VFSWR_MASK);
+        if (!(host.MmioRead32(kBarRegs, I40E_VPGEN_VFRSTAT(0)) &
+              I40E_VPGEN_VFRSTAT_VFRD_MASK))
+          Fail("VF reset not done");
+        if (host.MmioRead32(kBarVf, I40E_VF_ATQLEN1) ||
+            host.MmioRead32(kBarRegs, I40E_VF_ATQLEN(0)))
+          Fail("VF mailbox enabled after reset");
+        Enable(host, vf_atq_[0], false);
+        SendToPf(host, 0, 0x777, 100);
+        step_ = kVfReset;
+        return 0;
+
+      case kVfReset:
+        if (!Completed(host, pf_arq_, 2))
+          return 0;
+        if (Desc(host, pf_arq_, 2)->retval != 0)
+          Fail("event after reset from unexpected VF");
+        CheckEvent(host, pf_arq_, 2, i40e_aqc_opc_send_msg_to_pf, 0x777, 100);
+        step_ = kDone;
+        return 0;
+
+      case kDone:
+        break;
+    }
+    return 0;
+  }
+
+  void Interrupt(nicbm_bench::HostStub &host, unsigned vec) override {
+  }
+};
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  // runs until the driver is done, the duration only bounds a hung run
+  static char duration[] = "60";
+  char *def_argv[] = {argv[0], const_cast<char *>("-d"), duration, nullptr};
+  if (argc == 1) {
+    argc = 3;
+    argv = def_argv;
+  }
+
+  // the device may still have DMAs in flight when the run ends, so it is
+  // never deleted
+  VfDev *dev = new VfDev;
+  VfDriver drv(*dev);
+  nicbm_bench::HostStub host(kMemSize);
+  if (nicbm_bench::BenchMain(argc, argv, *dev, host, drv) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  if (!drv.Done()) {
+    fprintf(stderr, "i40e_vf_test: did not complete\n");
+    return EXIT_FAILURE;
+  }
+  if (drv.failures) {
+    fprintf(stderr, "i40e_vf_test: %u failures\n", drv.failures);
+    return EXIT_FAILURE;
+  }
+  printf("i40e_vf_test: passed (%u VFs, %lu frames switched)\n", kNumVfs,
+         dev->VebFrames());
+  return EXIT_SUCCESS;
+}
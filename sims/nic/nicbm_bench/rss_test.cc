@@ -0,0 +1,168 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Known-answer test for the i40e_bm RSS Toeplitz hash: checks the table
+ * driven rss_key_cache against the vectors of the Microsoft RSS verification
+ * suite (IPv4/IPv6, with and without ports) and against a bitwise reference
+ * for random inputs and keys.
+ */
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sims/nic/i40e_bm/i40e_bm.h"
+
+namespace {
+
+const uint8_t kMsKey[40] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2, 0x41, 0x67,
+    0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0, 0xd0, 0xca, 0x2b, 0xcb,
+    0xae, 0x7b, 0x30, 0xb4, 0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30,
+    0xf2, 0x0c, 0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa};
+
+struct Vector {
+  const char *src;
+  uint16_t sport;
+  const char *dst;
+  uint16_t dport;
+  uint32_t hash_addrs;
+  uint32_t hash_ports;
+};
+
+const Vector kV4[] = {
+    {"66.9.149.187", 2794, "161.142.100.80", 1766, 0x323e8fc2, 0x51ccc178},
+    {"199.92.111.2", 14230, "65.69.140.83", 4739, 0xd718262a, 0xc626b0ea},
+    {"24.19.198.95", 12898, "12.22.207.184", 38024, 0xd2d0a5de, 0x5c2b394a},
+    {"38.27.205.30", 48228, "209.142.163.6", 2217, 0x82989176, 0xafc7327f},
+    {"153.39.163.191", 44251, "202.188.127.2", 1303, 0x5d1809c5, 0x10e828a2},
+};
+
+const Vector kV6[] = {
+    {"3ffe:2501:200:1fff::7", 2794, "3ffe:2501:200:3::1", 1766, 0x2cc18cd5,
+     0x40207d3d},
+    {"3ffe:501:8::260:97ff:fe40:efab", 14230, "ff02::1", 4739, 0x0f0c461c,
+     0xdde51bbf},
+    {"3ffe:1900:4545:3:200:f8ff:fe21:67cf", 44251, "fe80::200:f8ff:fe21:67cf",
+     38024, 0x4b61e985, 0x02d1feef},
+};
+
+/* straight from the definition: for every set input bit, xor in the 32 key
+ * bits starting at that bit position */
+uint32_t Toeplitz(const uint8_t *key, const uint8_t *input, size_t len) {
+  uint32_t res = 0;
+  for (size_t i = 0; i < len; i++) {
+    for (unsigned b = 0; b < 8; b++) {
+      if (!(input[i] & (0x80 >> b)))
+        continue;
+      size_t bit = i * 8 + b;
+      uint32_t win = 0;
+      for (unsigned k = 0; k < 32; k++) {
+        size_t kb = bit + k;
+        win = (win << 1) | ((key[kb / 8] >> (7 - kb % 8)) & 1);
+      }
+      res ^= win;
+    }
+  }
+  return res;
+}
+
+/* input in the order the hash is defined: addresses, then ports */
+size_t Input(const Vector &v, int af, bool ports, uint8_t *buf) {
+  size_t alen = (af == AF_INET ? 4 : 16);
+  if (inet_pton(af, v.src, buf) != 1 || inet_pton(af, v.dst, buf + alen) != 1)
+    abort();
+  size_t len = 2 * alen;
+  if (ports) {
+    uint16_t p[2] = {htons(v.sport), htons(v.dport)};
+    memcpy(buf + len, p, sizeof(p));
+    len += sizeof(p);
+  }
+  return len;
+}
+
+unsigned failures = 0;
+
+void Check(const char *what, const Vector &v, uint32_t got, uint32_t exp) {
+  if (got == exp)
+    return;
+  fprintf(stderr, "%s %s:%u -> %s:%u: hash %08x expected %08x\n", what, v.src,
+          v.sport, v.dst, v.dport, got, exp);
+  failures++;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  /* the device keeps the key in its hash key registers, which hold the key
+   * bytes in memory order */
+  uint32_t key[13] = {};
+  memcpy(key, kMsKey, sizeof(kMsKey));
+  i40e::rss_key_cache kc(key);
+  uint8_t buf[i40e::rss_key_cache::max_input];
+
+  for (const Vector &v : kV4) {
+    Check("ipv4", v, kc.hash(buf, Input(v, AF_INET, false, buf)),
+          v.hash_addrs);
+    Check("ipv4 ports", v, kc.hash(buf, Input(v, AF_INET, true, buf)),
+          v.hash_ports);
+  }
+  for (const Vector &v : kV6) {
+    Check("ipv6", v, kc.hash(buf, Input(v, AF_INET6, false, buf)),
+          v.hash_addrs);
+    Check("ipv6 ports", v, kc.hash(buf, Input(v, AF_INET6, true, buf)),
+          v.hash_ports);
+  }
+
+  /* random keys and inputs of every length against the reference, changing
+   * the key has to invalidate the cached tables */
+  srand(1);
+  for (unsigned round = 0; round < 16; round++) {
+    uint8_t *kb = reinterpret_cast<uint8_t *>(key);
+    for (size_t i = 0; i < sizeof(key); i++)
+      kb[i] = rand();
+    kc.set_dirty();
+    for (size_t len = 0; len <= sizeof(buf); len++) {
+      for (size_t i = 0; i < len; i++)
+        buf[i] = rand();
+      uint32_t got = kc.hash(buf, len);
+      uint32_t exp = Toeplitz(kb, buf, len);
+      if (got != exp) {
+        fprintf(stderr, "random key %u len %zu: hash %08x expected %08x\n",
+                round, len, got, exp);
+        failures++;
+      }
+    }
+  }
+
+  if (failures) {
+    fprintf(stderr, "rss_test: %u failures\n", failures);
+    return EXIT_FAILURE;
+  }
+  printf("rss_test: passed\n");
+  return EXIT_SUCCESS;
+}
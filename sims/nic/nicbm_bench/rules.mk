@@ -0,0 +1,70 @@
+# Copyright 2021 Max Planck Institute for Software Systems, and
+# National University of Singapore
+#
+# Permission is hereby granted, free of charge, to any person obtaining
+# a copy of this software and associated documentation files (the
+# "Software"), to deal in the Software without restriction, including
+# without limitation the rights to use, copy, modify, merge, publish,
+# distribute, sublicense, and/or sell copies of the Software, and to
+# permit persons to whom the Software is furnished to do so, subject to
+# the following conditions:
+#
+# The above copyright notice and this permission notice shall be
+# included in all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+# MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+# IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+# CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+# TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+# SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+include mk/subdir_pre.mk
+
+bin_corundum_bench := $(d)corundum_bench
+bin_xsum_bench := $(d)xsum_bench
+bin_rss_test := $(d)rss_test
+bin_i40e_reg_test := $(d)i40e_reg_test
+bin_i40e_dma_test := $(d)i40e_dma_test
+bin_corundum_rss_test := $(d)corundum_rss_test
+bin_i40e_vf_test := $(d)i40e_vf_test
+
+objs_bench := $(d)bench.o
+objs_corundum_bench := $(objs_bench) $(d)corundum_bench.o \
+	$(objs_corundum_bm_dev)
+OBJS := $(objs_bench) $(d)corundum_bench.o $(d)xsum_bench.o $(d)rss_test.o \
+	$(d)i40e_reg_test.o $(d)i40e_dma_test.o $(d)corundum_rss_test.o \
+	$(d)i40e_vf_test.o
+
+$(bin_corundum_bench): $(objs_corundum_bench) $(lib_nicbm) $(lib_nicif) \
+	$(lib_netif) $(lib_pcie) $(lib_base) -lpthread
+
+$(bin_corundum_rss_test): $(objs_bench) $(d)corundum_rss_test.o \
+	$(objs_corundum_bm_dev) $(lib_nicbm) $(lib_nicif) $(lib_netif) \
+	$(lib_pcie) $(lib_base) -lpthread
+
+$(bin_xsum_bench): $(d)xsum_bench.o sims/nic/i40e_bm/xsums.o
+
+$(bin_rss_test): $(d)rss_test.o sims/nic/i40e_bm/rss.o
+
+$(bin_i40e_reg_test): $(d)i40e_reg_test.o $(objs_i40e_bm_dev) $(lib_nicbm) \
+	$(lib_nicif) $(lib_netif) $(lib_pcie) $(lib_base) -lpthread
+
+$(bin_i40e_dma_test): $(objs_bench) $(d)i40e_dma_test.o $(objs_i40e_bm_dev) \
+	$(lib_nicbm) $(lib_nicif) $(lib_netif) $(lib_pcie) $(lib_base) -lpthread
+
+$(bin_i40e_vf_test): $(objs_bench) $(d)i40e_vf_test.o $(objs_i40e_bm_dev) \
+	$(lib_nicbm) $(lib_nicif) $(lib_netif) $(lib_pcie) $(lib_base) -lpthread
+
+CLEAN := $(bin_corundum_bench) $(objs_bench) $(d)corundum_bench.o \
+	$(bin_xsum_bench) $(d)xsum_bench.o $(bin_rss_test) $(d)rss_test.o \
+	$(bin_i40e_reg_test) $(d)i40e_reg_test.o $(bin_i40e_dma_test) \
+	$(d)i40e_dma_test.o $(bin_corundum_rss_test) $(d)corundum_rss_test.o \
+	$(bin_i40e_vf_test) $(d)i40e_vf_test.o
+ALL := $(bin_corundum_bench) $(bin_xsum_bench) $(bin_rss_test) \
+	$(bin_i40e_reg_test) $(bin_i40e_dma_test) $(bin_corundum_rss_test) \
+	$(bin_i40e_vf_test)
+CHECK_ALL += $(bin_rss_test) $(bin_i40e_reg_test) $(bin_i40e_dma_test) \
+	$(bin_corundum_rss_test) $(bin_i40e_vf_test)
+include mk/subdir_post.mk
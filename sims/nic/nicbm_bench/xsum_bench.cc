@@ -0,0 +1,96 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Microbenchmark for the i40e_bm checksum routines: compares the vectorized
+ * one's complement sum against the portable loop for 64 B to 64 KB buffers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "sims/nic/i40e_bm/i40e_bm.h"
+
+static uint64_t WallNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* returns ns per call, running for at least `min_ns` */
+static double Measure(uint16_t (*fn)(const void *, size_t), const uint8_t *buf,
+                      size_t len, uint64_t min_ns, uint16_t &res) {
+  uint64_t iters = 0, start = WallNs(), now;
+  uint16_t acc = 0;
+  do {
+    for (unsigned i = 0; i < 64; i++)
+      acc += fn(buf, len);
+    iters += 64;
+    now = WallNs();
+  } while (now - start < min_ns);
+  res = acc;
+  return (double)(now - start) / iters;
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t min_ns = 100000000ULL;
+  int c;
+
+  while ((c = getopt(argc, argv, "t:")) != -1) {
+    switch (c) {
+      case 't':
+        min_ns = strtoull(optarg, nullptr, 0) * 1000000ULL;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-t MS-PER-SIZE]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  std::vector<uint8_t> buf(64 * 1024);
+  for (size_t i = 0; i < buf.size(); i++)
+    buf[i] = rand();
+
+  printf("%8s %12s %10s %12s %10s %8s\n", "len", "scalar_ns", "scalar_GBs",
+         "vector_ns", "vector_GBs", "speedup");
+  for (size_t len = 64; len <= buf.size(); len *= 2) {
+    uint16_t r_scalar, r_vector;
+    double t_scalar =
+        Measure(i40e::xsum_raw_scalar, buf.data(), len, min_ns, r_scalar);
+    double t_vector =
+        Measure(i40e::xsum_raw, buf.data(), len, min_ns, r_vector);
+    if (i40e::xsum_raw(buf.data(), len) !=
+        i40e::xsum_raw_scalar(buf.data(), len)) {
+      fprintf(stderr, "checksum mismatch for len=%zu\n", len);
+      return EXIT_FAILURE;
+    }
+    printf("%8zu %12.1f %10.2f %12.1f %10.2f %8.2f\n", len, t_scalar,
+           len / t_scalar, t_vector, len / t_vector, t_scalar / t_vector);
+  }
+  return EXIT_SUCCESS;
+}
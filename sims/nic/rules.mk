@@ -26,6 +26,7 @@ $(eval $(call subdir,corundum))
 $(eval $(call subdir,corundum_bm))
 $(eval $(call subdir,e1000_gem5))
 $(eval $(call subdir,i40e_bm))
+$(eval $(call subdir,nicbm_bench))
 $(eval $(call subdir,smartnic_adapter))
 $(eval $(call subdir,vfio_host))
 $(eval $(call subdir,vfio_soc))
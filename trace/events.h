@@ -226,6 +226,21 @@ class e_nic_msix : public event {
   }
 };
 
+class e_nic_msi : public event {
+ public:
+  uint16_t vec;
+
+  e_nic_msi(uint64_t ts_, uint16_t vec_) : event(ts_), vec(vec_) {
+  }
+
+  virtual ~e_nic_msi() {
+  }
+
+  virtual void dump(std::ostream &out) {
+    out << ts << ": N.MSI " << vec << std::endl;
+  }
+};
+
 class e_nic_dma_i : public event {
  public:
   uint64_t id;
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Decode a nicbm binary event log (`-l`) to text, including the device log
+ * messages recorded there. */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+#include <simbricks/nicbm/evlog.h>
+
+static const char *type_name(uint8_t type) {
+  switch (type) {
+    case nicbm::kEvMmioRead:
+      return "mmio_read";
+    case nicbm::kEvMmioWrite:
+      return "mmio_write";
+    case nicbm::kEvDmaIssue:
+      return "dma_issue";
+    case nicbm::kEvDmaComplete:
+      return "dma_complete";
+    case nicbm::kEvEthTx:
+      return "eth_tx";
+    case nicbm::kEvEthRx:
+      return "eth_rx";
+    case nicbm::kEvInterrupt:
+      return "interrupt";
+    default:
+      return nullptr;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  bool msgs_only = false;
+  if (argc == 3 && !strcmp(argv[1], "-m")) {
+    msgs_only = true;
+    argv++;
+    argc--;
+  }
+  if (argc != 2) {
+    std::cerr << "Usage: evlog_dump [-m] EVLOG" << std::endl;
+    std::cerr << "  -m: only print device log messages" << std::endl;
+    return 1;
+  }
+
+  std::ifstream f(argv[1], std::ios_base::in | std::ios_base::binary);
+  nicbm::EvLogHeader hdr;
+  if (!f.read(reinterpret_cast<char *>(&hdr), sizeof(hdr)) ||
+      memcmp(hdr.magic, NICBM_EVLOG_MAGIC, sizeof(hdr.magic)) ||
+      hdr.version != NICBM_EVLOG_VERSION ||
+      hdr.record_size != sizeof(nicbm::EvLogRecord)) {
+    std::cerr << "evlog_dump: " << argv[1] << " is not a nicbm event log"
+              << std::endl;
+    return 1;
+  }
+
+  std::unordered_map<uint32_t, std::string> strs;
+  /* string table entries that are not complete yet */
+  std::unordered_map<uint32_t, std::string> partial;
+  auto str = [&strs](uint32_t id) -> const char * {
+    auto it = strs.find(id);
+    return it != strs.end() ? it->second.c_str() : "?";
+  };
+
+  nicbm::EvLogRecord r;
+  while (f.read(reinterpret_cast<char *>(&r), sizeof(r))) {
+    switch (r.type) {
+      case nicbm::kEvMsgStr: {
+        std::string &s = partial[r.len];
+        s.append(reinterpret_cast<const char *>(&r.a), sizeof(r.a));
+        s.append(reinterpret_cast<const char *>(&r.b), sizeof(r.b));
+        if (r.flags) {
+          strs[r.len] = s.c_str();
+          partial.erase(r.len);
+        }
+        break;
+      }
+
+      case nicbm::kEvMsg: {
+        uint64_t args[nicbm::EvLog::kMsgMaxArgs];
+        unsigned n = r.flags;
+        if (n > nicbm::EvLog::kMsgMaxArgs) {
+          std::cerr << "evlog_dump: invalid message at " << r.ts << std::endl;
+          return 1;
+        }
+        if (n > 0)
+          args[0] = r.b;
+        uint64_t ts = r.ts;
+        uint32_t src = r.a;
+        uint32_t fmt = r.len;
+        for (unsigned i = 1; i < n; i += 2) {
+          if (!f.read(reinterpret_cast<char *>(&r), sizeof(r)) ||
+              r.type != nicbm::kEvMsgArgs) {
+            std::cerr << "evlog_dump: truncated message at " << ts
+                      << std::endl;
+            return 1;
+          }
+          args[i] = r.a;
+          if (i + 1 < n)
+            args[i + 1] = r.b;
+        }
+        std::cout << ts << " " << str(src) << ": "
+                  << nicbm::EvLog::Format(str(fmt), args, n) << "\n";
+        break;
+      }
+
+      case nicbm::kEvDropped:
+        std::cout << r.ts << " dropped " << r.a << " records\n";
+        break;
+
+      default:
+        if (msgs_only)
+          break;
+        if (const char *name = type_name(r.type)) {
+          std::cout << r.ts << " " << name << std::hex << " a=" << r.a
+                    << " b=" << r.b << " len=" << r.len
+                    << " flags=" << (unsigned)r.flags << std::dec << "\n";
+        } else {
+          std::cerr << "evlog_dump: unknown event type " << (unsigned)r.type
+                    << std::endl;
+        }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright 2021 Max Planck Institute for Software Systems, and
+ * National University of Singapore
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+#include <simbricks/nicbm/evlog.h>
+extern "C" {
+#include <simbricks/pcie/proto.h>
+}
+
+#include "trace/events.h"
+#include "trace/process.h"
+
+nicbm_evlog_parser::nicbm_evlog_parser() : header_checked(false) {
+}
+
+nicbm_evlog_parser::~nicbm_evlog_parser() {
+}
+
+bool nicbm_evlog_parser::probe(const char *path) {
+  std::ifstream f(path, std::ios_base::in | std::ios_base::binary);
+  char magic[8];
+  if (!f.read(magic, sizeof(magic)))
+    return false;
+  return !memcmp(magic, NICBM_EVLOG_MAGIC, sizeof(magic));
+}
+
+void nicbm_evlog_parser::process_line(char *line, size_t len) {
+}
+
+bool nicbm_evlog_parser::next_event() {
+  if (!header_checked) {
+    struct nicbm::EvLogHeader hdr;
+    if (!inf->read(reinterpret_cast<char *>(&hdr), sizeof(hdr)) ||
+        memcmp(hdr.magic, NICBM_EVLOG_MAGIC, sizeof(hdr.magic)) ||
+        hdr.version != NICBM_EVLOG_VERSION ||
+        hdr.record_size != sizeof(struct nicbm::EvLogRecord)) {
+      std::cerr << "nicbm_evlog_parser: invalid header" << std::endl;
+      return false;
+    }
+    header_checked = true;
+  }
+
+  got_event = false;
+  do {
+    struct nicbm::EvLogRecord r;
+    if (!inf->read(reinterpret_cast<char *>(&r), sizeof(r)))
+      return false;
+
+    switch (r.type) {
+      case nicbm::kEvMmioRead:
+        yield(std::make_shared<e_nic_mmio_r>(r.ts, r.a, r.len, r.b));
+        break;
+      case nicbm::kEvMmioWrite:
+        yield(std::make_shared<e_nic_mmio_w>(r.ts, r.a, r.len, r.b));
+        break;
+      case nicbm::kEvDmaIssue:
+        yield(std::make_shared<e_nic_dma_i>(r.ts, r.a, r.b, r.len));
+        break;
+      case nicbm::kEvDmaComplete:
+        yield(std::make_shared<e_nic_dma_c>(r.ts, r.a));
+        break;
+      case nicbm::kEvEthTx:
+        yield(std::make_shared<e_nic_tx>(r.ts, r.len));
+        break;
+      case nicbm::kEvEthRx:
+        yield(std::make_shared<e_nic_rx>(r.ts, r.len));
+        break;
+      case nicbm::kEvInterrupt:
+        if (r.flags == SIMBRICKS_PROTO_PCIE_INT_MSIX)
+          yield(std::make_shared<e_nic_msix>(r.ts, r.a));
+        else if (r.flags == SIMBRICKS_PROTO_PCIE_INT_MSI)
+          yield(std::make_shared<e_nic_msi>(r.ts, r.a));
+        break;
+      case nicbm::kEvDropped:
+        std::cerr << "nicbm_evlog_parser: " << r.a << " events lost at "
+                  << r.ts << std::endl;
+        break;
+      case nicbm::kEvMsg:
+      case nicbm::kEvMsgArgs:
+      case nicbm::kEvMsgStr:
+        // device log messages, see evlog_dump
+        break;
+      default:
+        std::cerr << "nicbm_evlog_parser: unknown event type "
+                  << (unsigned)r.type << std::endl;
+    }
+  } while (!got_event);
+
+  return true;
+}
@@ -154,6 +154,17 @@ void InstStats(coro_t::push_type &sink, coro_t::pull_type &source,
     data.tMean = 0;
 }
 
+/** open a nicbm log, either text debug output or a binary event log */
+static log_parser *open_nicbm(const char *path) {
+  log_parser *p;
+  if (nicbm_evlog_parser::probe(path))
+    p = new nicbm_evlog_parser;
+  else
+    p = new nicbm_parser;
+  p->open(path);
+  return p;
+}
+
 int main(int argc, char *argv[]) {
   if (argc != 5) {
     std::cerr << "Usage: process CLIENT_HLOG CLIENT_NLOG SERVER_HLOG "
@@ -196,15 +207,13 @@ int main(int argc, char *argv[]) {
   sh.label = "S";
   all_parsers.insert(&sh);
 
-  nicbm_parser cn;
-  cn.open(argv[2]);
-  cn.label = "C";
-  all_parsers.insert(&cn);
+  log_parser *cn = open_nicbm(argv[2]);
+  cn->label = "C";
+  all_parsers.insert(cn);
 
-  nicbm_parser sn;
-  sn.open(argv[4]);
-  sn.label = "S";
-  all_parsers.insert(&sn);
+  log_parser *sn = open_nicbm(argv[4]);
+  sn->label = "S";
+  all_parsers.insert(sn);
 
   std::cerr << "Opened all" << std::endl;
 
@@ -78,7 +78,7 @@ class log_parser {
   size_t try_line();
   virtual void process_line(char *line, size_t len) = 0;
 
-  bool next_event();
+  virtual bool next_event();
   void yield(std::shared_ptr<event> ev);
 
  public:
@@ -113,3 +113,19 @@ class nicbm_parser : public log_parser {
  public:
   virtual ~nicbm_parser();
 };
+
+/** Reader for binary event logs written by nicbm with `-l`. */
+class nicbm_evlog_parser : public log_parser {
+ protected:
+  bool header_checked;
+
+  virtual void process_line(char *line, size_t len);
+  virtual bool next_event();
+
+ public:
+  nicbm_evlog_parser();
+  virtual ~nicbm_evlog_parser();
+
+  /** check if `path` is a binary event log */
+  static bool probe(const char *path);
+};
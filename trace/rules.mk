@@ -23,12 +23,16 @@
 include mk/subdir_pre.mk
 
 bin_trace_process := $(d)process
+bin_evlog_dump := $(d)evlog_dump
 
-OBJS := $(addprefix $(d), process.o sym_map.o log_parser.o gem5.o nicbm.o)
+OBJS := $(addprefix $(d), process.o sym_map.o log_parser.o gem5.o nicbm.o \
+	nicbm_evlog.o)
 
 $(bin_trace_process): $(OBJS) -lboost_iostreams -lboost_coroutine \
 	-lboost_context
 
-CLEAN := $(bin_trace_process) $(OBJS)
-ALL := $(bin_trace_process)
+$(bin_evlog_dump): $(d)evlog_dump.o $(lib_nicbm) -lpthread
+
+CLEAN := $(bin_trace_process) $(bin_evlog_dump) $(OBJS) $(d)evlog_dump.o
+ALL := $(bin_trace_process) $(bin_evlog_dump)
 include mk/subdir_post.mk